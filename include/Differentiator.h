@@ -1,10 +1,15 @@
 #ifndef DIFFERENTIATOR_H
 #define DIFFERENTIATOR_H
 
+#include <pthread.h>
+#include <stdint.h>
+
+#include "OutputBuffer.h"
 #include "Tree.h"
 
 struct Latex_t {
   FILE *tex_file;
+  OutputBuffer_t output;
   char *tex_path;
 };
 
@@ -20,20 +25,49 @@ enum DumpMode { DUMP_ORIGINAL = 0, DUMP_DIFFERENTIATED = 1, DUMP_TAYLOR = 2 };
 #endif
 
 struct Variable_t {
-  char name;
+  SymbolId name;
   double value;
 };
 
+// `index[id]` is the position of the variable in `data` plus one, or zero.
 struct VarTable_t {
   Variable_t *data;
   size_t number_of_variables;
   size_t capacity;
+
+  size_t *index;
+  size_t index_size;
+};
+
+struct DerivativeCache_t {
+  char *directory;
+  size_t max_bytes;
+  size_t used_bytes;
+  pthread_mutex_t lock;
+};
+
+struct ThreadPool_t;
+struct CompactTree_t;
+
+// s(x) = sum c[k] (x - point)^k, k = 0..order
+struct TaylorPolynomial_t {
+  SymbolId var;
+  double point;
+  int order;
+  double *coefficients;
+};
+
+// Zero fields take the defaults below.
+struct DerivativeBudget_t {
+  size_t max_nodes;
+  size_t max_bytes;
 };
 
 struct Differentiator_t {
   Tree_t *expr_tree;
   Tree_t *diff_tree;
   Tree_t *taylor_tree;
+  struct TaylorPolynomial_t taylor;
 
   struct VarTable_t var_table;
 
@@ -50,8 +84,15 @@ struct Differentiator_t {
   double x_0;
   int extent;
 
+  char *output_dir;
   struct Latex_t latex;
 
+  struct DerivativeCache_t *cache;
+  struct DerivativeBudget_t budget;
+
+  // Shared by everything that runs in parallel, NULL runs it in the caller.
+  ThreadPool_t *pool;
+
 #ifdef _DEBUG
   struct Log_t logging;
 #endif
@@ -59,57 +100,461 @@ struct Differentiator_t {
 
 TreeData_t MakeNumber(double number);
 TreeData_t MakeOperation(OperationType operation);
-TreeData_t MakeVariable(char variable);
+TreeData_t MakeVariable(SymbolId variable);
 Node_t *MakeNode(OperationType op, Node_t *L, Node_t *R);
 
-Differentiator_t *DifferentiatorCtor(const char *expr_filename);
+Differentiator_t *DifferentiatorCtor(const char *expr_filename,
+                                     const char *output_dir = NULL);
+Differentiator_t *DifferentiatorWorkerCtor();
+bool DifferentiatorReadFile(Differentiator_t *diff, const char *expr_filename);
+Differentiator_t *DifferentiatorFileCtor(const char *expr_filename,
+                                         size_t n_threads,
+                                         DerivativeCache_t *cache,
+                                         const DerivativeBudget_t *budget,
+                                         SymbolId *var);
+void DifferentiatorFileDtor(Differentiator_t **diff);
 void DifferentiatorDtor(Differentiator_t **diff);
 
+bool DifferentiatorSetExpression(Differentiator_t *diff, const char *expression,
+                                 size_t length);
+
 // EBNF
+// Deeper expressions are rejected, the passes over the trees are recursive.
+const size_t EXPRESSION_MAX_DEPTH = 10000;
+
 Tree_t *ExpressionParser( Differentiator_t *diff );
 
 // Variable Table
-bool VarTableGet(VarTable_t *table, char name, double *value);
-void VarTableSet(VarTable_t *table, char name, double value);
+void VarTableCtor(VarTable_t *table, size_t initial_capacity);
+void VarTableDtor(VarTable_t *table);
+void VarTableClear(VarTable_t *table);
+bool VarTableGet(const VarTable_t *table, SymbolId name, double *value);
+void VarTableSet(VarTable_t *table, SymbolId name, double value);
 void VarTableAskUser(VarTable_t *table);
+void VarTableAskMissing(VarTable_t *table, const Tree_t *tree);
+void VarTableAddFromTree(VarTable_t *table, const Tree_t *tree);
 
 // Tree Optimization
-bool OptimizeTree(Tree_t *tree, Differentiator_t *diff, char independent_var);
+bool OptimizeTree(Tree_t *tree, Differentiator_t *diff,
+                  SymbolId independent_var);
 bool OptimizeConstants(Tree_t *tree, Differentiator_t *diff,
-                       char independent_var);
+                       SymbolId independent_var);
 bool SimplifyTree(Tree_t *tree);
 
 // Evaluate expression
 double EvaluateTree(Tree_t *tree, Differentiator_t *diff);
+double EvaluateOperation(OperationType op, double left, double right);
+
+// Compiled evaluation
+struct Instruction_t {
+  enum NodeType type;
+  int operation;
+  size_t slot;
+  double number;
+};
+
+struct CompiledExpr_t {
+  Instruction_t *code;
+  size_t size;
+  size_t stack_size;
+
+  SymbolId *variables;
+  size_t n_variables;
+};
+
+CompiledExpr_t *CompileTree(const Tree_t *tree);
+CompiledExpr_t *CompileCompactTree(const CompactTree_t *compact);
+void CompiledExprDtor(CompiledExpr_t **expr);
+
+size_t CompiledExprSlot(const CompiledExpr_t *expr, SymbolId name);
+bool CompiledExprBind(const CompiledExpr_t *expr, const VarTable_t *table,
+                      double *values);
+double CompiledExprEvaluate(const CompiledExpr_t *expr, const double *values);
+void CompiledExprEvaluateBatch(const CompiledExpr_t *expr, size_t slot,
+                               const double *points, size_t n_points,
+                               const double *values, double *results,
+                               ThreadPool_t *pool = NULL);
+
+// Interval evaluation
+struct Interval_t {
+  double lo;
+  double hi;
+};
+
+// Bounds of the expression while the variable in `slot` runs over `x`.
+Interval_t CompiledExprEvaluateInterval(const CompiledExpr_t *expr,
+                                        const double *values, size_t slot,
+                                        Interval_t x);
 
 // Differentiate expression
-Tree_t *DifferentiateExpression(Differentiator_t *diff, char independent_var,
+Tree_t *DifferentiateExpression(Differentiator_t *diff,
+                                SymbolId independent_var, int order);
+bool DifferentiateStep(Differentiator_t *diff, SymbolId independent_var,
+                       int order);
+Tree_t *DifferentiateTree(Differentiator_t *diff, const Tree_t *tree,
+                          SymbolId independent_var);
+// diff->diff_tree, f^(order - 1), becomes f^(order) in one step; a chain of
+// orders is built this way instead of starting from f for each of them.
+Tree_t *DifferentiateNextOrder(Differentiator_t *diff, SymbolId independent_var,
+                               int order);
+// A derivative of exactly this order in the cache is compiled from its mapped
+// file, without building the tree.
+CompiledExpr_t *CompileDerivative(Differentiator_t *diff,
+                                  SymbolId independent_var, int order);
+
+// Derivative budget
+const size_t DERIVATIVE_DEFAULT_MAX_NODES = 1 << 20;
+const size_t DERIVATIVE_DEFAULT_MAX_BYTES = 256 << 20;
+
+size_t EstimateDerivativeSize(const Node_t *root, SymbolId independent_var);
+bool DerivativeFitsBudget(const Differentiator_t *diff, const Node_t *root,
+                          SymbolId independent_var, int order);
+
+// Taylor-mode automatic differentiation
+bool TaylorModeCoefficients(const Node_t *root, const VarTable_t *table,
+                            SymbolId var, double point, int order,
+                            double *coefficients);
+bool TaylorModeDerivative(const Node_t *root, const VarTable_t *table,
+                          SymbolId var, double point, int order, double *value);
+
+// Derivative cache
+const size_t DERIVATIVE_CACHE_DEFAULT_SIZE = 64 << 20;
+
+bool DerivativeCacheCtor(DerivativeCache_t *cache, const char *directory,
+                         size_t max_bytes);
+void DerivativeCacheDtor(DerivativeCache_t *cache);
+uint64_t DerivativeCacheKey(const Differentiator_t *diff,
+                            SymbolId independent_var);
+Tree_t *DerivativeCacheLoadTree(DerivativeCache_t *cache, uint64_t key,
                                 int order);
+bool DerivativeCacheLoadCompact(DerivativeCache_t *cache, uint64_t key,
+                                int order, CompactTree_t *compact);
+bool DerivativeCacheStoreTree(DerivativeCache_t *cache, uint64_t key, int order,
+                              const Tree_t *tree);
+bool DerivativeCacheLoadCoefficients(DerivativeCache_t *cache, uint64_t key,
+                                     double point, int order,
+                                     double *coefficients);
+bool DerivativeCacheStoreCoefficients(DerivativeCache_t *cache, uint64_t key,
+                                      double point, int order,
+                                      const double *coefficients);
 
 // Taylor decomposition
-Tree_t *DifferentiatorBuildTaylorTree(Differentiator_t *diff, char var,
+// Also keeps the coefficients in `diff->taylor`.
+Tree_t *DifferentiatorBuildTaylorTree(Differentiator_t *diff, SymbolId var,
                                       double point, int order);
+// Fills `diff->taylor` from one chain of derivatives, which runs on to
+// `n_kept` when that is further; copies of f^(1)..f^(n_kept) go to `kept`
+// (NULL past the budget).
+void DifferentiatorTaylorChain(Differentiator_t *diff, SymbolId var,
+                               double point, int order, Tree_t **kept = NULL,
+                               int n_kept = 0);
+
+// Taylor polynomial
+void TaylorPolynomialCtor(TaylorPolynomial_t *taylor, SymbolId var,
+                          double point, int order);
+void TaylorPolynomialDtor(TaylorPolynomial_t *taylor);
+double TaylorPolynomialEvaluate(const TaylorPolynomial_t *taylor, double x);
+void TaylorPolynomialEvaluateBatch(const TaylorPolynomial_t *taylor,
+                                   const double *xs, size_t n_points,
+                                   double *results, ThreadPool_t *pool = NULL);
+Tree_t *TaylorPolynomialHornerTree(const TaylorPolynomial_t *taylor);
+
+// Taylor tables
+// Row `idx` holds the coefficients of the expansion at `points[idx]`.
+// Binary file (.bin), little-endian: TaylorTableHeader_t, then per point the
+// point and its order + 1 coefficients as raw doubles. CSV otherwise.
+const uint32_t TAYLOR_TABLE_MAGIC = 0x54545444; // "DTTT"
+const uint16_t TAYLOR_TABLE_VERSION = 1;
+
+struct TaylorTableHeader_t {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t order;
+  uint64_t n_points;
+};
+
+struct TaylorTable_t {
+  SymbolId var;
+  int order;
+  size_t n_points;
+  double *points;
+  double *coefficients;
+};
+
+bool TaylorTableBuild(Differentiator_t *diff, SymbolId var,
+                      const double *points, size_t n_points, int order,
+                      TaylorTable_t *table);
+void TaylorTableDtor(TaylorTable_t *table);
+bool TaylorTableWrite(const TaylorTable_t *table, const char *filename);
+
+// Taylor order search
+// `errors[k]` is the largest |f - T_k| over samples of [from, to], for
+// k = 0..order; the search stops at the first one within `tolerance`.
+const int TAYLOR_SEARCH_MAX_ORDER = 30;
+const size_t TAYLOR_SEARCH_SAMPLES = 512;
+
+struct TaylorOrderSearch_t {
+  double tolerance;
+  int max_order;
+  double from;
+  double to;
+
+  int order;
+  bool converged;
+  double *errors;
+};
+
+bool TaylorSearchOrder(Differentiator_t *diff, SymbolId var, double point,
+                       TaylorOrderSearch_t *search);
+void TaylorOrderSearchDtor(TaylorOrderSearch_t *search);
+
+// Chebyshev approximation
+// Zero fields take the defaults below, a zero tolerance fits a single piece.
+const int CHEBYSHEV_DEFAULT_DEGREE = 8;
+const size_t CHEBYSHEV_DEFAULT_MAX_PIECES = 64;
+
+struct ChebyshevOptions_t {
+  int degree;
+  int derivative;
+  double tolerance;
+  bool remez;
+  size_t max_pieces;
+};
+
+// Piece i covers [breaks[i], breaks[i + 1]]; its row of `coefficients` holds
+// the coefficients of T_0..T_degree in t = (2x - a - b) / (b - a).
+struct ChebyshevApprox_t {
+  SymbolId var;
+  int degree;
+  size_t n_pieces;
+  double *breaks;
+  double *coefficients;
+  double *errors;
+  double max_error;
+  // Through ChebyshevEvaluate at points off the fitting grids.
+  double checked_error;
+
+  size_t capacity;
+};
+
+bool ChebyshevFit(Differentiator_t *diff, SymbolId var, double from, double to,
+                  const ChebyshevOptions_t *options, ChebyshevApprox_t *approx);
+void ChebyshevApproxDtor(ChebyshevApprox_t *approx);
+double ChebyshevEvaluate(const ChebyshevApprox_t *approx, double x);
+Tree_t *ChebyshevPieceTree(const ChebyshevApprox_t *approx, size_t piece);
+bool ChebyshevWriteC(const ChebyshevApprox_t *approx, const char *name,
+                     FILE *stream);
+
+// Root finding
+const size_t ROOTS_DEFAULT_SAMPLES = 4096;
+
+struct Root_t {
+  double x;
+  double value;
+  int iterations;
+  // Sign of f right after the root, zero when f does not change sign.
+  int crossing;
+};
+
+struct Roots_t {
+  Root_t *roots;
+  size_t n_roots;
+};
+
+// f^(first_order) and the orders after it, as many as fit the budget, built as
+// one chain and compiled. A search for the roots of f^(k) refines them with
+// f^(k) and the two orders after it that the chain has.
+const int COMPILED_DERIVATIVES_MAX = 4;
+
+struct CompiledDerivatives_t {
+  int first_order;
+  int n_orders;
+  CompiledExpr_t *expr[COMPILED_DERIVATIVES_MAX];
+  double *values[COMPILED_DERIVATIVES_MAX];
+  size_t slot[COMPILED_DERIVATIVES_MAX];
+};
+
+bool CompiledDerivativesCtor(CompiledDerivatives_t *derivatives,
+                             Differentiator_t *diff, SymbolId var,
+                             int first_order, int n_orders);
+void CompiledDerivativesDtor(CompiledDerivatives_t *derivatives);
+
+bool FindRoots(Differentiator_t *diff, SymbolId var, double from, double to,
+               size_t n_samples, Roots_t *roots);
+bool FindDerivativeRoots(const Differentiator_t *diff,
+                         const CompiledDerivatives_t *derivatives, int order,
+                         double from, double to, size_t n_cells,
+                         Roots_t *roots);
+void RootsDtor(Roots_t *roots);
+
+// Extrema and inflection points
+enum CriticalPointType {
+  CRITICAL_MINIMUM = 0,
+  CRITICAL_MAXIMUM = 1,
+  CRITICAL_INFLECTION = 2,
+};
+
+struct CriticalPoint_t {
+  enum CriticalPointType type;
+  double x;
+  double y;
+};
+
+struct CriticalPoints_t {
+  CriticalPoint_t *points;
+  size_t n_points;
+};
+
+bool FindCriticalPoints(Differentiator_t *diff, SymbolId var, double from,
+                        double to, size_t n_cells, CriticalPoints_t *points);
+void CriticalPointsDtor(CriticalPoints_t *points);
 
 // Graphic DUMP
+#ifdef _DEBUG
 void DifferentiatiorDump(Differentiator_t *diff, enum DumpMode mode,
                          const char *format, ...);
+#endif
+
+// Shared subexpressions
+struct SubtreeClass_t;
+
+struct SharedSubtrees_t {
+  SubtreeClass_t *classes;
+  size_t n_classes;
+  size_t n_nodes;
+
+  const Node_t **node_keys;
+  size_t *node_classes;
+  size_t table_size;
+
+  const Node_t **definitions;
+  size_t n_definitions;
+};
+
+void SharedSubtreesCtor(SharedSubtrees_t *shared, const Node_t *root,
+                        size_t min_size);
+void SharedSubtreesCtorForest(SharedSubtrees_t *shared,
+                              const Node_t *const *roots, size_t n_roots,
+                              size_t min_size);
+void SharedSubtreesDtor(SharedSubtrees_t *shared);
+size_t SharedSubtreesName(const SharedSubtrees_t *shared, const Node_t *node);
+const Node_t *SharedSubtreesRepresentative(const SharedSubtrees_t *shared,
+                                           const Node_t *node);
+size_t SharedSubtreesClass(const SharedSubtrees_t *shared, const Node_t *node);
+const Node_t *SharedSubtreesClassNode(const SharedSubtrees_t *shared,
+                                      size_t id);
+
+// Derivative matrices
+struct MatrixStep_t;
+
+// Row-major entries, NULL where an entry is structurally zero. A symmetric
+// matrix keeps only its upper triangle. `steps` evaluates every distinct
+// subtree of all entries once.
+struct DerivativeMatrix_t {
+  size_t n_rows;
+  size_t n_cols;
+  SymbolId *variables;
+  Tree_t **entries;
+  bool symmetric;
+
+  MatrixStep_t *steps;
+  size_t n_steps;
+  size_t *entry_steps;
+};
+
+bool DerivativeJacobian(Differentiator_t *diff, const Tree_t *const *trees,
+                        size_t n_trees, const SymbolId *variables,
+                        size_t n_variables, DerivativeMatrix_t *jacobian);
+bool DerivativeGradient(Differentiator_t *diff, const Tree_t *tree,
+                        DerivativeMatrix_t *gradient);
+bool DerivativeHessian(Differentiator_t *diff,
+                       const DerivativeMatrix_t *gradient,
+                       DerivativeMatrix_t *hessian);
+void DerivativeMatrixDtor(DerivativeMatrix_t *matrix);
+
+const Tree_t *DerivativeMatrixEntry(const DerivativeMatrix_t *matrix,
+                                    size_t row, size_t col);
+size_t DerivativeMatrixNonZeros(const DerivativeMatrix_t *matrix);
+void DerivativeMatrixEvaluate(const DerivativeMatrix_t *matrix,
+                              const VarTable_t *table, double *values);
 
 // Latex
-Latex_t LatexCtor();
+Latex_t LatexCtor(const char *output_dir);
 void LatexDtor(Latex_t *latex);
 
 const char *GetJokeLine(OperationType op);
 
-void NodeToLatex(const Node_t *node, FILE *latex_file, int parent_priority = 0);
-void TreeDumpLatex(const Tree_t *tree, FILE *latex_file);
-void DifferentiatorAddOrigExpression(Differentiator_t *diff, int order);
-void DifferentiatorAddEvaluation(Differentiator_t *diff, char name);
-void DifferentiatorAddTaylorSeries(Differentiator_t *diff, char var, int order);
+void NodeToLatex(const Node_t *node, OutputBuffer_t *latex_file, int parent_priority = 0);
+void TreeDumpLatex(const Tree_t *tree, OutputBuffer_t *latex_file);
+void DifferentiatorAddOrigExpression(Differentiator_t *diff, SymbolId var,
+                                     int order);
+void DifferentiatorAddEvaluation(Differentiator_t *diff, SymbolId name);
+void DifferentiatorAddTaylorSeries(Differentiator_t *diff, SymbolId var,
+                                   int order);
+void DifferentiatorAddReportSections(Differentiator_t *diff, SymbolId var,
+                                     int n_orders, int taylor_order);
+void DifferentiatorAddTaylorOrderSearch(Differentiator_t *diff, SymbolId var,
+                                        const TaylorOrderSearch_t *search);
+void DifferentiatorAddCriticalPoints(Differentiator_t *diff, SymbolId var,
+                                     double from, double to,
+                                     const CriticalPoints_t *points);
 
 // GNU PLOT
-void DifferentiatorPlotFunctionAndTaylor(Differentiator_t *diff, char var,
-                                         int n_points,
-                                         const char *output_image);
+void DifferentiatorPlotFunctionAndTaylor(
+    Differentiator_t *diff, SymbolId var, int n_points, const char *output_image,
+    const CriticalPoints_t *critical = NULL);
+
+// Batch mode
+bool DifferentiatorBatch(const char *input_filename, const char *output_filename,
+                         SymbolId var, int order, size_t n_threads,
+                         DerivativeCache_t *cache,
+                         const DerivativeBudget_t *budget = NULL);
+
+// Report
+bool DifferentiatorReport(const char *expr_filename, const char *output_dir,
+                          bool interactive, DerivativeCache_t *cache,
+                          size_t n_threads,
+                          const DerivativeBudget_t *budget = NULL,
+                          double taylor_tolerance = 0);
+bool DifferentiatorStress(const char *expr_filename, size_t n_jobs,
+                          size_t n_threads);
+
+// Taylor table mode
+bool DifferentiatorTaylorTable(const char *expr_filename,
+                               const char *output_filename, double from,
+                               double to, size_t n_points, int order,
+                               size_t n_threads,
+                               const DerivativeBudget_t *budget = NULL);
+
+// Chebyshev mode
+bool DifferentiatorChebyshev(const char *expr_filename,
+                             const char *output_filename, const char *name,
+                             const ChebyshevOptions_t *options,
+                             size_t n_threads,
+                             const DerivativeBudget_t *budget = NULL);
+
+// Roots mode
+bool DifferentiatorRoots(const char *expr_filename, const char *output_filename,
+                         size_t n_samples, size_t n_threads,
+                         DerivativeCache_t *cache,
+                         const DerivativeBudget_t *budget = NULL);
+
+// Server mode
+bool DifferentiatorServe(const char *socket_path, size_t cache_capacity);
+
+// Random expressions
+struct ExpressionGenerator_t {
+  size_t n_nodes;
+  size_t max_depth;
+  size_t n_variables;
+  uint64_t state;
+};
+
+void ExpressionGeneratorCtor(ExpressionGenerator_t *generator, size_t n_nodes,
+                             size_t max_depth, size_t n_variables,
+                             uint64_t seed);
+Tree_t *GenerateExpression(ExpressionGenerator_t *generator);
+bool ExpressionWriteText(const Tree_t *tree, OutputBuffer_t *output);
 
 int CompareDoubleToDouble(double a, double b, double eps = 1e-10);
 void SkipSpaces(char **position);
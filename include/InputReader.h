@@ -0,0 +1,30 @@
+#ifndef INPUT_READER_H
+#define INPUT_READER_H
+
+#include <stddef.h>
+
+const size_t INPUT_READER_BLOCK_SIZE = 1 << 20;
+
+// Regular files are mapped and read sequentially, pipes and stdin ("-") are
+// read in chunks. Both are handed out in blocks of whole lines, a block stays
+// valid until the next call, so memory does not depend on the input size.
+struct InputReader_t {
+    int  fd;
+    bool mapped;
+    bool eof;
+    bool error;
+
+    char*  data;
+    size_t size;
+    size_t capacity;
+    size_t position;
+    size_t released;
+};
+
+InputReader_t* InputReaderOpen ( const char* filename );
+void           InputReaderClose( InputReader_t** reader );
+
+bool  InputReaderNextBlock( InputReader_t* reader, size_t max_size, const char** block, size_t* length );
+char* InputReaderReadAll  ( InputReader_t* reader, size_t* length );
+
+#endif//INPUT_READER_H
@@ -0,0 +1,42 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+
+#include "Tree.h"
+
+enum TokenType {
+    TOKEN_UNKNOWN = -1,
+
+    TOKEN_NUMBER        = 0,
+    TOKEN_VARIABLE      = 1,
+    TOKEN_OPERATION     = 2,
+    TOKEN_LEFT_BRACKET  = 3,
+    TOKEN_RIGHT_BRACKET = 4,
+    TOKEN_COMMA         = 5,
+    TOKEN_END           = 6
+};
+
+struct Token_t {
+    enum TokenType type;
+    TreeData_t     value;
+
+    const char* position;
+    size_t      length;
+};
+
+struct TokenStream_t {
+    Token_t* tokens;
+    size_t   size;
+    size_t   capacity;
+
+    size_t current;
+    size_t end_offset;
+};
+
+OperationType OperationMatch( const char* position, size_t* length );
+
+bool LexerTokenize( const char* buffer, TokenStream_t* stream );
+void TokenStreamDtor( TokenStream_t* stream );
+
+#endif//LEXER_H
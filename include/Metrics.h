@@ -0,0 +1,92 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Counters and phase timers are kept per thread and summed when the report is
+// written. Without _METRICS every macro below expands to nothing.
+
+#define INIT_METRIC_COUNTERS( COUNTER )                                  \
+    COUNTER( "nodes_created",           METRIC_NODES_CREATED )           \
+    COUNTER( "optimize_passes",         METRIC_OPTIMIZE_PASSES )         \
+    COUNTER( "constants_folded",        METRIC_CONSTANTS_FOLDED )        \
+    COUNTER( "rewrites_sub",            METRIC_REWRITES_SUB )            \
+    COUNTER( "rewrites_pow",            METRIC_REWRITES_POW )            \
+    COUNTER( "rewrites_mul",            METRIC_REWRITES_MUL )            \
+    COUNTER( "rewrites_add",            METRIC_REWRITES_ADD )            \
+    COUNTER( "rewrites_div",            METRIC_REWRITES_DIV )            \
+    COUNTER( "derivative_steps",        METRIC_DERIVATIVE_STEPS )        \
+    COUNTER( "evaluations",             METRIC_EVALUATIONS )             \
+    COUNTER( "derivative_estimates",    METRIC_DERIVATIVE_ESTIMATES )    \
+    COUNTER( "estimated_nodes",         METRIC_ESTIMATED_NODES )         \
+    COUNTER( "budget_fallbacks",        METRIC_BUDGET_FALLBACKS )        \
+    COUNTER( "taylor_mode_evaluations", METRIC_TAYLOR_MODE_EVALUATIONS ) \
+    COUNTER( "tasks_run",               METRIC_TASKS_RUN )               \
+    COUNTER( "tasks_stolen",            METRIC_TASKS_STOLEN )            \
+    COUNTER( "pool_idle_ns",            METRIC_POOL_IDLE_NS )            \
+    COUNTER( "arena_slabs",             METRIC_ARENA_SLABS )
+
+#define INIT_METRIC_PHASES( PHASE )            \
+    PHASE( "parse",         PHASE_PARSE )         \
+    PHASE( "differentiate", PHASE_DIFFERENTIATE ) \
+    PHASE( "simplify",      PHASE_SIMPLIFY )      \
+    PHASE( "evaluate",      PHASE_EVALUATE )      \
+    PHASE( "latex",         PHASE_LATEX )         \
+    PHASE( "plot",          PHASE_PLOT )
+
+#define METRICS_ENUM( string, name ) \
+    name,
+
+enum MetricCounter {
+    INIT_METRIC_COUNTERS( METRICS_ENUM )
+
+    METRIC_COUNTERS_NUMBER
+};
+
+enum MetricPhase {
+    INIT_METRIC_PHASES( METRICS_ENUM )
+
+    METRIC_PHASES_NUMBER
+};
+
+#undef METRICS_ENUM
+
+// Tree sizes are kept for derivative orders below this one.
+const int    METRICS_MAX_ORDER        = 32;
+const size_t METRICS_MAX_TRACE_EVENTS = 1 << 20;
+
+#ifdef _METRICS
+    #define METRIC_ADD( counter, value ) MetricsAdd( counter, value );
+    #define METRIC_INC( counter )        MetricsAdd( counter, 1 );
+
+    #define METRIC_TREE_SIZE( order, size ) MetricsTreeSize( order, size );
+
+    #define METRIC_PHASE_BEGIN( phase ) uint64_t phase##_start = MetricsNow();
+    #define METRIC_PHASE_END( phase )   MetricsPhase( phase, phase##_start );
+
+    #define ON_METRICS(...) __VA_ARGS__
+#else
+    #define METRIC_ADD( counter, value )
+    #define METRIC_INC( counter )
+
+    #define METRIC_TREE_SIZE( order, size )
+
+    #define METRIC_PHASE_BEGIN( phase )
+    #define METRIC_PHASE_END( phase )
+
+    #define ON_METRICS(...)
+#endif
+
+uint64_t MetricsNow();
+
+void MetricsAdd     ( MetricCounter counter, uint64_t value );
+void MetricsTreeSize( int order, size_t size );
+void MetricsPhase   ( MetricPhase phase, uint64_t start );
+
+// Has to be called after the threads that count have finished. A report whose
+// name ends with ".csv" is written as CSV, any other as JSON; the trace is in
+// the Chrome trace-event format. Either path may be NULL.
+bool MetricsWrite( const char* report_path, const char* trace_path );
+
+#endif//METRICS_H
@@ -54,4 +54,11 @@ enum NumberOfParams {
     macros("ln",      OP_LN,     19,  Function,    ONE_ARG,  "\\ln(%e)", \
            "Натуральный логарифм: логика с приправой e!")
 
+// Operands of each operation: binary operators read both children.
+#define OPERATION_ARGS( str, name, value, is_function, num_args, ... ) ( is_function == Function ? num_args : TWO_ARGS ),
+
+const int operation_args[] = { INIT_OPERATIONS( OPERATION_ARGS ) };
+
+#undef OPERATION_ARGS
+
 #endif
@@ -0,0 +1,37 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+const size_t OUTPUT_BUFFER_DEFAULT_CAPACITY = 1 << 16;
+const size_t DOUBLE_MAX_CHARS               = 32;
+
+// Precision for FormatDouble/BufferPutDouble: the shortest text that reads back
+// to the same double. Any other value behaves like printf("%.*g").
+const int SHORTEST_PRECISION = -1;
+
+struct OutputBuffer_t {
+    FILE*  stream;
+    char*  data;
+    size_t size;
+    size_t capacity;
+    bool   error;
+};
+
+void OutputBufferCtor ( OutputBuffer_t* buffer, FILE* stream, size_t capacity = OUTPUT_BUFFER_DEFAULT_CAPACITY );
+bool OutputBufferDtor ( OutputBuffer_t* buffer );
+bool OutputBufferFlush( OutputBuffer_t* buffer );
+
+void BufferPutChar  ( OutputBuffer_t* buffer, char symbol );
+void BufferPutBytes ( OutputBuffer_t* buffer, const char* data, size_t size );
+void BufferPutString( OutputBuffer_t* buffer, const char* string );
+void BufferPutDouble( OutputBuffer_t* buffer, double value, int precision = SHORTEST_PRECISION );
+void BufferPrintf   ( OutputBuffer_t* buffer, const char* format, ... ) __attribute__( ( format( printf, 2, 3 ) ) );
+
+size_t FormatDouble( char* destination, double value, int precision = SHORTEST_PRECISION );
+
+size_t ReadDouble( const char* position, double* value );
+size_t ReadLong  ( const char* position, long* value );
+
+#endif//OUTPUT_BUFFER_H
@@ -0,0 +1,26 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Variable names are interned once into a process-wide table and nodes keep
+// dense ids, so comparing two variables is comparing two integers. Ids are
+// given out in order of first appearance and are only valid inside one
+// process: everything written to disk stores the names.
+// A name is a letter followed by letters, digits and `_`: `x`, `rho`, `T0`, `k_b`.
+
+typedef uint32_t SymbolId;
+
+const SymbolId SYMBOL_NONE = UINT32_MAX;
+
+SymbolId SymbolIntern( const char* name, size_t length );
+SymbolId SymbolIntern( const char* name );
+SymbolId SymbolFind  ( const char* name, size_t length );
+
+const char* SymbolName  ( SymbolId id );
+size_t      SymbolCount ();
+
+size_t SymbolNameLength( const char* position );
+
+#endif//SYMBOL_TABLE_H
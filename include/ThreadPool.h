@@ -0,0 +1,44 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+// Work-stealing pool: every worker has its own deque, pushes and pops its end
+// of it and steals from the other end of the others when it runs dry. Tasks
+// submitted from outside the pool are spread over the deques round-robin.
+// A group counts the tasks submitted into it; a worker that waits for a group
+// runs other grouped tasks in the meantime, so fork-join code may nest.
+// Plain tasks are never run by a waiting worker: they may rely on
+// ThreadPoolWorkerIndex() to pick per-worker state.
+
+const size_t THREAD_POOL_NOT_WORKER = (size_t)-1;
+
+// The default number of workers, unless DIFF_THREADS says otherwise.
+const char* const THREAD_POOL_ENV = "DIFF_THREADS";
+
+struct ThreadPool_t;
+
+struct ThreadPoolGroup_t {
+    size_t pending;
+};
+
+ThreadPool_t* ThreadPoolCtor( size_t n_threads );
+void          ThreadPoolDtor( ThreadPool_t** pool );
+
+void ThreadPoolSubmit( ThreadPool_t* pool, void ( *function ) ( void* arg ), void* arg );
+void ThreadPoolWait  ( ThreadPool_t* pool );
+
+void ThreadPoolGroupSubmit( ThreadPool_t* pool, ThreadPoolGroup_t* group, void ( *function ) ( void* arg ), void* arg );
+void ThreadPoolGroupWait  ( ThreadPool_t* pool, ThreadPoolGroup_t* group );
+
+// Calls `function` on consecutive ranges of at least `grain` items and returns
+// when all of them are done. A NULL pool runs everything in the caller.
+void ThreadPoolParallelFor( ThreadPool_t* pool, size_t n_items, size_t grain,
+                            void ( *function ) ( void* arg, size_t begin, size_t end ), void* arg );
+
+size_t ThreadPoolSize( const ThreadPool_t* pool );
+size_t ThreadPoolWorkerIndex();
+bool   ThreadPoolIsWorker( const ThreadPool_t* pool );
+size_t ThreadPoolDefaultSize();
+
+#endif//THREAD_POOL_H
@@ -4,6 +4,8 @@
 #include <stdio.h>
 
 #include "Operations.h"
+#include "OutputBuffer.h"
+#include "SymbolTable.h"
 
 #ifdef _LINUX
 #include <linux/limits.h>
@@ -36,9 +38,9 @@ struct NodeValue {
     enum NodeType type;
 
     union {
-        double number; 
-        char   variable; 
-        int    operation; 
+        double   number; 
+        SymbolId variable; 
+        int      operation; 
     } data;
 };
 
@@ -61,6 +63,8 @@ Tree_t* TreeCtor();
 void    TreeDtor( Tree_t** tree, void ( *clean_function ) ( TreeData_t value, Tree_t* tree ) );
 
 void TreeSaveToFile( const Tree_t* tree, const char* filename );
+bool TreePrint( const Tree_t* tree, FILE* stream );
+bool TreeWriteText( const Tree_t* tree, OutputBuffer_t* output );
 Tree_t* TreeReadFromBuffer( char* buffer );
 
 Node_t* NodeCreate( const TreeData_t field, Node_t* parent );
@@ -69,8 +73,26 @@ void    NodeDelete( Node_t* node, Tree_t* tree, void ( *clean_function ) ( TreeD
 Node_t* NodeLeftCreate ( const TreeData_t field, Node_t* parent );
 Node_t* NodeRightCreate( const TreeData_t field, Node_t* parent );
 
-Node_t* NodeCopy( Node_t* node );
+Node_t* NodeCopy ( Node_t* node );
+size_t  NodeCount( const Node_t* node );
 
-void NodeGraphicDump( const Node_t* node, const char* image_path_name, ... );
+// Frees the node slabs when no node is alive and no other thread holds free
+// nodes, e.g. after a mode has destroyed its trees and its thread pool.
+void NodeArenaRelease();
+
+// A dump draws at most `max_nodes` nodes (0 is no limit), the subtrees that do
+// not fit become summary nodes with their sizes. With `representative` equal
+// subtrees are drawn once. `dot` runs in the background, GraphicDumpWait()
+// returns when every picture is ready.
+struct GraphDumpOptions_t {
+    size_t max_nodes;
+
+    const Node_t* ( *representative ) ( const Node_t* node, void* context );
+    void* context;
+};
+
+void NodeGraphicDump       ( const Node_t* node, const char* image_path_name, ... );
+void NodeGraphicDumpOptions( const Node_t* node, const GraphDumpOptions_t* options, const char* image_path_name, ... );
+void GraphicDumpWait();
 
 #endif//TREE_H
\ No newline at end of file
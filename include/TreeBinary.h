@@ -0,0 +1,62 @@
+#ifndef TREE_BINARY_H
+#define TREE_BINARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Tree.h"
+
+// Binary tree format (byte order of the writer, see TREE_BINARY_BIG_ENDIAN):
+//   header  TreeBinaryHeader_t
+//   payload post-order records, one per node:
+//     tag     1 byte: node type in bits 0-1, has_left bit 2, has_right bit 3
+//     value   8 raw IEEE bytes for a number, 1 byte for an operation,
+//             varint length and the name bytes for a variable
+//     offset  varint distance back to the left child, only when both children exist
+// The only child of a single-child node is always the previous record.
+
+const uint32_t TREE_BINARY_MAGIC   = 0x42525444; // "DTRB"
+const uint16_t TREE_BINARY_VERSION = 2;
+
+// Header flags. Numbers are stored raw, so a file is only read on a host of the
+// byte order it was written with; unknown flags are rejected.
+const uint16_t TREE_BINARY_BIG_ENDIAN = 0x0001;
+const uint16_t TREE_BINARY_FLAGS      = TREE_BINARY_BIG_ENDIAN;
+
+struct TreeBinaryHeader_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t n_nodes;
+    uint64_t hash;
+    uint64_t payload_size;
+};
+
+struct CompactTree_t {
+    const uint8_t* payload;
+    size_t         payload_size;
+    size_t         n_nodes;
+    uint64_t       hash;
+
+    char*  mapping;
+    size_t mapping_size;
+};
+
+uint64_t TreeStructuralHash( const Tree_t* tree );
+
+bool TreeWriteBinary( const Tree_t* tree, FILE* stream );
+bool TreeSaveBinary ( const Tree_t* tree, const char* filename );
+
+bool CompactTreeFromMemory( CompactTree_t* compact, const void* data, size_t size );
+bool CompactTreeLoad      ( CompactTree_t* compact, const char* filename );
+void CompactTreeUnload    ( CompactTree_t* compact );
+
+// Calls `visit` for every node in post-order, reading the records in place.
+typedef void ( *CompactTreeVisitor_t )( const TreeData_t* value, bool has_left, bool has_right, void* arg );
+
+bool CompactTreeWalk( const CompactTree_t* compact, CompactTreeVisitor_t visit, void* arg );
+
+Tree_t* CompactTreeExpand( const CompactTree_t* compact );
+Tree_t* TreeLoadBinary   ( const char* filename );
+
+#endif//TREE_BINARY_H
@@ -8,4 +8,9 @@ int MakeDirectory( const char* path );
 char* ReadToBuffer( const char* filename );
 off_t DetermineTheFileSize( const char* file_name );
 
+char* MapFile  ( const char* filename, size_t* size );
+void  UnmapFile( char* data, size_t size );
+
+char* MakePath( const char* directory, const char* name );
+
 #endif
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "DebugUtils.h"
+#include "InputReader.h"
+
+static bool InputReaderMap( InputReader_t* reader, size_t size );
+static void InputReaderRelease( InputReader_t* reader );
+static bool InputReaderFill( InputReader_t* reader, size_t max_size );
+
+InputReader_t* InputReaderOpen( const char* filename ) {
+    my_assert( filename, "Null pointer on `filename`" );
+
+    InputReader_t* reader = ( InputReader_t* ) calloc( 1, sizeof( *reader ) );
+    assert( reader && "Memory allocation error" );
+
+    if ( strcmp( filename, "-" ) == 0 ) {
+        reader->fd = STDIN_FILENO;
+        return reader;
+    }
+
+    reader->fd = open( filename, O_RDONLY );
+    if ( reader->fd == -1 ) {
+        PRINT_ERROR( "Error opening file `%s` \n", filename );
+        free( reader );
+        return NULL;
+    }
+
+    struct stat file_stat = {};
+    if ( fstat( reader->fd, &file_stat ) == 0 && S_ISREG( file_stat.st_mode ) &&
+         InputReaderMap( reader, ( size_t ) file_stat.st_size ) ) {
+        close( reader->fd );
+        reader->fd = -1;
+    }
+
+    return reader;
+}
+
+void InputReaderClose( InputReader_t** reader ) {
+    my_assert( reader, "Null pointer on pointer on `reader`" );
+    if ( !*reader )
+        return;
+
+    if ( ( *reader )->mapped ) {
+        if ( ( *reader )->size )
+            munmap( ( *reader )->data, ( *reader )->size );
+    } else {
+        free( ( *reader )->data );
+    }
+
+    if ( ( *reader )->fd > STDIN_FILENO )
+        close( ( *reader )->fd );
+
+    free( *reader );
+    *reader = NULL;
+}
+
+// An empty file is "mapped" too: there is nothing to read and nothing to stream.
+static bool InputReaderMap( InputReader_t* reader, size_t size ) {
+    if ( size ) {
+        void* data = mmap( NULL, size, PROT_READ, MAP_PRIVATE, reader->fd, 0 );
+        if ( data == MAP_FAILED )
+            return false;
+
+        madvise( data, size, MADV_SEQUENTIAL );
+        reader->data = ( char* ) data;
+    }
+
+    reader->mapped = true;
+    reader->eof = true;
+    reader->size = size;
+
+    return true;
+}
+
+// Pages that were already handed out are dropped, so a large file does not
+// stay resident after it was read.
+static void InputReaderRelease( InputReader_t* reader ) {
+    size_t page_size = ( size_t ) sysconf( _SC_PAGESIZE );
+    size_t end = reader->position / page_size * page_size;
+
+    if ( end > reader->released ) {
+        madvise( reader->data + reader->released, end - reader->released, MADV_DONTNEED );
+        reader->released = end;
+    }
+}
+
+// Reads until the buffer holds at least `max_size` bytes and a line end, or the input ends.
+static bool InputReaderFill( InputReader_t* reader, size_t max_size ) {
+    if ( reader->position ) {
+        memmove( reader->data, reader->data + reader->position, reader->size - reader->position );
+        reader->size -= reader->position;
+        reader->position = 0;
+    }
+
+    if ( reader->capacity < max_size ) {
+        reader->data = ( char* ) realloc( reader->data, max_size );
+        assert( reader->data && "Memory allocation error" );
+        reader->capacity = max_size;
+    }
+
+    bool has_line_end = memchr( reader->data, '\n', reader->size ) != NULL;
+    while ( !reader->eof && ( reader->size < max_size || !has_line_end ) ) {
+        if ( reader->size == reader->capacity ) {
+            reader->capacity *= 2;
+            reader->data = ( char* ) realloc( reader->data, reader->capacity );
+            assert( reader->data && "Memory allocation error" );
+        }
+
+        ssize_t read_bytes = read( reader->fd, reader->data + reader->size, reader->capacity - reader->size );
+        if ( read_bytes == -1 && errno == EINTR )
+            continue;
+
+        if ( read_bytes <= 0 ) {
+            reader->error = ( read_bytes == -1 );
+            reader->eof = true;
+            break;
+        }
+
+        has_line_end = has_line_end || memchr( reader->data + reader->size, '\n', ( size_t ) read_bytes );
+        reader->size += ( size_t ) read_bytes;
+    }
+
+    return !reader->error;
+}
+
+bool InputReaderNextBlock( InputReader_t* reader, size_t max_size, const char** block, size_t* length ) {
+    my_assert( reader, "Null pointer on `reader`" );
+    my_assert( block, "Null pointer on `block`" );
+    my_assert( length, "Null pointer on `length`" );
+
+    if ( reader->mapped )
+        InputReaderRelease( reader );
+    else if ( !InputReaderFill( reader, max_size ) )
+        PRINT_ERROR( "Error reading input \n" );
+
+    size_t left = reader->size - reader->position;
+    if ( left == 0 )
+        return false;
+
+    const char* start = reader->data + reader->position;
+    size_t end = left;
+
+    // The block is cut after the last line end that fits, a longer line is taken whole.
+    if ( left > max_size || !reader->eof ) {
+        const char* line_end = ( const char* ) memrchr( start, '\n', left < max_size ? left : max_size );
+        if ( !line_end )
+            line_end = ( const char* ) memchr( start, '\n', left );
+        if ( line_end )
+            end = ( size_t ) ( line_end - start ) + 1;
+    }
+
+    *block = start;
+    *length = end;
+    reader->position += end;
+
+    return true;
+}
+
+char* InputReaderReadAll( InputReader_t* reader, size_t* length ) {
+    my_assert( reader, "Null pointer on `reader`" );
+
+    size_t size = 0;
+    size_t capacity = 0;
+    char* buffer = NULL;
+
+    const char* block = NULL;
+    size_t block_length = 0;
+    while ( InputReaderNextBlock( reader, INPUT_READER_BLOCK_SIZE, &block, &block_length ) ) {
+        if ( size + block_length + 1 > capacity ) {
+            capacity = ( capacity * 2 > size + block_length + 1 ) ? capacity * 2 : size + block_length + 1;
+            buffer = ( char* ) realloc( buffer, capacity );
+            assert( buffer && "Memory allocation error" );
+        }
+
+        memcpy( buffer + size, block, block_length );
+        size += block_length;
+    }
+
+    if ( reader->error ) {
+        free( buffer );
+        return NULL;
+    }
+
+    if ( !buffer ) {
+        buffer = ( char* ) calloc( 1, sizeof( char ) );
+        assert( buffer && "Memory allocation error" );
+    }
+    buffer[size] = '\0';
+
+    if ( length )
+        *length = size;
+
+    return buffer;
+}
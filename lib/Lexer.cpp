@@ -0,0 +1,257 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Lexer.h"
+#include "OutputBuffer.h"
+
+// Trie over operation names, generated at compile time from INIT_OPERATIONS.
+// Matching walks it once, remembering the last terminal node, so the longest
+// name wins no matter in which order the operations are listed.
+
+struct OperationName_t {
+    const char*   name;
+    OperationType operation;
+};
+
+#define OPERATIONS_NAMES( str, name, ... ) { str, name },
+
+static constexpr OperationName_t operation_names[] = { INIT_OPERATIONS( OPERATIONS_NAMES ) };
+
+#undef OPERATIONS_NAMES
+
+const size_t TRIE_ALPHABET = 128;
+
+static constexpr size_t TrieCapacity() {
+    size_t capacity = 1;
+    for ( const OperationName_t& op : operation_names ) {
+        for ( size_t idx = 0; op.name[idx]; idx++ )
+            capacity++;
+    }
+
+    return capacity;
+}
+
+struct TrieNode_t {
+    char  symbol;
+    short child;
+    short sibling;
+    short operation;
+};
+
+struct OperationTrie_t {
+    TrieNode_t nodes[TrieCapacity()];
+    short      size;
+
+    short first[TRIE_ALPHABET];
+};
+
+static constexpr short TrieFindChild( const OperationTrie_t& trie, short node, char symbol ) {
+    short child = trie.nodes[node].child;
+    while ( child != -1 && trie.nodes[child].symbol != symbol )
+        child = trie.nodes[child].sibling;
+
+    return child;
+}
+
+static constexpr OperationTrie_t OperationTrieBuild() {
+    OperationTrie_t trie = {};
+
+    trie.nodes[0] = { '\0', -1, -1, OP_NOPE };
+    trie.size = 1;
+
+    for ( const OperationName_t& op : operation_names ) {
+        short node = 0;
+
+        for ( size_t idx = 0; op.name[idx]; idx++ ) {
+            short child = TrieFindChild( trie, node, op.name[idx] );
+
+            if ( child == -1 ) {
+                child = trie.size++;
+                trie.nodes[child] = { op.name[idx], -1, trie.nodes[node].child, OP_NOPE };
+                trie.nodes[node].child = child;
+            }
+
+            node = child;
+        }
+
+        if ( trie.nodes[node].operation != OP_NOPE )
+            throw "Duplicate operation name in INIT_OPERATIONS";
+
+        trie.nodes[node].operation = (short)op.operation;
+    }
+
+    for ( size_t symbol = 0; symbol < TRIE_ALPHABET; symbol++ )
+        trie.first[symbol] = TrieFindChild( trie, 0, (char)symbol );
+
+    return trie;
+}
+
+static constexpr OperationTrie_t operation_trie = OperationTrieBuild();
+
+OperationType OperationMatch( const char *position, size_t *length ) {
+    my_assert( position, "Null pointer on `position`" );
+
+    unsigned char symbol = (unsigned char)position[0];
+    if ( symbol >= TRIE_ALPHABET )
+        return OP_NOPE;
+
+    short node = operation_trie.first[symbol];
+    OperationType best = OP_NOPE;
+    size_t best_length = 0;
+
+    for ( size_t idx = 1; node != -1; idx++ ) {
+        if ( operation_trie.nodes[node].operation != OP_NOPE ) {
+            best = (OperationType)operation_trie.nodes[node].operation;
+            best_length = idx;
+        }
+
+        if ( !position[idx] )
+            break;
+
+        node = TrieFindChild( operation_trie, node, position[idx] );
+    }
+
+    if ( length )
+        *length = best_length;
+
+    return best;
+}
+
+static Token_t *TokenStreamPush( TokenStream_t *stream ) {
+    if ( stream->size >= stream->capacity ) {
+        size_t new_capacity = stream->capacity ? stream->capacity * 2 : 64;
+        Token_t *new_tokens = (Token_t *)realloc( stream->tokens, new_capacity * sizeof( Token_t ) );
+        if ( !new_tokens )
+            return NULL;
+
+        stream->tokens = new_tokens;
+        stream->capacity = new_capacity;
+    }
+
+    Token_t *token = &stream->tokens[stream->size++];
+    memset( token, 0, sizeof( *token ) );
+
+    return token;
+}
+
+static bool IsOperandEnd( const TokenStream_t *stream ) {
+    if ( stream->size == 0 )
+        return false;
+
+    enum TokenType last = stream->tokens[stream->size - 1].type;
+    return last == TOKEN_NUMBER || last == TOKEN_VARIABLE || last == TOKEN_RIGHT_BRACKET;
+}
+
+static bool IsNumberStart( const char *position, const TokenStream_t *stream ) {
+    if ( isdigit( position[0] ) || ( position[0] == '.' && isdigit( position[1] ) ) )
+        return true;
+
+    // A sign right after an operator or a bracket belongs to the literal, as ReadDouble reads it
+    if ( ( position[0] == '-' || position[0] == '+' ) && !IsOperandEnd( stream ) )
+        return isdigit( position[1] ) || ( position[1] == '.' && isdigit( position[2] ) );
+
+    return false;
+}
+
+static bool LexerReadToken( const char **position, TokenStream_t *stream ) {
+    const char *start = *position;
+    bool is_number = IsNumberStart( start, stream );
+
+    Token_t *token = TokenStreamPush( stream );
+    if ( !token )
+        return false;
+
+    token->position = start;
+    token->value.type = NODE_UNKNOWN;
+
+    if ( is_number ) {
+        token->type = TOKEN_NUMBER;
+        token->value.type = NODE_NUMBER;
+        token->length = ReadDouble( start, &token->value.data.number );
+    } else {
+        // A name that only starts with an operation, like `shift` or `ln2`, is a variable.
+        size_t length = 0;
+        size_t name_length = SymbolNameLength( start );
+        OperationType op = OperationMatch( start, &length );
+
+        if ( op != OP_NOPE && ( !name_length || length == name_length ) ) {
+            token->type = TOKEN_OPERATION;
+            token->value.type = NODE_OPERATION;
+            token->value.data.operation = op;
+            token->length = length;
+        } else if ( name_length ) {
+            token->type = TOKEN_VARIABLE;
+            token->value.type = NODE_VARIABLE;
+            token->value.data.variable = SymbolIntern( start, name_length );
+            token->length = name_length;
+        } else {
+            token->length = 1;
+            switch ( *start ) {
+                case '(':
+                    token->type = TOKEN_LEFT_BRACKET;
+                    break;
+                case ')':
+                    token->type = TOKEN_RIGHT_BRACKET;
+                    break;
+                case ',':
+                    token->type = TOKEN_COMMA;
+                    break;
+                case '$':
+                    token->type = TOKEN_END;
+                    break;
+                default:
+                    token->type = TOKEN_UNKNOWN;
+                    break;
+            }
+        }
+    }
+
+    *position += token->length;
+
+    return token->type != TOKEN_UNKNOWN;
+}
+
+bool LexerTokenize( const char *buffer, TokenStream_t *stream ) {
+    my_assert( buffer, "Null pointer on `buffer`" );
+    my_assert( stream, "Null pointer on `stream`" );
+
+    stream->size = 0;
+    stream->current = 0;
+
+    const char *position = buffer;
+
+    while ( true ) {
+        while ( isspace( *position ) )
+            position++;
+
+        if ( *position == '\0' ) {
+            PRINT_ERROR( "Unexpected end of the expression, `$` is missing\n" );
+            return false;
+        }
+
+        if ( !LexerReadToken( &position, stream ) ) {
+            PRINT_ERROR( "Unknown symbol in the expression --- `%s`\n", position );
+            return false;
+        }
+
+        if ( stream->tokens[stream->size - 1].type == TOKEN_END )
+            break;
+    }
+
+    stream->end_offset = (size_t)( position - buffer );
+    PRINT( "Tokenized %lu tokens", stream->size );
+
+    return true;
+}
+
+void TokenStreamDtor( TokenStream_t *stream ) {
+    my_assert( stream, "Null pointer on `stream`" );
+
+    free( stream->tokens );
+    stream->tokens = NULL;
+    stream->size = 0;
+    stream->capacity = 0;
+    stream->current = 0;
+}
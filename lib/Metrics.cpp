@@ -0,0 +1,263 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "DebugUtils.h"
+#include "Metrics.h"
+#include "OutputBuffer.h"
+
+#define METRICS_STRINGS( string, name ) \
+    string,
+
+static const char* counter_names[] = { INIT_METRIC_COUNTERS( METRICS_STRINGS ) };
+static const char* phase_names[]   = { INIT_METRIC_PHASES( METRICS_STRINGS ) };
+
+#undef METRICS_STRINGS
+
+struct TraceEvent_t {
+    MetricPhase phase;
+    uint64_t    start;
+    uint64_t    duration;
+};
+
+struct TreeSizes_t {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+};
+
+// A thread writes only its own block, so counting needs no locks. Blocks live
+// until the end of the process: pool threads may exit before the report.
+struct MetricsThread_t {
+    size_t index;
+
+    uint64_t    counters[METRIC_COUNTERS_NUMBER];
+    uint64_t    phase_time[METRIC_PHASES_NUMBER];
+    uint64_t    phase_calls[METRIC_PHASES_NUMBER];
+    TreeSizes_t tree_sizes[METRICS_MAX_ORDER];
+
+    TraceEvent_t* events;
+    size_t        n_events;
+    size_t        events_capacity;
+    uint64_t      dropped_events;
+
+    MetricsThread_t* next;
+};
+
+static pthread_mutex_t  metrics_lock    = PTHREAD_MUTEX_INITIALIZER;
+static MetricsThread_t* metrics_threads = NULL;
+static size_t           metrics_n_threads = 0;
+static uint64_t         metrics_start   = MetricsNow();
+
+static thread_local MetricsThread_t* metrics_thread = NULL;
+
+static MetricsThread_t* MetricsThread() {
+    if ( metrics_thread )
+        return metrics_thread;
+
+    metrics_thread = ( MetricsThread_t* ) calloc( 1, sizeof( *metrics_thread ) );
+    assert( metrics_thread && "Memory allocation error" );
+
+    pthread_mutex_lock( &metrics_lock );
+    metrics_thread->index = metrics_n_threads++;
+    metrics_thread->next = metrics_threads;
+    metrics_threads = metrics_thread;
+    pthread_mutex_unlock( &metrics_lock );
+
+    return metrics_thread;
+}
+
+uint64_t MetricsNow() {
+    struct timespec now = {};
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ( uint64_t ) now.tv_sec * 1000000000 + ( uint64_t ) now.tv_nsec;
+}
+
+void MetricsAdd( MetricCounter counter, uint64_t value ) {
+    MetricsThread()->counters[counter] += value;
+}
+
+void MetricsTreeSize( int order, size_t size ) {
+    if ( order < 0 || order >= METRICS_MAX_ORDER )
+        return;
+
+    TreeSizes_t* sizes = &MetricsThread()->tree_sizes[order];
+    sizes->count++;
+    sizes->total += size;
+    if ( size > sizes->max )
+        sizes->max = size;
+}
+
+void MetricsPhase( MetricPhase phase, uint64_t start ) {
+    MetricsThread_t* thread = MetricsThread();
+    uint64_t duration = MetricsNow() - start;
+
+    thread->phase_time[phase] += duration;
+    thread->phase_calls[phase]++;
+
+    if ( thread->n_events == thread->events_capacity ) {
+        if ( thread->events_capacity == METRICS_MAX_TRACE_EVENTS ) {
+            thread->dropped_events++;
+            return;
+        }
+
+        thread->events_capacity = thread->events_capacity ? thread->events_capacity * 2 : 256;
+        thread->events = ( TraceEvent_t* ) realloc( thread->events, thread->events_capacity * sizeof( TraceEvent_t ) );
+        assert( thread->events && "Memory allocation error" );
+    }
+
+    thread->events[thread->n_events++] = { phase, start, duration };
+}
+
+struct MetricsTotal_t {
+    uint64_t    counters[METRIC_COUNTERS_NUMBER];
+    uint64_t    phase_time[METRIC_PHASES_NUMBER];
+    uint64_t    phase_calls[METRIC_PHASES_NUMBER];
+    TreeSizes_t tree_sizes[METRICS_MAX_ORDER];
+
+    uint64_t dropped_events;
+    uint64_t elapsed;
+};
+
+static void MetricsSum( MetricsTotal_t* total ) {
+    memset( total, 0, sizeof( *total ) );
+
+    for ( MetricsThread_t* thread = metrics_threads; thread; thread = thread->next ) {
+        for ( int idx = 0; idx < METRIC_COUNTERS_NUMBER; idx++ )
+            total->counters[idx] += thread->counters[idx];
+
+        for ( int idx = 0; idx < METRIC_PHASES_NUMBER; idx++ ) {
+            total->phase_time[idx] += thread->phase_time[idx];
+            total->phase_calls[idx] += thread->phase_calls[idx];
+        }
+
+        for ( int order = 0; order < METRICS_MAX_ORDER; order++ ) {
+            TreeSizes_t* sizes = &total->tree_sizes[order];
+            sizes->count += thread->tree_sizes[order].count;
+            sizes->total += thread->tree_sizes[order].total;
+            if ( thread->tree_sizes[order].max > sizes->max )
+                sizes->max = thread->tree_sizes[order].max;
+        }
+
+        total->dropped_events += thread->dropped_events;
+    }
+
+    total->elapsed = MetricsNow() - metrics_start;
+}
+
+static double Milliseconds( uint64_t nanoseconds ) {
+    return ( double ) nanoseconds / 1e6;
+}
+
+static void MetricsJson( const MetricsTotal_t* total, OutputBuffer_t* output ) {
+    BufferPrintf( output, "{\n  \"threads\": %lu,\n  \"elapsed_ms\": %.3f,\n  \"counters\": {", metrics_n_threads,
+                  Milliseconds( total->elapsed ) );
+    for ( int idx = 0; idx < METRIC_COUNTERS_NUMBER; idx++ )
+        BufferPrintf( output, "%s\n    \"%s\": %lu", idx ? "," : "", counter_names[idx], total->counters[idx] );
+
+    BufferPutString( output, "\n  },\n  \"phases\": {" );
+    for ( int idx = 0; idx < METRIC_PHASES_NUMBER; idx++ )
+        BufferPrintf( output, "%s\n    \"%s\": { \"calls\": %lu, \"ms\": %.3f }", idx ? "," : "", phase_names[idx],
+                      total->phase_calls[idx], Milliseconds( total->phase_time[idx] ) );
+
+    BufferPutString( output, "\n  },\n  \"tree_size_by_order\": [" );
+    bool first = true;
+    for ( int order = 0; order < METRICS_MAX_ORDER; order++ ) {
+        const TreeSizes_t* sizes = &total->tree_sizes[order];
+        if ( !sizes->count )
+            continue;
+
+        BufferPrintf( output, "%s\n    { \"order\": %d, \"samples\": %lu, \"mean\": %.1f, \"max\": %lu }",
+                      first ? "" : ",", order, sizes->count, ( double ) sizes->total / ( double ) sizes->count,
+                      sizes->max );
+        first = false;
+    }
+
+    BufferPrintf( output, "\n  ],\n  \"dropped_trace_events\": %lu\n}\n", total->dropped_events );
+}
+
+static void MetricsCsv( const MetricsTotal_t* total, OutputBuffer_t* output ) {
+    BufferPutString( output, "kind,name,value,extra\n" );
+    BufferPrintf( output, "run,threads,%lu,\n", metrics_n_threads );
+    BufferPrintf( output, "run,elapsed_ms,%.3f,\n", Milliseconds( total->elapsed ) );
+
+    for ( int idx = 0; idx < METRIC_COUNTERS_NUMBER; idx++ )
+        BufferPrintf( output, "counter,%s,%lu,\n", counter_names[idx], total->counters[idx] );
+
+    for ( int idx = 0; idx < METRIC_PHASES_NUMBER; idx++ )
+        BufferPrintf( output, "phase_ms,%s,%.3f,%lu\n", phase_names[idx], Milliseconds( total->phase_time[idx] ),
+                      total->phase_calls[idx] );
+
+    for ( int order = 0; order < METRICS_MAX_ORDER; order++ ) {
+        const TreeSizes_t* sizes = &total->tree_sizes[order];
+        if ( sizes->count )
+            BufferPrintf( output, "tree_size,%d,%.1f,%lu\n", order,
+                          ( double ) sizes->total / ( double ) sizes->count, sizes->max );
+    }
+}
+
+static void MetricsTrace( OutputBuffer_t* output ) {
+    BufferPutString( output, "{\"traceEvents\":[" );
+
+    bool first = true;
+    for ( MetricsThread_t* thread = metrics_threads; thread; thread = thread->next ) {
+        for ( size_t idx = 0; idx < thread->n_events; idx++ ) {
+            const TraceEvent_t* event = &thread->events[idx];
+            BufferPrintf( output, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+                          first ? "" : ",", phase_names[event->phase], thread->index,
+                          ( double ) ( event->start - metrics_start ) / 1e3, ( double ) event->duration / 1e3 );
+            first = false;
+        }
+    }
+
+    BufferPutString( output, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+}
+
+static bool MetricsWriteFile( const char* path, const MetricsTotal_t* total, bool trace ) {
+    FILE* file = fopen( path, "w" );
+    if ( !file ) {
+        PRINT_ERROR( "Error opening file `%s` \n", path );
+        return false;
+    }
+
+    OutputBuffer_t output = {};
+    OutputBufferCtor( &output, file );
+
+    size_t length = strlen( path );
+    if ( trace )
+        MetricsTrace( &output );
+    else if ( length >= 4 && strcmp( path + length - 4, ".csv" ) == 0 )
+        MetricsCsv( total, &output );
+    else
+        MetricsJson( total, &output );
+
+    bool ok = OutputBufferDtor( &output );
+
+    return fclose( file ) == 0 && ok;
+}
+
+bool MetricsWrite( const char* report_path, const char* trace_path ) {
+#ifndef _METRICS
+    if ( report_path || trace_path ) {
+        PRINT_ERROR( "Metrics are not collected: the program was built without _METRICS \n" );
+    }
+#endif
+
+    MetricsTotal_t total = {};
+
+    pthread_mutex_lock( &metrics_lock );
+    MetricsSum( &total );
+
+    bool ok = true;
+    if ( report_path )
+        ok = MetricsWriteFile( report_path, &total, false ) && ok;
+    if ( trace_path )
+        ok = MetricsWriteFile( trace_path, &total, true ) && ok;
+    pthread_mutex_unlock( &metrics_lock );
+
+    return ok;
+}
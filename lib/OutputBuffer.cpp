@@ -0,0 +1,191 @@
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <charconv>
+
+#include "DebugUtils.h"
+#include "OutputBuffer.h"
+
+const size_t PRINTF_RESERVE = 256;
+
+void OutputBufferCtor( OutputBuffer_t* buffer, FILE* stream, size_t capacity ) {
+    my_assert( buffer, "Null pointer on `buffer`" );
+
+    buffer->stream = stream;
+    buffer->size = 0;
+    buffer->capacity = capacity ? capacity : OUTPUT_BUFFER_DEFAULT_CAPACITY;
+    buffer->error = false;
+
+    buffer->data = ( char* ) calloc( buffer->capacity, sizeof( char ) );
+    assert( buffer->data && "Memory allocation error" );
+}
+
+bool OutputBufferDtor( OutputBuffer_t* buffer ) {
+    my_assert( buffer, "Null pointer on `buffer`" );
+
+    bool ok = OutputBufferFlush( buffer );
+
+    free( buffer->data );
+    buffer->data = NULL;
+    buffer->capacity = 0;
+
+    return ok;
+}
+
+// Without a stream the buffer only grows and keeps everything written to it.
+bool OutputBufferFlush( OutputBuffer_t* buffer ) {
+    my_assert( buffer, "Null pointer on `buffer`" );
+
+    if ( !buffer->stream )
+        return !buffer->error;
+
+    if ( buffer->size && fwrite( buffer->data, 1, buffer->size, buffer->stream ) != buffer->size )
+        buffer->error = true;
+
+    buffer->size = 0;
+
+    return !buffer->error;
+}
+
+static void OutputBufferReserve( OutputBuffer_t* buffer, size_t size ) {
+    if ( buffer->capacity - buffer->size >= size )
+        return;
+
+    if ( buffer->stream )
+        OutputBufferFlush( buffer );
+
+    if ( buffer->capacity - buffer->size >= size )
+        return;
+
+    size_t new_capacity = buffer->capacity * 2;
+    while ( new_capacity - buffer->size < size )
+        new_capacity *= 2;
+
+    buffer->data = ( char* ) realloc( buffer->data, new_capacity );
+    assert( buffer->data && "Memory allocation error" );
+    buffer->capacity = new_capacity;
+}
+
+void BufferPutChar( OutputBuffer_t* buffer, char symbol ) {
+    if ( buffer->size == buffer->capacity )
+        OutputBufferReserve( buffer, 1 );
+
+    buffer->data[buffer->size++] = symbol;
+}
+
+void BufferPutBytes( OutputBuffer_t* buffer, const char* data, size_t size ) {
+    OutputBufferReserve( buffer, size );
+
+    memcpy( buffer->data + buffer->size, data, size );
+    buffer->size += size;
+}
+
+void BufferPutString( OutputBuffer_t* buffer, const char* string ) {
+    BufferPutBytes( buffer, string, strlen( string ) );
+}
+
+void BufferPutDouble( OutputBuffer_t* buffer, double value, int precision ) {
+    OutputBufferReserve( buffer, DOUBLE_MAX_CHARS );
+
+    buffer->size += FormatDouble( buffer->data + buffer->size, value, precision );
+}
+
+// A format without conversions is copied as is, everything else goes
+// straight into the buffer through vsnprintf.
+void BufferPrintf( OutputBuffer_t* buffer, const char* format, ... ) {
+    if ( !strchr( format, '%' ) ) {
+        BufferPutString( buffer, format );
+        return;
+    }
+
+    OutputBufferReserve( buffer, PRINTF_RESERVE );
+
+    va_list args;
+    va_start( args, format );
+    int length = vsnprintf( buffer->data + buffer->size, buffer->capacity - buffer->size, format, args );
+    va_end( args );
+
+    if ( length < 0 ) {
+        buffer->error = true;
+        return;
+    }
+
+    if ( ( size_t ) length >= buffer->capacity - buffer->size ) {
+        OutputBufferReserve( buffer, ( size_t ) length + 1 );
+
+        va_start( args, format );
+        vsnprintf( buffer->data + buffer->size, buffer->capacity - buffer->size, format, args );
+        va_end( args );
+    }
+
+    buffer->size += ( size_t ) length;
+}
+
+size_t FormatDouble( char* destination, double value, int precision ) {
+    my_assert( destination, "Null pointer on `destination`" );
+
+    char* end = destination + DOUBLE_MAX_CHARS - 1;
+    std::to_chars_result result = ( precision == SHORTEST_PRECISION )
+                                      ? std::to_chars( destination, end, value )
+                                      : std::to_chars( destination, end, value, std::chars_format::general, precision );
+    assert( result.ec == std::errc() && "Buffer for a double is too small" );
+
+    *result.ptr = '\0';
+
+    return ( size_t ) ( result.ptr - destination );
+}
+
+// The longest run that can belong to a number: from_chars stops at the first
+// character that does not fit, so the bound only has to be safe, not exact.
+static const char* NumberSpanEnd( const char* position ) {
+    while ( isalnum( ( unsigned char ) *position ) || *position == '.' || *position == '+' || *position == '-' )
+        position++;
+
+    return position;
+}
+
+// Reads a number the way strtod does (leading spaces and '+' are allowed);
+// returns the number of characters consumed, 0 when there is no number
+// (then `value` is left untouched).
+size_t ReadDouble( const char* position, double* value ) {
+    my_assert( position, "Null pointer on `position`" );
+    my_assert( value, "Null pointer on `value`" );
+
+    const char* start = position;
+    while ( isspace( ( unsigned char ) *position ) )
+        position++;
+
+    if ( *position == '+' && position[1] != '-' )
+        position++;
+
+    std::from_chars_result result = std::from_chars( position, NumberSpanEnd( position ), *value );
+    if ( result.ec == std::errc::invalid_argument )
+        return 0;
+
+    if ( result.ec == std::errc::result_out_of_range )
+        *value = strtod( position, NULL );
+
+    return ( size_t ) ( result.ptr - start );
+}
+
+size_t ReadLong( const char* position, long* value ) {
+    my_assert( position, "Null pointer on `position`" );
+    my_assert( value, "Null pointer on `value`" );
+
+    const char* start = position;
+    while ( isspace( ( unsigned char ) *position ) )
+        position++;
+
+    if ( *position == '+' && position[1] != '-' )
+        position++;
+
+    std::from_chars_result result = std::from_chars( position, NumberSpanEnd( position ), *value );
+    if ( result.ec != std::errc() )
+        return 0;
+
+    return ( size_t ) ( result.ptr - start );
+}
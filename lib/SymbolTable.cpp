@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "SymbolTable.h"
+
+// Names live in `symbols` in order of their ids and are never freed, lookups go
+// through an open-addressing table of ids kept at most half full. Parsers in
+// worker threads intern concurrently, so every access takes the lock.
+
+struct Symbol_t {
+    char    *name;
+    size_t   length;
+    uint64_t hash;
+};
+
+struct SymbolTable_t {
+    Symbol_t *symbols;
+    size_t    n_symbols;
+    size_t    capacity;
+
+    SymbolId *slots;
+    size_t    n_slots;
+
+    pthread_mutex_t lock;
+};
+
+static SymbolTable_t symbol_table = { NULL, 0, 0, NULL, 0, PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t HashName( const char *name, size_t length ) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for ( size_t idx = 0; idx < length; idx++ ) {
+        hash ^= (unsigned char)name[idx];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static size_t FindSlot( const SymbolTable_t *table, const char *name, size_t length, uint64_t hash ) {
+    size_t mask = table->n_slots - 1;
+    size_t slot = hash & mask;
+
+    for ( ; table->slots[slot] != SYMBOL_NONE; slot = ( slot + 1 ) & mask ) {
+        const Symbol_t *symbol = &table->symbols[table->slots[slot]];
+        if ( symbol->hash == hash && symbol->length == length && memcmp( symbol->name, name, length ) == 0 )
+            break;
+    }
+
+    return slot;
+}
+
+static void GrowSlots( SymbolTable_t *table ) {
+    size_t n_slots = table->n_slots ? table->n_slots * 2 : 64;
+
+    free( table->slots );
+    table->slots = (SymbolId *)malloc( n_slots * sizeof( SymbolId ) );
+    assert( table->slots && "Memory allocation error" );
+
+    memset( table->slots, 0xFF, n_slots * sizeof( SymbolId ) );
+    table->n_slots = n_slots;
+
+    size_t mask = n_slots - 1;
+    for ( size_t id = 0; id < table->n_symbols; id++ ) {
+        size_t slot = table->symbols[id].hash & mask;
+        while ( table->slots[slot] != SYMBOL_NONE )
+            slot = ( slot + 1 ) & mask;
+        table->slots[slot] = (SymbolId)id;
+    }
+}
+
+SymbolId SymbolIntern( const char *name, size_t length ) {
+    my_assert( name, "Null pointer on `name`" );
+
+    SymbolTable_t *table = &symbol_table;
+    uint64_t hash = HashName( name, length );
+
+    pthread_mutex_lock( &table->lock );
+
+    if ( ( table->n_symbols + 1 ) * 2 > table->n_slots )
+        GrowSlots( table );
+
+    size_t slot = FindSlot( table, name, length, hash );
+    SymbolId id = table->slots[slot];
+
+    if ( id == SYMBOL_NONE ) {
+        assert( table->n_symbols < SYMBOL_NONE && "Too many symbols" );
+
+        if ( table->n_symbols >= table->capacity ) {
+            table->capacity = table->capacity ? table->capacity * 2 : 32;
+            table->symbols = (Symbol_t *)realloc( table->symbols, table->capacity * sizeof( Symbol_t ) );
+            assert( table->symbols && "Memory allocation error" );
+        }
+
+        char *copy = (char *)malloc( length + 1 );
+        assert( copy && "Memory allocation error" );
+        memcpy( copy, name, length );
+        copy[length] = '\0';
+
+        id = (SymbolId)table->n_symbols++;
+        table->symbols[id] = { copy, length, hash };
+        table->slots[slot] = id;
+    }
+
+    pthread_mutex_unlock( &table->lock );
+
+    return id;
+}
+
+SymbolId SymbolIntern( const char *name ) {
+    my_assert( name, "Null pointer on `name`" );
+
+    return SymbolIntern( name, strlen( name ) );
+}
+
+SymbolId SymbolFind( const char *name, size_t length ) {
+    my_assert( name, "Null pointer on `name`" );
+
+    SymbolTable_t *table = &symbol_table;
+    uint64_t hash = HashName( name, length );
+
+    pthread_mutex_lock( &table->lock );
+    SymbolId id = table->n_slots ? table->slots[FindSlot( table, name, length, hash )] : SYMBOL_NONE;
+    pthread_mutex_unlock( &table->lock );
+
+    return id;
+}
+
+const char *SymbolName( SymbolId id ) {
+    SymbolTable_t *table = &symbol_table;
+
+    pthread_mutex_lock( &table->lock );
+    const char *name = ( id < table->n_symbols ) ? table->symbols[id].name : "?";
+    pthread_mutex_unlock( &table->lock );
+
+    return name;
+}
+
+size_t SymbolCount() {
+    pthread_mutex_lock( &symbol_table.lock );
+    size_t count = symbol_table.n_symbols;
+    pthread_mutex_unlock( &symbol_table.lock );
+
+    return count;
+}
+
+size_t SymbolNameLength( const char *position ) {
+    my_assert( position, "Null pointer on `position`" );
+
+    if ( !isalpha( (unsigned char)position[0] ) )
+        return 0;
+
+    size_t length = 1;
+    while ( isalnum( (unsigned char)position[length] ) || position[length] == '_' )
+        length++;
+
+    return length;
+}
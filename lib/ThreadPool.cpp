@@ -0,0 +1,432 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "DebugUtils.h"
+#include "Metrics.h"
+#include "ThreadPool.h"
+
+// Counters shared by all threads are only touched with __atomic builtins.
+// `queued` is raised before a task is pushed and lowered after one is taken,
+// so a worker that sees zero under `sleep_lock` may sleep: whoever pushes next
+// sees it in `n_sleeping` and signals.
+
+struct Task_t {
+    void ( *function )( void *arg );
+    void *arg;
+
+    ThreadPoolGroup_t *group;
+};
+
+struct WorkerDeque_t {
+    Task_t *tasks;
+    size_t  head;
+    size_t  size;
+    size_t  capacity;
+
+    pthread_mutex_t lock;
+};
+
+struct ThreadPool_t {
+    pthread_t     *threads;
+    size_t         n_started;
+    WorkerDeque_t *deques;
+    size_t         n_deques;
+    size_t         n_threads;
+
+    size_t next_deque;
+    size_t queued;
+    size_t pending;
+    size_t n_sleeping;
+    bool   stop;
+
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t  has_task;
+
+    pthread_mutex_t done_lock;
+    pthread_cond_t  all_done;
+};
+
+struct WorkerArgs_t {
+    ThreadPool_t *pool;
+    size_t        index;
+};
+
+struct ParallelRange_t {
+    void ( *function )( void *arg, size_t begin, size_t end );
+    void  *arg;
+    size_t begin;
+    size_t end;
+};
+
+const size_t DEQUE_INITIAL_CAPACITY = 64;
+const size_t CHUNKS_PER_WORKER      = 4;
+
+static thread_local size_t        worker_index = THREAD_POOL_NOT_WORKER;
+static thread_local ThreadPool_t *worker_pool  = NULL;
+
+// ------------------------------------ Deques ------------------------------------
+
+static void DequePushBack( WorkerDeque_t *deque, Task_t task ) {
+    pthread_mutex_lock( &deque->lock );
+
+    if ( deque->size >= deque->capacity ) {
+        size_t new_capacity = deque->capacity * 2;
+        Task_t *new_tasks = (Task_t *)calloc( new_capacity, sizeof( Task_t ) );
+        assert( new_tasks && "Memory allocation error" );
+
+        for ( size_t idx = 0; idx < deque->size; idx++ )
+            new_tasks[idx] = deque->tasks[( deque->head + idx ) % deque->capacity];
+
+        free( deque->tasks );
+        deque->tasks = new_tasks;
+        deque->head = 0;
+        deque->capacity = new_capacity;
+    }
+
+    deque->tasks[( deque->head + deque->size ) % deque->capacity] = task;
+    deque->size++;
+
+    pthread_mutex_unlock( &deque->lock );
+}
+
+// The owner takes the newest task, a thief the oldest one. With `grouped_only`
+// the nearest task of some group from that end is taken, plain tasks in front
+// of it stay where they are.
+static bool DequeTake( WorkerDeque_t *deque, bool from_back, bool grouped_only, Task_t *task ) {
+    pthread_mutex_lock( &deque->lock );
+
+    bool found = false;
+    for ( size_t n = 0; n < deque->size && !found; n++ ) {
+        size_t pos = from_back ? deque->size - 1 - n : n;
+        size_t slot = ( deque->head + pos ) % deque->capacity;
+        if ( grouped_only && !deque->tasks[slot].group )
+            continue;
+
+        *task = deque->tasks[slot];
+        if ( pos == 0 ) {
+            deque->head = ( deque->head + 1 ) % deque->capacity;
+        } else {
+            for ( size_t idx = pos; idx + 1 < deque->size; idx++ )
+                deque->tasks[( deque->head + idx ) % deque->capacity] =
+                    deque->tasks[( deque->head + idx + 1 ) % deque->capacity];
+        }
+        deque->size--;
+        found = true;
+    }
+
+    pthread_mutex_unlock( &deque->lock );
+
+    return found;
+}
+
+// ----------------------------------- Scheduling ---------------------------------
+
+static bool TakeTask( ThreadPool_t *pool, size_t self, bool grouped_only, Task_t *task ) {
+    if ( __atomic_load_n( &pool->queued, __ATOMIC_SEQ_CST ) == 0 )
+        return false;
+
+    if ( DequeTake( &pool->deques[self], true, grouped_only, task ) ) {
+        __atomic_sub_fetch( &pool->queued, 1, __ATOMIC_SEQ_CST );
+        return true;
+    }
+
+    for ( size_t step = 1; step < pool->n_threads; step++ ) {
+        size_t victim = ( self + step ) % pool->n_threads;
+
+        if ( DequeTake( &pool->deques[victim], false, grouped_only, task ) ) {
+            __atomic_sub_fetch( &pool->queued, 1, __ATOMIC_SEQ_CST );
+            METRIC_INC( METRIC_TASKS_STOLEN )
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void SignalDone( ThreadPool_t *pool ) {
+    pthread_mutex_lock( &pool->done_lock );
+    pthread_cond_broadcast( &pool->all_done );
+    pthread_mutex_unlock( &pool->done_lock );
+}
+
+static void RunTask( ThreadPool_t *pool, Task_t task ) {
+    task.function( task.arg );
+    METRIC_INC( METRIC_TASKS_RUN )
+
+    // The group may be gone as soon as its counter is zero.
+    bool group_done = task.group && __atomic_sub_fetch( &task.group->pending, 1, __ATOMIC_SEQ_CST ) == 0;
+    bool pool_done = __atomic_sub_fetch( &pool->pending, 1, __ATOMIC_SEQ_CST ) == 0;
+
+    if ( group_done || pool_done )
+        SignalDone( pool );
+}
+
+static void PushTask( ThreadPool_t *pool, Task_t task ) {
+    size_t target = ( worker_pool == pool )
+                        ? worker_index
+                        : __atomic_fetch_add( &pool->next_deque, 1, __ATOMIC_RELAXED ) % pool->n_threads;
+
+    if ( task.group )
+        __atomic_add_fetch( &task.group->pending, 1, __ATOMIC_SEQ_CST );
+    __atomic_add_fetch( &pool->pending, 1, __ATOMIC_SEQ_CST );
+    __atomic_add_fetch( &pool->queued, 1, __ATOMIC_SEQ_CST );
+
+    DequePushBack( &pool->deques[target], task );
+
+    if ( __atomic_load_n( &pool->n_sleeping, __ATOMIC_SEQ_CST ) ) {
+        pthread_mutex_lock( &pool->sleep_lock );
+        pthread_cond_signal( &pool->has_task );
+        pthread_mutex_unlock( &pool->sleep_lock );
+    }
+}
+
+static void *WorkerLoop( void *raw_args ) {
+    WorkerArgs_t *args = (WorkerArgs_t *)raw_args;
+    ThreadPool_t *pool = args->pool;
+    worker_index = args->index;
+    worker_pool = pool;
+    free( args );
+
+    while ( true ) {
+        Task_t task = {};
+        if ( TakeTask( pool, worker_index, false, &task ) ) {
+            RunTask( pool, task );
+            continue;
+        }
+
+        ON_METRICS( uint64_t idle_start = MetricsNow(); )
+
+        pthread_mutex_lock( &pool->sleep_lock );
+        __atomic_add_fetch( &pool->n_sleeping, 1, __ATOMIC_SEQ_CST );
+
+        while ( __atomic_load_n( &pool->queued, __ATOMIC_SEQ_CST ) == 0 && !pool->stop )
+            pthread_cond_wait( &pool->has_task, &pool->sleep_lock );
+
+        __atomic_sub_fetch( &pool->n_sleeping, 1, __ATOMIC_SEQ_CST );
+        bool finished = pool->stop && __atomic_load_n( &pool->queued, __ATOMIC_SEQ_CST ) == 0;
+        pthread_mutex_unlock( &pool->sleep_lock );
+
+        METRIC_ADD( METRIC_POOL_IDLE_NS, MetricsNow() - idle_start )
+
+        if ( finished )
+            break;
+    }
+
+    return NULL;
+}
+
+// ---------------------------------- Interface ----------------------------------
+
+ThreadPool_t *ThreadPoolCtor( size_t n_threads ) {
+    if ( n_threads == 0 )
+        n_threads = ThreadPoolDefaultSize();
+
+    ThreadPool_t *pool = (ThreadPool_t *)calloc( 1, sizeof( *pool ) );
+    assert( pool && "Memory allocation error" );
+
+    pool->threads = (pthread_t *)calloc( n_threads, sizeof( pthread_t ) );
+    pool->deques = (WorkerDeque_t *)calloc( n_threads, sizeof( WorkerDeque_t ) );
+    assert( pool->threads && pool->deques && "Memory allocation error" );
+
+    pool->n_deques = n_threads;
+    for ( size_t idx = 0; idx < n_threads; idx++ ) {
+        pool->deques[idx].capacity = DEQUE_INITIAL_CAPACITY;
+        pool->deques[idx].tasks = (Task_t *)calloc( DEQUE_INITIAL_CAPACITY, sizeof( Task_t ) );
+        assert( pool->deques[idx].tasks && "Memory allocation error" );
+        pthread_mutex_init( &pool->deques[idx].lock, NULL );
+    }
+
+    pthread_mutex_init( &pool->sleep_lock, NULL );
+    pthread_cond_init( &pool->has_task, NULL );
+    pthread_mutex_init( &pool->done_lock, NULL );
+    pthread_cond_init( &pool->all_done, NULL );
+
+    // The deque of a worker that failed to start is emptied by the others.
+    pool->n_threads = n_threads;
+    for ( size_t idx = 0; idx < n_threads; idx++ ) {
+        WorkerArgs_t *args = (WorkerArgs_t *)calloc( 1, sizeof( *args ) );
+        assert( args && "Memory allocation error" );
+        args->pool = pool;
+        args->index = idx;
+
+        if ( pthread_create( &pool->threads[idx], NULL, WorkerLoop, args ) != 0 ) {
+            PRINT_ERROR( "Failed to start worker thread %lu \n", idx );
+            free( args );
+            break;
+        }
+
+        pool->n_started++;
+    }
+
+    // Without workers every task runs in the caller.
+    if ( pool->n_started == 0 )
+        pool->n_threads = 0;
+
+    PRINT( "Thread pool started with %lu workers", pool->n_started );
+
+    return pool;
+}
+
+void ThreadPoolDtor( ThreadPool_t **pool ) {
+    my_assert( pool, "Null pointer on pointer on `pool`" );
+    if ( *pool == NULL )
+        return;
+
+    ThreadPool_t *p = *pool;
+
+    pthread_mutex_lock( &p->sleep_lock );
+    p->stop = true;
+    pthread_cond_broadcast( &p->has_task );
+    pthread_mutex_unlock( &p->sleep_lock );
+
+    for ( size_t idx = 0; idx < p->n_started; idx++ )
+        pthread_join( p->threads[idx], NULL );
+
+    for ( size_t idx = 0; idx < p->n_deques; idx++ ) {
+        pthread_mutex_destroy( &p->deques[idx].lock );
+        free( p->deques[idx].tasks );
+    }
+
+    pthread_mutex_destroy( &p->sleep_lock );
+    pthread_cond_destroy( &p->has_task );
+    pthread_mutex_destroy( &p->done_lock );
+    pthread_cond_destroy( &p->all_done );
+
+    free( p->threads );
+    free( p->deques );
+    free( p );
+    *pool = NULL;
+}
+
+void ThreadPoolSubmit( ThreadPool_t *pool, void ( *function )( void *arg ), void *arg ) {
+    my_assert( pool, "Null pointer on `pool`" );
+    my_assert( function, "Null pointer on `function`" );
+
+    if ( pool->n_threads == 0 ) {
+        function( arg );
+        return;
+    }
+
+    PushTask( pool, { function, arg, NULL } );
+}
+
+// Only from outside the pool: a worker waiting here would wait for itself.
+void ThreadPoolWait( ThreadPool_t *pool ) {
+    my_assert( pool, "Null pointer on `pool`" );
+
+    pthread_mutex_lock( &pool->done_lock );
+    while ( __atomic_load_n( &pool->pending, __ATOMIC_SEQ_CST ) != 0 )
+        pthread_cond_wait( &pool->all_done, &pool->done_lock );
+    pthread_mutex_unlock( &pool->done_lock );
+}
+
+void ThreadPoolGroupSubmit( ThreadPool_t *pool, ThreadPoolGroup_t *group, void ( *function )( void *arg ),
+                            void *arg ) {
+    my_assert( group, "Null pointer on `group`" );
+    my_assert( function, "Null pointer on `function`" );
+
+    if ( !pool || pool->n_threads == 0 ) {
+        function( arg );
+        return;
+    }
+
+    PushTask( pool, { function, arg, group } );
+}
+
+void ThreadPoolGroupWait( ThreadPool_t *pool, ThreadPoolGroup_t *group ) {
+    my_assert( group, "Null pointer on `group`" );
+
+    if ( !pool || __atomic_load_n( &group->pending, __ATOMIC_SEQ_CST ) == 0 )
+        return;
+
+    if ( worker_pool != pool ) {
+        pthread_mutex_lock( &pool->done_lock );
+        while ( __atomic_load_n( &group->pending, __ATOMIC_SEQ_CST ) != 0 )
+            pthread_cond_wait( &pool->all_done, &pool->done_lock );
+        pthread_mutex_unlock( &pool->done_lock );
+        return;
+    }
+
+    // Help with grouped tasks until the group is done; grouped tasks are found
+    // wherever they sit in a deque, so plain tasks pushed around them by other
+    // threads cannot hide them. Whatever is not queued is running elsewhere.
+    while ( __atomic_load_n( &group->pending, __ATOMIC_SEQ_CST ) != 0 ) {
+        Task_t task = {};
+        if ( TakeTask( pool, worker_index, true, &task ) ) {
+            RunTask( pool, task );
+        } else {
+            ON_METRICS( uint64_t idle_start = MetricsNow(); )
+            sched_yield();
+            METRIC_ADD( METRIC_POOL_IDLE_NS, MetricsNow() - idle_start )
+        }
+    }
+}
+
+static void RunRange( void *arg ) {
+    ParallelRange_t *range = (ParallelRange_t *)arg;
+
+    range->function( range->arg, range->begin, range->end );
+}
+
+void ThreadPoolParallelFor( ThreadPool_t *pool, size_t n_items, size_t grain,
+                            void ( *function )( void *arg, size_t begin, size_t end ), void *arg ) {
+    my_assert( function, "Null pointer on `function`" );
+
+    if ( grain == 0 )
+        grain = 1;
+
+    if ( !pool || pool->n_threads < 2 || n_items <= grain ) {
+        if ( n_items )
+            function( arg, 0, n_items );
+        return;
+    }
+
+    size_t chunk = n_items / ( pool->n_threads * CHUNKS_PER_WORKER );
+    if ( chunk < grain )
+        chunk = grain;
+
+    size_t n_chunks = ( n_items + chunk - 1 ) / chunk;
+    ParallelRange_t *ranges = (ParallelRange_t *)calloc( n_chunks, sizeof( ParallelRange_t ) );
+    assert( ranges && "Memory allocation error" );
+
+    ThreadPoolGroup_t group = {};
+    for ( size_t idx = 0; idx < n_chunks; idx++ ) {
+        size_t begin = idx * chunk;
+        ranges[idx] = { function, arg, begin, ( begin + chunk < n_items ) ? begin + chunk : n_items };
+
+        ThreadPoolGroupSubmit( pool, &group, RunRange, &ranges[idx] );
+    }
+
+    ThreadPoolGroupWait( pool, &group );
+    free( ranges );
+}
+
+size_t ThreadPoolSize( const ThreadPool_t *pool ) {
+    my_assert( pool, "Null pointer on `pool`" );
+
+    return pool->n_threads;
+}
+
+size_t ThreadPoolWorkerIndex() {
+    return worker_index;
+}
+
+bool ThreadPoolIsWorker( const ThreadPool_t *pool ) {
+    return pool && worker_pool == pool;
+}
+
+size_t ThreadPoolDefaultSize() {
+    const char *env = getenv( THREAD_POOL_ENV );
+    if ( env ) {
+        long n_threads = atol( env );
+        if ( n_threads > 0 )
+            return (size_t)n_threads;
+    }
+
+    long n_cpus = sysconf( _SC_NPROCESSORS_ONLN );
+
+    return n_cpus > 0 ? (size_t)n_cpus : 1;
+}
@@ -6,13 +6,19 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "DebugUtils.h"
+#include "Lexer.h"
+#include "Metrics.h"
+#include "OutputBuffer.h"
+#include "ThreadPool.h"
 #include "Tree.h"
 #include "UtilsRW.h"
 
 const uint32_t fill_color = 0xb6b4b4;
+const size_t   DOT_THREADS = 2;
 #define OPERATIONS_STRINGS( string, ... ) \
     string,
     
@@ -20,6 +26,208 @@ static const char* operations_txt[] = { INIT_OPERATIONS( OPERATIONS_STRINGS ) };
 
 #undef OPERATIONS_STRINGS
 
+// Nodes are carved from slabs and recycled through a free list per thread, so
+// builders running on different workers never meet in malloc. A thread holding
+// too many free nodes hands a chain of them to a shared depot for any thread to
+// pick up, and a thread that exits hands over all of them. NodeArenaRelease()
+// frees the slabs once every node is back in the depot. ASan builds keep calloc
+// and free so that use-after-free is still caught.
+#ifndef __SANITIZE_ADDRESS__
+    #define NODE_ARENA
+#endif
+
+#ifdef NODE_ARENA
+const size_t ARENA_SLAB_NODES = 512;
+
+// Free nodes are linked through `right`. `balance` is the number of nodes taken
+// minus the number given back by this thread, a node may die on another one.
+struct NodeArena_t {
+    Node_t *free_nodes;
+    size_t  n_free;
+
+    long balance;
+    bool registered;
+};
+
+// Chains of ARENA_SLAB_NODES nodes are linked through `left` of their heads,
+// slabs through `left` of their first node, which is never handed out. Shorter
+// lists from exiting threads go to `loose`. `balance` adds up the arenas handed
+// back, `n_arenas` counts the threads still holding one.
+struct NodeDepot_t {
+    Node_t *chains;
+    Node_t *slabs;
+    Node_t *loose;
+
+    long   balance;
+    size_t n_arenas;
+
+    pthread_mutex_t lock;
+};
+
+static thread_local NodeArena_t node_arena = {};
+static NodeDepot_t              node_depot = { NULL, NULL, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+static pthread_key_t  arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+// Called with the depot locked.
+static void ArenaHandBack( NodeArena_t *arena ) {
+    if ( !arena->registered )
+        return;
+
+    while ( arena->free_nodes ) {
+        Node_t *node = arena->free_nodes;
+        arena->free_nodes = node->right;
+
+        node->left = NULL;
+        node->right = node_depot.loose;
+        node_depot.loose = node;
+    }
+
+    node_depot.balance += arena->balance;
+    node_depot.n_arenas--;
+
+    *arena = {};
+}
+
+static void ArenaThreadExit( void *arg ) {
+    pthread_mutex_lock( &node_depot.lock );
+    ArenaHandBack( (NodeArena_t *)arg );
+    pthread_mutex_unlock( &node_depot.lock );
+}
+
+static void ArenaKeyCtor() {
+    pthread_key_create( &arena_key, ArenaThreadExit );
+}
+
+// The first allocation or release on a thread registers its exit hook.
+static void ArenaRegister( NodeArena_t *arena ) {
+    pthread_once( &arena_key_once, ArenaKeyCtor );
+    pthread_setspecific( arena_key, arena );
+    arena->registered = true;
+
+    pthread_mutex_lock( &node_depot.lock );
+    node_depot.n_arenas++;
+    pthread_mutex_unlock( &node_depot.lock );
+}
+
+// Called with the depot locked, takes at most ARENA_SLAB_NODES loose nodes.
+static bool ArenaTakeLoose( NodeArena_t *arena ) {
+    if ( !node_depot.loose )
+        return false;
+
+    while ( node_depot.loose && arena->n_free < ARENA_SLAB_NODES ) {
+        Node_t *node = node_depot.loose;
+        node_depot.loose = node->right;
+
+        node->right = arena->free_nodes;
+        arena->free_nodes = node;
+        arena->n_free++;
+    }
+
+    return true;
+}
+
+static void ArenaRefill( NodeArena_t *arena ) {
+    pthread_mutex_lock( &node_depot.lock );
+    Node_t *chain = node_depot.chains;
+    if ( chain )
+        node_depot.chains = chain->left;
+    bool refilled = chain || ArenaTakeLoose( arena );
+    pthread_mutex_unlock( &node_depot.lock );
+
+    if ( chain ) {
+        chain->left = NULL;
+        arena->free_nodes = chain;
+        arena->n_free = ARENA_SLAB_NODES;
+    }
+    if ( refilled )
+        return;
+
+    Node_t *slab = (Node_t *)calloc( ARENA_SLAB_NODES + 1, sizeof( Node_t ) );
+    assert( slab && "Memory allocation error" );
+
+    METRIC_INC( METRIC_ARENA_SLABS )
+
+    for ( size_t idx = 1; idx < ARENA_SLAB_NODES; idx++ )
+        slab[idx].right = &slab[idx + 1];
+
+    arena->free_nodes = &slab[1];
+    arena->n_free = ARENA_SLAB_NODES;
+
+    pthread_mutex_lock( &node_depot.lock );
+    slab->left = node_depot.slabs;
+    node_depot.slabs = slab;
+    pthread_mutex_unlock( &node_depot.lock );
+}
+
+static Node_t *ArenaAlloc() {
+    NodeArena_t *arena = &node_arena;
+    if ( !arena->registered )
+        ArenaRegister( arena );
+    if ( !arena->free_nodes )
+        ArenaRefill( arena );
+
+    Node_t *node = arena->free_nodes;
+    arena->free_nodes = node->right;
+    arena->n_free--;
+    arena->balance++;
+
+    memset( node, 0, sizeof( *node ) );
+
+    return node;
+}
+
+static void ArenaFree( Node_t *node ) {
+    NodeArena_t *arena = &node_arena;
+    if ( !arena->registered )
+        ArenaRegister( arena );
+
+    node->left = NULL;
+    node->right = arena->free_nodes;
+    arena->free_nodes = node;
+    arena->n_free++;
+    arena->balance--;
+
+    if ( arena->n_free < 2 * ARENA_SLAB_NODES )
+        return;
+
+    Node_t *chain = arena->free_nodes;
+    Node_t *tail = chain;
+    for ( size_t idx = 1; idx < ARENA_SLAB_NODES; idx++ )
+        tail = tail->right;
+
+    arena->free_nodes = tail->right;
+    arena->n_free -= ARENA_SLAB_NODES;
+    tail->right = NULL;
+
+    pthread_mutex_lock( &node_depot.lock );
+    chain->left = node_depot.chains;
+    node_depot.chains = chain;
+    pthread_mutex_unlock( &node_depot.lock );
+}
+#endif
+
+void NodeArenaRelease() {
+#ifdef NODE_ARENA
+    pthread_mutex_lock( &node_depot.lock );
+    ArenaHandBack( &node_arena );
+
+    // Nodes may still be alive or sit in the lists of running threads.
+    if ( node_depot.n_arenas == 0 && node_depot.balance == 0 ) {
+        while ( node_depot.slabs ) {
+            Node_t *slab = node_depot.slabs;
+            node_depot.slabs = slab->left;
+            free( slab );
+        }
+
+        node_depot.chains = NULL;
+        node_depot.loose = NULL;
+    }
+    pthread_mutex_unlock( &node_depot.lock );
+#endif
+}
+
 Tree_t *TreeCtor() {
     Tree_t *new_tree = (Tree_t *)calloc( 1, sizeof( *new_tree ) );
     assert( new_tree && "Memory allocation error" );
@@ -39,8 +247,14 @@ void TreeDtor( Tree_t **tree, void ( *clean_function )( TreeData_t value, Tree_t
 }
 
 Node_t *NodeCreate( const TreeData_t field, Node_t *parent ) {
+#ifdef NODE_ARENA
+    Node_t *new_node = ArenaAlloc();
+#else
     Node_t *new_node = (Node_t *)calloc( 1, sizeof( *new_node ) );
     assert( new_node && "Memory allocation error" );
+#endif
+
+    METRIC_INC( METRIC_NODES_CREATED )
 
     new_node->value = field;
     new_node->parent = parent;
@@ -86,7 +300,41 @@ void NodeDelete( Node_t *node, Tree_t *tree, void ( *clean_function )( TreeData_
     if ( clean_function )
         clean_function( node->value, tree );
 
+#ifdef NODE_ARENA
+    ArenaFree( node );
+#else
     free( node );
+#endif
+}
+
+// Walks down the left spines with a stack of right children, the parser accepts
+// very deep trees.
+size_t NodeCount( const Node_t *node ) {
+    size_t count = 0;
+    size_t capacity = 64;
+    size_t top = 0;
+    const Node_t **stack = (const Node_t **)calloc( capacity, sizeof( Node_t * ) );
+    assert( stack && "Memory allocation error" );
+
+    while ( node || top ) {
+        if ( !node )
+            node = stack[--top];
+
+        count++;
+        if ( node->right ) {
+            if ( top >= capacity ) {
+                capacity *= 2;
+                stack = (const Node_t **)realloc( stack, capacity * sizeof( Node_t * ) );
+                assert( stack && "Memory allocation error" );
+            }
+            stack[top++] = node->right;
+        }
+        node = node->left;
+    }
+
+    free( stack );
+
+    return count;
 }
 
 Node_t *NodeCopy( Node_t *node ) {
@@ -130,52 +378,191 @@ static uint32_t my_crc32_ptr( const void *ptr ) {
 }
 #endif
 
-#define DOT_PRINT( format, ... ) fprintf( dot_stream, format, ##__VA_ARGS__ );
+#define DOT_PRINT( format, ... ) BufferPrintf( dot_stream, format, ##__VA_ARGS__ );
+
+// Nodes are drawn breadth-first, so a capped dump keeps the top of the tree.
+// Equal subtrees (by `representative`) are drawn once and shared as in a DAG,
+// whatever does not fit into `max_nodes` is drawn as one summary node.
+struct GraphDump_t {
+    const GraphDumpOptions_t *options;
+    OutputBuffer_t           *dot_stream;
+
+    const Node_t **queue;
+    size_t         n_queued;
+    size_t         max_nodes;
+
+    const Node_t **drawn;
+    size_t         table_size;
+
+    size_t n_summaries;
+};
 
-static void NodeDumpRecursively( const Node_t *node, FILE *dot_stream );
-static void NodeInitDot( const Node_t *node, FILE *dot_stream );
-static void NodeBondInitDot( const Node_t *node, FILE *dot_stream );
+static ThreadPool_t  *dot_pool      = NULL;
+static pthread_once_t dot_pool_once = PTHREAD_ONCE_INIT;
+
+static void NodeGraphicDumpV( const Node_t *node, const GraphDumpOptions_t *options, const char *image_path_name,
+                              va_list args );
+static void GraphDumpNodes( GraphDump_t *dump, const Node_t *root );
+static void GraphChildDot( GraphDump_t *dump, const Node_t *node, const Node_t *child, const char *port );
+static void NodeInitDot( const Node_t *node, OutputBuffer_t *dot_stream );
 
 void NodeGraphicDump( const Node_t *node, const char *image_path_name, ... ) {
-    if ( !node || !image_path_name ) {
-        PRINT_ERROR( "Null pointer on `node` %s:%d \n", __FILE__, __LINE__ );
-        return;
-    }
+    GraphDumpOptions_t options = {};
 
-    char dot_path[MAX_LEN_PATH] = {};
-    char svg_path[MAX_LEN_PATH + 5] = {};
+    va_list args;
+    va_start( args, image_path_name );
+    NodeGraphicDumpV( node, &options, image_path_name, args );
+    va_end( args );
+}
+
+void NodeGraphicDumpOptions( const Node_t *node, const GraphDumpOptions_t *options, const char *image_path_name,
+                             ... ) {
+    my_assert( options, "Null pointer on `options`" );
 
     va_list args;
     va_start( args, image_path_name );
-    vsnprintf( dot_path, MAX_LEN_PATH, image_path_name, args );
+    NodeGraphicDumpV( node, options, image_path_name, args );
     va_end( args );
+}
 
-    snprintf( svg_path, MAX_LEN_PATH + 5, "%s.svg", dot_path );
+static void DotPoolCtor() {
+    dot_pool = ThreadPoolCtor( DOT_THREADS );
+}
 
-    FILE *dot_stream = fopen( dot_path, "w" );
-    assert( dot_stream && "File opening error" );
+static void RunDot( void *arg ) {
+    char *cmd = (char *)arg;
 
-    fprintf( dot_stream, "digraph {\n\tsplines=line;\n" );
-    NodeDumpRecursively( node, dot_stream );
-    fprintf( dot_stream, "}\n" );
+    int sys_result = system( cmd );
+    (void)sys_result;
 
-    fclose( dot_stream );
+    free( cmd );
+}
 
-    char cmd[MAX_LEN_PATH * 3] = {};
-    snprintf( cmd, sizeof( cmd ), "dot -Tsvg %s -o %s", dot_path, svg_path );
-    system( cmd );
+void GraphicDumpWait() {
+    pthread_once( &dot_pool_once, DotPoolCtor );
+    ThreadPoolWait( dot_pool );
 }
 
-static void NodeDumpRecursively( const Node_t *node, FILE *dot_stream ) {
-    if ( node == NULL ) {
+static void NodeGraphicDumpV( const Node_t *node, const GraphDumpOptions_t *options, const char *image_path_name,
+                              va_list args ) {
+    if ( !node || !image_path_name ) {
+        PRINT_ERROR( "Null pointer on `node` %s:%d \n", __FILE__, __LINE__ );
         return;
     }
 
-    NodeInitDot( node, dot_stream );
-    NodeBondInitDot( node, dot_stream );
+    char *dot_path = (char *)calloc( MAX_LEN_PATH, sizeof( char ) );
+    assert( dot_path && "Memory allocation error" );
+    vsnprintf( dot_path, MAX_LEN_PATH, image_path_name, args );
+
+    FILE *dot_file = fopen( dot_path, "w" );
+    assert( dot_file && "File opening error" );
+
+    OutputBuffer_t dot_stream = {};
+    OutputBufferCtor( &dot_stream, dot_file );
+
+    GraphDump_t dump = {};
+    dump.options = options;
+    dump.dot_stream = &dot_stream;
+
+    BufferPutString( &dot_stream, "digraph {\n\tsplines=line;\n" );
+    GraphDumpNodes( &dump, node );
+    BufferPutString( &dot_stream, "}\n" );
+
+    OutputBufferDtor( &dot_stream );
+    fclose( dot_file );
+
+    // `dot` is slow on big graphs, the caller does not wait for the picture.
+    size_t cmd_length = 2 * strlen( dot_path ) + sizeof( "dot -Tsvg '' -o '.svg'" );
+    char *cmd = (char *)calloc( cmd_length, sizeof( char ) );
+    assert( cmd && "Memory allocation error" );
+    snprintf( cmd, cmd_length, "dot -Tsvg '%s' -o '%s.svg'", dot_path, dot_path );
+    free( dot_path );
+
+    pthread_once( &dot_pool_once, DotPoolCtor );
+    ThreadPoolSubmit( dot_pool, RunDot, cmd );
+}
+
+static const Node_t *GraphNode( const GraphDump_t *dump, const Node_t *node ) {
+    if ( !dump->options->representative )
+        return node;
+
+    return dump->options->representative( node, dump->options->context );
+}
+
+static bool GraphDrawn( const GraphDump_t *dump, const Node_t *node, size_t *slot ) {
+    size_t mask = dump->table_size - 1;
+    *slot = ( (uintptr_t)node >> 4 ) & mask;
+
+    while ( dump->drawn[*slot] && dump->drawn[*slot] != node )
+        *slot = ( *slot + 1 ) & mask;
+
+    return dump->drawn[*slot] != NULL;
+}
+
+static void GraphEnqueue( GraphDump_t *dump, const Node_t *node, size_t slot ) {
+    dump->drawn[slot] = node;
+    dump->queue[dump->n_queued++] = node;
+}
+
+static void GraphDumpNodes( GraphDump_t *dump, const Node_t *root ) {
+    size_t n_nodes = NodeCount( root );
+    dump->max_nodes = dump->options->max_nodes && dump->options->max_nodes < n_nodes ? dump->options->max_nodes
+                                                                                     : n_nodes;
+
+    dump->table_size = 16;
+    while ( dump->table_size < dump->max_nodes * 2 )
+        dump->table_size *= 2;
+
+    dump->queue = (const Node_t **)calloc( dump->max_nodes, sizeof( Node_t * ) );
+    dump->drawn = (const Node_t **)calloc( dump->table_size, sizeof( Node_t * ) );
+    assert( dump->queue && dump->drawn && "Memory allocation error" );
+
+    size_t slot = 0;
+    root = GraphNode( dump, root );
+    GraphDrawn( dump, root, &slot );
+    GraphEnqueue( dump, root, slot );
+
+    for ( size_t idx = 0; idx < dump->n_queued; idx++ ) {
+        const Node_t *node = dump->queue[idx];
+
+        NodeInitDot( node, dump->dot_stream );
+        if ( node->left )
+            GraphChildDot( dump, node, node->left, "left" );
+        if ( node->right )
+            GraphChildDot( dump, node, node->right, "right" );
+    }
+
+    free( dump->queue );
+    free( dump->drawn );
 }
 
-static void NodeInitDot( const Node_t *node, FILE *dot_stream ) {
+static void GraphChildDot( GraphDump_t *dump, const Node_t *node, const Node_t *child, const char *port ) {
+    OutputBuffer_t *dot_stream = dump->dot_stream;
+    const Node_t *target = GraphNode( dump, child );
+
+    char target_name[64] = {};
+    size_t slot = 0;
+    if ( GraphDrawn( dump, target, &slot ) || dump->n_queued < dump->max_nodes ) {
+        if ( !dump->drawn[slot] )
+            GraphEnqueue( dump, target, slot );
+
+        snprintf( target_name, sizeof( target_name ), "node_%lX", (uintptr_t)target );
+    } else {
+        snprintf( target_name, sizeof( target_name ), "summary_%lu", dump->n_summaries++ );
+        DOT_PRINT( "\t%s [shape=box, style=\"filled,dashed\", fillcolor=\"#D5D8DC\", "
+                   "label=\"%lu nodes\"]; \n",
+                   target_name, NodeCount( child ) );
+    }
+
+#ifdef _SIMPLIFIED_DUMP
+    (void)port;
+    DOT_PRINT( "\tnode_%lX -> %s;\n", (uintptr_t)node, target_name );
+#else
+    DOT_PRINT( "\tnode_%lX:%s:s->%s\n", (uintptr_t)node, port, target_name );
+#endif
+}
+
+static void NodeInitDot( const Node_t *node, OutputBuffer_t *dot_stream ) {
 #ifdef _SIMPLIFIED_DUMP
     DOT_PRINT( "\tnode_%lX [style=filled, ", (uintptr_t)node );
     switch ( node->value.type ) {
@@ -183,7 +570,7 @@ static void NodeInitDot( const Node_t *node, FILE *dot_stream ) {
             DOT_PRINT( "fillcolor=\"#5DADE2\", label=\"%lg\"]; \n", node->value.data.number );
             break;
         case NODE_VARIABLE:
-            DOT_PRINT( "fillcolor=\"#82E0AA\", label=\"`%c`\"]; \n", node->value.data.variable );
+            DOT_PRINT( "fillcolor=\"#82E0AA\", label=\"`%s`\"]; \n", SymbolName( node->value.data.variable ) );
             break;
         case NODE_OPERATION:
             DOT_PRINT( "fillcolor=\"#F5B041\", label=\"%s\"]; \n",
@@ -224,7 +611,7 @@ static void NodeInitDot( const Node_t *node, FILE *dot_stream ) {
         case NODE_VARIABLE:
             DOT_PRINT( "\t\t\t<TD PORT=\"type\">type=VARIABLE</TD> \n" );
             DOT_PRINT( "\t\t</TR> \n\t\t<TR> \n" );
-            DOT_PRINT( "\t\t\t<TD PORT=\"value\">value=`%c`</TD> \n", node->value.data.variable );
+            DOT_PRINT( "\t\t\t<TD PORT=\"value\">value=`%s`</TD> \n", SymbolName( node->value.data.variable ) );
             break;
         case NODE_OPERATION: {
             DOT_PRINT( "\t\t\t<TD PORT=\"type\">type=OPERATION</TD> \n" );
@@ -268,48 +655,25 @@ static void NodeInitDot( const Node_t *node, FILE *dot_stream ) {
 #endif
 }
 
-static void NodeBondInitDot( const Node_t *node, FILE *dot_stream ) {
-#ifdef _SIMPLIFIED_DUMP
-    if ( node->left ) {
-        DOT_PRINT( "\tnode_%lX -> node_%lX;\n", (uintptr_t)node, (uintptr_t)node->left );
-        NodeDumpRecursively( node->left, dot_stream );
-    }
-    if ( node->right ) {
-        DOT_PRINT( "\tnode_%lX -> node_%lX;\n", (uintptr_t)node, (uintptr_t)node->right );
-        NodeDumpRecursively( node->right, dot_stream );
-    }
-#else
-    if ( node->left ) {
-        DOT_PRINT( "\tnode_%lX:left:s->node_%lX\n", (uintptr_t)node, (uintptr_t)node->left );
-        NodeDumpRecursively( node->left, dot_stream );
-    }
-
-    if ( node->right ) {
-        DOT_PRINT( "\tnode_%lX:right:s->node_%lX\n", (uintptr_t)node, (uintptr_t)node->right );
-        NodeDumpRecursively( node->right, dot_stream );
-    }
-#endif
-}
-
 #undef DOT_PRINT
 
-static void TreeSaveNode( const Node_t *node, FILE *stream, bool *error ) {
+static void TreeSaveNode( const Node_t *node, OutputBuffer_t *output, bool *error ) {
     if ( !node ) {
-        fprintf( stream, "nil" );
+        BufferPutString( output, "nil" );
         return;
     }
 
-    fprintf( stream, "( " );
+    BufferPutString( output, "( " );
 
     switch ( node->value.type ) {
         case NODE_NUMBER:
-            fprintf( stream, "%lg ", node->value.data.number );
+            BufferPutDouble( output, node->value.data.number );
             break;
         case NODE_VARIABLE:
-            fprintf( stream, "%c ", node->value.data.variable );
+            BufferPutString( output, SymbolName( node->value.data.variable ) );
             break;
         case NODE_OPERATION:
-            fprintf( stream, "%s ", operations_txt[node->value.data.operation] );
+            BufferPutString( output, operations_txt[node->value.data.operation] );
             break;
 
         case NODE_UNKNOWN:
@@ -317,18 +681,42 @@ static void TreeSaveNode( const Node_t *node, FILE *stream, bool *error ) {
             *error = true;
             return;
     }
+    BufferPutChar( output, ' ' );
 
-    TreeSaveNode( node->left, stream, error );
+    TreeSaveNode( node->left, output, error );
     if ( *error )
         return;
 
-    fprintf( stream, " " );
+    BufferPutChar( output, ' ' );
 
-    TreeSaveNode( node->right, stream, error );
+    TreeSaveNode( node->right, output, error );
     if ( *error )
         return;
 
-    fprintf( stream, " )" );
+    BufferPutString( output, " )" );
+}
+
+// Numbers are written in the shortest form that reads back to the same double.
+bool TreeWriteText( const Tree_t *tree, OutputBuffer_t *output ) {
+    my_assert( tree, "Null pointer on tree" );
+    my_assert( output, "Null pointer on output" );
+
+    bool error = false;
+    TreeSaveNode( tree->root, output, &error );
+
+    return !error;
+}
+
+bool TreePrint( const Tree_t *tree, FILE *stream ) {
+    my_assert( tree, "Null pointer on tree" );
+    my_assert( stream, "Null pointer on stream" );
+
+    OutputBuffer_t output = {};
+    OutputBufferCtor( &output, stream );
+
+    bool written = TreeWriteText( tree, &output );
+
+    return OutputBufferDtor( &output ) && written;
 }
 
 void TreeSaveToFile( const Tree_t *tree, const char *filename ) {
@@ -338,8 +726,7 @@ void TreeSaveToFile( const Tree_t *tree, const char *filename ) {
     FILE *file_with_base = fopen( filename, "w" );
     my_assert( file_with_base, "Failed to open file for writing tree" );
 
-    bool error = false;
-    TreeSaveNode( tree->root, file_with_base, &error );
+    bool error = !TreePrint( tree, file_with_base );
     if ( error )
         PRINT_ERROR( "Error writing a tree to a file!!!\n" );
 
@@ -355,24 +742,31 @@ static void CleanSpace( char **position ) {
         ( *position )++;
 }
 
-#define OP_IS_IT( str, name, ... )                                                                           \
-    if ( strncmp( *current_position, str, strlen( str ) ) == 0 ) {                                           \
-        read_bytes = strlen( str );                                                                          \
-        PRINT( "Parse operation: %s \n", str );                                                              \
-        return name;                                                                                         \
-    }
-
 static OperationType IsItOperation( char **current_position ) {
     CleanSpace( current_position );
 
-    int read_bytes = 0;
+    size_t read_bytes = 0;
+    size_t name_length = SymbolNameLength( *current_position );
+    OperationType op = OperationMatch( *current_position, &read_bytes );
+    if ( name_length && read_bytes != name_length )
+        op = OP_NOPE;
 
-    INIT_OPERATIONS( OP_IS_IT )
+    if ( op != OP_NOPE ) {
+        PRINT( "Parse operation: %.*s \n", (int)read_bytes, *current_position );
+        *current_position += read_bytes;
+    }
 
-    return OP_NOPE;
+    return op;
 }
 
-#undef OP_IS_IT
+// The same test as the lexer: ReadDouble also takes "inf" and "nan", which would
+// split variables such as `info` or `nano` into a number and the rest.
+static bool IsNumberStart( const char *position ) {
+    if ( position[0] == '-' || position[0] == '+' )
+        position++;
+
+    return isdigit( (unsigned char)position[0] ) || ( position[0] == '.' && isdigit( (unsigned char)position[1] ) );
+}
 
 static TreeData_t NodeParseValue( char **current_position ) {
     my_assert( current_position, "Null pointer on `current position`" );
@@ -380,8 +774,10 @@ static TreeData_t NodeParseValue( char **current_position ) {
     TreeData_t value = {};
     CleanSpace( current_position );
 
-    int read_bytes = 0;
-    if ( sscanf( *current_position, " %lf%n", &( value.data.number ), &read_bytes ) >= 1 ) {
+    size_t read_bytes = 0;
+    if ( IsNumberStart( *current_position ) )
+        read_bytes = ReadDouble( *current_position, &( value.data.number ) );
+    if ( read_bytes ) {
         PRINT( "Parse number: %lg \n", value.data.number );
         value.type = NODE_NUMBER;
         ( *current_position ) += read_bytes;
@@ -397,11 +793,12 @@ static TreeData_t NodeParseValue( char **current_position ) {
     }
     PRINT( "It's not an operation \n" );
 
-    if ( isalpha( **current_position ) ) {
-        PRINT( "Parse variable: %c \n", **current_position )
+    size_t name_length = SymbolNameLength( *current_position );
+    if ( name_length ) {
+        PRINT( "Parse variable: %.*s \n", (int)name_length, *current_position )
         value.type = NODE_VARIABLE;
-        value.data.variable = **current_position;
-        ( *current_position )++;
+        value.data.variable = SymbolIntern( *current_position, name_length );
+        ( *current_position ) += name_length;
         return value;
     }
     PRINT( "It's not a variable \n" );
@@ -0,0 +1,487 @@
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Tree.h"
+#include "TreeBinary.h"
+#include "UtilsRW.h"
+
+#define OPERATIONS_COUNT( ... ) +1
+
+static const int operations_count = 0 INIT_OPERATIONS( OPERATIONS_COUNT );
+
+#undef OPERATIONS_COUNT
+
+const uint8_t TAG_TYPE_MASK = 0x03;
+const uint8_t TAG_HAS_LEFT  = 0x04;
+const uint8_t TAG_HAS_RIGHT = 0x08;
+
+const uint8_t TAG_NUMBER    = 0;
+const uint8_t TAG_VARIABLE  = 1;
+const uint8_t TAG_OPERATION = 2;
+const uint8_t TAG_UNKNOWN   = 3;
+
+struct ByteBuffer_t {
+    uint8_t *data;
+    size_t   size;
+    size_t   capacity;
+};
+
+struct SaveFrame_t {
+    const Node_t *node;
+    int           state;
+    uint64_t      left_index;
+};
+
+static void ByteBufferReserve( ByteBuffer_t *buffer, size_t extra ) {
+    if ( buffer->size + extra <= buffer->capacity )
+        return;
+
+    size_t new_capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+    while ( new_capacity < buffer->size + extra )
+        new_capacity *= 2;
+
+    buffer->data = (uint8_t *)realloc( buffer->data, new_capacity );
+    assert( buffer->data && "Memory allocation error" );
+    buffer->capacity = new_capacity;
+}
+
+static void ByteBufferPut( ByteBuffer_t *buffer, const void *data, size_t size ) {
+    ByteBufferReserve( buffer, size );
+    memcpy( buffer->data + buffer->size, data, size );
+    buffer->size += size;
+}
+
+static void ByteBufferPutVarint( ByteBuffer_t *buffer, uint64_t value ) {
+    ByteBufferReserve( buffer, 10 );
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if ( value )
+            byte |= 0x80;
+        buffer->data[buffer->size++] = byte;
+    } while ( value );
+}
+
+static void EmitRecord( ByteBuffer_t *payload, const Node_t *node, uint64_t index, uint64_t left_index ) {
+    uint8_t tag = 0;
+    switch ( node->value.type ) {
+        case NODE_NUMBER:
+            tag = TAG_NUMBER;
+            break;
+        case NODE_VARIABLE:
+            tag = TAG_VARIABLE;
+            break;
+        case NODE_OPERATION:
+            tag = TAG_OPERATION;
+            break;
+        case NODE_UNKNOWN:
+        default:
+            tag = TAG_UNKNOWN;
+            break;
+    }
+
+    if ( node->left )
+        tag |= TAG_HAS_LEFT;
+    if ( node->right )
+        tag |= TAG_HAS_RIGHT;
+
+    ByteBufferPut( payload, &tag, 1 );
+
+    switch ( tag & TAG_TYPE_MASK ) {
+        case TAG_NUMBER:
+            ByteBufferPut( payload, &node->value.data.number, sizeof( double ) );
+            break;
+        case TAG_VARIABLE: {
+            const char *name = SymbolName( node->value.data.variable );
+            size_t length = strlen( name );
+            ByteBufferPutVarint( payload, length );
+            ByteBufferPut( payload, name, length );
+            break;
+        }
+        case TAG_OPERATION: {
+            uint8_t operation = (uint8_t)node->value.data.operation;
+            ByteBufferPut( payload, &operation, 1 );
+            break;
+        }
+        default:
+            break;
+    }
+
+    if ( node->left && node->right )
+        ByteBufferPutVarint( payload, index - left_index );
+}
+
+// Iterative post-order walk: the parser accepts very deep trees.
+static uint64_t EncodeTree( const Tree_t *tree, ByteBuffer_t *payload ) {
+    if ( !tree->root )
+        return 0;
+
+    size_t capacity = 64;
+    size_t top = 0;
+    SaveFrame_t *stack = (SaveFrame_t *)calloc( capacity, sizeof( SaveFrame_t ) );
+    assert( stack && "Memory allocation error" );
+
+    uint64_t n_nodes = 0;
+    stack[top++] = { tree->root, 0, 0 };
+
+    while ( top ) {
+        SaveFrame_t *frame = &stack[top - 1];
+        const Node_t *child = NULL;
+
+        if ( frame->state == 0 ) {
+            frame->state = 1;
+            child = frame->node->left;
+        } else if ( frame->state == 1 ) {
+            frame->state = 2;
+            frame->left_index = n_nodes - 1;
+            child = frame->node->right;
+        } else {
+            EmitRecord( payload, frame->node, n_nodes, frame->left_index );
+            n_nodes++;
+            top--;
+            continue;
+        }
+
+        if ( child ) {
+            if ( top >= capacity ) {
+                capacity *= 2;
+                stack = (SaveFrame_t *)realloc( stack, capacity * sizeof( SaveFrame_t ) );
+                assert( stack && "Memory allocation error" );
+            }
+            stack[top++] = { child, 0, 0 };
+        }
+    }
+
+    free( stack );
+
+    return n_nodes;
+}
+
+static uint64_t HashBytes( const uint8_t *data, size_t size ) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for ( size_t idx = 0; idx < size; idx++ ) {
+        hash ^= data[idx];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+uint64_t TreeStructuralHash( const Tree_t *tree ) {
+    my_assert( tree, "Null pointer on `tree`" );
+
+    ByteBuffer_t payload = {};
+    EncodeTree( tree, &payload );
+
+    uint64_t hash = HashBytes( payload.data, payload.size );
+    free( payload.data );
+
+    return hash;
+}
+
+static uint16_t HostByteOrderFlag() {
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return TREE_BINARY_BIG_ENDIAN;
+#else
+    return 0;
+#endif
+}
+
+bool TreeWriteBinary( const Tree_t *tree, FILE *stream ) {
+    my_assert( tree, "Null pointer on `tree`" );
+    my_assert( stream, "Null pointer on `stream`" );
+
+    ByteBuffer_t payload = {};
+
+    TreeBinaryHeader_t header = {};
+    header.magic = TREE_BINARY_MAGIC;
+    header.version = TREE_BINARY_VERSION;
+    header.flags = HostByteOrderFlag();
+    header.n_nodes = EncodeTree( tree, &payload );
+    header.hash = HashBytes( payload.data, payload.size );
+    header.payload_size = payload.size;
+
+    bool ok = fwrite( &header, sizeof( header ), 1, stream ) == 1;
+    if ( ok && payload.size )
+        ok = fwrite( payload.data, 1, payload.size, stream ) == payload.size;
+
+    free( payload.data );
+
+    return ok;
+}
+
+bool TreeSaveBinary( const Tree_t *tree, const char *filename ) {
+    my_assert( tree, "Null pointer on `tree`" );
+    my_assert( filename, "Null pointer on `filename`" );
+
+    FILE *file = fopen( filename, "wb" );
+    if ( !file ) {
+        PRINT_ERROR( "Error opening file `%s` \n", filename );
+        return false;
+    }
+
+    bool ok = TreeWriteBinary( tree, file );
+    if ( fclose( file ) != 0 )
+        ok = false;
+
+    if ( !ok )
+        PRINT_ERROR( "Error writing a tree to `%s` \n", filename );
+
+    return ok;
+}
+
+// ------------------------------------ Loading -----------------------------------
+
+struct RecordReader_t {
+    const uint8_t *position;
+    const uint8_t *end;
+};
+
+struct Record_t {
+    uint8_t    tag;
+    TreeData_t value;
+    uint64_t   left_offset;
+};
+
+static bool ReadVarint( RecordReader_t *reader, uint64_t *value ) {
+    *value = 0;
+    for ( int shift = 0; shift < 64; shift += 7 ) {
+        if ( reader->position >= reader->end )
+            return false;
+
+        uint8_t byte = *reader->position++;
+        *value |= (uint64_t)( byte & 0x7F ) << shift;
+        if ( !( byte & 0x80 ) )
+            return true;
+    }
+
+    return false;
+}
+
+// Without `intern` a variable name is only checked and its record gets no
+// symbol, so rejected files leave the symbol table alone.
+static bool ReadRecord( RecordReader_t *reader, Record_t *record, bool intern ) {
+    if ( reader->position >= reader->end )
+        return false;
+
+    record->tag = *reader->position++;
+    record->left_offset = 1;
+    if ( record->tag & ~( TAG_TYPE_MASK | TAG_HAS_LEFT | TAG_HAS_RIGHT ) )
+        return false;
+
+    switch ( record->tag & TAG_TYPE_MASK ) {
+        case TAG_NUMBER:
+            if ( reader->end - reader->position < (ptrdiff_t)sizeof( double ) )
+                return false;
+            record->value.type = NODE_NUMBER;
+            memcpy( &record->value.data.number, reader->position, sizeof( double ) );
+            reader->position += sizeof( double );
+            break;
+
+        case TAG_VARIABLE: {
+            uint64_t length = 0;
+            if ( !ReadVarint( reader, &length ) || length == 0 ||
+                 length > (uint64_t)( reader->end - reader->position ) )
+                return false;
+
+            const char *name = (const char *)reader->position;
+            if ( !isalpha( (unsigned char)name[0] ) )
+                return false;
+            for ( size_t idx = 1; idx < length; idx++ ) {
+                if ( !isalnum( (unsigned char)name[idx] ) && name[idx] != '_' )
+                    return false;
+            }
+
+            record->value.type = NODE_VARIABLE;
+            if ( intern )
+                record->value.data.variable = SymbolIntern( name, length );
+            reader->position += length;
+            break;
+        }
+
+        case TAG_OPERATION:
+            if ( reader->position >= reader->end || *reader->position >= operations_count )
+                return false;
+            record->value.type = NODE_OPERATION;
+            record->value.data.operation = *reader->position++;
+            break;
+
+        default:
+            return false;
+    }
+
+    if ( ( record->tag & TAG_HAS_LEFT ) && ( record->tag & TAG_HAS_RIGHT ) )
+        return ReadVarint( reader, &record->left_offset );
+
+    return true;
+}
+
+// Walks the records with a stack of subtree roots (indices, or nodes when
+// `nodes` is not NULL) and checks that every child offset matches it.
+static bool DecodeRecords( const CompactTree_t *compact, Node_t **nodes ) {
+    if ( compact->n_nodes == 0 )
+        return compact->payload_size == 0;
+
+    uint64_t *indices = (uint64_t *)calloc( compact->n_nodes, sizeof( uint64_t ) );
+    assert( indices && "Memory allocation error" );
+
+    RecordReader_t reader = { compact->payload, compact->payload + compact->payload_size };
+    size_t top = 0;
+    bool ok = true;
+
+    for ( uint64_t index = 0; ok && index < compact->n_nodes; index++ ) {
+        Record_t record = {};
+        if ( !ReadRecord( &reader, &record, nodes != NULL ) ) {
+            ok = false;
+            break;
+        }
+
+        bool has_left = record.tag & TAG_HAS_LEFT;
+        bool has_right = record.tag & TAG_HAS_RIGHT;
+        size_t n_children = (size_t)has_left + (size_t)has_right;
+
+        if ( top < n_children || ( has_left && has_right && indices[top - 2] + record.left_offset != index ) ) {
+            ok = false;
+            break;
+        }
+
+        Node_t *node = nodes ? NodeCreate( record.value, NULL ) : NULL;
+        if ( nodes ) {
+            if ( has_right ) {
+                node->right = nodes[--top];
+                node->right->parent = node;
+            }
+            if ( has_left ) {
+                node->left = nodes[--top];
+                node->left->parent = node;
+            }
+            nodes[top] = node;
+        } else {
+            top -= n_children;
+        }
+
+        indices[top++] = index;
+    }
+
+    free( indices );
+
+    ok = ok && top == 1 && reader.position == reader.end;
+    if ( !ok && nodes ) {
+        for ( size_t idx = 0; idx < top; idx++ )
+            NodeDelete( nodes[idx], NULL, NULL );
+    }
+
+    return ok;
+}
+
+bool CompactTreeFromMemory( CompactTree_t *compact, const void *data, size_t size ) {
+    my_assert( compact, "Null pointer on `compact`" );
+    my_assert( data || size == 0, "Null pointer on `data`" );
+
+    TreeBinaryHeader_t header = {};
+    if ( size < sizeof( header ) )
+        return false;
+
+    memcpy( &header, data, sizeof( header ) );
+    if ( header.magic != TREE_BINARY_MAGIC || header.version != TREE_BINARY_VERSION ||
+         ( header.flags & ~TREE_BINARY_FLAGS ) || header.flags != HostByteOrderFlag() ||
+         header.payload_size != size - sizeof( header ) ||
+         header.n_nodes > header.payload_size ) {
+        return false;
+    }
+
+    compact->payload = (const uint8_t *)data + sizeof( header );
+    compact->payload_size = header.payload_size;
+    compact->n_nodes = header.n_nodes;
+    compact->hash = header.hash;
+
+    if ( HashBytes( compact->payload, compact->payload_size ) != header.hash || !DecodeRecords( compact, NULL ) ) {
+        compact->payload = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool CompactTreeLoad( CompactTree_t *compact, const char *filename ) {
+    my_assert( compact, "Null pointer on `compact`" );
+    my_assert( filename, "Null pointer on `filename`" );
+
+    size_t size = 0;
+    char *mapping = MapFile( filename, &size );
+    if ( !mapping )
+        return false;
+
+    if ( !CompactTreeFromMemory( compact, mapping, size ) ) {
+        PRINT_ERROR( "File `%s` is not a valid binary tree \n", filename );
+        UnmapFile( mapping, size );
+        return false;
+    }
+
+    compact->mapping = mapping;
+    compact->mapping_size = size;
+
+    return true;
+}
+
+void CompactTreeUnload( CompactTree_t *compact ) {
+    my_assert( compact, "Null pointer on `compact`" );
+
+    UnmapFile( compact->mapping, compact->mapping_size );
+    memset( compact, 0, sizeof( *compact ) );
+}
+
+bool CompactTreeWalk( const CompactTree_t *compact, CompactTreeVisitor_t visit, void *arg ) {
+    my_assert( compact, "Null pointer on `compact`" );
+    my_assert( visit, "Null pointer on `visit`" );
+
+    RecordReader_t reader = { compact->payload, compact->payload + compact->payload_size };
+
+    for ( size_t index = 0; index < compact->n_nodes; index++ ) {
+        Record_t record = {};
+        if ( !ReadRecord( &reader, &record, true ) )
+            return false;
+
+        visit( &record.value, record.tag & TAG_HAS_LEFT, record.tag & TAG_HAS_RIGHT, arg );
+    }
+
+    return true;
+}
+
+Tree_t *CompactTreeExpand( const CompactTree_t *compact ) {
+    my_assert( compact, "Null pointer on `compact`" );
+
+    Tree_t *tree = TreeCtor();
+    if ( compact->n_nodes == 0 )
+        return tree;
+
+    Node_t **nodes = (Node_t **)calloc( compact->n_nodes, sizeof( Node_t * ) );
+    assert( nodes && "Memory allocation error" );
+
+    if ( DecodeRecords( compact, nodes ) ) {
+        tree->root = nodes[0];
+    } else {
+        TreeDtor( &tree, NULL );
+    }
+
+    free( nodes );
+
+    return tree;
+}
+
+Tree_t *TreeLoadBinary( const char *filename ) {
+    my_assert( filename, "Null pointer on `filename`" );
+
+    CompactTree_t compact = {};
+    if ( !CompactTreeLoad( &compact, filename ) )
+        return NULL;
+
+    Tree_t *tree = CompactTreeExpand( &compact );
+    CompactTreeUnload( &compact );
+
+    return tree;
+}
@@ -1,6 +1,11 @@
 #include <errno.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include "InputReader.h"
 #include "UtilsRW.h"
 #include "DebugUtils.h"
 
@@ -20,35 +25,84 @@ off_t DetermineTheFileSize( const char* filename ) {
     my_assert( filename, "Null pointer on `filename`" );
 
     struct stat file_stat;
-    int check_stat = stat( filename, &file_stat );
-    assert( check_stat == 0 );
+    if ( stat( filename, &file_stat ) != 0 ) {
+        PRINT_ERROR( "The file `%s` is unavailable! \n", filename );
+        return -1;
+    }
 
     return file_stat.st_size;
 }
 
 
+// Works for regular files, pipes and stdin ("-"); NULL when the input can not be read.
 char* ReadToBuffer( const char* filename ) {
     my_assert( filename, "Null pointer on `filename`" );
 
-    off_t file_size = DetermineTheFileSize( filename );
-    if ( file_size == 0 ) {
+    InputReader_t* reader = InputReaderOpen( filename );
+    if ( !reader )
+        return NULL;
+
+    size_t size = 0;
+    char* buffer = InputReaderReadAll( reader, &size );
+    InputReaderClose( &reader );
+
+    if ( !buffer ) {
+        PRINT_ERROR( "Fail read to buffer from `%s` \n", filename );
+    } else if ( size == 0 ) {
         PRINT_ERROR( "The file `%s` is empty!", filename );
     }
 
-    char* buffer = ( char* ) calloc ( ( size_t ) ( file_size + 1 ), sizeof( *buffer ) );
-    assert( buffer && "Memory allocation error for `buffer`" );
+    return buffer;
+}
 
-    FILE* file = fopen( filename, "r" );
-    assert( file && "Error opening file" );
 
-    size_t result_of_read = fread( buffer, sizeof( char ), ( size_t ) file_size, file );
-    assert( result_of_read != 0 && "Fail read to buffer \n" );
+char* MapFile( const char* filename, size_t* size ) {
+    my_assert( filename, "Null pointer on `filename`" );
+    my_assert( size, "Null pointer on `size`" );
 
-    int result_of_fclose = fclose( file );
-    if ( result_of_fclose ) {
-        PRINT_ERROR( "Error closing file `%s` \n", filename );
+    *size = 0;
+
+    int fd = open( filename, O_RDONLY );
+    if ( fd == -1 ) {
+        PRINT_ERROR( "Error opening file `%s` \n", filename );
+        return NULL;
     }
 
-    return buffer;
+    struct stat file_stat;
+    if ( fstat( fd, &file_stat ) == -1 || file_stat.st_size == 0 ) {
+        PRINT_ERROR( "The file `%s` is empty or unavailable! \n", filename );
+        close( fd );
+        return NULL;
+    }
+
+    void* data = mmap( NULL, ( size_t ) file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if ( data == MAP_FAILED ) {
+        PRINT_ERROR( "Failed to map file `%s` \n", filename );
+        return NULL;
+    }
+
+    *size = ( size_t ) file_stat.st_size;
+    return ( char* ) data;
+}
+
+void UnmapFile( char* data, size_t size ) {
+    if ( data )
+        munmap( data, size );
 }
 
+char* MakePath( const char* directory, const char* name ) {
+    my_assert( name, "Null pointer on `name`" );
+
+    if ( !directory )
+        return strdup( name );
+
+    size_t length = strlen( directory ) + strlen( name ) + 2;
+    char* path = ( char* ) calloc( length, sizeof( *path ) );
+    assert( path && "Memory allocation error for `path`" );
+
+    snprintf( path, length, "%s/%s", directory, name );
+
+    return path;
+}
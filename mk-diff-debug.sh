@@ -1,3 +1,3 @@
 #!/bin/sh
 
-g++ ./src/main.cpp ./lib/Tree.cpp ./lib/UtilsRW.cpp ./src/Differentiator.cpp ./src/Expression.cpp ./src/ExpressionParser.cpp ./src/LatexGenerator.cpp ./src/GraphGeneration.cpp ./src/TreeOptimizer.cpp -o diff-debug -I./include -std=c++17 -Wall -Wextra -Weffc++ -Waggressive-loop-optimizations -Wc++14-compat -Wmissing-declarations -Wcast-align -Wcast-qual -Wchar-subscripts -Wconditionally-supported -Wconversion -Wctor-dtor-privacy -Wempty-body -Wfloat-equal -Wformat-nonliteral -Wformat-security -Wformat-signedness -Wformat=2 -Winline -Wlogical-op -Wnon-virtual-dtor -Wopenmp-simd -Woverloaded-virtual -Wpacked -Wpointer-arith -Winit-self -Wredundant-decls -Wshadow -Wsign-conversion -Wsign-promo -Wstrict-null-sentinel -Wstrict-overflow=2 -Wsuggest-attribute=noreturn -Wsuggest-final-methods -Wsuggest-final-types -Wsuggest-override -Wswitch-default -Wsync-nand -Wundef -Wunreachable-code -Wunused -Wuseless-cast -Wvariadic-macros -Wno-literal-suffix -Wno-missing-field-initializers -Wno-narrowing -Wno-old-style-cast -Wno-varargs -Wstack-protector -fcheck-new -fsized-deallocation -fstack-protector -fstrict-overflow -flto-odr-type-merging -fno-omit-frame-pointer -Wlarger-than=8192 -Wstack-usage=8192 -pie -fPIE -Werror=vla -ggdb3 -O0 -D_DEBUG -fsanitize=address,alignment,bool,bounds,enum,float-cast-overflow,float-divide-by-zero,integer-divide-by-zero,leak,nonnull-attribute,null,object-size,return,returns-nonnull-attribute,shift,signed-integer-overflow,undefined,unreachable,vla-bound,vptr
\ No newline at end of file
+g++ ./src/main.cpp ./lib/Tree.cpp ./lib/Lexer.cpp ./lib/UtilsRW.cpp ./lib/ThreadPool.cpp ./lib/OutputBuffer.cpp ./lib/InputReader.cpp ./lib/TreeBinary.cpp ./lib/Metrics.cpp ./lib/SymbolTable.cpp ./src/Differentiator.cpp ./src/Expression.cpp ./src/ExpressionParser.cpp ./src/LatexGenerator.cpp ./src/SharedSubtrees.cpp ./src/DerivativeMatrix.cpp ./src/GraphGeneration.cpp ./src/TreeOptimizer.cpp ./src/Batch.cpp ./src/ExpressionCompiler.cpp ./src/DerivativeBudget.cpp ./src/TaylorMode.cpp ./src/TaylorPolynomial.cpp ./src/TaylorTable.cpp ./src/TaylorOrder.cpp ./src/Chebyshev.cpp ./src/Roots.cpp ./src/Interval.cpp ./src/Extrema.cpp ./src/ExpressionGenerator.cpp ./src/Server.cpp ./src/Report.cpp ./src/DerivativeCache.cpp -pthread -o diff-debug -I./include -std=c++17 -Wall -Wextra -Weffc++ -Waggressive-loop-optimizations -Wc++14-compat -Wmissing-declarations -Wcast-align -Wcast-qual -Wchar-subscripts -Wconditionally-supported -Wconversion -Wctor-dtor-privacy -Wempty-body -Wfloat-equal -Wformat-nonliteral -Wformat-security -Wformat-signedness -Wformat=2 -Winline -Wlogical-op -Wnon-virtual-dtor -Wopenmp-simd -Woverloaded-virtual -Wpacked -Wpointer-arith -Winit-self -Wredundant-decls -Wshadow -Wsign-conversion -Wsign-promo -Wstrict-null-sentinel -Wstrict-overflow=2 -Wsuggest-attribute=noreturn -Wsuggest-final-methods -Wsuggest-final-types -Wsuggest-override -Wswitch-default -Wsync-nand -Wundef -Wunreachable-code -Wunused -Wuseless-cast -Wvariadic-macros -Wno-literal-suffix -Wno-missing-field-initializers -Wno-narrowing -Wno-old-style-cast -Wno-varargs -Wstack-protector -fcheck-new -fsized-deallocation -fstack-protector -fstrict-overflow -flto-odr-type-merging -fno-omit-frame-pointer -Wlarger-than=8192 -Wstack-usage=8192 -pie -fPIE -Werror=vla -ggdb3 -O0 -D_DEBUG -fsanitize=address,alignment,bool,bounds,enum,float-cast-overflow,float-divide-by-zero,integer-divide-by-zero,leak,nonnull-attribute,null,object-size,return,returns-nonnull-attribute,shift,signed-integer-overflow,undefined,unreachable,vla-bound,vptr
\ No newline at end of file
@@ -0,0 +1,343 @@
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "Metrics.h"
+#include "InputReader.h"
+#include "ThreadPool.h"
+#include "UtilsRW.h"
+
+// Batch driver: every non-empty line of the input is `<expression> [$ <point>]`,
+// variables other than the independent one evaluate to zero.
+// The input is read in blocks of whole lines (`-` is stdin), the lines of a block
+// are sharded across the thread pool, every worker owns a Differentiator_t,
+// and shard outputs are written in input order before the next block.
+// With a derivative cache the whole chain goes through DifferentiateExpression,
+// so the simplify stage is counted as part of differentiate.
+// A derivative over the node budget is written as `-`, its value then comes
+// from Taylor-mode evaluation of the expression.
+
+enum BatchStage {
+    STAGE_PARSE         = 0,
+    STAGE_DIFFERENTIATE = 1,
+    STAGE_SIMPLIFY      = 2,
+    STAGE_EVALUATE      = 3,
+    STAGE_OUTPUT        = 4,
+
+    BATCH_STAGES_COUNT
+};
+
+static const char *stage_names[BATCH_STAGES_COUNT] = { "parse", "differentiate", "simplify", "evaluate",
+                                                       "output" };
+
+const size_t SHARDS_PER_WORKER = 8;
+const size_t BATCH_BLOCK_SIZE  = 16 << 20;
+
+struct BatchStats_t {
+    double time[BATCH_STAGES_COUNT];
+
+    size_t processed;
+    size_t failed;
+    size_t bytes;
+};
+
+struct BatchRecord_t {
+    const char *text;
+    size_t      length;
+};
+
+struct BatchContext_t {
+    Differentiator_t **workers;
+    size_t             n_workers;
+
+    SymbolId var;
+    int      order;
+};
+
+struct BatchShard_t {
+    BatchContext_t *context;
+
+    BatchRecord_t *records;
+    size_t         n_records;
+
+    char  *output;
+    size_t output_size;
+
+    BatchStats_t stats;
+};
+
+static double GetTimeSeconds() {
+    struct timespec ts = {};
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool BatchSplitRecords( const char *data, size_t size, BatchRecord_t **records, size_t *n_records ) {
+    size_t capacity = 1024;
+    *records = (BatchRecord_t *)calloc( capacity, sizeof( BatchRecord_t ) );
+    if ( !*records )
+        return false;
+
+    *n_records = 0;
+    size_t line_start = 0;
+
+    for ( size_t idx = 0; idx <= size; idx++ ) {
+        if ( idx < size && data[idx] != '\n' )
+            continue;
+
+        const char *line = data + line_start;
+        size_t length = idx - line_start;
+        line_start = idx + 1;
+
+        size_t first = 0;
+        while ( first < length && isspace( (unsigned char)line[first] ) )
+            first++;
+        if ( first == length )
+            continue;
+
+        if ( *n_records >= capacity ) {
+            capacity *= 2;
+            BatchRecord_t *new_records = (BatchRecord_t *)realloc( *records, capacity * sizeof( BatchRecord_t ) );
+            if ( !new_records )
+                return false;
+            *records = new_records;
+        }
+
+        ( *records )[( *n_records )++] = { line, length };
+    }
+
+    return true;
+}
+
+static void BatchProcessRecord( Differentiator_t *diff, const BatchRecord_t *record, BatchContext_t *context,
+                                OutputBuffer_t *output, BatchStats_t *stats ) {
+    stats->bytes += record->length;
+
+    double start = GetTimeSeconds();
+    bool parsed = DifferentiatorSetExpression( diff, record->text, record->length );
+    double finish = GetTimeSeconds();
+    stats->time[STAGE_PARSE] += finish - start;
+
+    if ( !parsed ) {
+        BufferPutString( output, "error\tparse\n" );
+        stats->failed++;
+        return;
+    }
+
+    double point = 0.0;
+    ReadDouble( diff->expr_info.current_position, &point );
+
+    bool differentiated = true;
+    if ( diff->cache ) {
+        start = GetTimeSeconds();
+        differentiated = DifferentiateExpression( diff, context->var, context->order ) != NULL;
+        stats->time[STAGE_DIFFERENTIATE] += GetTimeSeconds() - start;
+    } else {
+        DifferentiateExpression( diff, context->var, 0 );
+    }
+
+    for ( int order = 1; differentiated && !diff->cache && order <= context->order; order++ ) {
+        start = GetTimeSeconds();
+        differentiated = DifferentiateStep( diff, context->var, order );
+        finish = GetTimeSeconds();
+        stats->time[STAGE_DIFFERENTIATE] += finish - start;
+
+        if ( !differentiated )
+            break;
+
+        start = GetTimeSeconds();
+        OptimizeTree( diff->diff_tree, diff, context->var );
+        stats->time[STAGE_SIMPLIFY] += GetTimeSeconds() - start;
+        METRIC_TREE_SIZE( order, NodeCount( diff->diff_tree->root ) )
+    }
+
+    start = GetTimeSeconds();
+    VarTableAddFromTree( &diff->var_table, diff->expr_tree );
+    VarTableSet( &diff->var_table, context->var, point );
+    double value = EvaluateTree( diff->expr_tree, diff );
+    double deriv_value = NAN;
+    bool evaluated = true;
+    if ( differentiated )
+        deriv_value = EvaluateTree( diff->diff_tree, diff );
+    else
+        evaluated = TaylorModeDerivative( diff->expr_tree->root, &diff->var_table, context->var, point,
+                                          context->order, &deriv_value );
+    stats->time[STAGE_EVALUATE] += GetTimeSeconds() - start;
+
+    if ( !evaluated ) {
+        BufferPutString( output, "error\tdifferentiate\n" );
+        stats->failed++;
+        return;
+    }
+
+    start = GetTimeSeconds();
+    BufferPutDouble( output, value );
+    BufferPutChar( output, '\t' );
+    BufferPutDouble( output, deriv_value );
+    BufferPutChar( output, '\t' );
+    if ( differentiated )
+        TreeWriteText( diff->diff_tree, output );
+    else
+        BufferPutChar( output, '-' );
+    BufferPutChar( output, '\n' );
+    stats->time[STAGE_OUTPUT] += GetTimeSeconds() - start;
+
+    stats->processed++;
+}
+
+static void BatchProcessShard( void *arg ) {
+    BatchShard_t *shard = (BatchShard_t *)arg;
+    BatchContext_t *context = shard->context;
+
+    size_t worker = ThreadPoolWorkerIndex();
+    if ( worker == THREAD_POOL_NOT_WORKER || worker >= context->n_workers )
+        worker = context->n_workers;
+
+    Differentiator_t *diff = context->workers[worker];
+
+    // A buffer without a stream keeps everything, its memory goes to the shard
+    OutputBuffer_t output = {};
+    OutputBufferCtor( &output, NULL );
+
+    for ( size_t idx = 0; idx < shard->n_records; idx++ )
+        BatchProcessRecord( diff, &shard->records[idx], context, &output, &shard->stats );
+
+    shard->output = output.data;
+    shard->output_size = output.size;
+}
+
+static void BatchReportStats( const BatchStats_t *total, size_t n_workers, double wall_time ) {
+    double megabytes = (double)total->bytes / ( 1024.0 * 1024.0 );
+
+    fprintf( stderr, "Batch: %lu expressions (%lu failed), %.3f MB, %lu workers, %.3f s wall\n",
+             total->processed + total->failed, total->failed, megabytes, n_workers, wall_time );
+    fprintf( stderr, "%-14s %12s %14s %10s\n", "stage", "time, s", "expr/s", "MB/s" );
+
+    for ( int stage = 0; stage < BATCH_STAGES_COUNT; stage++ ) {
+        double time = total->time[stage];
+        double rate = time > 0 ? (double)total->processed / time : 0;
+        double mb_rate = time > 0 ? megabytes / time : 0;
+
+        fprintf( stderr, "%-14s %12.6f %14.1f %10.2f\n", stage_names[stage], time, rate, mb_rate );
+    }
+
+    if ( wall_time > 0 )
+        fprintf( stderr, "%-14s %12.6f %14.1f %10.2f\n", "total (wall)", wall_time,
+                 (double)total->processed / wall_time, megabytes / wall_time );
+}
+
+// Shards one block of lines over the pool and appends the results in input order.
+static bool BatchRunBlock( ThreadPool_t *pool, BatchContext_t *context, const char *block, size_t length,
+                           FILE *output, BatchStats_t *total ) {
+    BatchRecord_t *records = NULL;
+    size_t n_records = 0;
+    if ( !BatchSplitRecords( block, length, &records, &n_records ) ) {
+        PRINT_ERROR( "Memory allocation error while splitting the input \n" );
+        free( records );
+        return false;
+    }
+
+    size_t shard_size = n_records / ( ( context->n_workers + 1 ) * SHARDS_PER_WORKER ) + 1;
+    size_t n_shards = ( n_records + shard_size - 1 ) / shard_size;
+
+    BatchShard_t *shards = (BatchShard_t *)calloc( n_shards + 1, sizeof( BatchShard_t ) );
+    assert( shards && "Memory allocation error" );
+
+    for ( size_t idx = 0; idx < n_shards; idx++ ) {
+        shards[idx].context = context;
+        shards[idx].records = records + idx * shard_size;
+        shards[idx].n_records = ( idx + 1 < n_shards ) ? shard_size : n_records - idx * shard_size;
+
+        ThreadPoolSubmit( pool, BatchProcessShard, &shards[idx] );
+    }
+
+    ThreadPoolWait( pool );
+
+    for ( size_t idx = 0; idx < n_shards; idx++ ) {
+        if ( shards[idx].output_size )
+            fwrite( shards[idx].output, 1, shards[idx].output_size, output );
+        free( shards[idx].output );
+
+        for ( int stage = 0; stage < BATCH_STAGES_COUNT; stage++ )
+            total->time[stage] += shards[idx].stats.time[stage];
+        total->processed += shards[idx].stats.processed;
+        total->failed += shards[idx].stats.failed;
+        total->bytes += shards[idx].stats.bytes;
+    }
+
+    free( shards );
+    free( records );
+
+    return true;
+}
+
+bool DifferentiatorBatch( const char *input_filename, const char *output_filename, SymbolId var, int order,
+                          size_t n_threads, DerivativeCache_t *cache, const DerivativeBudget_t *budget ) {
+    my_assert( input_filename, "Null pointer on `input_filename`" );
+    my_assert( output_filename, "Null pointer on `output_filename`" );
+
+    double wall_start = GetTimeSeconds();
+
+    InputReader_t *input = InputReaderOpen( input_filename );
+    if ( !input )
+        return false;
+
+    bool to_stdout = ( strcmp( output_filename, "-" ) == 0 );
+    FILE *output = to_stdout ? stdout : fopen( output_filename, "w" );
+    if ( !output ) {
+        PRINT_ERROR( "Error opening file `%s` \n", output_filename );
+        InputReaderClose( &input );
+        return false;
+    }
+
+    ThreadPool_t *pool = ThreadPoolCtor( n_threads );
+    size_t n_workers = ThreadPoolSize( pool );
+
+    BatchContext_t context = {};
+    context.var = var;
+    context.order = order;
+    context.n_workers = n_workers;
+    context.workers = (Differentiator_t **)calloc( n_workers + 1, sizeof( Differentiator_t * ) );
+    assert( context.workers && "Memory allocation error" );
+
+    for ( size_t idx = 0; idx <= n_workers; idx++ ) {
+        context.workers[idx] = DifferentiatorWorkerCtor();
+        context.workers[idx]->cache = cache;
+        context.workers[idx]->pool = pool;
+        if ( budget )
+            context.workers[idx]->budget = *budget;
+    }
+
+    BatchStats_t total = {};
+    bool ok = true;
+
+    const char *block = NULL;
+    size_t length = 0;
+    while ( ok && InputReaderNextBlock( input, BATCH_BLOCK_SIZE, &block, &length ) )
+        ok = BatchRunBlock( pool, &context, block, length, output, &total );
+
+    ok = ok && !input->error;
+
+    ThreadPoolDtor( &pool );
+
+    if ( !to_stdout )
+        fclose( output );
+
+    for ( size_t idx = 0; idx <= n_workers; idx++ )
+        DifferentiatorDtor( &context.workers[idx] );
+    NodeArenaRelease();
+
+    free( context.workers );
+    InputReaderClose( &input );
+
+    BatchReportStats( &total, n_workers, GetTimeSeconds() - wall_start );
+
+    return ok;
+}
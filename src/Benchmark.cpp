@@ -0,0 +1,467 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "Metrics.h"
+#include "Tree.h"
+#include "TreeBinary.h"
+
+// Benchmark of every stage on a random expression. A sample runs a stage
+// until BENCH_MIN_SAMPLE_NS have been measured and gives nanoseconds per
+// processed item (a node, or a node times a point for the batch evaluation);
+// the first sample warms the caches up and is thrown away. The median and a
+// 95% confidence interval of the mean are reported.
+
+const int      BENCH_MAX_ORDER     = 8;
+const uint64_t BENCH_MIN_SAMPLE_NS = 20000000;
+const size_t   BENCH_MAX_SAMPLES   = 1000;
+
+struct BenchOptions_t {
+    size_t   n_nodes;
+    size_t   max_depth;
+    size_t   n_variables;
+    uint64_t seed;
+    int      max_order;
+    size_t   repeat;
+    size_t   n_points;
+
+    const char *csv_path;
+};
+
+struct BenchData_t {
+    Differentiator_t *diff;
+    Differentiator_t *eval_diff;
+
+    Tree_t  *expr;
+    size_t   expr_size;
+    SymbolId var;
+
+    OutputBuffer_t text;
+    char          *tree_text;
+
+    Tree_t *derivatives[BENCH_MAX_ORDER + 1];
+    Tree_t *raw[BENCH_MAX_ORDER + 1];
+    size_t  derivative_sizes[BENCH_MAX_ORDER + 1];
+    size_t  raw_sizes[BENCH_MAX_ORDER + 1];
+    int     order;
+
+    CompiledExpr_t *compiled;
+    size_t          slot;
+    double         *values;
+    double         *points;
+    double         *results;
+    size_t          n_points;
+
+    OutputBuffer_t output;
+    FILE          *null_file;
+};
+
+struct BenchStats_t {
+    double median;
+    double mean;
+    double ci95;
+    double min;
+};
+
+// One iteration of a stage: returns the measured nanoseconds, `items` is the work done.
+typedef uint64_t ( *BenchRun_t )( BenchData_t *data, size_t *items );
+
+static uint64_t BenchParse( BenchData_t *data, size_t *items ) {
+    uint64_t start = MetricsNow();
+    bool parsed = DifferentiatorSetExpression( data->diff, data->text.data, data->text.size );
+    uint64_t elapsed = MetricsNow() - start;
+
+    *items = parsed ? data->expr_size : 0;
+
+    return elapsed;
+}
+
+static uint64_t BenchDifferentiate( BenchData_t *data, size_t *items ) {
+    TreeDtor( &data->diff->diff_tree, NULL );
+    data->diff->diff_tree = TreeCtor();
+    data->diff->diff_tree->root = NodeCopy( data->derivatives[data->order - 1]->root );
+
+    uint64_t start = MetricsNow();
+    bool differentiated = DifferentiateStep( data->diff, data->var, data->order );
+    uint64_t elapsed = MetricsNow() - start;
+
+    *items = differentiated ? data->derivative_sizes[data->order - 1] : 0;
+
+    return elapsed;
+}
+
+static uint64_t BenchSimplify( BenchData_t *data, size_t *items ) {
+    TreeDtor( &data->diff->diff_tree, NULL );
+    data->diff->diff_tree = TreeCtor();
+    data->diff->diff_tree->root = NodeCopy( data->raw[data->order]->root );
+
+    uint64_t start = MetricsNow();
+    OptimizeTree( data->diff->diff_tree, data->diff, data->var );
+    uint64_t elapsed = MetricsNow() - start;
+
+    *items = data->raw_sizes[data->order];
+
+    return elapsed;
+}
+
+static uint64_t BenchEvaluate( BenchData_t *data, size_t *items ) {
+    uint64_t start = MetricsNow();
+    volatile double value = EvaluateTree( data->expr, data->eval_diff );
+    uint64_t elapsed = MetricsNow() - start;
+    (void)value;
+
+    *items = data->expr_size;
+
+    return elapsed;
+}
+
+static uint64_t BenchEvaluateBatch( BenchData_t *data, size_t *items ) {
+    uint64_t start = MetricsNow();
+    CompiledExprEvaluateBatch( data->compiled, data->slot, data->points, data->n_points, data->values,
+                               data->results );
+    uint64_t elapsed = MetricsNow() - start;
+
+    *items = data->expr_size * data->n_points;
+
+    return elapsed;
+}
+
+static uint64_t BenchWriteText( BenchData_t *data, size_t *items ) {
+    data->output.size = 0;
+
+    uint64_t start = MetricsNow();
+    TreeWriteText( data->expr, &data->output );
+    uint64_t elapsed = MetricsNow() - start;
+
+    *items = data->expr_size;
+
+    return elapsed;
+}
+
+static uint64_t BenchReadText( BenchData_t *data, size_t *items ) {
+    char *buffer = strdup( data->tree_text );
+    assert( buffer && "Memory allocation error" );
+
+    uint64_t start = MetricsNow();
+    Tree_t *tree = TreeReadFromBuffer( buffer );
+    uint64_t elapsed = MetricsNow() - start;
+
+    *items = tree ? data->expr_size : 0;
+
+    TreeDtor( &tree, NULL );
+    free( buffer );
+
+    return elapsed;
+}
+
+static uint64_t BenchWriteBinary( BenchData_t *data, size_t *items ) {
+    uint64_t start = MetricsNow();
+    bool written = TreeWriteBinary( data->expr, data->null_file );
+    uint64_t elapsed = MetricsNow() - start;
+
+    *items = written ? data->expr_size : 0;
+
+    return elapsed;
+}
+
+static uint64_t BenchLatex( BenchData_t *data, size_t *items ) {
+    data->output.size = 0;
+
+    uint64_t start = MetricsNow();
+    NodeToLatex( data->expr->root, &data->output );
+    uint64_t elapsed = MetricsNow() - start;
+
+    *items = data->expr_size;
+
+    return elapsed;
+}
+
+static double BenchSample( BenchRun_t run, BenchData_t *data ) {
+    uint64_t elapsed = 0;
+    size_t total_items = 0;
+
+    while ( elapsed < BENCH_MIN_SAMPLE_NS ) {
+        size_t items = 0;
+        elapsed += run( data, &items );
+
+        if ( items == 0 )
+            return NAN;
+        total_items += items;
+    }
+
+    return (double)elapsed / (double)total_items;
+}
+
+static int CompareDoubles( const void *a, const void *b ) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return ( x > y ) - ( x < y );
+}
+
+// Two-sided 95% quantiles of Student's t for 1..30 degrees of freedom.
+static double StudentQuantile( size_t degrees ) {
+    static const double quantiles[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                        2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                        2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+    const size_t n_quantiles = sizeof( quantiles ) / sizeof( quantiles[0] );
+
+    if ( degrees == 0 )
+        return INFINITY;
+
+    return degrees <= n_quantiles ? quantiles[degrees - 1] : 1.96;
+}
+
+static BenchStats_t BenchStats( double *samples, size_t n_samples ) {
+    qsort( samples, n_samples, sizeof( double ), CompareDoubles );
+
+    BenchStats_t stats = {};
+    stats.min = samples[0];
+    stats.median = ( n_samples % 2 ) ? samples[n_samples / 2]
+                                     : ( samples[n_samples / 2 - 1] + samples[n_samples / 2] ) / 2;
+
+    for ( size_t idx = 0; idx < n_samples; idx++ )
+        stats.mean += samples[idx];
+    stats.mean /= (double)n_samples;
+
+    double variance = 0;
+    for ( size_t idx = 0; idx < n_samples; idx++ )
+        variance += ( samples[idx] - stats.mean ) * ( samples[idx] - stats.mean );
+    variance = n_samples > 1 ? variance / (double)( n_samples - 1 ) : 0;
+
+    stats.ci95 = StudentQuantile( n_samples - 1 ) * sqrt( variance / (double)n_samples );
+
+    return stats;
+}
+
+static void BenchCase( const char *name, BenchRun_t run, BenchData_t *data, const BenchOptions_t *options,
+                       FILE *csv_file ) {
+    double *samples = (double *)calloc( options->repeat, sizeof( double ) );
+    assert( samples && "Memory allocation error" );
+
+    BenchSample( run, data );
+
+    for ( size_t idx = 0; idx < options->repeat; idx++ ) {
+        samples[idx] = BenchSample( run, data );
+        if ( isnan( samples[idx] ) ) {
+            printf( "%-18s failed\n", name );
+            free( samples );
+            return;
+        }
+    }
+
+    BenchStats_t stats = BenchStats( samples, options->repeat );
+    free( samples );
+
+    printf( "%-18s %10.2f ns/item  ±%6.2f%%  min %10.2f  %10.2f Mitems/s\n", name, stats.median,
+            100 * stats.ci95 / stats.mean, stats.min, 1e3 / stats.median );
+
+    if ( csv_file )
+        fprintf( csv_file, "%s,%lu,%lu,%.4f,%.4f,%.4f,%.4f,%.4f\n", name, options->n_nodes, options->repeat,
+                 stats.median, stats.mean, stats.ci95, stats.min, 1e3 / stats.median );
+}
+
+static bool BenchDataCtor( BenchData_t *data, const BenchOptions_t *options ) {
+    ExpressionGenerator_t generator = {};
+    ExpressionGeneratorCtor( &generator, options->n_nodes, options->max_depth, options->n_variables,
+                             options->seed );
+
+    data->expr = GenerateExpression( &generator );
+    data->var = SymbolIntern( "x" );
+    data->expr_size = NodeCount( data->expr->root );
+
+    OutputBufferCtor( &data->text, NULL );
+    ExpressionWriteText( data->expr, &data->text );
+
+    OutputBufferCtor( &data->output, NULL );
+    TreeWriteText( data->expr, &data->output );
+    BufferPutChar( &data->output, '\0' );
+    data->tree_text = strdup( data->output.data );
+    assert( data->tree_text && "Memory allocation error" );
+
+    data->null_file = fopen( "/dev/null", "w" );
+    if ( !data->null_file ) {
+        PRINT_ERROR( "Error opening /dev/null \n" );
+        return false;
+    }
+
+    // Variables other than `x` stay unbound here, so the simplifier does not fold them.
+    data->diff = DifferentiatorWorkerCtor();
+    data->derivatives[0] = TreeCtor();
+    data->derivatives[0]->root = NodeCopy( data->expr->root );
+    data->derivative_sizes[0] = data->expr_size;
+
+    for ( int order = 1; order <= options->max_order; order++ ) {
+        data->diff->diff_tree = TreeCtor();
+        data->diff->diff_tree->root = NodeCopy( data->derivatives[order - 1]->root );
+        if ( !DifferentiateStep( data->diff, data->var, order ) ) {
+            PRINT_ERROR( "Differentiation of the generated expression failed \n" );
+            return false;
+        }
+
+        data->raw[order] = data->diff->diff_tree;
+        data->raw_sizes[order] = NodeCount( data->raw[order]->root );
+
+        data->derivatives[order] = TreeCtor();
+        data->derivatives[order]->root = NodeCopy( data->raw[order]->root );
+        OptimizeTree( data->derivatives[order], data->diff, data->var );
+        data->derivative_sizes[order] = NodeCount( data->derivatives[order]->root );
+
+        data->diff->diff_tree = NULL;
+    }
+
+    data->eval_diff = DifferentiatorWorkerCtor();
+    VarTableAddFromTree( &data->eval_diff->var_table, data->expr );
+    for ( size_t idx = 0; idx < data->eval_diff->var_table.number_of_variables; idx++ )
+        data->eval_diff->var_table.data[idx].value = 0.5;
+
+    data->compiled = CompileTree( data->expr );
+    data->slot = CompiledExprSlot( data->compiled, data->var );
+    data->values = (double *)calloc( data->compiled->n_variables + 1, sizeof( double ) );
+    assert( data->values && "Memory allocation error" );
+    CompiledExprBind( data->compiled, &data->eval_diff->var_table, data->values );
+
+    data->n_points = options->n_points;
+    data->points = (double *)calloc( data->n_points, sizeof( double ) );
+    data->results = (double *)calloc( data->n_points, sizeof( double ) );
+    assert( data->points && data->results && "Memory allocation error" );
+    for ( size_t idx = 0; idx < data->n_points; idx++ )
+        data->points[idx] = -1 + 2 * (double)idx / (double)data->n_points;
+
+    return true;
+}
+
+static void BenchDataDtor( BenchData_t *data ) {
+    for ( int order = 0; order <= BENCH_MAX_ORDER; order++ ) {
+        TreeDtor( &data->derivatives[order], NULL );
+        TreeDtor( &data->raw[order], NULL );
+    }
+
+    if ( data->diff )
+        DifferentiatorDtor( &data->diff );
+    if ( data->eval_diff )
+        DifferentiatorDtor( &data->eval_diff );
+    if ( data->compiled )
+        CompiledExprDtor( &data->compiled );
+    if ( data->null_file )
+        fclose( data->null_file );
+
+    TreeDtor( &data->expr, NULL );
+    OutputBufferDtor( &data->text );
+    OutputBufferDtor( &data->output );
+
+    free( data->tree_text );
+    free( data->values );
+    free( data->points );
+    free( data->results );
+}
+
+static bool BenchRun( const BenchOptions_t *options ) {
+    BenchData_t data = {};
+    if ( !BenchDataCtor( &data, options ) ) {
+        BenchDataDtor( &data );
+        return false;
+    }
+
+    FILE *csv_file = NULL;
+    if ( options->csv_path ) {
+        csv_file = fopen( options->csv_path, "w" );
+        if ( !csv_file ) {
+            PRINT_ERROR( "Error opening file `%s` \n", options->csv_path );
+            BenchDataDtor( &data );
+            return false;
+        }
+        fprintf( csv_file, "case,nodes,samples,median_ns,mean_ns,ci95_ns,min_ns,mitems_per_s\n" );
+    }
+
+    printf( "Expression: %lu nodes, %lu bytes of text, seed %lu, %lu samples\n", data.expr_size, data.text.size,
+            options->seed, options->repeat );
+    for ( int order = 1; order <= options->max_order; order++ )
+        printf( "Derivative %d: %lu nodes before simplification, %lu after\n", order, data.raw_sizes[order],
+                data.derivative_sizes[order] );
+
+    BenchCase( "parse", BenchParse, &data, options, csv_file );
+
+    for ( int order = 1; order <= options->max_order; order++ ) {
+        data.order = order;
+
+        char name[32] = {};
+        snprintf( name, sizeof( name ), "differentiate/%d", order );
+        BenchCase( name, BenchDifferentiate, &data, options, csv_file );
+
+        snprintf( name, sizeof( name ), "simplify/%d", order );
+        BenchCase( name, BenchSimplify, &data, options, csv_file );
+    }
+
+    BenchCase( "evaluate", BenchEvaluate, &data, options, csv_file );
+    BenchCase( "evaluate-batch", BenchEvaluateBatch, &data, options, csv_file );
+    BenchCase( "write-text", BenchWriteText, &data, options, csv_file );
+    BenchCase( "read-text", BenchReadText, &data, options, csv_file );
+    BenchCase( "write-binary", BenchWriteBinary, &data, options, csv_file );
+    BenchCase( "latex", BenchLatex, &data, options, csv_file );
+
+    if ( csv_file )
+        fclose( csv_file );
+
+    BenchDataDtor( &data );
+
+    return true;
+}
+
+static void PrintUsage( const char *program ) {
+    fprintf( stderr,
+             "Usage: %s [--nodes N] [--depth N] [--vars N] [--seed N] [--orders N] [--repeat N] [--points N]"
+             " [--csv FILE]\n",
+             program );
+}
+
+int main( int argc, char **argv ) {
+    BenchOptions_t options = {};
+    options.n_nodes = 100;
+    options.n_variables = 1;
+    options.seed = 1;
+    options.max_order = 3;
+    options.repeat = 15;
+    options.n_points = 4096;
+
+    for ( int idx = 1; idx < argc; idx += 2 ) {
+        if ( idx + 1 >= argc ) {
+            PrintUsage( argv[0] );
+            return 1;
+        }
+
+        const char *value = argv[idx + 1];
+        if ( strcmp( argv[idx], "--nodes" ) == 0 ) {
+            options.n_nodes = (size_t)atol( value );
+        } else if ( strcmp( argv[idx], "--depth" ) == 0 ) {
+            options.max_depth = (size_t)atol( value );
+        } else if ( strcmp( argv[idx], "--vars" ) == 0 ) {
+            options.n_variables = (size_t)atol( value );
+        } else if ( strcmp( argv[idx], "--seed" ) == 0 ) {
+            options.seed = (uint64_t)atoll( value );
+        } else if ( strcmp( argv[idx], "--orders" ) == 0 ) {
+            options.max_order = atoi( value );
+        } else if ( strcmp( argv[idx], "--repeat" ) == 0 ) {
+            options.repeat = (size_t)atol( value );
+        } else if ( strcmp( argv[idx], "--points" ) == 0 ) {
+            options.n_points = (size_t)atol( value );
+        } else if ( strcmp( argv[idx], "--csv" ) == 0 ) {
+            options.csv_path = value;
+        } else {
+            PrintUsage( argv[0] );
+            return 1;
+        }
+    }
+
+    if ( options.max_order < 0 || options.max_order > BENCH_MAX_ORDER || options.repeat == 0 ||
+         options.repeat > BENCH_MAX_SAMPLES || options.n_points == 0 ) {
+        PrintUsage( argv[0] );
+        return 1;
+    }
+
+    return BenchRun( &options ) ? 0 : 1;
+}
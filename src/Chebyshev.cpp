@@ -0,0 +1,602 @@
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "OutputBuffer.h"
+#include "SymbolTable.h"
+#include "ThreadPool.h"
+#include "Tree.h"
+#include "UtilsRW.h"
+
+// Chebyshev approximation of f or one of its derivatives. A piece interpolates
+// at the Chebyshev nodes (a DCT of the samples), optionally refined by Remez
+// exchange towards the minimax polynomial. The error is the largest deviation
+// on a dense grid of the piece; a piece over the tolerance is halved until the
+// number of pieces would exceed the limit. Samples go through the compiled
+// batch evaluator on the pool.
+// The same coefficients are evaluated by Clenshaw here and in the emitted C
+// code; the tree is the power form in (x - middle), built by the Taylor
+// polynomial code, and the C code lists it for every piece. The finished fit is
+// checked through ChebyshevEvaluate at points off the fitting grids. A piece
+// where f is not finite has no coefficients to emit, so the fit fails on it.
+
+const size_t GRID_PER_DEGREE = 32;
+const size_t CHECK_POINTS = 4096;
+const int REMEZ_ITERATIONS = 16;
+const double REMEZ_LEVELLED = 1e-6;
+
+struct ChebyshevFit_t {
+    CompiledExpr_t *expr;
+    double *values;
+    size_t slot;
+    ThreadPool_t *pool;
+
+    int degree;
+    double tolerance;
+    bool remez;
+    size_t max_depth;
+
+    // Scratch of one piece: the nodes and the grid with f at them.
+    double *nodes;
+    double *f_nodes;
+    double *grid;
+    double *f_grid;
+    size_t n_grid;
+    double *system;
+    double *solution;
+    size_t *reference;
+};
+
+static double Clenshaw( const double *c, int degree, double t ) {
+    double b1 = 0, b2 = 0;
+    for ( int k = degree; k >= 1; k-- ) {
+        double b0 = c[k] + 2 * t * b1 - b2;
+        b2 = b1;
+        b1 = b0;
+    }
+
+    return c[0] + t * b1 - b2;
+}
+
+static void SampleAt( ChebyshevFit_t *fit, const double *ts, size_t n, double a, double b, double *xs,
+                      double *fs ) {
+    double middle = ( a + b ) / 2, half = ( b - a ) / 2;
+    for ( size_t idx = 0; idx < n; idx++ )
+        xs[idx] = middle + half * ts[idx];
+
+    CompiledExprEvaluateBatch( fit->expr, fit->slot, xs, n, fit->values, fs, fit->pool );
+}
+
+// Largest |f - p| on the grid, infinite if f or p is not finite somewhere.
+static double GridError( const ChebyshevFit_t *fit, const double *c ) {
+    double error = 0;
+    for ( size_t idx = 0; idx < fit->n_grid; idx++ ) {
+        double deviation = fabs( fit->f_grid[idx] - Clenshaw( c, fit->degree, fit->grid[idx] ) );
+        if ( !( deviation <= error ) )
+            error = isfinite( deviation ) ? deviation : INFINITY;
+    }
+
+    return error;
+}
+
+static void Interpolate( const ChebyshevFit_t *fit, double *c ) {
+    size_t n = (size_t)fit->degree + 1;
+
+    for ( size_t k = 0; k < n; k++ ) {
+        double sum = 0;
+        for ( size_t j = 0; j < n; j++ )
+            sum += fit->f_nodes[j] * cos( M_PI * (double)k * ( (double)j + 0.5 ) / (double)n );
+        c[k] = 2 * sum / (double)n;
+    }
+    c[0] /= 2;
+}
+
+// Gaussian elimination with partial pivoting, `a` is n x n row-major.
+static bool SolveLinear( double *a, double *rhs, size_t n ) {
+    for ( size_t col = 0; col < n; col++ ) {
+        size_t pivot = col;
+        for ( size_t row = col + 1; row < n; row++ ) {
+            if ( fabs( a[row * n + col] ) > fabs( a[pivot * n + col] ) )
+                pivot = row;
+        }
+        if ( fpclassify( a[pivot * n + col] ) == FP_ZERO )
+            return false;
+
+        if ( pivot != col ) {
+            for ( size_t k = 0; k < n; k++ ) {
+                double tmp = a[col * n + k];
+                a[col * n + k] = a[pivot * n + k];
+                a[pivot * n + k] = tmp;
+            }
+            double tmp = rhs[col];
+            rhs[col] = rhs[pivot];
+            rhs[pivot] = tmp;
+        }
+
+        for ( size_t row = col + 1; row < n; row++ ) {
+            double factor = a[row * n + col] / a[col * n + col];
+            for ( size_t k = col; k < n; k++ )
+                a[row * n + k] -= factor * a[col * n + k];
+            rhs[row] -= factor * rhs[col];
+        }
+    }
+
+    for ( size_t row = n; row-- > 0; ) {
+        double sum = rhs[row];
+        for ( size_t k = row + 1; k < n; k++ )
+            sum -= a[row * n + k] * rhs[k];
+        rhs[row] = sum / a[row * n + row];
+    }
+
+    return true;
+}
+
+// p(t_i) + (-1)^i E = f(t_i) on the reference, for c_0..c_degree and E.
+static bool RemezSolve( ChebyshevFit_t *fit, double *c ) {
+    size_t n = (size_t)fit->degree + 2;
+
+    for ( size_t i = 0; i < n; i++ ) {
+        double t = fit->grid[fit->reference[i]];
+        double *row = fit->system + i * n;
+
+        row[0] = 1;
+        if ( n > 2 )
+            row[1] = t;
+        for ( size_t k = 2; k + 1 < n; k++ )
+            row[k] = 2 * t * row[k - 1] - row[k - 2];
+        row[n - 1] = ( i % 2 ) ? -1 : 1;
+
+        fit->solution[i] = fit->f_grid[fit->reference[i]];
+    }
+
+    if ( !SolveLinear( fit->system, fit->solution, n ) )
+        return false;
+
+    memcpy( c, fit->solution, ( n - 1 ) * sizeof( double ) );
+    return true;
+}
+
+// One extremum per run of the error sign, trimmed from the smaller end down to
+// degree + 2 alternating points.
+static bool RemezExchange( ChebyshevFit_t *fit, const double *c ) {
+    size_t n = (size_t)fit->degree + 2;
+    size_t *extrema = fit->reference;
+    size_t n_extrema = 0;
+    double last_sign = 0;
+
+    for ( size_t idx = 0; idx < fit->n_grid; idx++ ) {
+        double error = fit->f_grid[idx] - Clenshaw( c, fit->degree, fit->grid[idx] );
+        if ( fpclassify( error ) == FP_ZERO )
+            continue;
+
+        double sign = error > 0 ? 1 : -1;
+        if ( n_extrema == 0 || CompareDoubleToDouble( sign, last_sign ) != 0 ) {
+            extrema[n_extrema++] = idx;
+            last_sign = sign;
+        } else {
+            size_t *current = &extrema[n_extrema - 1];
+            if ( fabs( error ) > fabs( fit->f_grid[*current] - Clenshaw( c, fit->degree, fit->grid[*current] ) ) )
+                *current = idx;
+        }
+    }
+
+    if ( n_extrema < n )
+        return false;
+
+    size_t first = 0;
+    for ( ; n_extrema > n; n_extrema-- ) {
+        size_t last = first + n_extrema - 1;
+        double error_first = fit->f_grid[extrema[first]] - Clenshaw( c, fit->degree, fit->grid[extrema[first]] );
+        double error_last = fit->f_grid[extrema[last]] - Clenshaw( c, fit->degree, fit->grid[extrema[last]] );
+
+        if ( fabs( error_first ) < fabs( error_last ) )
+            first++;
+    }
+
+    if ( first != 0 )
+        memmove( extrema, extrema + first, n * sizeof( size_t ) );
+
+    return true;
+}
+
+static double Remez( ChebyshevFit_t *fit, double *c, double error ) {
+    size_t n = (size_t)fit->degree + 2;
+    double *candidate = fit->solution + n;
+
+    // Chebyshev extrema, which the grid contains.
+    for ( size_t i = 0; i < n; i++ )
+        fit->reference[i] = i * ( fit->n_grid - 1 ) / ( n - 1 );
+
+    for ( int iteration = 0; iteration < REMEZ_ITERATIONS; iteration++ ) {
+        if ( !RemezSolve( fit, candidate ) )
+            break;
+
+        double levelled = fabs( fit->solution[n - 1] );
+        double candidate_error = GridError( fit, candidate );
+        if ( candidate_error < error ) {
+            memcpy( c, candidate, ( n - 1 ) * sizeof( double ) );
+            error = candidate_error;
+        }
+
+        if ( candidate_error - levelled <= REMEZ_LEVELLED * candidate_error || !RemezExchange( fit, candidate ) )
+            break;
+    }
+
+    return error;
+}
+
+static void PushPiece( ChebyshevApprox_t *approx, double a, double b, const double *c, double error ) {
+    size_t n = (size_t)approx->degree + 1;
+
+    if ( approx->n_pieces + 1 >= approx->capacity ) {
+        approx->capacity = approx->capacity ? approx->capacity * 2 : 8;
+        approx->breaks = (double *)realloc( approx->breaks, approx->capacity * sizeof( double ) );
+        approx->coefficients = (double *)realloc( approx->coefficients, approx->capacity * n * sizeof( double ) );
+        approx->errors = (double *)realloc( approx->errors, approx->capacity * sizeof( double ) );
+        assert( approx->breaks && approx->coefficients && approx->errors && "Memory allocation error" );
+    }
+
+    approx->breaks[approx->n_pieces] = a;
+    approx->breaks[approx->n_pieces + 1] = b;
+    memcpy( approx->coefficients + approx->n_pieces * n, c, n * sizeof( double ) );
+    approx->errors[approx->n_pieces] = error;
+    approx->n_pieces++;
+
+    if ( !( error <= approx->max_error ) )
+        approx->max_error = error;
+}
+
+static void FitInterval( ChebyshevFit_t *fit, ChebyshevApprox_t *approx, double a, double b, size_t depth ) {
+    size_t n = (size_t)fit->degree + 1;
+
+    double *c = (double *)calloc( n, sizeof( double ) );
+    double *xs = (double *)calloc( fit->n_grid, sizeof( double ) );
+    assert( c && xs && "Memory allocation error" );
+
+    SampleAt( fit, fit->nodes, n, a, b, xs, fit->f_nodes );
+    SampleAt( fit, fit->grid, fit->n_grid, a, b, xs, fit->f_grid );
+    free( xs );
+
+    Interpolate( fit, c );
+    double error = GridError( fit, c );
+
+    if ( fit->remez && isfinite( error ) )
+        error = Remez( fit, c, error );
+
+    if ( fit->tolerance > 0 && !( error <= fit->tolerance ) && depth < fit->max_depth ) {
+        free( c );
+
+        double middle = ( a + b ) / 2;
+        FitInterval( fit, approx, a, middle, depth + 1 );
+        FitInterval( fit, approx, middle, b, depth + 1 );
+        return;
+    }
+
+    PRINT( "Chebyshev piece [%g; %g]: error %g", a, b, error );
+    PushPiece( approx, a, b, c, error );
+    free( c );
+}
+
+// Largest |f - p| halfway between CHECK_POINTS evenly spaced points, none of
+// which is on a fitting grid.
+static double CheckError( ChebyshevFit_t *fit, const ChebyshevApprox_t *approx, double from, double to ) {
+    double *xs = (double *)calloc( 2 * CHECK_POINTS, sizeof( double ) );
+    assert( xs && "Memory allocation error" );
+    double *fs = xs + CHECK_POINTS;
+
+    double step = ( to - from ) / (double)CHECK_POINTS;
+    for ( size_t idx = 0; idx < CHECK_POINTS; idx++ )
+        xs[idx] = from + ( (double)idx + 0.5 ) * step;
+
+    CompiledExprEvaluateBatch( fit->expr, fit->slot, xs, CHECK_POINTS, fit->values, fs, fit->pool );
+
+    double error = 0;
+    for ( size_t idx = 0; idx < CHECK_POINTS; idx++ ) {
+        double deviation = fabs( fs[idx] - ChebyshevEvaluate( approx, xs[idx] ) );
+        if ( !( deviation <= error ) )
+            error = isfinite( deviation ) ? deviation : INFINITY;
+    }
+
+    free( xs );
+
+    return error;
+}
+
+bool ChebyshevFit( Differentiator_t *diff, SymbolId var, double from, double to, const ChebyshevOptions_t *options,
+                   ChebyshevApprox_t *approx ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( diff->expr_tree, "Null pointer on `diff->expr_tree`" );
+    my_assert( options, "Null pointer on `options`" );
+    my_assert( approx, "Null pointer on `approx`" );
+
+    int degree = options->degree > 0 ? options->degree : CHEBYSHEV_DEFAULT_DEGREE;
+    size_t max_pieces = options->max_pieces ? options->max_pieces : CHEBYSHEV_DEFAULT_MAX_PIECES;
+
+    if ( !isfinite( from ) || !isfinite( to ) || !( from < to ) || options->derivative < 0 )
+        return false;
+
+    CompiledExpr_t *expr = CompileDerivative( diff, var, options->derivative );
+    if ( !expr ) {
+        PRINT_ERROR( "The derivative of order %d is over the budget\n", options->derivative );
+        return false;
+    }
+
+    *approx = {};
+    approx->var = var;
+    approx->degree = degree;
+
+    ChebyshevFit_t fit = {};
+    fit.expr = expr;
+    fit.values = (double *)calloc( fit.expr->n_variables + 1, sizeof( double ) );
+    assert( fit.values && "Memory allocation error" );
+    CompiledExprBind( fit.expr, &diff->var_table, fit.values );
+    fit.slot = CompiledExprSlot( fit.expr, var );
+    fit.pool = diff->pool;
+
+    fit.degree = degree;
+    fit.tolerance = options->tolerance;
+    fit.remez = options->remez;
+    while ( ( (size_t)2 << fit.max_depth ) <= max_pieces )
+        fit.max_depth++;
+
+    size_t n = (size_t)degree + 1;
+    fit.n_grid = GRID_PER_DEGREE * n + 1;
+    fit.nodes = (double *)calloc( 2 * n + 2 * fit.n_grid, sizeof( double ) );
+    fit.system = (double *)calloc( ( n + 1 ) * ( n + 1 ), sizeof( double ) );
+    fit.solution = (double *)calloc( 2 * ( n + 1 ), sizeof( double ) );
+    fit.reference = (size_t *)calloc( fit.n_grid, sizeof( size_t ) );
+    assert( fit.nodes && fit.system && fit.solution && fit.reference && "Memory allocation error" );
+    fit.f_nodes = fit.nodes + n;
+    fit.grid = fit.nodes + 2 * n;
+    fit.f_grid = fit.grid + fit.n_grid;
+
+    for ( size_t j = 0; j < n; j++ )
+        fit.nodes[j] = cos( M_PI * ( (double)j + 0.5 ) / (double)n );
+    for ( size_t idx = 0; idx < fit.n_grid; idx++ )
+        fit.grid[idx] = -cos( M_PI * (double)idx / (double)( fit.n_grid - 1 ) );
+
+    FitInterval( &fit, approx, from, to, 0 );
+    approx->checked_error = CheckError( &fit, approx, from, to );
+
+    free( fit.nodes );
+    free( fit.system );
+    free( fit.solution );
+    free( fit.reference );
+    free( fit.values );
+    CompiledExprDtor( &fit.expr );
+
+    for ( size_t piece = 0; piece < approx->n_pieces; piece++ ) {
+        for ( size_t k = 0; k < n; k++ ) {
+            if ( isfinite( approx->coefficients[piece * n + k] ) )
+                continue;
+
+            PRINT_ERROR( "f is not finite on the piece [%g; %g] \n", approx->breaks[piece],
+                         approx->breaks[piece + 1] );
+            ChebyshevApproxDtor( approx );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void ChebyshevApproxDtor( ChebyshevApprox_t *approx ) {
+    my_assert( approx, "Null pointer on `approx`" );
+
+    free( approx->breaks );
+    free( approx->coefficients );
+    free( approx->errors );
+    *approx = {};
+}
+
+static size_t FindPiece( const ChebyshevApprox_t *approx, double x ) {
+    size_t lo = 0, hi = approx->n_pieces - 1;
+    while ( lo < hi ) {
+        size_t middle = ( lo + hi + 1 ) / 2;
+        if ( x < approx->breaks[middle] )
+            hi = middle - 1;
+        else
+            lo = middle;
+    }
+
+    return lo;
+}
+
+// Outside of the interval the nearest piece is extrapolated.
+double ChebyshevEvaluate( const ChebyshevApprox_t *approx, double x ) {
+    my_assert( approx, "Null pointer on `approx`" );
+
+    if ( approx->n_pieces == 0 )
+        return NAN;
+
+    size_t piece = FindPiece( approx, x );
+    double a = approx->breaks[piece], b = approx->breaks[piece + 1];
+
+    return Clenshaw( approx->coefficients + piece * ( (size_t)approx->degree + 1 ), approx->degree,
+                     ( 2 * x - a - b ) / ( b - a ) );
+}
+
+// sum c_k T_k(t) = sum d_k t^k = sum d_k / half^k (x - middle)^k
+Tree_t *ChebyshevPieceTree( const ChebyshevApprox_t *approx, size_t piece ) {
+    my_assert( approx, "Null pointer on `approx`" );
+    assert( piece < approx->n_pieces && "Chebyshev piece out of range" );
+
+    size_t n = (size_t)approx->degree + 1;
+    const double *c = approx->coefficients + piece * n;
+    double a = approx->breaks[piece], b = approx->breaks[piece + 1];
+
+    TaylorPolynomial_t power = {};
+    TaylorPolynomialCtor( &power, approx->var, ( a + b ) / 2, approx->degree );
+
+    // T_{k-1} and T_k as power series in t.
+    double *previous = (double *)calloc( 2 * n, sizeof( double ) );
+    assert( previous && "Memory allocation error" );
+    double *current = previous + n;
+
+    previous[0] = 1;
+    power.coefficients[0] = c[0];
+    if ( n > 1 ) {
+        current[1] = 1;
+        power.coefficients[1] = c[1];
+    }
+
+    for ( size_t k = 2; k < n; k++ ) {
+        // T_{k+1} = 2t T_k - T_{k-1}, written over T_{k-1}.
+        for ( size_t j = n; j-- > 0; )
+            previous[j] = ( j ? 2 * current[j - 1] : 0 ) - previous[j];
+
+        double *tmp = previous;
+        previous = current;
+        current = tmp;
+
+        for ( size_t j = 0; j <= k; j++ )
+            power.coefficients[j] += c[k] * current[j];
+    }
+
+    free( previous < current ? previous : current );
+
+    double scale = 1, half = ( b - a ) / 2;
+    for ( size_t k = 0; k < n; k++ ) {
+        power.coefficients[k] /= scale;
+        scale *= half;
+    }
+
+    Tree_t *tree = TaylorPolynomialHornerTree( &power );
+    TaylorPolynomialDtor( &power );
+
+    return tree;
+}
+
+// `name` prefixes the emitted identifiers, so it must be a C identifier itself.
+static bool ChebyshevCheckName( const char *name ) {
+    bool ok = isalpha( (unsigned char)name[0] ) || name[0] == '_';
+    for ( size_t idx = 1; ok && name[idx]; idx++ )
+        ok = isalnum( (unsigned char)name[idx] ) || name[idx] == '_';
+
+    if ( !ok )
+        PRINT_ERROR( "`%s` is not a C identifier \n", name );
+
+    return ok;
+}
+
+// Every piece in power form, as an expression this program reads.
+static void ChebyshevWritePieces( const ChebyshevApprox_t *approx, OutputBuffer_t *output ) {
+    for ( size_t piece = 0; piece < approx->n_pieces; piece++ ) {
+        BufferPrintf( output, "// On [%g; %g]: ", approx->breaks[piece], approx->breaks[piece + 1] );
+
+        Tree_t *tree = ChebyshevPieceTree( approx, piece );
+        ExpressionWriteText( tree, output );
+        TreeDtor( &tree, NULL );
+
+        BufferPutChar( output, '\n' );
+    }
+    BufferPutChar( output, '\n' );
+}
+
+bool ChebyshevWriteC( const ChebyshevApprox_t *approx, const char *name, FILE *stream ) {
+    my_assert( approx, "Null pointer on `approx`" );
+    my_assert( name, "Null pointer on `name`" );
+    my_assert( stream, "Null pointer on `stream`" );
+
+    if ( !ChebyshevCheckName( name ) )
+        return false;
+
+    OutputBuffer_t output = {};
+    OutputBufferCtor( &output, stream );
+
+    size_t n = (size_t)approx->degree + 1;
+
+    BufferPrintf( &output, "// Chebyshev approximation in %s: %lu pieces of degree %d, max error %g.\n\n",
+                  SymbolName( approx->var ), approx->n_pieces, approx->degree, approx->max_error );
+    ChebyshevWritePieces( approx, &output );
+    BufferPrintf( &output, "#include <stddef.h>\n\n" );
+
+    BufferPrintf( &output, "static const double %s_breaks[%lu] = {", name, approx->n_pieces + 1 );
+    for ( size_t idx = 0; idx <= approx->n_pieces; idx++ ) {
+        BufferPutString( &output, idx ? ", " : " " );
+        BufferPutDouble( &output, approx->breaks[idx] );
+    }
+    BufferPutString( &output, " };\n\n" );
+
+    BufferPrintf( &output, "static const double %s_coefficients[%lu][%lu] = {\n", name, approx->n_pieces, n );
+    for ( size_t piece = 0; piece < approx->n_pieces; piece++ ) {
+        BufferPutString( &output, "    {" );
+        for ( size_t k = 0; k < n; k++ ) {
+            BufferPutString( &output, k ? ", " : " " );
+            BufferPutDouble( &output, approx->coefficients[piece * n + k] );
+        }
+        BufferPutString( &output, " },\n" );
+    }
+    BufferPutString( &output, "};\n\n" );
+
+    BufferPrintf( &output,
+                  "double %s( double x ) {\n"
+                  "    size_t lo = 0, hi = %lu;\n"
+                  "    while ( lo < hi ) {\n"
+                  "        size_t middle = ( lo + hi + 1 ) / 2;\n"
+                  "        if ( x < %s_breaks[middle] )\n"
+                  "            hi = middle - 1;\n"
+                  "        else\n"
+                  "            lo = middle;\n"
+                  "    }\n\n"
+                  "    const double *c = %s_coefficients[lo];\n"
+                  "    double a = %s_breaks[lo], b = %s_breaks[lo + 1];\n"
+                  "    double t = ( 2 * x - a - b ) / ( b - a );\n\n"
+                  "    double b1 = 0, b2 = 0;\n"
+                  "    for ( int k = %d; k >= 1; k-- ) {\n"
+                  "        double b0 = c[k] + 2 * t * b1 - b2;\n"
+                  "        b2 = b1;\n"
+                  "        b1 = b0;\n"
+                  "    }\n\n"
+                  "    return c[0] + t * b1 - b2;\n"
+                  "}\n",
+                  name, approx->n_pieces ? approx->n_pieces - 1 : 0, name, name, name, name, approx->degree );
+
+    return OutputBufferDtor( &output );
+}
+
+bool DifferentiatorChebyshev( const char *expr_filename, const char *output_filename, const char *name,
+                              const ChebyshevOptions_t *options, size_t n_threads, const DerivativeBudget_t *budget ) {
+    my_assert( expr_filename, "Null pointer on `expr_filename`" );
+    my_assert( output_filename, "Null pointer on `output_filename`" );
+    my_assert( name, "Null pointer on `name`" );
+    my_assert( options, "Null pointer on `options`" );
+
+    if ( !ChebyshevCheckName( name ) )
+        return false;
+
+    SymbolId x = 0;
+    Differentiator_t *diff = DifferentiatorFileCtor( expr_filename, n_threads, NULL, budget, &x );
+    if ( !diff )
+        return false;
+
+    ChebyshevApprox_t approx = {};
+    bool ok = ChebyshevFit( diff, x, diff->plot_x_min, diff->plot_x_max, options, &approx );
+
+    if ( ok ) {
+        fprintf( stderr, "Chebyshev: [%g; %g], %lu pieces of degree %d, max error %g, checked %g\n",
+                 diff->plot_x_min, diff->plot_x_max, approx.n_pieces, approx.degree, approx.max_error,
+                 approx.checked_error );
+
+        bool to_stdout = ( strcmp( output_filename, "-" ) == 0 );
+        FILE *output = to_stdout ? stdout : fopen( output_filename, "w" );
+        if ( !output ) {
+            PRINT_ERROR( "Error opening file `%s` \n", output_filename );
+            ok = false;
+        } else {
+            ok = ChebyshevWriteC( &approx, name, output );
+            if ( !to_stdout )
+                ok = fclose( output ) == 0 && ok;
+        }
+    }
+
+    ChebyshevApproxDtor( &approx );
+    DifferentiatorFileDtor( &diff );
+
+    return ok;
+}
@@ -0,0 +1,144 @@
+#include <stdint.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "Metrics.h"
+#include "Tree.h"
+
+// The size of the next derivative is known before it is built. Every rule of
+// DifferentiateNode puts copies of the operands and derivatives of the operands
+// into a fixed frame of new nodes, so one bottom-up pass over the pairs
+// (subtree size, derivative size) gives the node count of the raw derivative
+// exactly; OptimizeTree only shrinks it afterwards. The frames below mirror the
+// rules one to one and have to be changed together with them.
+// Sums saturate: `x^x^x` overflows size_t long before it runs out of memory.
+
+struct SubtreeSize_t {
+    size_t size;
+    size_t derivative;
+};
+
+const size_t LEAF = 1;
+
+static size_t Sum( size_t a, size_t b ) {
+    return ( a > SIZE_MAX - b ) ? SIZE_MAX : a + b;
+}
+
+// One new node over operands of the given sizes.
+static size_t Frame( size_t L, size_t R = 0 ) {
+    return Sum( Sum( 1, L ), R );
+}
+
+static SubtreeSize_t EstimateNode( const Node_t *node, SymbolId independent_var ) {
+    if ( !node )
+        return { 0, 0 };
+
+    if ( node->value.type == NODE_NUMBER || node->value.type == NODE_VARIABLE )
+        return { LEAF, LEAF };
+
+    SubtreeSize_t left = EstimateNode( node->left, independent_var );
+    SubtreeSize_t right = EstimateNode( node->right, independent_var );
+
+    size_t cl = left.size, dl = left.derivative;
+    size_t cr = right.size, dr = right.derivative;
+    size_t result = 0;
+
+    if ( node->value.type != NODE_OPERATION )
+        return { Frame( cl, cr ), 0 };
+
+    switch ( node->value.data.operation ) {
+        case OP_ADD:
+        case OP_SUB:
+            result = Frame( dl, dr );
+            break;
+        case OP_MUL:
+            result = Frame( Frame( dl, cr ), Frame( cl, dr ) );
+            break;
+        case OP_DIV:
+            result = Frame( Frame( Frame( dl, cr ), Frame( cl, dr ) ), Frame( cr, cr ) );
+            break;
+
+        case OP_POW:
+            if ( node->right->value.type == NODE_NUMBER )
+                result = Frame( Frame( LEAF, Frame( cl, LEAF ) ), dl );
+            else if ( node->left->value.type == NODE_NUMBER )
+                result = Frame( Frame( Frame( LEAF, cr ), Frame( LEAF ) ), dr );
+            else
+                result = Frame( Frame( cl, cr ), Frame( Frame( dr, Frame( cl ) ), Frame( cr, Frame( dl, cl ) ) ) );
+            break;
+
+        case OP_LOG:
+            if ( !node->right )
+                result = Frame( dl, cl );
+            else
+                result = Frame( Frame( Frame( dl, cl ), Frame( Frame( dr, Frame( cl ) ), Frame( cr, Frame( cr ) ) ) ),
+                                Frame( cr ) );
+            break;
+        case OP_LN:
+            result = Frame( dl, cl );
+            break;
+
+        case OP_SIN:
+        case OP_SH:
+        case OP_CH:
+            result = Frame( Frame( cl ), dl );
+            break;
+        case OP_COS:
+            result = Frame( LEAF, Frame( Frame( cl ), dl ) );
+            break;
+        case OP_TAN:
+            result = Frame( dl, Frame( Frame( cl ), LEAF ) );
+            break;
+        case OP_CTAN:
+            result = Frame( LEAF, Frame( dl, Frame( Frame( cl ), LEAF ) ) );
+            break;
+
+        case OP_ARCSIN:
+        case OP_ARSINH:
+        case OP_ARCH:
+            result = Frame( dl, Frame( Frame( LEAF, Frame( cl, LEAF ) ), LEAF ) );
+            break;
+        case OP_ARCCOS:
+            result = Frame( LEAF, Frame( dl, Frame( Frame( LEAF, Frame( cl, LEAF ) ), LEAF ) ) );
+            break;
+        case OP_ARCTAN:
+        case OP_ARTANH:
+            result = Frame( dl, Frame( LEAF, Frame( cl, LEAF ) ) );
+            break;
+        case OP_ARCCTAN:
+            result = Frame( LEAF, Frame( dl, Frame( LEAF, Frame( cl, LEAF ) ) ) );
+            break;
+
+        default:
+            break;
+    }
+
+    return { Frame( cl, cr ), result };
+}
+
+size_t EstimateDerivativeSize( const Node_t *root, SymbolId independent_var ) {
+    return EstimateNode( root, independent_var ).derivative;
+}
+
+bool DerivativeFitsBudget( const Differentiator_t *diff, const Node_t *root, SymbolId independent_var, int order ) {
+    my_assert( diff, "Null pointer on `diff`" );
+
+    size_t max_nodes = diff->budget.max_nodes ? diff->budget.max_nodes : DERIVATIVE_DEFAULT_MAX_NODES;
+    size_t max_bytes = diff->budget.max_bytes ? diff->budget.max_bytes : DERIVATIVE_DEFAULT_MAX_BYTES;
+
+    SubtreeSize_t estimate = EstimateNode( root, independent_var );
+    METRIC_INC( METRIC_DERIVATIVE_ESTIMATES )
+    METRIC_ADD( METRIC_ESTIMATED_NODES, estimate.derivative )
+
+    // The old tree is freed only after the new one is built.
+    size_t peak_nodes = Sum( estimate.size, estimate.derivative );
+    if ( estimate.derivative <= max_nodes && peak_nodes <= max_bytes / sizeof( Node_t ) )
+        return true;
+
+    PRINT( "Derivative of order %d would take %lu nodes, the budget is %lu nodes and %lu bytes", order,
+           estimate.derivative, max_nodes, max_bytes );
+    METRIC_INC( METRIC_BUDGET_FALLBACKS )
+    (void)order;
+
+    return false;
+}
@@ -0,0 +1,365 @@
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "TreeBinary.h"
+#include "UtilsRW.h"
+
+// Content-addressed cache of derivative trees and Taylor coefficients.
+//   d-<key>-<order>.dtrb           optimized derivative of the given order
+//   t-<key>-<point>-<order>.coef   Taylor coefficients f^(k)(point) / k!, k = 0..order
+// The key hashes the expression, the independent variable and every other
+// bound variable, because OptimizeTree folds those into the derivative.
+// Variables are hashed by name: symbol ids differ from one process to another.
+// Files are written to a temporary name and renamed into place; when the
+// directory grows over `max_bytes`, the least recently used files are removed
+// until it is back under three quarters of the limit. Temporary files belong
+// to writers in flight and are neither counted nor removed.
+
+const char *const TEMP_FILE_PREFIX = ".tmp-";
+
+const uint32_t COEFFICIENTS_MAGIC   = 0x46435444; // "DTCF"
+const uint16_t COEFFICIENTS_VERSION = 1;
+
+// Bump when the differentiation rules or the simplifier change their output.
+const uint64_t DERIVATIVE_CACHE_VERSION = 2;
+
+struct CoefficientsHeader_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t n_coefficients;
+};
+
+struct CacheFile_t {
+    char  *path;
+    off_t  size;
+    time_t mtime;
+};
+
+static uint64_t MixHash( uint64_t hash, const void *data, size_t size ) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for ( size_t idx = 0; idx < size; idx++ ) {
+        hash ^= bytes[idx];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static off_t DirectorySize( const char *directory, CacheFile_t **files, size_t *n_files );
+
+bool DerivativeCacheCtor( DerivativeCache_t *cache, const char *directory, size_t max_bytes ) {
+    my_assert( cache, "Null pointer on `cache`" );
+    my_assert( directory, "Null pointer on `directory`" );
+
+    if ( MakeDirectory( directory ) != 0 )
+        return false;
+
+    cache->directory = strdup( directory );
+    cache->max_bytes = max_bytes;
+    cache->used_bytes = (size_t)DirectorySize( directory, NULL, NULL );
+    pthread_mutex_init( &cache->lock, NULL );
+
+    PRINT( "Derivative cache `%s`: %lu of %lu bytes used", directory, cache->used_bytes, max_bytes );
+
+    return true;
+}
+
+void DerivativeCacheDtor( DerivativeCache_t *cache ) {
+    my_assert( cache, "Null pointer on `cache`" );
+
+    pthread_mutex_destroy( &cache->lock );
+    free( cache->directory );
+    cache->directory = NULL;
+}
+
+uint64_t DerivativeCacheKey( const Differentiator_t *diff, SymbolId independent_var ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( diff->expr_tree, "Null pointer on `expr_tree`" );
+
+    uint64_t hash = TreeStructuralHash( diff->expr_tree );
+    hash = MixHash( hash, &DERIVATIVE_CACHE_VERSION, sizeof( DERIVATIVE_CACHE_VERSION ) );
+    const char *independent_name = SymbolName( independent_var );
+    hash = MixHash( hash, independent_name, strlen( independent_name ) );
+
+    // The sum keeps the key independent of the variable table order.
+    uint64_t bound = 0;
+    for ( size_t idx = 0; idx < diff->var_table.number_of_variables; idx++ ) {
+        const Variable_t *var = &diff->var_table.data[idx];
+        if ( var->name == independent_var || !isfinite( var->value ) )
+            continue;
+
+        const char *name = SymbolName( var->name );
+        uint64_t var_hash = MixHash( 0xcbf29ce484222325ULL, name, strlen( name ) );
+        bound += MixHash( var_hash, &var->value, sizeof( var->value ) );
+    }
+
+    return MixHash( hash, &bound, sizeof( bound ) );
+}
+
+static char *TreeFilePath( const DerivativeCache_t *cache, uint64_t key, int order ) {
+    char name[64] = {};
+    snprintf( name, sizeof( name ), "d-%016lx-%d.dtrb", key, order );
+
+    return MakePath( cache->directory, name );
+}
+
+static char *CoefficientsFilePath( const DerivativeCache_t *cache, uint64_t key, double point, int order ) {
+    uint64_t point_bits = 0;
+    memcpy( &point_bits, &point, sizeof( point_bits ) );
+
+    char name[96] = {};
+    snprintf( name, sizeof( name ), "t-%016lx-%016lx-%d.coef", key, point_bits, order );
+
+    return MakePath( cache->directory, name );
+}
+
+// ----------------------------------- Eviction -----------------------------------
+
+static int CompareByTime( const void *first, const void *second ) {
+    const CacheFile_t *a = (const CacheFile_t *)first;
+    const CacheFile_t *b = (const CacheFile_t *)second;
+
+    return ( a->mtime > b->mtime ) - ( a->mtime < b->mtime );
+}
+
+static off_t DirectorySize( const char *directory, CacheFile_t **files, size_t *n_files ) {
+    DIR *dir = opendir( directory );
+    if ( !dir )
+        return 0;
+
+    size_t capacity = 0;
+    if ( n_files )
+        *n_files = 0;
+
+    off_t total = 0;
+    for ( struct dirent *entry = readdir( dir ); entry; entry = readdir( dir ) ) {
+        if ( entry->d_name[0] == '.' && ( !entry->d_name[1] || entry->d_name[1] == '.' ) )
+            continue;
+        if ( strncmp( entry->d_name, TEMP_FILE_PREFIX, strlen( TEMP_FILE_PREFIX ) ) == 0 )
+            continue;
+
+        char *path = MakePath( directory, entry->d_name );
+        struct stat file_stat = {};
+        if ( stat( path, &file_stat ) == -1 || !S_ISREG( file_stat.st_mode ) ) {
+            free( path );
+            continue;
+        }
+
+        total += file_stat.st_size;
+
+        if ( !files ) {
+            free( path );
+            continue;
+        }
+
+        if ( *n_files >= capacity ) {
+            capacity = capacity ? capacity * 2 : 64;
+            *files = (CacheFile_t *)realloc( *files, capacity * sizeof( CacheFile_t ) );
+            assert( *files && "Memory allocation error" );
+        }
+        ( *files )[( *n_files )++] = { path, file_stat.st_size, file_stat.st_mtime };
+    }
+
+    closedir( dir );
+
+    return total;
+}
+
+static void DerivativeCacheEvict( DerivativeCache_t *cache ) {
+    CacheFile_t *files = NULL;
+    size_t n_files = 0;
+    off_t total = DirectorySize( cache->directory, &files, &n_files );
+
+    qsort( files, n_files, sizeof( CacheFile_t ), CompareByTime );
+
+    size_t target = cache->max_bytes - cache->max_bytes / 4;
+    size_t removed = 0;
+    for ( size_t idx = 0; idx < n_files; idx++ ) {
+        if ( (size_t)total > target && unlink( files[idx].path ) == 0 ) {
+            total -= files[idx].size;
+            removed++;
+        }
+        free( files[idx].path );
+    }
+    free( files );
+
+    cache->used_bytes = (size_t)total;
+
+    PRINT( "Derivative cache: evicted %lu files, %lu bytes left", removed, cache->used_bytes );
+}
+
+// `replaced` is the size of the file the new one took the place of.
+static void DerivativeCacheAccount( DerivativeCache_t *cache, size_t bytes, size_t replaced ) {
+    pthread_mutex_lock( &cache->lock );
+
+    cache->used_bytes += bytes;
+    cache->used_bytes -= ( replaced < cache->used_bytes ) ? replaced : cache->used_bytes;
+    if ( cache->used_bytes > cache->max_bytes )
+        DerivativeCacheEvict( cache );
+
+    pthread_mutex_unlock( &cache->lock );
+}
+
+// ------------------------------------ Storage ------------------------------------
+
+static bool WriteAtomically( DerivativeCache_t *cache, const char *path, bool ( *write )( FILE *, const void * ),
+                             const void *data ) {
+    char temp_name[32] = {};
+    snprintf( temp_name, sizeof( temp_name ), "%sXXXXXX", TEMP_FILE_PREFIX );
+    char *temp_path = MakePath( cache->directory, temp_name );
+
+    int fd = mkstemp( temp_path );
+    if ( fd == -1 ) {
+        free( temp_path );
+        return false;
+    }
+
+    FILE *file = fdopen( fd, "wb" );
+    if ( !file ) {
+        close( fd );
+        unlink( temp_path );
+        free( temp_path );
+        return false;
+    }
+
+    bool ok = write( file, data );
+    ok = ( fflush( file ) == 0 ) && ok;
+
+    long size = ftell( file );
+    ok = ( fclose( file ) == 0 ) && ok;
+
+    struct stat replaced_stat = {};
+    off_t replaced = ( stat( path, &replaced_stat ) == 0 ) ? replaced_stat.st_size : 0;
+    ok = ok && rename( temp_path, path ) == 0;
+
+    if ( !ok )
+        unlink( temp_path );
+    free( temp_path );
+
+    if ( ok && size > 0 )
+        DerivativeCacheAccount( cache, (size_t)size, (size_t)replaced );
+
+    return ok;
+}
+
+static bool WriteTree( FILE *file, const void *tree ) {
+    return TreeWriteBinary( (const Tree_t *)tree, file );
+}
+
+struct CoefficientsData_t {
+    const double *coefficients;
+    size_t        n_coefficients;
+};
+
+static bool WriteCoefficients( FILE *file, const void *arg ) {
+    const CoefficientsData_t *data = (const CoefficientsData_t *)arg;
+
+    CoefficientsHeader_t header = {};
+    header.magic = COEFFICIENTS_MAGIC;
+    header.version = COEFFICIENTS_VERSION;
+    header.n_coefficients = data->n_coefficients;
+
+    return fwrite( &header, sizeof( header ), 1, file ) == 1 &&
+           fwrite( data->coefficients, sizeof( double ), data->n_coefficients, file ) == data->n_coefficients;
+}
+
+static void TouchFile( const char *path ) {
+    utimensat( AT_FDCWD, path, NULL, 0 );
+}
+
+// The compact tree points into the mapped file until CompactTreeUnload.
+bool DerivativeCacheLoadCompact( DerivativeCache_t *cache, uint64_t key, int order, CompactTree_t *compact ) {
+    my_assert( cache, "Null pointer on `cache`" );
+    my_assert( compact, "Null pointer on `compact`" );
+
+    char *path = TreeFilePath( cache, key, order );
+    bool ok = false;
+
+    if ( access( path, R_OK ) == 0 ) {
+        ok = CompactTreeLoad( compact, path );
+        if ( ok )
+            TouchFile( path );
+    }
+
+    free( path );
+
+    return ok;
+}
+
+Tree_t *DerivativeCacheLoadTree( DerivativeCache_t *cache, uint64_t key, int order ) {
+    my_assert( cache, "Null pointer on `cache`" );
+
+    CompactTree_t compact = {};
+    if ( !DerivativeCacheLoadCompact( cache, key, order, &compact ) )
+        return NULL;
+
+    Tree_t *tree = CompactTreeExpand( &compact );
+    CompactTreeUnload( &compact );
+
+    return tree;
+}
+
+bool DerivativeCacheStoreTree( DerivativeCache_t *cache, uint64_t key, int order, const Tree_t *tree ) {
+    my_assert( cache, "Null pointer on `cache`" );
+    my_assert( tree, "Null pointer on `tree`" );
+
+    char *path = TreeFilePath( cache, key, order );
+    bool ok = WriteAtomically( cache, path, WriteTree, tree );
+    free( path );
+
+    return ok;
+}
+
+bool DerivativeCacheLoadCoefficients( DerivativeCache_t *cache, uint64_t key, double point, int order,
+                                      double *coefficients ) {
+    my_assert( cache, "Null pointer on `cache`" );
+    my_assert( coefficients, "Null pointer on `coefficients`" );
+
+    char *path = CoefficientsFilePath( cache, key, point, order );
+
+    FILE *file = fopen( path, "rb" );
+    if ( !file ) {
+        free( path );
+        return false;
+    }
+
+    size_t n_coefficients = (size_t)order + 1;
+
+    CoefficientsHeader_t header = {};
+    bool ok = fread( &header, sizeof( header ), 1, file ) == 1 && header.magic == COEFFICIENTS_MAGIC &&
+              header.version == COEFFICIENTS_VERSION && header.n_coefficients == n_coefficients &&
+              fread( coefficients, sizeof( double ), n_coefficients, file ) == n_coefficients;
+
+    fclose( file );
+    if ( ok )
+        TouchFile( path );
+    free( path );
+
+    return ok;
+}
+
+bool DerivativeCacheStoreCoefficients( DerivativeCache_t *cache, uint64_t key, double point, int order,
+                                       const double *coefficients ) {
+    my_assert( cache, "Null pointer on `cache`" );
+    my_assert( coefficients, "Null pointer on `coefficients`" );
+
+    CoefficientsData_t data = { coefficients, (size_t)order + 1 };
+
+    char *path = CoefficientsFilePath( cache, key, point, order );
+    bool ok = WriteAtomically( cache, path, WriteCoefficients, &data );
+    free( path );
+
+    return ok;
+}
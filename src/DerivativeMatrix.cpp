@@ -0,0 +1,354 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "SymbolTable.h"
+#include "ThreadPool.h"
+#include "Tree.h"
+
+// Gradients, Hessians and Jacobians over many variables. An entry is never
+// built when its row does not contain the variable of its column; the Hessian
+// is differentiated from the gradient, upper triangle only. The remaining
+// entries are independent grouped tasks on the pool, all differentiated by one
+// worker with an empty variable table: it only folds numbers, so the tasks
+// share it read-only.
+// The finished entries are hash-consed together into one list of steps, so a
+// subtree repeated across entries is evaluated once per point.
+
+struct MatrixStep_t {
+    NodeValue value;
+    size_t    left;
+    size_t    right;
+};
+
+struct MatrixTask_t {
+    Differentiator_t *worker;
+    const Tree_t     *tree;
+    SymbolId          var;
+
+    Tree_t **entry;
+    bool     failed;
+};
+
+static void MatrixCtor( DerivativeMatrix_t *matrix, size_t n_rows, const SymbolId *variables, size_t n_cols,
+                        bool symmetric ) {
+    memset( matrix, 0, sizeof( *matrix ) );
+    matrix->n_rows = n_rows;
+    matrix->n_cols = n_cols;
+    matrix->symmetric = symmetric;
+
+    matrix->variables = (SymbolId *)calloc( n_cols + 1, sizeof( SymbolId ) );
+    matrix->entries = (Tree_t **)calloc( n_rows * n_cols + 1, sizeof( Tree_t * ) );
+    assert( matrix->variables && matrix->entries && "Memory allocation error" );
+
+    if ( n_cols )
+        memcpy( matrix->variables, variables, n_cols * sizeof( SymbolId ) );
+}
+
+// `columns[id]` is the column of symbol `id` plus one, or zero.
+static size_t *ColumnMap( const SymbolId *variables, size_t n_variables, size_t *n_symbols ) {
+    *n_symbols = SymbolCount();
+
+    size_t *columns = (size_t *)calloc( *n_symbols + 1, sizeof( size_t ) );
+    assert( columns && "Memory allocation error" );
+
+    for ( size_t col = 0; col < n_variables; col++ ) {
+        if ( variables[col] < *n_symbols )
+            columns[variables[col]] = col + 1;
+    }
+
+    return columns;
+}
+
+static void MarkVariables( const Node_t *node, const size_t *columns, size_t n_symbols, bool *depends ) {
+    if ( !node )
+        return;
+
+    if ( node->value.type == NODE_VARIABLE && node->value.data.variable < n_symbols &&
+         columns[node->value.data.variable] )
+        depends[columns[node->value.data.variable] - 1] = true;
+
+    MarkVariables( node->left, columns, n_symbols, depends );
+    MarkVariables( node->right, columns, n_symbols, depends );
+}
+
+static void CollectVariables( const Node_t *node, bool *seen, size_t n_symbols, SymbolId *variables,
+                              size_t *n_variables ) {
+    if ( !node )
+        return;
+
+    if ( node->value.type == NODE_VARIABLE && node->value.data.variable < n_symbols &&
+         !seen[node->value.data.variable] ) {
+        seen[node->value.data.variable] = true;
+        variables[( *n_variables )++] = node->value.data.variable;
+    }
+
+    CollectVariables( node->left, seen, n_symbols, variables, n_variables );
+    CollectVariables( node->right, seen, n_symbols, variables, n_variables );
+}
+
+static void MatrixEntryTask( void *arg ) {
+    MatrixTask_t *task = (MatrixTask_t *)arg;
+
+    Tree_t *entry = DifferentiateTree( task->worker, task->tree, task->var );
+    if ( !entry ) {
+        task->failed = true;
+        return;
+    }
+
+    const Node_t *root = entry->root;
+    if ( root->value.type == NODE_NUMBER && fpclassify( root->value.data.number ) == FP_ZERO )
+        TreeDtor( &entry, NULL );
+
+    *task->entry = entry;
+}
+
+// Every distinct subtree becomes one step; a step only refers to earlier ones.
+static void MatrixCompile( DerivativeMatrix_t *matrix ) {
+    size_t n_entries = matrix->n_rows * matrix->n_cols;
+
+    const Node_t **roots = (const Node_t **)calloc( n_entries + 1, sizeof( Node_t * ) );
+    matrix->entry_steps = (size_t *)calloc( n_entries + 1, sizeof( size_t ) );
+    assert( roots && matrix->entry_steps && "Memory allocation error" );
+
+    for ( size_t idx = 0; idx < n_entries; idx++ )
+        roots[idx] = matrix->entries[idx] ? matrix->entries[idx]->root : NULL;
+
+    SharedSubtrees_t shared = {};
+    SharedSubtreesCtorForest( &shared, roots, n_entries, SIZE_MAX );
+
+    // Step 0 is a missing operand.
+    matrix->n_steps = shared.n_classes;
+    matrix->steps = (MatrixStep_t *)calloc( matrix->n_steps + 1, sizeof( MatrixStep_t ) );
+    assert( matrix->steps && "Memory allocation error" );
+
+    for ( size_t id = 1; id <= matrix->n_steps; id++ ) {
+        const Node_t *node = SharedSubtreesClassNode( &shared, id );
+        matrix->steps[id] = { node->value, SharedSubtreesClass( &shared, node->left ),
+                              SharedSubtreesClass( &shared, node->right ) };
+    }
+
+    for ( size_t idx = 0; idx < n_entries; idx++ )
+        matrix->entry_steps[idx] = SharedSubtreesClass( &shared, roots[idx] );
+
+    PRINT( "Derivative matrix %lux%lu: %lu nodes, %lu distinct", matrix->n_rows, matrix->n_cols, shared.n_nodes,
+           matrix->n_steps );
+
+    SharedSubtreesDtor( &shared );
+    free( roots );
+}
+
+// `rows[row]` is differentiated by the variable of every column marked in `nonzero`.
+static bool MatrixBuild( Differentiator_t *diff, DerivativeMatrix_t *matrix, const Tree_t *const *rows,
+                         const bool *nonzero ) {
+    size_t n_entries = matrix->n_rows * matrix->n_cols;
+
+    MatrixTask_t *tasks = (MatrixTask_t *)calloc( n_entries + 1, sizeof( MatrixTask_t ) );
+    assert( tasks && "Memory allocation error" );
+
+    Differentiator_t *worker = DifferentiatorWorkerCtor();
+    worker->budget = diff->budget;
+    worker->pool = diff->pool;
+
+    ThreadPoolGroup_t group = {};
+    for ( size_t idx = 0; idx < n_entries; idx++ ) {
+        if ( !nonzero[idx] )
+            continue;
+
+        tasks[idx] = { worker, rows[idx / matrix->n_cols], matrix->variables[idx % matrix->n_cols],
+                       &matrix->entries[idx], false };
+        ThreadPoolGroupSubmit( diff->pool, &group, MatrixEntryTask, &tasks[idx] );
+    }
+
+    ThreadPoolGroupWait( diff->pool, &group );
+
+    bool ok = true;
+    for ( size_t idx = 0; idx < n_entries; idx++ )
+        ok = ok && !tasks[idx].failed;
+
+    DifferentiatorDtor( &worker );
+    free( tasks );
+
+    if ( ok )
+        MatrixCompile( matrix );
+
+    return ok;
+}
+
+bool DerivativeJacobian( Differentiator_t *diff, const Tree_t *const *trees, size_t n_trees,
+                         const SymbolId *variables, size_t n_variables, DerivativeMatrix_t *jacobian ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( trees || n_trees == 0, "Null pointer on `trees`" );
+    my_assert( variables || n_variables == 0, "Null pointer on `variables`" );
+    my_assert( jacobian, "Null pointer on `jacobian`" );
+
+    MatrixCtor( jacobian, n_trees, variables, n_variables, false );
+
+    size_t n_symbols = 0;
+    size_t *columns = ColumnMap( variables, n_variables, &n_symbols );
+
+    bool *nonzero = (bool *)calloc( n_trees * n_variables + 1, sizeof( bool ) );
+    assert( nonzero && "Memory allocation error" );
+
+    for ( size_t row = 0; row < n_trees; row++ )
+        MarkVariables( trees[row] ? trees[row]->root : NULL, columns, n_symbols, nonzero + row * n_variables );
+
+    bool ok = MatrixBuild( diff, jacobian, trees, nonzero );
+
+    free( nonzero );
+    free( columns );
+
+    if ( !ok )
+        DerivativeMatrixDtor( jacobian );
+
+    return ok;
+}
+
+// Over the variables of `diff->var_table`, or of the tree when the table is empty.
+bool DerivativeGradient( Differentiator_t *diff, const Tree_t *tree, DerivativeMatrix_t *gradient ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( tree, "Null pointer on `tree`" );
+
+    size_t n_symbols = SymbolCount();
+    SymbolId *variables = (SymbolId *)calloc( n_symbols + 1, sizeof( SymbolId ) );
+    assert( variables && "Memory allocation error" );
+
+    size_t n_variables = 0;
+    if ( diff->var_table.number_of_variables ) {
+        for ( ; n_variables < diff->var_table.number_of_variables; n_variables++ )
+            variables[n_variables] = diff->var_table.data[n_variables].name;
+    } else {
+        bool *seen = (bool *)calloc( n_symbols + 1, sizeof( bool ) );
+        assert( seen && "Memory allocation error" );
+
+        CollectVariables( tree->root, seen, n_symbols, variables, &n_variables );
+        free( seen );
+    }
+
+    bool ok = DerivativeJacobian( diff, &tree, 1, variables, n_variables, gradient );
+    free( variables );
+
+    return ok;
+}
+
+// H[i][j] = d g[i] / d x[j] for j >= i. It is zero unless g[i] contains x[j]
+// and g[j] contains x[i].
+bool DerivativeHessian( Differentiator_t *diff, const DerivativeMatrix_t *gradient, DerivativeMatrix_t *hessian ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( gradient, "Null pointer on `gradient`" );
+    my_assert( hessian, "Null pointer on `hessian`" );
+    my_assert( gradient->n_rows == 1, "The gradient has to be a single row" );
+
+    size_t n = gradient->n_cols;
+    MatrixCtor( hessian, n, gradient->variables, n, true );
+
+    size_t n_symbols = 0;
+    size_t *columns = ColumnMap( gradient->variables, n, &n_symbols );
+
+    bool *depends = (bool *)calloc( n * n + 1, sizeof( bool ) );
+    bool *nonzero = (bool *)calloc( n * n + 1, sizeof( bool ) );
+    assert( depends && nonzero && "Memory allocation error" );
+
+    for ( size_t row = 0; row < n; row++ ) {
+        const Tree_t *entry = gradient->entries[row];
+        MarkVariables( entry ? entry->root : NULL, columns, n_symbols, depends + row * n );
+    }
+
+    for ( size_t row = 0; row < n; row++ ) {
+        for ( size_t col = row; col < n; col++ )
+            nonzero[row * n + col] = depends[row * n + col] && depends[col * n + row];
+    }
+
+    bool ok = MatrixBuild( diff, hessian, gradient->entries, nonzero );
+
+    free( nonzero );
+    free( depends );
+    free( columns );
+
+    if ( !ok )
+        DerivativeMatrixDtor( hessian );
+
+    return ok;
+}
+
+void DerivativeMatrixDtor( DerivativeMatrix_t *matrix ) {
+    my_assert( matrix, "Null pointer on `matrix`" );
+
+    size_t n_entries = matrix->n_rows * matrix->n_cols;
+    for ( size_t idx = 0; matrix->entries && idx < n_entries; idx++ )
+        TreeDtor( &matrix->entries[idx], NULL );
+
+    free( matrix->entries );
+    free( matrix->variables );
+    free( matrix->steps );
+    free( matrix->entry_steps );
+
+    memset( matrix, 0, sizeof( *matrix ) );
+}
+
+const Tree_t *DerivativeMatrixEntry( const DerivativeMatrix_t *matrix, size_t row, size_t col ) {
+    my_assert( matrix, "Null pointer on `matrix`" );
+    my_assert( row < matrix->n_rows && col < matrix->n_cols, "Matrix index out of range" );
+
+    if ( matrix->symmetric && row > col )
+        return matrix->entries[col * matrix->n_cols + row];
+
+    return matrix->entries[row * matrix->n_cols + col];
+}
+
+size_t DerivativeMatrixNonZeros( const DerivativeMatrix_t *matrix ) {
+    my_assert( matrix, "Null pointer on `matrix`" );
+
+    size_t count = 0;
+    for ( size_t row = 0; row < matrix->n_rows; row++ ) {
+        for ( size_t col = 0; col < matrix->n_cols; col++ )
+            count += DerivativeMatrixEntry( matrix, row, col ) != NULL;
+    }
+
+    return count;
+}
+
+// `values` gets all n_rows * n_cols entries, row-major; unbound variables are NaN.
+void DerivativeMatrixEvaluate( const DerivativeMatrix_t *matrix, const VarTable_t *table, double *values ) {
+    my_assert( matrix, "Null pointer on `matrix`" );
+    my_assert( table, "Null pointer on `table`" );
+    my_assert( values || matrix->n_rows * matrix->n_cols == 0, "Null pointer on `values`" );
+
+    double *results = (double *)calloc( matrix->n_steps + 1, sizeof( double ) );
+    assert( results && "Memory allocation error" );
+
+    for ( size_t id = 1; id <= matrix->n_steps; id++ ) {
+        const MatrixStep_t *step = &matrix->steps[id];
+
+        switch ( step->value.type ) {
+            case NODE_NUMBER:
+                results[id] = step->value.data.number;
+                break;
+            case NODE_VARIABLE:
+                results[id] = NAN;
+                VarTableGet( table, step->value.data.variable, &results[id] );
+                break;
+            case NODE_OPERATION:
+                results[id] = EvaluateOperation( (OperationType)step->value.data.operation, results[step->left],
+                                                 results[step->right] );
+                break;
+            case NODE_UNKNOWN:
+            default:
+                results[id] = NAN;
+                break;
+        }
+    }
+
+    for ( size_t row = 0; row < matrix->n_rows; row++ ) {
+        for ( size_t col = 0; col < matrix->n_cols; col++ ) {
+            size_t idx = ( matrix->symmetric && row > col ) ? col * matrix->n_cols + row : row * matrix->n_cols + col;
+            values[row * matrix->n_cols + col] = results[matrix->entry_steps[idx]];
+        }
+    }
+
+    free( results );
+}
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -7,7 +8,10 @@
 
 #include "DebugUtils.h"
 #include "Differentiator.h"
+#include "Metrics.h"
+#include "ThreadPool.h"
 #include "Tree.h"
+#include "TreeBinary.h"
 #include "UtilsRW.h"
 
 #define NUM_( n ) NodeCreate( MakeNumber( n ), NULL )
@@ -26,43 +30,181 @@
 #define cL NodeCopy( node->left )
 #define cR NodeCopy( node->right )
 
-#define dL DifferentiateNode( node->left, independent_var, diff, order )
-#define dR DifferentiateNode( node->right, independent_var, diff, order )
+#define dL \
+    ( operands.forked ? operands.left : DifferentiateNode( node->left, independent_var, diff, order, operands.left_parallel ) )
+#define dR \
+    ( operands.forked ? operands.right : DifferentiateNode( node->right, independent_var, diff, order, operands.right_parallel ) )
 
 // Variable Table
-static void VarTableCtor( VarTable_t *table, size_t initial_capacity );
-static void VarTableDtor( VarTable_t *table );
-
 static void AddVarsToTableFromNode( Node_t *node, VarTable_t *table );
 
-ON_DEBUG( static Log_t DumpCtor() );
+ON_DEBUG( static Log_t DumpCtor( const char *output_dir ) );
 ON_DEBUG( static void DumpDtor( Log_t *logging ) );
 
-Differentiator_t *DifferentiatorCtor( const char *expr_filename ) {
+static void ReadPlotParameters( Differentiator_t *diff );
+
+Differentiator_t *DifferentiatorCtor( const char *expr_filename, const char *output_dir ) {
     my_assert( expr_filename, "Null pointer on `expr_filename`" );
 
-    char *buffer = ReadToBuffer( expr_filename );
+    Differentiator_t *diff = DifferentiatorWorkerCtor();
+    if ( !DifferentiatorReadFile( diff, expr_filename ) ) {
+        DifferentiatorDtor( &diff );
+        return NULL;
+    }
+
+    if ( output_dir ) {
+        MakeDirectory( output_dir );
+        diff->output_dir = strdup( output_dir );
+    }
 
+    diff->latex = LatexCtor( diff->output_dir );
+    ON_DEBUG( diff->logging = DumpCtor( diff->output_dir ); )
+
+    return diff;
+}
+
+Differentiator_t *DifferentiatorWorkerCtor() {
     Differentiator_t *diff = (Differentiator_t *)calloc( 1, sizeof( Differentiator_t ) );
     assert( diff && "Memory allocation error" );
 
+    VarTableCtor( &( diff->var_table ), 5 );
+
+    return diff;
+}
+
+// The expression and the plot parameters after it, without any output.
+bool DifferentiatorReadFile( Differentiator_t *diff, const char *expr_filename ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( expr_filename, "Null pointer on `expr_filename`" );
+
+    char *buffer = ReadToBuffer( expr_filename );
+    if ( !buffer )
+        return false;
+
+    free( diff->expr_info.buffer );
     diff->expr_info.buffer = buffer;
 
-    Tree_t *expr_tree = ExpressionParser( diff );
-    if ( !expr_tree ) {
-        free( buffer );
+    TreeDtor( &diff->expr_tree, NULL );
+    TreeDtor( &diff->diff_tree, NULL );
+    TreeDtor( &diff->taylor_tree, NULL );
+    TaylorPolynomialDtor( &diff->taylor );
+
+    diff->expr_tree = ExpressionParser( diff );
+    if ( !diff->expr_tree )
+        return false;
+
+    ReadPlotParameters( diff );
+
+    return true;
+}
+
+// A worker for the tools that run over the plot interval of a file in `x`:
+// the file is read without output, other variables evaluate to zero and
+// parallel work goes to a pool of `n_threads`.
+Differentiator_t *DifferentiatorFileCtor( const char *expr_filename, size_t n_threads, DerivativeCache_t *cache,
+                                          const DerivativeBudget_t *budget, SymbolId *var ) {
+    my_assert( expr_filename, "Null pointer on `expr_filename`" );
+    my_assert( var, "Null pointer on `var`" );
+
+    Differentiator_t *diff = DifferentiatorWorkerCtor();
+    if ( !DifferentiatorReadFile( diff, expr_filename ) ) {
+        DifferentiatorDtor( &diff );
         return NULL;
     }
 
-    diff->expr_tree = expr_tree;
+    diff->cache = cache;
+    if ( budget )
+        diff->budget = *budget;
+    diff->pool = ThreadPoolCtor( n_threads );
 
+    *var = SymbolIntern( "x" );
+    VarTableAddFromTree( &diff->var_table, diff->expr_tree );
 
-    VarTableCtor( &( diff->var_table ), 5 );
+    return diff;
+}
 
-    diff->latex = LatexCtor();
-    ON_DEBUG( diff->logging = DumpCtor(); )
+void DifferentiatorFileDtor( Differentiator_t **diff ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( *diff, "An attempt to launch destructor for a null-terminated struct" );
 
-    return diff;
+    ThreadPoolDtor( &( *diff )->pool );
+    DifferentiatorDtor( diff );
+    NodeArenaRelease();
+}
+
+bool DifferentiatorSetExpression( Differentiator_t *diff, const char *expression, size_t length ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( expression, "Null pointer on `expression`" );
+
+    bool has_terminator = ( memchr( expression, '$', length ) != NULL );
+
+    char *buffer = (char *)realloc( diff->expr_info.buffer, length + 2 );
+    assert( buffer && "Memory allocation error" );
+
+    memcpy( buffer, expression, length );
+    if ( !has_terminator )
+        buffer[length++] = '$';
+    buffer[length] = '\0';
+
+    diff->expr_info.buffer = buffer;
+    diff->expr_info.current_position = buffer + length;
+
+    TreeDtor( &diff->expr_tree, NULL );
+    TreeDtor( &diff->diff_tree, NULL );
+    TreeDtor( &diff->taylor_tree, NULL );
+    TaylorPolynomialDtor( &diff->taylor );
+
+    diff->expr_tree = ExpressionParser( diff );
+    if ( !diff->expr_tree )
+        return false;
+
+    VarTableClear( &diff->var_table );
+
+    return true;
+}
+
+static bool SkipPlotSeparator( char **position ) {
+    SkipSpaces( position );
+    if ( **position != '&' )
+        return false;
+
+    ( *position )++;
+    return true;
+}
+
+// `x_min x_max & y_min y_max & x_0 & extent`, reading stops at the first mismatch
+// and leaves the remaining parameters as they were.
+static void ReadPlotParameters( Differentiator_t *diff ) {
+    char *current_position = diff->expr_info.current_position;
+
+    double *numbers[] = { &( diff->plot_x_min ), &( diff->plot_x_max ), &( diff->plot_y_min ),
+                          &( diff->plot_y_max ), &( diff->x_0 ) };
+    const bool separated[] = { false, false, true, false, true };
+    const size_t n_numbers = sizeof( numbers ) / sizeof( numbers[0] );
+
+    size_t n_read = 0;
+    for ( ; n_read < n_numbers; n_read++ ) {
+        if ( separated[n_read] && !SkipPlotSeparator( &current_position ) )
+            break;
+
+        size_t read_bytes = ReadDouble( current_position, numbers[n_read] );
+        if ( !read_bytes )
+            break;
+        current_position += read_bytes;
+    }
+
+    long extent = 0;
+    if ( n_read == n_numbers && SkipPlotSeparator( &current_position ) &&
+         ReadLong( current_position, &extent ) && extent >= INT_MIN && extent <= INT_MAX ) {
+        diff->extent = (int)extent;
+        PRINT( "OK" );
+    } else {
+        PRINT( "NOT OK" );
+    }
+
+    PRINT( "y_min = %g; y_max = %g", diff->plot_y_min, diff->plot_y_max );
+    PRINT( "x_min = %g; x_max = %g", diff->plot_x_min, diff->plot_x_max );
+    PRINT( "x_0 = %g; extent = %d", diff->x_0, diff->extent );
 }
 
 void DifferentiatorDtor( Differentiator_t **diff ) {
@@ -74,37 +216,55 @@ void DifferentiatorDtor( Differentiator_t **diff ) {
     TreeDtor( &( ( *diff )->expr_tree ), NULL );
     TreeDtor( &( ( *diff )->diff_tree ), NULL );
     TreeDtor( &( ( *diff )->taylor_tree ), NULL );
+    TaylorPolynomialDtor( &( *diff )->taylor );
 
     VarTableDtor( &( *diff )->var_table );
-    LatexDtor( &( *diff )->latex );
-    ON_DEBUG( DumpDtor( &( *diff )->logging ); )
+    if ( ( *diff )->latex.tex_file )
+        LatexDtor( &( *diff )->latex );
+    ON_DEBUG( if ( ( *diff )->logging.log_file ) DumpDtor( &( *diff )->logging ); )
 
+    free( ( *diff )->output_dir );
     free( *diff );
     *diff = NULL;
 }
 
-static void VarTableCtor( VarTable_t *table, size_t initial_capacity ) {
+void VarTableCtor( VarTable_t *table, size_t initial_capacity ) {
     my_assert( table, "Null pointer on `table`" );
 
     table->data = (Variable_t *)calloc( initial_capacity, sizeof( Variable_t ) );
     table->number_of_variables = 0;
     table->capacity = initial_capacity;
+    table->index = NULL;
+    table->index_size = 0;
 }
 
-static void VarTableDtor( VarTable_t *table ) {
+void VarTableDtor( VarTable_t *table ) {
     my_assert( table, "Null pointer on `table`" );
 
     free( table->data );
+    free( table->index );
     table->data = NULL;
     table->number_of_variables = 0;
     table->capacity = 0;
+    table->index = NULL;
+    table->index_size = 0;
+}
+
+void VarTableClear( VarTable_t *table ) {
+    my_assert( table, "Null pointer on `table`" );
+
+    for ( size_t idx = 0; idx < table->number_of_variables; idx++ )
+        table->index[table->data[idx].name] = 0;
+
+    table->number_of_variables = 0;
 }
 
 static void AddVarsToTableFromNode( Node_t *node, VarTable_t *table ) {
     if ( !node )
         return;
 
-    if ( node->value.type == NODE_VARIABLE ) {
+    double value = 0.0;
+    if ( node->value.type == NODE_VARIABLE && !VarTableGet( table, node->value.data.variable, &value ) ) {
         VarTableSet( table, node->value.data.variable, 0.0 );
     }
 
@@ -112,14 +272,30 @@ static void AddVarsToTableFromNode( Node_t *node, VarTable_t *table ) {
     AddVarsToTableFromNode( node->right, table );
 }
 
-void VarTableSet( VarTable_t *table, char name, double value ) {
+void VarTableAddFromTree( VarTable_t *table, const Tree_t *tree ) {
     my_assert( table, "Null pointer on `table`" );
+    my_assert( tree, "Null pointer on `tree`" );
 
-    for ( size_t idx = 0; idx < table->number_of_variables; idx++ ) {
-        if ( table->data[idx].name == name ) {
-            table->data[idx].value = value;
-            return;
-        }
+    AddVarsToTableFromNode( tree->root, table );
+}
+
+void VarTableSet( VarTable_t *table, SymbolId name, double value ) {
+    my_assert( table, "Null pointer on `table`" );
+
+    if ( name < table->index_size && table->index[name] ) {
+        table->data[table->index[name] - 1].value = value;
+        return;
+    }
+
+    if ( name >= table->index_size ) {
+        size_t new_size = table->index_size ? table->index_size : 16;
+        while ( new_size <= name )
+            new_size *= 2;
+
+        table->index = (size_t *)realloc( table->index, new_size * sizeof( size_t ) );
+        assert( table->index && "Memory allocation error" );
+        memset( table->index + table->index_size, 0, ( new_size - table->index_size ) * sizeof( size_t ) );
+        table->index_size = new_size;
     }
 
     if ( table->number_of_variables >= table->capacity ) {
@@ -133,29 +309,44 @@ void VarTableSet( VarTable_t *table, char name, double value ) {
     table->data[table->number_of_variables].name = name;
     table->data[table->number_of_variables].value = value;
     table->number_of_variables++;
+    table->index[name] = table->number_of_variables;
 }
 
-bool VarTableGet( VarTable_t *table, char name, double *value ) {
-    if ( !table || !value )
+bool VarTableGet( const VarTable_t *table, SymbolId name, double *value ) {
+    if ( !table || !value || name >= table->index_size || !table->index[name] )
         return false;
 
+    *value = table->data[table->index[name] - 1].value;
+    return true;
+}
+
+void VarTableAskUser( VarTable_t *table ) {
+    my_assert( table, "Null pointer on `table`" );
+
     for ( size_t idx = 0; idx < table->number_of_variables; idx++ ) {
-        if ( table->data[idx].name == name ) {
-            *value = table->data[idx].value;
-            return true;
+        printf( "Enter value for variable %s: ", SymbolName( table->data[idx].name ) );
+        if ( scanf( "%lf", &table->data[idx].value ) != 1 ) {
+            printf( "Invalid input. Using 0.0 for %s\n", SymbolName( table->data[idx].name ) );
+            table->data[idx].value = 0.0;
+
+            int c;
+            while ( ( c = getchar() ) != '\n' && c != EOF ) {
+            }
         }
     }
-
-    return false;
 }
 
-void VarTableAskUser( VarTable_t *table ) {
+void VarTableAskMissing( VarTable_t *table, const Tree_t *tree ) {
     my_assert( table, "Null pointer on `table`" );
+    my_assert( tree, "Null pointer on `tree`" );
 
-    for ( size_t idx = 0; idx < table->number_of_variables; idx++ ) {
-        printf( "Enter value for variable %c: ", table->data[idx].name );
+    size_t known = table->number_of_variables;
+    AddVarsToTableFromNode( tree->root, table );
+
+    for ( size_t idx = known; idx < table->number_of_variables; idx++ ) {
+        printf( "Enter value for variable %s: ", SymbolName( table->data[idx].name ) );
         if ( scanf( "%lf", &table->data[idx].value ) != 1 ) {
-            printf( "Invalid input. Using 0.0 for %c\n", table->data[idx].name );
+            printf( "Invalid input. Using 0.0 for %s\n", SymbolName( table->data[idx].name ) );
             table->data[idx].value = 0.0;
 
             int c;
@@ -173,19 +364,81 @@ static double Factorial( const uint n ) {
     return result;
 }
 
-Tree_t *DifferentiatorBuildTaylorTree( Differentiator_t *diff, char var, double point, int order ) {
+void DifferentiatorTaylorChain( Differentiator_t *diff, SymbolId var, double point, int order, Tree_t **kept,
+                                int n_kept ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( kept || n_kept == 0, "Null pointer on `kept`" );
+
+    // Coefficients of the same expansion, e.g. from TaylorSearchOrder, are reused.
+    TaylorPolynomial_t *taylor = &diff->taylor;
+    bool need_coefficients = !taylor->coefficients || taylor->var != var || taylor->order != order ||
+                             CompareDoubleToDouble( taylor->point, point ) != 0;
+
+    uint64_t key = 0;
+    if ( need_coefficients ) {
+        TaylorPolynomialDtor( taylor );
+        TaylorPolynomialCtor( taylor, var, point, order );
+
+        if ( diff->cache ) {
+            key = DerivativeCacheKey( diff, var );
+            if ( DerivativeCacheLoadCoefficients( diff->cache, key, point, order, taylor->coefficients ) ) {
+                PRINT( "Taylor coefficients were loaded from the cache" );
+                need_coefficients = false;
+            }
+        }
+    }
+
+    for ( int idx = 0; idx < n_kept; idx++ )
+        kept[idx] = NULL;
+
+    int last_order = n_kept;
+    if ( need_coefficients && order > last_order )
+        last_order = order;
+    if ( !need_coefficients && n_kept == 0 )
+        return;
+
+    double *coefficients = taylor->coefficients;
+    for ( int cur_order = 0; cur_order <= last_order; cur_order++ ) {
+        Tree_t *tree = cur_order == 0 ? DifferentiateExpression( diff, var, 0 )
+                                      : DifferentiateNextOrder( diff, var, cur_order );
+        bool wants_coefficient = need_coefficients && cur_order <= order;
+
+        // Over the budget every coefficient comes from one Taylor-mode pass instead.
+        if ( !tree ) {
+            if ( wants_coefficient &&
+                 !TaylorModeCoefficients( diff->expr_tree->root, &diff->var_table, var, point, order, coefficients ) ) {
+                for ( int idx = cur_order; idx <= order; idx++ )
+                    coefficients[idx] = NAN;
+            }
+            break;
+        }
+
+        if ( wants_coefficient )
+            coefficients[cur_order] = EvaluateTree( tree, diff ) / Factorial( (uint)cur_order );
+
+        if ( cur_order >= 1 && cur_order <= n_kept ) {
+            kept[cur_order - 1] = TreeCtor();
+            kept[cur_order - 1]->root = NodeCopy( tree->root );
+        }
+    }
+
+    if ( need_coefficients && diff->cache )
+        DerivativeCacheStoreCoefficients( diff->cache, key, point, order, coefficients );
+}
+
+Tree_t *DifferentiatorBuildTaylorTree( Differentiator_t *diff, SymbolId var, double point, int order ) {
     my_assert( diff, "Null pointer on `diff`" );
 
     PRINT( "Start building Taylor Tree" );
 
+    DifferentiatorTaylorChain( diff, var, point, order );
+
+    const double *coefficients = diff->taylor.coefficients;
+
     Node_t *result = NUM_( 0 );
 
     for ( int cur_order = 0; cur_order <= order; cur_order++ ) {
-        DifferentiateExpression( diff, var, cur_order );
-
-        double value = EvaluateTree( diff->diff_tree, diff );
-        double coeff = value / Factorial( (uint)cur_order );
-        Node_t *coeff_node = NUM_( coeff );
+        Node_t *coeff_node = NUM_( coefficients[cur_order] );
 
         Node_t *term = NULL;
 
@@ -211,9 +464,11 @@ Tree_t *DifferentiatorBuildTaylorTree( Differentiator_t *diff, char var, double
 }
 
 #ifdef _DEBUG
-static Log_t DumpCtor() {
+const size_t DUMP_MAX_NODES = 300;
+
+static Log_t DumpCtor( const char *output_dir ) {
     Log_t logging = {};
-    logging.log_path = strdup( "dump" );
+    logging.log_path = MakePath( output_dir, "dump" );
 
     char buffer[MAX_LEN_PATH] = {};
 
@@ -237,6 +492,8 @@ static Log_t DumpCtor() {
 static void DumpDtor( Log_t *logging ) {
     my_assert( logging, "Null pointer on `logging" );
 
+    GraphicDumpWait();
+
     int fclose_result = fclose( logging->log_file );
     if ( fclose_result ) {
         PRINT_ERROR( "Fail to close file with logs \n" );
@@ -294,14 +551,28 @@ static void HandleDumpMode( Differentiator_t *diff, enum DumpMode mode ) {
     }
 }
 
+static const Node_t *DumpRepresentative( const Node_t *node, void *context ) {
+    return SharedSubtreesRepresentative( (const SharedSubtrees_t *)context, node );
+}
+
+// Big trees are drawn as a DAG of distinct subtrees and cut at DUMP_MAX_NODES.
 static void DumpExpressionTree( Differentiator_t *diff, Node_t *root, const char *title ) {
     if ( !root ) {
         PRINT_HTML( "Empty tree" );
         return;
     }
 
-    PRINT_HTML( "<pre>%s:</pre>\n", title );
-    NodeGraphicDump( root, "%s/image%lu.dot", diff->logging.img_log_path, diff->logging.image_number );
+    // Only the classes of equal subtrees are needed, nothing gets a name.
+    SharedSubtrees_t shared = {};
+    SharedSubtreesCtor( &shared, root, SIZE_MAX );
+
+    PRINT_HTML( "<pre>%s: %lu nodes, %lu distinct subtrees</pre>\n", title, shared.n_nodes, shared.n_classes );
+
+    GraphDumpOptions_t options = { DUMP_MAX_NODES, DumpRepresentative, &shared };
+    NodeGraphicDumpOptions( root, &options, "%s/image%lu.dot", diff->logging.img_log_path,
+                            diff->logging.image_number );
+
+    SharedSubtreesDtor( &shared );
 }
 
 static void PrintCustomMessage( Differentiator_t *diff, const char *format, va_list args ) {
@@ -316,36 +587,144 @@ static void PrintCustomMessage( Differentiator_t *diff, const char *format, va_l
 #undef PRINT_HTML
 #endif
 
-static Node_t *DifferentiateNode( Node_t *node, char independent_var, Differentiator_t *diff, int order );
+static Node_t *DifferentiateNode( Node_t *node, SymbolId independent_var, Differentiator_t *diff, int order,
+                                  bool parallel );
+
+// diff->diff_tree holds f^(order - 1) and becomes f^(order), optimized and
+// stored in the cache under `key`.
+static bool DifferentiateCachedStep( Differentiator_t *diff, SymbolId independent_var, int order, uint64_t key ) {
+    if ( !DifferentiateStep( diff, independent_var, order ) )
+        return false;
+
+    OptimizeTree( diff->diff_tree, diff, independent_var );
+    METRIC_TREE_SIZE( order, NodeCount( diff->diff_tree->root ) )
+
+    if ( diff->cache )
+        DerivativeCacheStoreTree( diff->cache, key, order, diff->diff_tree );
+
+    return true;
+}
 
-Tree_t *DifferentiateExpression( Differentiator_t *diff, char independent_var, int order ) {
+Tree_t *DifferentiateExpression( Differentiator_t *diff, SymbolId independent_var, int order ) {
     my_assert( diff, "Null pointer on diff" );
 
-    if ( diff->diff_tree && diff->diff_tree->root ) {
-        TreeDtor( &diff->diff_tree, NULL );
+    TreeDtor( &diff->diff_tree, NULL );
+
+    uint64_t key = 0;
+    int start_order = 0;
+    if ( diff->cache && order > 0 ) {
+        key = DerivativeCacheKey( diff, independent_var );
+
+        for ( start_order = order; start_order > 0; start_order-- ) {
+            Tree_t *cached = DerivativeCacheLoadTree( diff->cache, key, start_order );
+            if ( cached ) {
+                diff->diff_tree = cached;
+                break;
+            }
+        }
     }
-    diff->diff_tree = TreeCtor();
 
-    diff->diff_tree->root = NodeCopy( diff->expr_tree->root );
-    if ( !diff->diff_tree->root )
-        return NULL;
+    if ( start_order == 0 ) {
+        diff->diff_tree = TreeCtor();
+
+        diff->diff_tree->root = NodeCopy( diff->expr_tree->root );
+        if ( !diff->diff_tree->root )
+            return NULL;
+    }
+
+    for ( int idx = start_order + 1; idx <= order; idx++ ) {
+        if ( !DifferentiateCachedStep( diff, independent_var, idx, key ) )
+            return NULL;
+    }
+
+    return diff->diff_tree;
+}
 
-    for ( int idx = 1; idx <= order; idx++ ) {
-        Node_t *next_deriv = DifferentiateNode( diff->diff_tree->root, independent_var, diff, idx );
+Tree_t *DifferentiateNextOrder( Differentiator_t *diff, SymbolId independent_var, int order ) {
+    my_assert( diff, "Null pointer on diff" );
+    my_assert( diff->diff_tree, "Null pointer on `diff_tree`" );
 
-        NodeDelete( diff->diff_tree->root, NULL, NULL );
-        diff->diff_tree->root = next_deriv;
+    uint64_t key = 0;
+    if ( diff->cache ) {
+        key = DerivativeCacheKey( diff, independent_var );
 
-        if ( !diff->diff_tree->root ) {
-            PRINT_ERROR( "Differentiation failed at order %d\n", idx );
+        Tree_t *cached = DerivativeCacheLoadTree( diff->cache, key, order );
+        if ( cached ) {
             TreeDtor( &diff->diff_tree, NULL );
-            return NULL;
+            diff->diff_tree = cached;
+            return cached;
         }
+    }
+
+    return DifferentiateCachedStep( diff, independent_var, order, key ) ? diff->diff_tree : NULL;
+}
 
-        OptimizeTree( diff->diff_tree, diff, independent_var );
+CompiledExpr_t *CompileDerivative( Differentiator_t *diff, SymbolId independent_var, int order ) {
+    my_assert( diff, "Null pointer on diff" );
+    my_assert( diff->expr_tree, "Null pointer on `expr_tree`" );
+
+    if ( order == 0 )
+        return CompileTree( diff->expr_tree );
+
+    if ( diff->cache ) {
+        CompactTree_t compact = {};
+        if ( DerivativeCacheLoadCompact( diff->cache, DerivativeCacheKey( diff, independent_var ), order, &compact ) ) {
+            CompiledExpr_t *expr = CompileCompactTree( &compact );
+            CompactTreeUnload( &compact );
+            if ( expr )
+                return expr;
+        }
     }
 
-    return diff->diff_tree;
+    const Tree_t *tree = DifferentiateExpression( diff, independent_var, order );
+
+    return tree ? CompileTree( tree ) : NULL;
+}
+
+bool DifferentiateStep( Differentiator_t *diff, SymbolId independent_var, int order ) {
+    my_assert( diff, "Null pointer on diff" );
+    my_assert( diff->diff_tree, "Null pointer on `diff_tree`" );
+
+    if ( !DerivativeFitsBudget( diff, diff->diff_tree->root, independent_var, order ) ) {
+        TreeDtor( &diff->diff_tree, NULL );
+        return false;
+    }
+
+    METRIC_PHASE_BEGIN( PHASE_DIFFERENTIATE )
+    Node_t *next_deriv = DifferentiateNode( diff->diff_tree->root, independent_var, diff, order, diff->pool != NULL );
+    METRIC_PHASE_END( PHASE_DIFFERENTIATE )
+    METRIC_INC( METRIC_DERIVATIVE_STEPS )
+
+    NodeDelete( diff->diff_tree->root, NULL, NULL );
+    diff->diff_tree->root = next_deriv;
+
+    if ( !diff->diff_tree->root ) {
+        PRINT_ERROR( "Differentiation failed at order %d\n", order );
+        TreeDtor( &diff->diff_tree, NULL );
+        return false;
+    }
+
+    return true;
+}
+
+Tree_t *DifferentiateTree( Differentiator_t *diff, const Tree_t *tree, SymbolId independent_var ) {
+    my_assert( diff, "Null pointer on diff" );
+    my_assert( tree, "Null pointer on tree" );
+
+    if ( !DerivativeFitsBudget( diff, tree->root, independent_var, 1 ) )
+        return NULL;
+
+    Tree_t *result = TreeCtor();
+    result->root = DifferentiateNode( tree->root, independent_var, diff, 1, diff->pool != NULL );
+
+    if ( !result->root ) {
+        TreeDtor( &result, NULL );
+        return NULL;
+    }
+
+    OptimizeTree( result, diff, independent_var );
+
+    return result;
 }
 
 Node_t *MakeNode( OperationType op, Node_t *L, Node_t *R ) {
@@ -360,22 +739,108 @@ Node_t *MakeNode( OperationType op, Node_t *L, Node_t *R ) {
 }
 
 #define EXPLAIN                                                                                              \
-    fprintf( diff->latex.tex_file, "%s\n\n", GetJokeLine( (OperationType)node->value.data.operation ) );     \
-    fprintf( diff->latex.tex_file, "\\begin{align*} \n" );                                                   \
-    fprintf( diff->latex.tex_file, "\\begin{autobreak} \n" );                                                \
-    fprintf( diff->latex.tex_file, "\\frac{d}{dx}(" );                                                       \
-    NodeToLatex( node, diff->latex.tex_file );                                                               \
-    fprintf( diff->latex.tex_file, ") = " );                                                                 \
+    BufferPrintf( &diff->latex.output, "%s\n\n", GetJokeLine( (OperationType)node->value.data.operation ) ); \
+    BufferPrintf( &diff->latex.output, "\\begin{align*} \n" );                                               \
+    BufferPrintf( &diff->latex.output, "\\begin{autobreak} \n" );                                            \
+    BufferPrintf( &diff->latex.output, "\\frac{d}{dx}(" );                                                   \
+    NodeToLatex( node, &diff->latex.output );                                                                \
+    BufferPrintf( &diff->latex.output, ") = " );                                                             \
                                                                                                              \
-    NodeToLatex( result, diff->latex.tex_file );                                                             \
-    fprintf( diff->latex.tex_file, "\\end{autobreak} \n\n" );                                                \
-    fprintf( diff->latex.tex_file, "\\end{align*} \n\n" );
+    NodeToLatex( result, &diff->latex.output );                                                              \
+    BufferPrintf( &diff->latex.output, "\\end{autobreak} \n\n" );                                            \
+    BufferPrintf( &diff->latex.output, "\\end{align*} \n\n" );
+
+// ---------------------------- Parallel differentiation ---------------------------
+
+// The derivatives of the two operands never share a node, so above the cutoff
+// the right one is forked to the pool while this thread builds the left one.
+// Nodes come from the arena of whichever thread builds them, and the result is
+// the tree the sequential recursion builds. The probe doubles its bound, so the
+// decision costs about as much as the smaller operand; an operand found below
+// the cutoff is differentiated sequentially with no further probing.
+const size_t PARALLEL_CUTOFF = 2048;
+const size_t PARALLEL_PROBE  = 4;
+
+struct OperandDerivatives_t {
+    bool    forked;
+    Node_t *left;
+    Node_t *right;
+
+    bool left_parallel;
+    bool right_parallel;
+};
+
+struct DifferentiateTask_t {
+    Node_t           *node;
+    SymbolId          independent_var;
+    Differentiator_t *diff;
+    int               order;
+
+    Node_t *result;
+};
+
+// Counts the nodes of `node`, but stops at `limit`.
+static size_t NodeCountUpTo( const Node_t *node, size_t limit ) {
+    if ( !node || limit == 0 )
+        return 0;
+
+    size_t count = 1 + NodeCountUpTo( node->left, limit - 1 );
+    if ( count < limit )
+        count += NodeCountUpTo( node->right, limit - count );
 
-static Node_t *DifferentiateNode( Node_t *node, char independent_var, Differentiator_t *diff, int order ) {
+    return count;
+}
+
+static bool UsesBothDerivatives( OperationType op ) {
+    return op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV || op == OP_POW || op == OP_LOG;
+}
+
+static void DifferentiateTask( void *arg ) {
+    DifferentiateTask_t *task = (DifferentiateTask_t *)arg;
+
+    task->result = DifferentiateNode( task->node, task->independent_var, task->diff, task->order, true );
+}
+
+static void PlanOperands( Node_t *node, SymbolId independent_var, Differentiator_t *diff, int order,
+                          OperandDerivatives_t *operands ) {
+    operands->left_parallel = node->left != NULL;
+    operands->right_parallel = node->right != NULL;
+
+    for ( size_t bound = PARALLEL_PROBE; operands->left_parallel && operands->right_parallel; bound *= 2 ) {
+        if ( bound > PARALLEL_CUTOFF )
+            bound = PARALLEL_CUTOFF;
+
+        operands->left_parallel = NodeCountUpTo( node->left, bound ) >= bound;
+        operands->right_parallel = NodeCountUpTo( node->right, bound ) >= bound;
+
+        if ( bound == PARALLEL_CUTOFF )
+            break;
+    }
+
+    if ( !operands->left_parallel || !operands->right_parallel ||
+         !UsesBothDerivatives( (OperationType)node->value.data.operation ) )
+        return;
+
+    DifferentiateTask_t right = { node->right, independent_var, diff, order, NULL };
+    ThreadPoolGroup_t group = {};
+
+    ThreadPoolGroupSubmit( diff->pool, &group, DifferentiateTask, &right );
+    operands->left = DifferentiateNode( node->left, independent_var, diff, order, true );
+    ThreadPoolGroupWait( diff->pool, &group );
+
+    operands->right = right.result;
+    operands->forked = true;
+}
+
+// --------------------------------- Derivatives ---------------------------------
+
+static Node_t *DifferentiateNode( Node_t *node, SymbolId independent_var, Differentiator_t *diff, int order,
+                                  bool parallel ) {
     if ( !node )
         return NULL;
 
     Node_t *result = NULL;
+    OperandDerivatives_t operands = {};
 
     switch ( node->value.type ) {
         case NODE_NUMBER:
@@ -387,6 +852,9 @@ static Node_t *DifferentiateNode( Node_t *node, char independent_var, Differenti
             break;
 
         case NODE_OPERATION: {
+            if ( parallel )
+                PlanOperands( node, independent_var, diff, order, &operands );
+
             switch ( node->value.data.operation ) {
                 case OP_ADD:
                     result = ADD_( dL, dR );
@@ -417,7 +885,7 @@ static Node_t *DifferentiateNode( Node_t *node, char independent_var, Differenti
                             MUL_( MUL_( POW_( NUM_( a ), cR ), MakeNode( OP_LN, NUM_( a ), NULL ) ), dR );
                         break;
                     }
-                    result = MUL_( POW_( cL, cR ), ADD_( MUL_( dR, MakeNode( OP_LOG, cL, NULL ) ),
+                    result = MUL_( POW_( cL, cR ), ADD_( MUL_( dR, MakeNode( OP_LN, cL, NULL ) ),
                                                          MUL_( cR, DIV_( dL, cL ) ) ) );
                     break;
                 }
@@ -427,9 +895,10 @@ static Node_t *DifferentiateNode( Node_t *node, char independent_var, Differenti
                         result = DIV_( dL, cL );
                         break;
                     }
-                    result = DIV_( SUB_( MUL_( dR, MakeNode( OP_LOG, cL, NULL ) ),
-                                         MUL_( dL, MakeNode( OP_LOG, cR, NULL ) ) ),
-                                   MUL_( cR, MakeNode( OP_LOG, cL, NULL ) ) );
+                    // log(u, v) = ln u / ln v
+                    result = DIV_( SUB_( DIV_( dL, cL ), DIV_( MUL_( dR, MakeNode( OP_LN, cL, NULL ) ),
+                                                               MUL_( cR, MakeNode( OP_LN, cR, NULL ) ) ) ),
+                                   MakeNode( OP_LN, cR, NULL ) );
                     break;
 
                 case OP_LN:
@@ -437,7 +906,7 @@ static Node_t *DifferentiateNode( Node_t *node, char independent_var, Differenti
                     break;
 
                 case OP_SIN:
-                    result = MUL_( SIN_( cL ), dL );
+                    result = MUL_( COS_( cL ), dL );
                     break;
                 case OP_COS:
                     result = MUL_( NUM_( -1 ), MUL_( SIN_( cL ), dL ) );
@@ -457,11 +926,11 @@ static Node_t *DifferentiateNode( Node_t *node, char independent_var, Differenti
                     break;
 
                 case OP_ARCSIN:
-                    result = DIV_( dL, POW_( SUB_( NUM_( 1 ), POW_( cL, NUM_( 2 ) ) ), NUM_( -1 ) ) );
+                    result = DIV_( dL, POW_( SUB_( NUM_( 1 ), POW_( cL, NUM_( 2 ) ) ), NUM_( 0.5 ) ) );
                     break;
                 case OP_ARCCOS:
                     result = MUL_( NUM_( -1 ),
-                                   DIV_( dL, POW_( SUB_( NUM_( 1 ), POW_( cL, NUM_( 2 ) ) ), NUM_( -1 ) ) ) );
+                                   DIV_( dL, POW_( SUB_( NUM_( 1 ), POW_( cL, NUM_( 2 ) ) ), NUM_( 0.5 ) ) ) );
                     break;
                 case OP_ARCTAN:
                     result = DIV_( dL, ADD_( NUM_( 1 ), POW_( cL, NUM_( 2 ) ) ) );
@@ -470,6 +939,16 @@ static Node_t *DifferentiateNode( Node_t *node, char independent_var, Differenti
                     result = MUL_( NUM_( -1 ), DIV_( dL, ADD_( NUM_( 1 ), POW_( cL, NUM_( 2 ) ) ) ) );
                     break;
 
+                case OP_ARSINH:
+                    result = DIV_( dL, POW_( ADD_( POW_( cL, NUM_( 2 ) ), NUM_( 1 ) ), NUM_( 0.5 ) ) );
+                    break;
+                case OP_ARCH:
+                    result = DIV_( dL, POW_( SUB_( POW_( cL, NUM_( 2 ) ), NUM_( 1 ) ), NUM_( 0.5 ) ) );
+                    break;
+                case OP_ARTANH:
+                    result = DIV_( dL, SUB_( NUM_( 1 ), POW_( cL, NUM_( 2 ) ) ) );
+                    break;
+
                 default:
                     PRINT_ERROR( "Unknown operation in differentiation!\n" );
                     result = NULL;
@@ -510,7 +989,7 @@ TreeData_t MakeOperation( OperationType operation ) {
     return value;
 }
 
-TreeData_t MakeVariable( char variable ) {
+TreeData_t MakeVariable( SymbolId variable ) {
     TreeData_t value = {};
 
     value.type = NODE_VARIABLE;
@@ -0,0 +1,456 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "ThreadPool.h"
+#include "Tree.h"
+#include "TreeBinary.h"
+
+// A tree is compiled into a post-order program over a value stack. Variables
+// are resolved to dense slots at compile time, so evaluation does no lookups.
+// A missing child of an operation that reads it evaluates to zero, exactly as
+// EvaluateTree does.
+// The records of a compact tree are already in post-order, so it is compiled
+// straight from its mapping: the code of a child that is never read is cut off
+// and a missing child is filled in with zero.
+
+const size_t BATCH_CHUNK     = 256;
+const size_t CHUNKS_PER_TASK = 16;
+const size_t SMALL_STACK     = 64;
+
+// `slots[id]` is the slot of symbol `id` plus one, or zero before its first use.
+struct Compiler_t {
+    CompiledExpr_t *expr;
+    size_t          capacity;
+    size_t          variables_capacity;
+
+    size_t *slots;
+    size_t  slots_size;
+};
+
+// A compiled subtree of a compact tree: where its code starts and its stack depth.
+struct CompactSubtree_t {
+    size_t start;
+    size_t depth;
+};
+
+struct CompactCompiler_t {
+    Compiler_t        compiler;
+    CompactSubtree_t *subtrees;
+    size_t            top;
+};
+
+static void EmitInstruction( Compiler_t *compiler, Instruction_t instruction ) {
+    CompiledExpr_t *expr = compiler->expr;
+
+    if ( expr->size >= compiler->capacity ) {
+        compiler->capacity = compiler->capacity ? compiler->capacity * 2 : 32;
+        expr->code = (Instruction_t *)realloc( expr->code, compiler->capacity * sizeof( Instruction_t ) );
+        assert( expr->code && "Memory allocation error" );
+    }
+
+    expr->code[expr->size++] = instruction;
+}
+
+static void InsertInstruction( Compiler_t *compiler, size_t position, Instruction_t instruction ) {
+    CompiledExpr_t *expr = compiler->expr;
+
+    EmitInstruction( compiler, instruction );
+    memmove( expr->code + position + 1, expr->code + position, ( expr->size - 1 - position ) * sizeof( Instruction_t ) );
+    expr->code[position] = instruction;
+}
+
+static size_t GetVariableSlot( Compiler_t *compiler, SymbolId name ) {
+    CompiledExpr_t *expr = compiler->expr;
+
+    if ( name >= compiler->slots_size ) {
+        size_t new_size = compiler->slots_size ? compiler->slots_size : 16;
+        while ( new_size <= name )
+            new_size *= 2;
+
+        compiler->slots = (size_t *)realloc( compiler->slots, new_size * sizeof( size_t ) );
+        assert( compiler->slots && "Memory allocation error" );
+        memset( compiler->slots + compiler->slots_size, 0, ( new_size - compiler->slots_size ) * sizeof( size_t ) );
+        compiler->slots_size = new_size;
+    }
+
+    if ( compiler->slots[name] )
+        return compiler->slots[name] - 1;
+
+    if ( expr->n_variables >= compiler->variables_capacity ) {
+        compiler->variables_capacity = compiler->variables_capacity ? compiler->variables_capacity * 2 : 4;
+        expr->variables = (SymbolId *)realloc( expr->variables, compiler->variables_capacity * sizeof( SymbolId ) );
+        assert( expr->variables && "Memory allocation error" );
+    }
+
+    expr->variables[expr->n_variables] = name;
+    compiler->slots[name] = expr->n_variables + 1;
+    return expr->n_variables++;
+}
+
+static size_t CompileNode( Compiler_t *compiler, const Node_t *node ) {
+    Instruction_t instruction = {};
+
+    if ( !node ) {
+        instruction.type = NODE_NUMBER;
+        instruction.number = 0.0;
+        EmitInstruction( compiler, instruction );
+        return 1;
+    }
+
+    instruction.type = node->value.type;
+
+    switch ( node->value.type ) {
+        case NODE_NUMBER:
+            instruction.number = node->value.data.number;
+            EmitInstruction( compiler, instruction );
+            return 1;
+
+        case NODE_VARIABLE:
+            instruction.slot = GetVariableSlot( compiler, node->value.data.variable );
+            EmitInstruction( compiler, instruction );
+            return 1;
+
+        case NODE_OPERATION: {
+            instruction.operation = node->value.data.operation;
+
+            size_t left_depth = CompileNode( compiler, node->left );
+            size_t right_depth = 0;
+            if ( operation_args[instruction.operation] == TWO_ARGS )
+                right_depth = CompileNode( compiler, node->right ) + 1;
+
+            EmitInstruction( compiler, instruction );
+            return left_depth > right_depth ? left_depth : right_depth;
+        }
+
+        case NODE_UNKNOWN:
+        default:
+            instruction.type = NODE_NUMBER;
+            instruction.number = NAN;
+            EmitInstruction( compiler, instruction );
+            return 1;
+    }
+}
+
+CompiledExpr_t *CompileTree( const Tree_t *tree ) {
+    my_assert( tree, "Null pointer on `tree`" );
+
+    Compiler_t compiler = {};
+    compiler.expr = (CompiledExpr_t *)calloc( 1, sizeof( CompiledExpr_t ) );
+    assert( compiler.expr && "Memory allocation error" );
+
+    compiler.expr->stack_size = CompileNode( &compiler, tree->root );
+    free( compiler.slots );
+
+    PRINT( "Compiled %lu instructions, stack %lu, %lu variables", compiler.expr->size,
+           compiler.expr->stack_size, compiler.expr->n_variables );
+
+    return compiler.expr;
+}
+
+static void CompileRecord( const TreeData_t *value, bool has_left, bool has_right, void *arg ) {
+    CompactCompiler_t *state = (CompactCompiler_t *)arg;
+    Compiler_t *compiler = &state->compiler;
+    CompiledExpr_t *expr = compiler->expr;
+
+    CompactSubtree_t left = {}, right = {};
+    if ( has_right )
+        right = state->subtrees[--state->top];
+    if ( has_left )
+        left = state->subtrees[--state->top];
+
+    size_t start = has_left ? left.start : has_right ? right.start : expr->size;
+
+    Instruction_t zero = {};
+    zero.type = NODE_NUMBER;
+
+    Instruction_t instruction = {};
+    instruction.type = value->type;
+    size_t depth = 1;
+
+    switch ( value->type ) {
+        case NODE_NUMBER:
+            expr->size = start;
+            instruction.number = value->data.number;
+            EmitInstruction( compiler, instruction );
+            break;
+
+        case NODE_VARIABLE:
+            expr->size = start;
+            instruction.slot = GetVariableSlot( compiler, value->data.variable );
+            EmitInstruction( compiler, instruction );
+            break;
+
+        case NODE_OPERATION: {
+            instruction.operation = value->data.operation;
+            bool two_args = operation_args[instruction.operation] == TWO_ARGS;
+
+            if ( has_right && !two_args )
+                expr->size = right.start;
+            if ( !has_left ) {
+                InsertInstruction( compiler, start, zero );
+                left.depth = 1;
+            }
+
+            depth = left.depth;
+            if ( two_args ) {
+                if ( !has_right ) {
+                    EmitInstruction( compiler, zero );
+                    right.depth = 1;
+                }
+                depth = ( left.depth > right.depth + 1 ) ? left.depth : right.depth + 1;
+            }
+
+            EmitInstruction( compiler, instruction );
+            break;
+        }
+
+        case NODE_UNKNOWN:
+        default:
+            expr->size = start;
+            instruction.type = NODE_NUMBER;
+            instruction.number = NAN;
+            EmitInstruction( compiler, instruction );
+            break;
+    }
+
+    state->subtrees[state->top++] = { start, depth };
+}
+
+CompiledExpr_t *CompileCompactTree( const CompactTree_t *compact ) {
+    my_assert( compact, "Null pointer on `compact`" );
+
+    CompactCompiler_t state = {};
+    state.compiler.expr = (CompiledExpr_t *)calloc( 1, sizeof( CompiledExpr_t ) );
+    assert( state.compiler.expr && "Memory allocation error" );
+    state.subtrees = (CompactSubtree_t *)calloc( compact->n_nodes + 1, sizeof( CompactSubtree_t ) );
+    assert( state.subtrees && "Memory allocation error" );
+
+    bool ok = CompactTreeWalk( compact, CompileRecord, &state );
+
+    // An empty tree evaluates to zero, as in CompileTree.
+    if ( state.top == 0 ) {
+        Instruction_t zero = {};
+        zero.type = NODE_NUMBER;
+        EmitInstruction( &state.compiler, zero );
+        state.subtrees[state.top++] = { 0, 1 };
+    }
+
+    CompiledExpr_t *expr = state.compiler.expr;
+    expr->stack_size = state.subtrees[0].depth;
+
+    free( state.compiler.slots );
+    free( state.subtrees );
+
+    if ( !ok ) {
+        CompiledExprDtor( &expr );
+        return NULL;
+    }
+
+    PRINT( "Compiled %lu instructions from a compact tree, stack %lu, %lu variables", expr->size, expr->stack_size,
+           expr->n_variables );
+
+    return expr;
+}
+
+void CompiledExprDtor( CompiledExpr_t **expr ) {
+    my_assert( expr, "Null pointer on pointer on `expr`" );
+    if ( *expr == NULL )
+        return;
+
+    free( ( *expr )->code );
+    free( ( *expr )->variables );
+    free( *expr );
+    *expr = NULL;
+}
+
+size_t CompiledExprSlot( const CompiledExpr_t *expr, SymbolId name ) {
+    my_assert( expr, "Null pointer on `expr`" );
+
+    for ( size_t idx = 0; idx < expr->n_variables; idx++ ) {
+        if ( expr->variables[idx] == name )
+            return idx;
+    }
+
+    return expr->n_variables;
+}
+
+bool CompiledExprBind( const CompiledExpr_t *expr, const VarTable_t *table, double *values ) {
+    my_assert( expr, "Null pointer on `expr`" );
+    my_assert( values, "Null pointer on `values`" );
+
+    bool all_found = true;
+    for ( size_t idx = 0; idx < expr->n_variables; idx++ ) {
+        if ( !VarTableGet( table, expr->variables[idx], &values[idx] ) ) {
+            values[idx] = NAN;
+            all_found = false;
+        }
+    }
+
+    return all_found;
+}
+
+double CompiledExprEvaluate( const CompiledExpr_t *expr, const double *values ) {
+    my_assert( expr, "Null pointer on `expr`" );
+
+    double small_stack[SMALL_STACK] = {};
+    double *stack = small_stack;
+    if ( expr->stack_size > SMALL_STACK ) {
+        stack = (double *)calloc( expr->stack_size, sizeof( double ) );
+        assert( stack && "Memory allocation error" );
+    }
+
+    size_t top = 0;
+
+    for ( size_t idx = 0; idx < expr->size; idx++ ) {
+        const Instruction_t *instruction = &expr->code[idx];
+
+        switch ( instruction->type ) {
+            case NODE_NUMBER:
+                stack[top++] = instruction->number;
+                break;
+            case NODE_VARIABLE:
+                stack[top++] = values[instruction->slot];
+                break;
+            case NODE_OPERATION:
+                if ( operation_args[instruction->operation] == TWO_ARGS ) {
+                    top--;
+                    stack[top - 1] =
+                        EvaluateOperation( (OperationType)instruction->operation, stack[top - 1], stack[top] );
+                } else {
+                    stack[top - 1] = EvaluateOperation( (OperationType)instruction->operation, stack[top - 1], 0.0 );
+                }
+                break;
+            case NODE_UNKNOWN:
+            default:
+                stack[top++] = NAN;
+                break;
+        }
+    }
+
+    double result = top ? stack[0] : 0.0;
+
+    if ( stack != small_stack )
+        free( stack );
+
+    return result;
+}
+
+static void EvaluateChunk( const CompiledExpr_t *expr, size_t slot, const double *points, size_t n_points,
+                           const double *values, double *stack ) {
+    size_t top = 0;
+
+    for ( size_t idx = 0; idx < expr->size; idx++ ) {
+        const Instruction_t *instruction = &expr->code[idx];
+        double *column = stack + top * BATCH_CHUNK;
+
+        switch ( instruction->type ) {
+            case NODE_NUMBER:
+                for ( size_t point = 0; point < n_points; point++ )
+                    column[point] = instruction->number;
+                top++;
+                break;
+
+            case NODE_VARIABLE:
+                if ( instruction->slot == slot ) {
+                    memcpy( column, points, n_points * sizeof( double ) );
+                } else {
+                    double value = values ? values[instruction->slot] : NAN;
+                    for ( size_t point = 0; point < n_points; point++ )
+                        column[point] = value;
+                }
+                top++;
+                break;
+
+            case NODE_OPERATION: {
+                OperationType op = (OperationType)instruction->operation;
+
+                if ( operation_args[op] == TWO_ARGS ) {
+                    double *left = column - 2 * BATCH_CHUNK;
+                    double *right = column - BATCH_CHUNK;
+
+                    switch ( op ) {
+                        case OP_ADD:
+                            for ( size_t point = 0; point < n_points; point++ )
+                                left[point] += right[point];
+                            break;
+                        case OP_SUB:
+                            for ( size_t point = 0; point < n_points; point++ )
+                                left[point] -= right[point];
+                            break;
+                        case OP_MUL:
+                            for ( size_t point = 0; point < n_points; point++ )
+                                left[point] *= right[point];
+                            break;
+                        case OP_DIV:
+                            for ( size_t point = 0; point < n_points; point++ )
+                                left[point] /= right[point];
+                            break;
+                        default:
+                            for ( size_t point = 0; point < n_points; point++ )
+                                left[point] = EvaluateOperation( op, left[point], right[point] );
+                            break;
+                    }
+                    top--;
+                } else {
+                    double *arg = column - BATCH_CHUNK;
+                    for ( size_t point = 0; point < n_points; point++ )
+                        arg[point] = EvaluateOperation( op, arg[point], 0.0 );
+                }
+                break;
+            }
+
+            case NODE_UNKNOWN:
+            default:
+                for ( size_t point = 0; point < n_points; point++ )
+                    column[point] = NAN;
+                top++;
+                break;
+        }
+    }
+}
+
+struct BatchRange_t {
+    const CompiledExpr_t *expr;
+    size_t                slot;
+    const double         *points;
+    const double         *values;
+    double               *results;
+};
+
+// Every range has its own stack, so ranges may run on different workers.
+static void EvaluateRange( void *arg, size_t begin, size_t end ) {
+    const BatchRange_t *range = (const BatchRange_t *)arg;
+    const CompiledExpr_t *expr = range->expr;
+
+    double *stack = (double *)calloc( expr->stack_size * BATCH_CHUNK, sizeof( double ) );
+    assert( stack && "Memory allocation error" );
+
+    for ( size_t start = begin; start < end; start += BATCH_CHUNK ) {
+        size_t chunk = ( end - start < BATCH_CHUNK ) ? end - start : BATCH_CHUNK;
+
+        EvaluateChunk( expr, range->slot, range->points + start, chunk, range->values, stack );
+        memcpy( range->results + start, stack, chunk * sizeof( double ) );
+    }
+
+    free( stack );
+}
+
+void CompiledExprEvaluateBatch( const CompiledExpr_t *expr, size_t slot, const double *points, size_t n_points,
+                                const double *values, double *results, ThreadPool_t *pool ) {
+    my_assert( expr, "Null pointer on `expr`" );
+    my_assert( points || n_points == 0, "Null pointer on `points`" );
+    my_assert( results || n_points == 0, "Null pointer on `results`" );
+
+    if ( expr->size == 0 ) {
+        for ( size_t idx = 0; idx < n_points; idx++ )
+            results[idx] = 0.0;
+        return;
+    }
+
+    BatchRange_t range = { expr, slot, points, values, results };
+    ThreadPoolParallelFor( pool, n_points, BATCH_CHUNK * CHUNKS_PER_TASK, EvaluateRange, &range );
+}
@@ -0,0 +1,144 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "Tree.h"
+
+// Random expressions for benchmarks. A node gets a budget of nodes, an
+// operation splits what is left between its children, so the tree has exactly
+// `n_nodes` nodes unless `max_depth` cuts a branch short.
+
+#define OPERATION_NAME( str, ... ) str,
+
+static const char *const operation_names[] = { INIT_OPERATIONS( OPERATION_NAME ) };
+
+#undef OPERATION_NAME
+
+static const int  N_OPERATIONS        = (int)( sizeof( operation_args ) / sizeof( operation_args[0] ) );
+static const char GENERATOR_VARIABLES[] = "xyzuvwabpq";
+
+static uint64_t GeneratorNext( ExpressionGenerator_t *generator ) {
+    // xorshift64*
+    generator->state ^= generator->state >> 12;
+    generator->state ^= generator->state << 25;
+    generator->state ^= generator->state >> 27;
+
+    return generator->state * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t GeneratorBelow( ExpressionGenerator_t *generator, size_t bound ) {
+    return GeneratorNext( generator ) % bound;
+}
+
+static Node_t *GenerateLeaf( ExpressionGenerator_t *generator ) {
+    size_t n_variables = generator->n_variables ? generator->n_variables : 1;
+    if ( n_variables > sizeof( GENERATOR_VARIABLES ) - 1 )
+        n_variables = sizeof( GENERATOR_VARIABLES ) - 1;
+
+    if ( GeneratorBelow( generator, 3 ) ) {
+        const char *variable = GENERATOR_VARIABLES + GeneratorBelow( generator, n_variables );
+        return NodeCreate( MakeVariable( SymbolIntern( variable, 1 ) ), NULL );
+    }
+
+    // Small numbers with at most two decimal places read back exactly from text.
+    double number = (double)( 1 + GeneratorBelow( generator, 40 ) ) / 4;
+    return NodeCreate( MakeNumber( number ), NULL );
+}
+
+static Node_t *GenerateNode( ExpressionGenerator_t *generator, size_t budget, size_t depth ) {
+    if ( budget <= 1 || depth >= generator->max_depth )
+        return GenerateLeaf( generator );
+
+    OperationType op = (OperationType)GeneratorBelow( generator, (size_t)N_OPERATIONS );
+    if ( budget == 2 ) {
+        while ( operation_args[op] != ONE_ARG )
+            op = (OperationType)GeneratorBelow( generator, (size_t)N_OPERATIONS );
+    }
+
+    if ( operation_args[op] == ONE_ARG )
+        return MakeNode( op, GenerateNode( generator, budget - 1, depth + 1 ), NULL );
+
+    size_t left_budget = 1 + GeneratorBelow( generator, budget - 2 );
+    Node_t *left = GenerateNode( generator, left_budget, depth + 1 );
+    Node_t *right = GenerateNode( generator, budget - 1 - left_budget, depth + 1 );
+
+    return MakeNode( op, left, right );
+}
+
+void ExpressionGeneratorCtor( ExpressionGenerator_t *generator, size_t n_nodes, size_t max_depth,
+                              size_t n_variables, uint64_t seed ) {
+    my_assert( generator, "Null pointer on `generator`" );
+
+    generator->n_nodes = n_nodes ? n_nodes : 1;
+    generator->max_depth = max_depth ? max_depth : SIZE_MAX;
+    generator->n_variables = n_variables;
+    generator->state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+Tree_t *GenerateExpression( ExpressionGenerator_t *generator ) {
+    my_assert( generator, "Null pointer on `generator`" );
+
+    Tree_t *tree = TreeCtor();
+    tree->root = GenerateNode( generator, generator->n_nodes, 0 );
+
+    return tree;
+}
+
+// Every operation is put in brackets, so the parser reads back the same tree.
+static void WriteInfixNode( const Node_t *node, OutputBuffer_t *output ) {
+    switch ( node->value.type ) {
+        case NODE_NUMBER:
+            if ( node->value.data.number < 0 ) {
+                BufferPutChar( output, '(' );
+                BufferPutDouble( output, node->value.data.number );
+                BufferPutChar( output, ')' );
+            } else {
+                BufferPutDouble( output, node->value.data.number );
+            }
+            break;
+
+        case NODE_VARIABLE:
+            BufferPutString( output, SymbolName( node->value.data.variable ) );
+            break;
+
+        case NODE_OPERATION: {
+            int op = node->value.data.operation;
+            if ( operation_args[op] == ONE_ARG ) {
+                BufferPrintf( output, "%s(", operation_names[op] );
+                WriteInfixNode( node->left, output );
+                BufferPutChar( output, ')' );
+            } else if ( op == OP_LOG ) {
+                BufferPutString( output, "log(" );
+                WriteInfixNode( node->left, output );
+                BufferPutString( output, ", " );
+                WriteInfixNode( node->right, output );
+                BufferPutChar( output, ')' );
+            } else {
+                BufferPutChar( output, '(' );
+                WriteInfixNode( node->left, output );
+                BufferPrintf( output, " %s ", operation_names[op] );
+                WriteInfixNode( node->right, output );
+                BufferPutChar( output, ')' );
+            }
+            break;
+        }
+
+        case NODE_UNKNOWN:
+        default:
+            BufferPutChar( output, '?' );
+            break;
+    }
+}
+
+bool ExpressionWriteText( const Tree_t *tree, OutputBuffer_t *output ) {
+    my_assert( tree, "Null pointer on `tree`" );
+    my_assert( output, "Null pointer on `output`" );
+
+    if ( tree->root )
+        WriteInfixNode( tree->root, output );
+    BufferPutString( output, " $" );
+
+    return !output->error;
+}
@@ -5,385 +5,347 @@
 
 #include "DebugUtils.h"
 #include "Differentiator.h"
+#include "Lexer.h"
+#include "Metrics.h"
 #include "Tree.h"
 
-static Node_t *GetGrammar( char **cur_pos, Node_t *parent, bool *error );
-static Node_t *GetExpression( char **cur_pos, Node_t *parent, bool *error );
-static Node_t *GetTerm( char **cur_pos, Node_t *parent, bool *error );
-static Node_t *GetPrimary( char **cur_pos, Node_t *parent, bool *error );
-static Node_t *GetPow( char **cur_pos, Node_t *parent, bool *error );
-static Node_t *GetNumber( char **cur_pos, Node_t *parent, bool *error );
-static Node_t *GetFunction( char **cur_pos, Node_t *parent, bool *error );
-static Node_t *GetVariable( char **cur_pos, Node_t *parent, bool *error );
+static Node_t *ParseTokens( TokenStream_t *tokens, bool *error );
+static Tree_t *ParseExpression( Differentiator_t *diff );
 
 Tree_t *ExpressionParser( Differentiator_t *diff ) {
     my_assert( diff, "Null pointer on `diff`" );
 
-    Tree_t *tree = TreeCtor();
+    METRIC_PHASE_BEGIN( PHASE_PARSE )
+    Tree_t *tree = ParseExpression( diff );
+    METRIC_PHASE_END( PHASE_PARSE )
 
-    char *current_position = diff->expr_info.buffer;
-    bool error = false;
-    tree->root = GetGrammar( &current_position, NULL, &error );
+    return tree;
+}
 
-    if ( error ) {
+static Tree_t *ParseExpression( Differentiator_t *diff ) {
+    TokenStream_t tokens = {};
+    if ( !LexerTokenize( diff->expr_info.buffer, &tokens ) ) {
         PRINT_ERROR( "The expression was not considered correct." );
-        TreeDtor( &tree, NULL );
+        TokenStreamDtor( &tokens );
         return NULL;
     }
 
-    PRINT( "Cur_pos: `%s`", current_position );
+    Tree_t *tree = TreeCtor();
 
-    SkipSpaces( &( current_position ) );
+    bool error = false;
+    tree->root = ParseTokens( &tokens, &error );
 
-    int scanf_result = sscanf( current_position, "%lf %lf & %lf %lf & %lf & %d",
-                               &(diff->plot_x_min), &(diff->plot_x_max), &(diff->plot_y_min), &(diff->plot_y_max),
-                               &(diff->x_0), &(diff->extent) );
+    char *current_position = diff->expr_info.buffer + tokens.end_offset;
+    TokenStreamDtor( &tokens );
 
-    if ( scanf_result == 6 ) {
-        PRINT( "OK" );
-    } else {
-        PRINT( "NOT OK" );
+    if ( error ) {
+        PRINT_ERROR( "The expression was not considered correct." );
+        TreeDtor( &tree, NULL );
+        return NULL;
     }
 
-    PRINT( "y_min = %g; y_max = %g", diff->plot_y_min, diff->plot_y_max );
-    PRINT( "x_min = %g; x_max = %g", diff->plot_x_min, diff->plot_x_max );
-    PRINT( "x_0 = %g; extent = %d", diff->x_0, diff->extent );
+    diff->expr_info.current_position = current_position;
+    PRINT( "Cur_pos: `%s`", current_position );
 
     PRINT( "The expression was considered correct." );
     return tree;
 }
 
-#define SyntaxError( string )                                                                                \
-    PRINT_ERROR( "Syntax error in `%s` %s:%d --- `%s`\n", __func__, __FILE__, __LINE__, *string );           \
+// Precedence climbing over the token stream with explicit operand and
+// operator stacks, so the parser itself never runs out of native stack.
+// Nodes are linked into the final tree as they are reduced; every operand
+// carries the depth of its tree, which is capped at EXPRESSION_MAX_DEPTH for
+// the recursive passes that follow.
+
+enum StackEntryKind {
+    ENTRY_BINARY   = 0,
+    ENTRY_BRACKET  = 1,
+    ENTRY_FUNCTION = 2
+};
+
+struct OperatorEntry_t {
+    enum StackEntryKind kind;
+    OperationType       operation;
+    int                 args_read;
+    const char         *position;
+};
+
+struct ParserStacks_t {
+    Node_t **operands;
+    size_t  *depths;
+    size_t   operands_size;
+    size_t   operands_capacity;
+    bool     too_deep;
+
+    OperatorEntry_t *operators;
+    size_t           operators_size;
+    size_t           operators_capacity;
+};
+
+#define SyntaxError( token )                                                                                 \
+    PRINT_ERROR( "Syntax error in `%s` %s:%d --- `%s`\n", __func__, __FILE__, __LINE__, ( token )->position ); \
     *error = true;
 
-#define DEBUG_PRINT_PARSE PRINT( "%s ~ Current position: `%s`", __func__, *cur_pos );
+#define OPERATION_ARGS( str, name, value, is_function, num_args, ... ) ( is_function == Function ? num_args : ZERO_ARG ),
 
-static Node_t *GetGrammar( char **cur_pos, Node_t *parent, bool *error ) {
-    my_assert( cur_pos, "Null pointer on `cur_pos`" );
-    my_assert( *cur_pos, "Null pointer on `*cur_pos`" );
-    my_assert( error, "Null pointer on `error`" );
-
-    SkipSpaces( cur_pos );
+static const int args_count[] = { INIT_OPERATIONS( OPERATION_ARGS ) };
 
-    Node_t *node = GetExpression( cur_pos, parent, error );
+#undef OPERATION_ARGS
 
-    SkipSpaces( cur_pos );
-
-    if ( **cur_pos != '$' ) {
-        SyntaxError( cur_pos );
+static int GetBinaryPriority( OperationType op ) {
+    switch ( op ) {
+        case OP_ADD:
+        case OP_SUB:
+            return 1;
+        case OP_MUL:
+        case OP_DIV:
+            return 2;
+        case OP_POW:
+            return 3;
+        default:
+            return 0;
     }
-
-    ( *cur_pos )++;
-
-    return node;
 }
 
-static Node_t *GetExpression( char **cur_pos, Node_t *parent, bool *error ) {
-    my_assert( cur_pos, "Null pointer on `cur_pos`" );
-    my_assert( *cur_pos, "Null pointer on `*cur_pos`" );
-    my_assert( error, "Null pointer on `error`" );
-
-    SkipSpaces( cur_pos );
-
-    DEBUG_PRINT_PARSE;
-
-    Node_t *node = GetTerm( cur_pos, parent, error );
-
-    SkipSpaces( cur_pos );
-
-    while ( **cur_pos == '+' || **cur_pos == '-' ) {
-        TreeData_t op_value = {};
-        op_value.type = NODE_OPERATION;
-        op_value.data.operation = ( **cur_pos == '+' ) ? OP_ADD : OP_SUB;
-        ( *cur_pos )++;
-
-        SkipSpaces( cur_pos );
-
-        Node_t *new_root = NodeCreate( op_value, parent );
-        new_root->left = node;
-        node->parent = new_root;
+static bool IsRightAssociative( OperationType op ) {
+    return op == OP_POW;
+}
 
-        SkipSpaces( cur_pos );
+static bool PushOperand( ParserStacks_t *stacks, Node_t *node ) {
+    if ( stacks->operands_size >= stacks->operands_capacity ) {
+        size_t new_capacity = stacks->operands_capacity ? stacks->operands_capacity * 2 : 32;
+        Node_t **new_operands = (Node_t **)realloc( stacks->operands, new_capacity * sizeof( Node_t * ) );
+        if ( !new_operands )
+            return false;
+        stacks->operands = new_operands;
 
-        Node_t *right = GetTerm( cur_pos, new_root, error );
-        new_root->right = right;
+        size_t *new_depths = (size_t *)realloc( stacks->depths, new_capacity * sizeof( size_t ) );
+        if ( !new_depths )
+            return false;
+        stacks->depths = new_depths;
 
-        node = new_root;
+        stacks->operands_capacity = new_capacity;
     }
 
-    return node;
+    stacks->depths[stacks->operands_size] = 1;
+    stacks->operands[stacks->operands_size++] = node;
+    return true;
 }
 
-static Node_t *GetPow( char **cur_pos, Node_t *parent, bool *error ) {
-    my_assert( cur_pos, "Null pointer on `cur_pos`" );
-    my_assert( *cur_pos, "Null pointer on `*cur_pos`" );
-    my_assert( error, "Null pointer on `error`" );
-
-    SkipSpaces( cur_pos );
-
-    DEBUG_PRINT_PARSE;
-
-    Node_t *node = GetPrimary( cur_pos, parent, error );
-
-    SkipSpaces( cur_pos );
+static bool PushOperator( ParserStacks_t *stacks, OperatorEntry_t entry ) {
+    if ( stacks->operators_size >= stacks->operators_capacity ) {
+        size_t new_capacity = stacks->operators_capacity ? stacks->operators_capacity * 2 : 32;
+        OperatorEntry_t *new_operators =
+            (OperatorEntry_t *)realloc( stacks->operators, new_capacity * sizeof( OperatorEntry_t ) );
+        if ( !new_operators )
+            return false;
 
-    if ( **cur_pos == '^' ) {
-        ( *cur_pos )++;
-
-        TreeData_t op_value = {};
-        op_value.type = NODE_OPERATION;
-        op_value.data.operation = OP_POW;
-
-        SkipSpaces( cur_pos );
-
-        Node_t *new_root = NodeCreate( op_value, parent );
-        new_root->left = node;
-        node->parent = new_root;
-
-        SkipSpaces( cur_pos );
-
-        Node_t *right = GetPow( cur_pos, new_root, error );
-        new_root->right = right;
-
-        node = new_root;
+        stacks->operators = new_operators;
+        stacks->operators_capacity = new_capacity;
     }
 
-    return node;
+    stacks->operators[stacks->operators_size++] = entry;
+    return true;
 }
 
-static Node_t *GetTerm( char **cur_pos, Node_t *parent, bool *error ) {
-    my_assert( cur_pos, "Null pointer on `cur_pos`" );
-    my_assert( *cur_pos, "Null pointer on `*cur_pos`" );
-    my_assert( error, "Null pointer on `error`" );
-
-    SkipSpaces( cur_pos );
-
-    DEBUG_PRINT_PARSE;
-
-    Node_t *node = GetPow( cur_pos, parent, error );
-
-    SkipSpaces( cur_pos );
-
-    while ( **cur_pos == '*' || **cur_pos == '/' ) {
-        char op = **cur_pos;
-        ( *cur_pos )++;
-
-        TreeData_t op_value = {};
-        op_value.type = NODE_OPERATION;
-        op_value.data.operation = ( op == '*' ) ? OP_MUL : OP_DIV;
-
-        SkipSpaces( cur_pos );
+static OperatorEntry_t *TopOperator( ParserStacks_t *stacks ) {
+    return stacks->operators_size ? &stacks->operators[stacks->operators_size - 1] : NULL;
+}
 
-        Node_t *new_root = NodeCreate( op_value, parent );
-        new_root->left = node;
-        node->parent = new_root;
+static Node_t *ReduceNode( ParserStacks_t *stacks, OperationType op, int n_args ) {
+    my_assert( stacks->operands_size >= (size_t)n_args, "Operand stack underflow" );
 
-        SkipSpaces( cur_pos );
+    size_t depth = 0;
+    Node_t *right = NULL;
+    if ( n_args == TWO_ARGS ) {
+        right = stacks->operands[--stacks->operands_size];
+        depth = stacks->depths[stacks->operands_size];
+    }
+    Node_t *left = stacks->operands[--stacks->operands_size];
+    if ( stacks->depths[stacks->operands_size] > depth )
+        depth = stacks->depths[stacks->operands_size];
 
-        Node_t *right = GetPow( cur_pos, new_root, error );
-        new_root->right = right;
+    Node_t *node = MakeNode( op, left, right );
+    stacks->depths[stacks->operands_size] = depth + 1;
+    stacks->operands[stacks->operands_size++] = node;
 
-        node = new_root;
-    }
+    if ( depth + 1 > EXPRESSION_MAX_DEPTH )
+        stacks->too_deep = true;
 
     return node;
 }
 
-static Node_t *GetPrimary( char **cur_pos, Node_t *parent, bool *error ) {
-    my_assert( cur_pos, "Null pointer on `cur_pos`" );
-    my_assert( *cur_pos, "Null pointer on `*cur_pos`" );
-    my_assert( error, "Null pointer on `error`" );
-
-    SkipSpaces( cur_pos );
+static void ReduceBinaries( ParserStacks_t *stacks, int min_priority, bool right_assoc ) {
+    OperatorEntry_t *top = TopOperator( stacks );
 
-    DEBUG_PRINT_PARSE;
+    while ( top && top->kind == ENTRY_BINARY ) {
+        int top_priority = GetBinaryPriority( top->operation );
+        if ( top_priority < min_priority || ( top_priority == min_priority && right_assoc ) )
+            break;
 
-    Node_t *func = GetFunction( cur_pos, parent, error );
-    if ( func )
-        return func;
-    if ( *error )
-        return NULL;
-
-    if ( **cur_pos == '(' ) {
-        ( *cur_pos )++;
-        SkipSpaces( cur_pos );
-
-        Node_t *node = GetExpression( cur_pos, parent, error );
-        if ( *error )
-            return NULL;
-
-        SkipSpaces( cur_pos );
-
-        if ( **cur_pos != ')' ) {
-            SyntaxError( cur_pos );
-            return NULL;
-        }
-        ( *cur_pos )++;
-        return node;
+        ReduceNode( stacks, top->operation, TWO_ARGS );
+        stacks->operators_size--;
+        top = TopOperator( stacks );
     }
-
-    SkipSpaces( cur_pos );
-
-    Node_t *node = GetVariable( cur_pos, parent, error );
-    if ( node )
-        return node;
-    return GetNumber( cur_pos, parent, error );
 }
 
-static Node_t *GetNumber( char **cur_pos, Node_t *parent, bool *error ) {
-    my_assert( cur_pos, "Null pointer on `cur_pos`" );
-    my_assert( *cur_pos, "Null pointer on `*cur_pos`" );
-    my_assert( error, "Null pointer on `error`" );
-
-    SkipSpaces( cur_pos );
-
-    DEBUG_PRINT_PARSE;
+static bool ParseOperand( ParserStacks_t *stacks, TokenStream_t *tokens, bool *error ) {
+    Token_t *token = &tokens->tokens[tokens->current];
 
-    char *start = *cur_pos;
-    char *end = NULL;
-    double val = strtod( start, &end );
+    switch ( token->type ) {
+        case TOKEN_NUMBER:
+        case TOKEN_VARIABLE:
+            PRINT( "Operand - %.*s", (int)token->length, token->position );
+            tokens->current++;
+            if ( !PushOperand( stacks, NodeCreate( token->value, NULL ) ) )
+                *error = true;
+            return true;
 
-    if ( end == start ) {
-        return NULL;
+        case TOKEN_LEFT_BRACKET:
+            tokens->current++;
+            if ( !PushOperator( stacks, { ENTRY_BRACKET, OP_NOPE, 0, token->position } ) )
+                *error = true;
+            return false;
+
+        case TOKEN_OPERATION:
+            if ( args_count[token->value.data.operation] != ZERO_ARG ) {
+                PRINT( "Function - %.*s", (int)token->length, token->position );
+                tokens->current++;
+
+                if ( tokens->tokens[tokens->current].type != TOKEN_LEFT_BRACKET ) {
+                    SyntaxError( &tokens->tokens[tokens->current] );
+                    return false;
+                }
+                tokens->current++;
+
+                if ( !PushOperator( stacks, { ENTRY_FUNCTION, (OperationType)token->value.data.operation, 0,
+                                              token->position } ) )
+                    *error = true;
+                return false;
+            }
+            SyntaxError( token );
+            return false;
+
+        case TOKEN_RIGHT_BRACKET:
+        case TOKEN_COMMA:
+        case TOKEN_END:
+        case TOKEN_UNKNOWN:
+        default:
+            SyntaxError( token );
+            return false;
     }
+}
 
-    *cur_pos = end;
-
-    TreeData_t value = {};
-    value.type = NODE_NUMBER;
-    value.data.number = val;
+static bool CloseBracket( ParserStacks_t *stacks, Token_t *token, bool *error ) {
+    ReduceBinaries( stacks, 0, false );
 
-    Node_t *node = NodeCreate( value, parent );
-    if ( !node ) {
-        *error = true;
-        return NULL;
+    OperatorEntry_t *top = TopOperator( stacks );
+    if ( !top ) {
+        SyntaxError( token );
+        return false;
     }
 
-    PRINT( "Number - %lg", val );
-
-    return node;
-}
+    if ( top->kind == ENTRY_FUNCTION ) {
+        int n_args = args_count[top->operation];
+        if ( top->args_read + 1 != n_args ) {
+            SyntaxError( token );
+            return false;
+        }
 
-#define OPERATION_COMPARE( str, name, value, is_function, num_args, ... )                                    \
-    if ( operation == OP_NOPE && is_function == Function && strncmp( *cur_pos, str, strlen( str ) ) == 0 ) { \
-        operation = name;                                                                                    \
-        func_len = (int)strlen( str );                                                                       \
-        args_count = num_args;                                                                               \
-        PRINT( "Function - %s", str );                                                                       \
+        ReduceNode( stacks, top->operation, n_args );
     }
 
-static Node_t *GetFunction( char **cur_pos, Node_t *parent, bool *error ) {
-    my_assert( cur_pos, "Null pointer on `cur_pos`" );
-    my_assert( *cur_pos, "Null pointer on `*cur_pos`" );
-    my_assert( error, "Null pointer on `error`" );
-
-    SkipSpaces( cur_pos );
-
-    DEBUG_PRINT_PARSE;
-
-    OperationType operation = OP_NOPE;
-    int func_len = 0;
-    int args_count = 0;
+    stacks->operators_size--;
+    return true;
+}
 
-    INIT_OPERATIONS( OPERATION_COMPARE );
+static bool NextArgument( ParserStacks_t *stacks, Token_t *token, bool *error ) {
+    ReduceBinaries( stacks, 0, false );
 
-    if ( operation == OP_NOPE ) {
-        return NULL;
+    OperatorEntry_t *top = TopOperator( stacks );
+    if ( !top || top->kind != ENTRY_FUNCTION || top->args_read + 1 >= args_count[top->operation] ) {
+        SyntaxError( token );
+        return false;
     }
 
-    *cur_pos += func_len;
+    top->args_read++;
+    return true;
+}
 
-    TreeData_t val = {};
-    val.type = NODE_OPERATION;
-    val.data.operation = operation;
+static void ParserStacksDtor( ParserStacks_t *stacks ) {
+    for ( size_t idx = 0; idx < stacks->operands_size; idx++ )
+        NodeDelete( stacks->operands[idx], NULL, NULL );
 
-    Node_t *func_node = NodeCreate( val, parent );
-    if ( !func_node ) {
-        *error = true;
-        return NULL;
-    }
+    free( stacks->operands );
+    free( stacks->depths );
+    free( stacks->operators );
+}
 
-    if ( **cur_pos != '(' ) {
-        SyntaxError( cur_pos );
-        *error = true;
-        NodeDelete( func_node, NULL, NULL );
-        return NULL;
-    }
-    ( *cur_pos )++;
+static Node_t *ParseTokens( TokenStream_t *tokens, bool *error ) {
+    my_assert( tokens, "Null pointer on `tokens`" );
+    my_assert( error, "Null pointer on `error`" );
 
-    SkipSpaces( cur_pos );
+    ParserStacks_t stacks = {};
+    bool expect_operand = true;
 
-    if ( args_count == ONE_ARG || args_count == TWO_ARGS ) {
-        Node_t *arg1 = GetExpression( cur_pos, func_node, error );
-        if ( *error || !arg1 ) {
-            NodeDelete( func_node, NULL, NULL );
-            return NULL;
-        }
+    while ( !*error && !stacks.too_deep ) {
+        Token_t *token = &tokens->tokens[tokens->current];
+        PRINT( "Current token: `%.*s`", (int)token->length, token->position );
 
-        func_node->left = arg1;
-        arg1->parent = func_node;
+        if ( expect_operand ) {
+            expect_operand = !ParseOperand( &stacks, tokens, error );
+            continue;
+        }
 
-        if ( args_count == TWO_ARGS ) {
-            if ( **cur_pos != ',' ) {
-                SyntaxError( cur_pos );
+        if ( token->type == TOKEN_OPERATION && GetBinaryPriority( (OperationType)token->value.data.operation ) ) {
+            OperationType op = (OperationType)token->value.data.operation;
+            ReduceBinaries( &stacks, GetBinaryPriority( op ), IsRightAssociative( op ) );
+            if ( !PushOperator( &stacks, { ENTRY_BINARY, op, 0, token->position } ) )
                 *error = true;
-                NodeDelete( func_node, NULL, NULL );
-                return NULL;
-            }
-            ( *cur_pos )++;
 
-            Node_t *arg2 = GetExpression( cur_pos, func_node, error );
-            if ( *error || !arg2 ) {
-                NodeDelete( func_node, NULL, NULL );
-                return NULL;
+            tokens->current++;
+            expect_operand = true;
+        } else if ( token->type == TOKEN_RIGHT_BRACKET ) {
+            if ( !CloseBracket( &stacks, token, error ) )
+                break;
+            tokens->current++;
+        } else if ( token->type == TOKEN_COMMA ) {
+            if ( !NextArgument( &stacks, token, error ) )
+                break;
+            tokens->current++;
+            expect_operand = true;
+        } else if ( token->type == TOKEN_END ) {
+            ReduceBinaries( &stacks, 0, false );
+            if ( stacks.operators_size != 0 ) {
+                SyntaxError( token );
+                break;
             }
-
-            func_node->right = arg2;
-            arg2->parent = func_node;
+            tokens->current++;
+            break;
+        } else {
+            SyntaxError( token );
         }
     }
 
-    if ( **cur_pos != ')' ) {
-        SyntaxError( cur_pos );
+    if ( stacks.too_deep ) {
+        PRINT_ERROR( "The expression is nested deeper than %lu levels\n", EXPRESSION_MAX_DEPTH );
         *error = true;
-        NodeDelete( func_node, NULL, NULL );
-        return NULL;
     }
-    ( *cur_pos )++;
-
-    return func_node;
-}
-
-#undef OPERATION_COMPARE
-
-static Node_t *GetVariable( char **cur_pos, Node_t *parent, bool *error ) {
-    my_assert( cur_pos, "Null pointer on `cur_pos`" );
-    my_assert( *cur_pos, "Null pointer on `*cur_pos`" );
-    my_assert( error, "Null pointer on `error`" );
-
-    DEBUG_PRINT_PARSE;
 
-    if ( isalpha( **cur_pos ) ) {
-        TreeData_t value = {};
-        value.type = NODE_VARIABLE;
-        value.data.variable = **cur_pos;
-
-        ( *cur_pos )++;
-
-        Node_t *node = NodeCreate( value, parent );
-        if ( !node ) {
-            *error = true;
-            return NULL;
-        }
-
-        PRINT( "Variable - %c", value.data.variable );
-        return node;
+    Node_t *root = NULL;
+    if ( !*error ) {
+        my_assert( stacks.operands_size == 1, "Unbalanced operand stack" );
+        root = stacks.operands[0];
+        stacks.operands_size = 0;
     }
 
-    return NULL;
+    ParserStacksDtor( &stacks );
+
+    return root;
 }
 
+#undef SyntaxError
+
 void SkipSpaces( char **position ) {
     while ( isspace( **position ) )
         ( *position )++;
@@ -0,0 +1,84 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+
+// Local extrema and inflection points of f: the roots of f' where f' changes
+// sign (a minimum from minus to plus, a maximum the other way) and the roots of
+// f'' where f'' changes sign. Both come from FindDerivativeRoots over one chain
+// of f, f', f'' and f''' (the roots of f'' are refined by Newton), so the parts
+// of the interval where the interval bounds of f' or f'' keep one sign are
+// never sampled. A root where the derivative only touches zero (f' of x^3 at
+// zero) is neither and is left out.
+// Points are sorted by x; a derivative over the budget leaves its kind out.
+
+const int CRITICAL_ORDERS = 4;
+
+// f is the first order of the chain.
+static void CriticalPointsEvaluate( const CompiledDerivatives_t *derivatives, CriticalPoints_t *points ) {
+    double *values = derivatives->values[0];
+    size_t slot = derivatives->slot[0];
+
+    for ( size_t idx = 0; idx < points->n_points; idx++ ) {
+        values[slot] = points->points[idx].x;
+        points->points[idx].y = CompiledExprEvaluate( derivatives->expr[0], values );
+    }
+}
+
+bool FindCriticalPoints( Differentiator_t *diff, SymbolId var, double from, double to, size_t n_cells,
+                         CriticalPoints_t *points ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( diff->expr_tree, "Null pointer on `diff->expr_tree`" );
+    my_assert( points, "Null pointer on `points`" );
+
+    CompiledDerivatives_t derivatives = {};
+    CompiledDerivativesCtor( &derivatives, diff, var, 0, CRITICAL_ORDERS );
+
+    Roots_t extrema = {}, inflections = {};
+    bool found_extrema = FindDerivativeRoots( diff, &derivatives, 1, from, to, n_cells, &extrema );
+    bool found_inflections = FindDerivativeRoots( diff, &derivatives, 2, from, to, n_cells, &inflections );
+    if ( !found_extrema && !found_inflections ) {
+        CompiledDerivativesDtor( &derivatives );
+        return false;
+    }
+
+    size_t n_roots = extrema.n_roots + inflections.n_roots;
+    points->points = (CriticalPoint_t *)calloc( n_roots + 1, sizeof( CriticalPoint_t ) );
+    assert( points->points && "Memory allocation error" );
+    points->n_points = 0;
+
+    // Both lists are sorted, they are merged.
+    size_t i = 0, j = 0;
+    while ( i < extrema.n_roots || j < inflections.n_roots ) {
+        bool extremum = j >= inflections.n_roots ||
+                        ( i < extrema.n_roots && extrema.roots[i].x <= inflections.roots[j].x );
+        const Root_t *root = extremum ? &extrema.roots[i++] : &inflections.roots[j++];
+        if ( root->crossing == 0 )
+            continue;
+
+        CriticalPointType type = CRITICAL_INFLECTION;
+        if ( extremum )
+            type = ( root->crossing > 0 ) ? CRITICAL_MINIMUM : CRITICAL_MAXIMUM;
+
+        points->points[points->n_points++] = { type, root->x, NAN };
+    }
+
+    RootsDtor( &extrema );
+    RootsDtor( &inflections );
+
+    CriticalPointsEvaluate( &derivatives, points );
+    CompiledDerivativesDtor( &derivatives );
+    PRINT( "%lu extrema and inflection points in [%g; %g]", points->n_points, from, to );
+
+    return true;
+}
+
+void CriticalPointsDtor( CriticalPoints_t *points ) {
+    my_assert( points, "Null pointer on `points`" );
+
+    free( points->points );
+    points->points = NULL;
+    points->n_points = 0;
+}
@@ -1,16 +1,88 @@
 #include "DebugUtils.h"
 #include "Differentiator.h"
+#include "UtilsRW.h"
+#include <assert.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-static bool GeneratePlotData( Differentiator_t *diff, char var, int n_points, double *out_y_min,
-                              double *out_y_max ) {
-    const char *func_data_file = "func_data.tmp";
-    const char *taylor_data_file = "taylor_data.tmp";
+// Temporary files of one plot. Names carry the pid and the address of the
+// Differentiator_t, so concurrent plots never share a file.
+struct PlotFiles_t {
+    char *func_data;
+    char *taylor_data;
+    char *tangent_point;
+    char *extrema;
+    char *inflections;
+    char *script;
+};
 
-    FILE *f_func = fopen( func_data_file, "w" );
-    FILE *f_taylor = fopen( taylor_data_file, "w" );
+static char *MakePlotFileName( const Differentiator_t *diff, const char *suffix ) {
+    char name[128] = {};
+    snprintf( name, sizeof( name ), "plot_%d_%lx_%s", getpid(), (uintptr_t)diff, suffix );
+
+    return MakePath( diff->output_dir, name );
+}
+
+static void PlotFilesCtor( PlotFiles_t *files, const Differentiator_t *diff ) {
+    files->func_data = MakePlotFileName( diff, "func_data.tmp" );
+    files->taylor_data = MakePlotFileName( diff, "taylor_data.tmp" );
+    files->tangent_point = MakePlotFileName( diff, "tangent_point.tmp" );
+    files->extrema = MakePlotFileName( diff, "extrema.tmp" );
+    files->inflections = MakePlotFileName( diff, "inflections.tmp" );
+    files->script = MakePlotFileName( diff, "plot_script.gp" );
+}
+
+static void PlotFilesDtor( PlotFiles_t *files ) {
+    remove( files->func_data );
+    remove( files->taylor_data );
+    remove( files->tangent_point );
+    remove( files->extrema );
+    remove( files->inflections );
+    remove( files->script );
+
+    free( files->func_data );
+    free( files->taylor_data );
+    free( files->tangent_point );
+    free( files->extrema );
+    free( files->inflections );
+    free( files->script );
+}
+
+// Both curves are compiled once and evaluated over all points on the pool.
+static void PlotEvaluate( const Differentiator_t *diff, const Tree_t *tree, SymbolId var, const double *xs,
+                          size_t n_points, double *ys ) {
+    CompiledExpr_t *expr = CompileTree( tree );
+
+    double *values = (double *)calloc( expr->n_variables + 1, sizeof( double ) );
+    assert( values && "Memory allocation error" );
+
+    CompiledExprBind( expr, &diff->var_table, values );
+    CompiledExprEvaluateBatch( expr, CompiledExprSlot( expr, var ), xs, n_points, values, ys, diff->pool );
+
+    free( values );
+    CompiledExprDtor( &expr );
+}
+
+static void WritePlotPoint( FILE *file, double x, double y, double *y_min, double *y_max ) {
+    if ( isfinite( y ) ) {
+        fprintf( file, "%.10g %.10g\n", x, y );
+        if ( y < *y_min )
+            *y_min = y;
+        if ( y > *y_max )
+            *y_max = y;
+    } else {
+        fprintf( file, "%.10g NaN\n", x );
+    }
+}
+
+static bool GeneratePlotData( Differentiator_t *diff, const PlotFiles_t *files, SymbolId var, int n_points,
+                              double *out_y_min, double *out_y_max ) {
+    FILE *f_func = fopen( files->func_data, "w" );
+    FILE *f_taylor = fopen( files->taylor_data, "w" );
     if ( !f_func || !f_taylor ) {
         if ( f_func )
             fclose( f_func );
@@ -20,38 +92,31 @@ static bool GeneratePlotData( Differentiator_t *diff, char var, int n_points, do
         return false;
     }
 
-    double computed_y_min = INFINITY;
-    double computed_y_max = -INFINITY;
-    double step = ( diff->plot_x_max - diff->plot_x_min ) / ( n_points - 1 );
+    size_t n = (size_t)n_points;
+    double *xs = (double *)calloc( 3 * n, sizeof( double ) );
+    assert( xs && "Memory allocation error" );
+    double *ys_func = xs + n;
+    double *ys_taylor = xs + 2 * n;
 
-    for ( int i = 0; i < n_points; i++ ) {
-        double x = diff->plot_x_min + i * step;
-        VarTableSet( &diff->var_table, var, x );
+    double step = ( diff->plot_x_max - diff->plot_x_min ) / ( n_points - 1 );
+    for ( int i = 0; i < n_points; i++ )
+        xs[i] = diff->plot_x_min + i * step;
 
-        double y_func = EvaluateTree( diff->expr_tree, diff );
-        double y_taylor = EvaluateTree( diff->taylor_tree, diff );
+    PlotEvaluate( diff, diff->expr_tree, var, xs, n, ys_func );
+    if ( diff->taylor.coefficients && diff->taylor.var == var )
+        TaylorPolynomialEvaluateBatch( &diff->taylor, xs, n, ys_taylor, diff->pool );
+    else
+        PlotEvaluate( diff, diff->taylor_tree, var, xs, n, ys_taylor );
 
-        if ( isfinite( y_func ) ) {
-            fprintf( f_func, "%.10g %.10g\n", x, y_func );
-            if ( y_func < computed_y_min )
-                computed_y_min = y_func;
-            if ( y_func > computed_y_max )
-                computed_y_max = y_func;
-        } else {
-            fprintf( f_func, "%.10g NaN\n", x );
-        }
+    double computed_y_min = INFINITY;
+    double computed_y_max = -INFINITY;
 
-        if ( isfinite( y_taylor ) ) {
-            fprintf( f_taylor, "%.10g %.10g\n", x, y_taylor );
-            if ( y_taylor < computed_y_min )
-                computed_y_min = y_taylor;
-            if ( y_taylor > computed_y_max )
-                computed_y_max = y_taylor;
-        } else {
-            fprintf( f_taylor, "%.10g NaN\n", x );
-        }
+    for ( size_t i = 0; i < n; i++ ) {
+        WritePlotPoint( f_func, xs[i], ys_func[i], &computed_y_min, &computed_y_max );
+        WritePlotPoint( f_taylor, xs[i], ys_taylor[i], &computed_y_min, &computed_y_max );
     }
 
+    free( xs );
     fclose( f_func );
     fclose( f_taylor );
 
@@ -60,9 +125,8 @@ static bool GeneratePlotData( Differentiator_t *diff, char var, int n_points, do
     return true;
 }
 
-static void WriteTangentPoint( double x0, double y0 ) {
-    const char *tangent_point_file = "tangent_point.tmp";
-    FILE *f = fopen( tangent_point_file, "w" );
+static void WriteTangentPoint( const PlotFiles_t *files, double x0, double y0 ) {
+    FILE *f = fopen( files->tangent_point, "w" );
     if ( f ) {
         if ( isfinite( x0 ) && isfinite( y0 ) ) {
             fprintf( f, "%.10g %.10g\n", x0, y0 );
@@ -71,6 +135,44 @@ static void WriteTangentPoint( double x0, double y0 ) {
     }
 }
 
+// Extrema and inflection points go to separate files, the counts tell which
+// of them the plot shows.
+static void WriteCriticalPoints( const PlotFiles_t *files, const CriticalPoints_t *critical, size_t *n_extrema,
+                                 size_t *n_inflections ) {
+    *n_extrema = 0;
+    *n_inflections = 0;
+    if ( !critical )
+        return;
+
+    FILE *f_extrema = fopen( files->extrema, "w" );
+    FILE *f_inflections = fopen( files->inflections, "w" );
+    if ( !f_extrema || !f_inflections ) {
+        if ( f_extrema )
+            fclose( f_extrema );
+        if ( f_inflections )
+            fclose( f_inflections );
+        perror( "Failed to create critical point files" );
+        return;
+    }
+
+    for ( size_t idx = 0; idx < critical->n_points; idx++ ) {
+        const CriticalPoint_t *point = &critical->points[idx];
+        if ( !isfinite( point->y ) )
+            continue;
+
+        if ( point->type == CRITICAL_INFLECTION ) {
+            fprintf( f_inflections, "%.10g %.10g\n", point->x, point->y );
+            ( *n_inflections )++;
+        } else {
+            fprintf( f_extrema, "%.10g %.10g\n", point->x, point->y );
+            ( *n_extrema )++;
+        }
+    }
+
+    fclose( f_extrema );
+    fclose( f_inflections );
+}
+
 static void DetermineYRange( double user_y_min, double user_y_max, double computed_y_min,
                              double computed_y_max, double *final_y_min, double *final_y_max ) {
     bool auto_y = ( !isfinite( user_y_min ) || !isfinite( user_y_max ) );
@@ -92,10 +194,10 @@ static void DetermineYRange( double user_y_min, double user_y_max, double comput
     }
 }
 
-static bool WriteGnuplotScript( const char *output_image, char var, double x_min, double x_max, double y_min,
-                                double y_max, double f_x0, double f_prime_x0, double x0 ) {
-    const char *gnuplot_script = "plot_script.gp";
-    FILE *f_gp = fopen( gnuplot_script, "w" );
+static bool WriteGnuplotScript( const PlotFiles_t *files, const char *output_image, SymbolId var, double x_min,
+                                double x_max, double y_min, double y_max, double f_x0, double f_prime_x0,
+                                double x0, size_t n_extrema, size_t n_inflections ) {
+    FILE *f_gp = fopen( files->script, "w" );
     if ( !f_gp ) {
         perror( "Failed to create Gnuplot script" );
         return false;
@@ -105,35 +207,38 @@ static bool WriteGnuplotScript( const char *output_image, char var, double x_min
              "set terminal pngcairo enhanced size 800,600\n"
              "set output '%s'\n"
              "set title 'Функция, ряд Тейлора и касательная'\n"
-             "set xlabel '%c'\n"
+             "set xlabel '%s'\n"
              "set ylabel 'f(x)'\n"
              "set xrange [%.10g:%.10g]\n"
              "set yrange [%.10g:%.10g]\n"
              "set grid\n"
              "f_tangent(x) = %.10g + %.10g * (x - %.10g)\n"
              "plot "
-             "'func_data.tmp' with lines lw 2 lc rgb 'blue'   title 'Функция', \\\n"
-             "     'taylor_data.tmp' with lines lw 2 lc rgb 'red'    title 'Ряд "
+             "'%s' with lines lw 2 lc rgb 'blue'   title 'Функция', \\\n"
+             "     '%s' with lines lw 2 lc rgb 'red'    title 'Ряд "
              "Тейлора', \\\n"
              "     f_tangent(x) with lines lw 2 lc rgb 'green' title 'Касательная', "
              "\\\n"
-             "     'tangent_point.tmp' using 1:2 with points pt 7 ps 2 lc rgb 'black' "
-             "title 'Точка касания'\n",
-             output_image, var, x_min, x_max, y_min, y_max, f_x0, f_prime_x0, x0 );
+             "     '%s' using 1:2 with points pt 7 ps 2 lc rgb 'black' "
+             "title 'Точка касания'",
+             output_image, SymbolName( var ), x_min, x_max, y_min, y_max, f_x0, f_prime_x0, x0, files->func_data,
+             files->taylor_data, files->tangent_point );
+    if ( n_extrema )
+        fprintf( f_gp, ", \\\n     '%s' using 1:2 with points pt 9 ps 2 lc rgb 'dark-orange' title 'Экстремумы'",
+                 files->extrema );
+    if ( n_inflections )
+        fprintf( f_gp, ", \\\n     '%s' using 1:2 with points pt 5 ps 1.5 lc rgb 'dark-violet' "
+                 "title 'Точки перегиба'",
+                 files->inflections );
+    fprintf( f_gp, "\n" );
 
     fclose( f_gp );
     return true;
 }
 
-static void CleanupTempFiles( void ) {
-    remove( "func_data.tmp" );
-    remove( "taylor_data.tmp" );
-    remove( "tangent_point.tmp" );
-    remove( "plot_script.gp" );
-}
-
-void DifferentiatorPlotFunctionAndTaylor( Differentiator_t *diff, char var, int n_points,
-                                          const char *output_image ) {
+// `critical` points, when given, are marked on the curve.
+void DifferentiatorPlotFunctionAndTaylor( Differentiator_t *diff, SymbolId var, int n_points,
+                                          const char *output_image, const CriticalPoints_t *critical ) {
     my_assert( diff, "Null pointer on `diff`" );
     my_assert( output_image, "Null pointer on `output_image`" );
     my_assert( n_points > 1, "n_points must be > 1" );
@@ -143,7 +248,7 @@ void DifferentiatorPlotFunctionAndTaylor( Differentiator_t *diff, char var, int
 
     double x0 = 0.0;
     if ( !VarTableGet( &diff->var_table, var, &x0 ) ) {
-        printf( "Warning: variable '%c' not found, using x0 = 0\n", var );
+        printf( "Warning: variable '%s' not found, using x0 = 0\n", SymbolName( var ) );
         x0 = 0.0;
     }
 
@@ -151,14 +256,23 @@ void DifferentiatorPlotFunctionAndTaylor( Differentiator_t *diff, char var, int
 
     VarTableSet( &diff->var_table, var, x0 );
     double f_x0 = EvaluateTree( diff->expr_tree, diff );
-    DifferentiateExpression( diff, var, 1 );
-    double f_prime_x0 = EvaluateTree( diff->diff_tree, diff );
+    double f_prime_x0 = NAN;
+    if ( DifferentiateExpression( diff, var, 1 ) )
+        f_prime_x0 = EvaluateTree( diff->diff_tree, diff );
+    else
+        TaylorModeDerivative( diff->expr_tree->root, &diff->var_table, var, x0, 1, &f_prime_x0 );
+
+    PlotFiles_t files = {};
+    PlotFilesCtor( &files, diff );
+
+    WriteTangentPoint( &files, x0, f_x0 );
 
-    WriteTangentPoint( x0, f_x0 );
+    size_t n_extrema = 0, n_inflections = 0;
+    WriteCriticalPoints( &files, critical, &n_extrema, &n_inflections );
 
     double computed_y_min = 0, computed_y_max = 0;
-    if ( !GeneratePlotData( diff, var, n_points, &computed_y_min, &computed_y_max ) ) {
-        CleanupTempFiles();
+    if ( !GeneratePlotData( diff, &files, var, n_points, &computed_y_min, &computed_y_max ) ) {
+        PlotFilesDtor( &files );
         return;
     }
 
@@ -166,16 +280,19 @@ void DifferentiatorPlotFunctionAndTaylor( Differentiator_t *diff, char var, int
     DetermineYRange( diff->plot_y_min, diff->plot_y_max, computed_y_min, computed_y_max, &final_y_min,
                      &final_y_max );
 
-    if ( !WriteGnuplotScript( output_image, var, diff->plot_x_min, diff->plot_x_max, final_y_min, final_y_max,
-                              f_x0, f_prime_x0, x0 ) ) {
-        CleanupTempFiles();
+    if ( !WriteGnuplotScript( &files, output_image, var, diff->plot_x_min, diff->plot_x_max, final_y_min,
+                              final_y_max, f_x0, f_prime_x0, x0, n_extrema, n_inflections ) ) {
+        PlotFilesDtor( &files );
         return;
     }
 
-    char cmd[512];
-    snprintf( cmd, sizeof( cmd ), "gnuplot plot_script.gp" );
+    size_t cmd_length = strlen( files.script ) + sizeof( "gnuplot ''" );
+    char *cmd = (char *)calloc( cmd_length, sizeof( char ) );
+    assert( cmd && "Memory allocation error" );
+    snprintf( cmd, cmd_length, "gnuplot '%s'", files.script );
     int sys_result = system( cmd );
     (void)sys_result;
+    free( cmd );
 
-    CleanupTempFiles();
+    PlotFilesDtor( &files );
 }
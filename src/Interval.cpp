@@ -0,0 +1,249 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "Tree.h"
+
+// Interval evaluation of a compiled expression: every value on the stack is an
+// interval that holds f over a range of one variable, the other variables are
+// points. Bounds are widened by one ulp after each operation, which covers the
+// rounding of the libm functions. An operation that cannot be bounded (division
+// by an interval around zero, a pole inside the range, a NaN operand) gives the
+// whole line, so a range is only ever pruned when f really keeps its sign.
+// Outside the domain of a function f is NaN, not a value, so the domain is
+// clipped and only the defined part is bounded.
+
+const Interval_t INTERVAL_ENTIRE = { -INFINITY, INFINITY };
+const size_t INTERVAL_SMALL_STACK = 64;
+
+static Interval_t IntervalMake( double lo, double hi ) {
+    if ( isnan( lo ) || isnan( hi ) )
+        return INTERVAL_ENTIRE;
+
+    return { nextafter( lo, -INFINITY ), nextafter( hi, INFINITY ) };
+}
+
+static Interval_t IntervalPoint( double x ) {
+    if ( isnan( x ) )
+        return INTERVAL_ENTIRE;
+
+    return { x, x };
+}
+
+static bool IntervalContains( Interval_t a, double x ) {
+    return a.lo <= x && x <= a.hi;
+}
+
+static Interval_t IntervalMul( Interval_t a, Interval_t b ) {
+    double p[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+
+    double lo = p[0], hi = p[0];
+    for ( int idx = 0; idx < 4; idx++ ) {
+        // 0 * inf
+        if ( isnan( p[idx] ) )
+            return INTERVAL_ENTIRE;
+        lo = fmin( lo, p[idx] );
+        hi = fmax( hi, p[idx] );
+    }
+
+    return IntervalMake( lo, hi );
+}
+
+static Interval_t IntervalDiv( Interval_t a, Interval_t b ) {
+    if ( IntervalContains( b, 0 ) )
+        return INTERVAL_ENTIRE;
+
+    return IntervalMul( a, IntervalMake( 1 / b.hi, 1 / b.lo ) );
+}
+
+// The defined part of `a` for a function on [lo, hi], false when there is none.
+static bool IntervalClip( Interval_t *a, double lo, double hi ) {
+    a->lo = fmax( a->lo, lo );
+    a->hi = fmin( a->hi, hi );
+
+    return a->lo <= a->hi;
+}
+
+static Interval_t IntervalMonotone( OperationType op, Interval_t a, bool increasing ) {
+    double lo = EvaluateOperation( op, a.lo, 0 );
+    double hi = EvaluateOperation( op, a.hi, 0 );
+
+    return increasing ? IntervalMake( lo, hi ) : IntervalMake( hi, lo );
+}
+
+// x^n for an integer n.
+static Interval_t IntervalPowInteger( Interval_t a, double n ) {
+    if ( fpclassify( n ) == FP_ZERO )
+        return { 1, 1 };
+    if ( n < 0 )
+        return IntervalDiv( { 1, 1 }, IntervalPowInteger( a, -n ) );
+
+    bool even = CompareDoubleToDouble( fmod( n, 2 ), 0 ) == 0;
+    if ( !even || a.lo >= 0 )
+        return IntervalMake( pow( a.lo, n ), pow( a.hi, n ) );
+    if ( a.hi <= 0 )
+        return IntervalMake( pow( a.hi, n ), pow( a.lo, n ) );
+
+    return IntervalMake( 0, pow( fmax( -a.lo, a.hi ), n ) );
+}
+
+static Interval_t IntervalPow( Interval_t a, Interval_t b ) {
+    if ( CompareDoubleToDouble( b.lo, b.hi ) == 0 && CompareDoubleToDouble( b.lo, floor( b.lo ) ) == 0 )
+        return IntervalPowInteger( a, b.lo );
+
+    // exp(b ln a), a negative base is defined at integer exponents only.
+    if ( !IntervalClip( &a, 0, INFINITY ) )
+        return INTERVAL_ENTIRE;
+
+    Interval_t exponent = IntervalMul( b, IntervalMonotone( OP_LN, a, true ) );
+    return IntervalMake( exp( exponent.lo ), exp( exponent.hi ) );
+}
+
+// sin on [lo, hi] reaches 1 at pi/2 + 2 pi k and -1 at -pi/2 + 2 pi k.
+static Interval_t IntervalSin( Interval_t a ) {
+    if ( !isfinite( a.lo ) || !isfinite( a.hi ) || a.hi - a.lo >= 2 * M_PI )
+        return { -1, 1 };
+
+    double sin_lo = sin( a.lo ), sin_hi = sin( a.hi );
+    double lo = fmin( sin_lo, sin_hi ), hi = fmax( sin_lo, sin_hi );
+
+    double peak = M_PI / 2 + 2 * M_PI * ceil( ( a.lo - M_PI / 2 ) / ( 2 * M_PI ) );
+    if ( peak <= a.hi )
+        hi = 1;
+    double trough = -M_PI / 2 + 2 * M_PI * ceil( ( a.lo + M_PI / 2 ) / ( 2 * M_PI ) );
+    if ( trough <= a.hi )
+        lo = -1;
+
+    Interval_t result = IntervalMake( lo, hi );
+    IntervalClip( &result, -1, 1 );
+    return result;
+}
+
+// tan and cot are monotone between their poles: pi/2 + pi k for tan, pi k for cot.
+static Interval_t IntervalTan( Interval_t a, bool cotangent ) {
+    if ( !isfinite( a.lo ) || !isfinite( a.hi ) || a.hi - a.lo >= M_PI )
+        return INTERVAL_ENTIRE;
+
+    double shift = cotangent ? 0 : M_PI / 2;
+    double pole = shift + M_PI * ceil( ( a.lo - shift ) / M_PI );
+    if ( pole <= a.hi )
+        return INTERVAL_ENTIRE;
+
+    return IntervalMonotone( cotangent ? OP_CTAN : OP_TAN, a, !cotangent );
+}
+
+static Interval_t IntervalOperation( OperationType op, Interval_t a, Interval_t b ) {
+    switch ( op ) {
+        case OP_ADD:
+            return IntervalMake( a.lo + b.lo, a.hi + b.hi );
+        case OP_SUB:
+            return IntervalMake( a.lo - b.hi, a.hi - b.lo );
+        case OP_MUL:
+            return IntervalMul( a, b );
+        case OP_DIV:
+            return IntervalDiv( a, b );
+        case OP_POW:
+            return IntervalPow( a, b );
+
+        case OP_LOG:
+            if ( !IntervalClip( &a, 0, INFINITY ) || !IntervalClip( &b, 0, INFINITY ) )
+                return INTERVAL_ENTIRE;
+            return IntervalDiv( IntervalMonotone( OP_LN, a, true ), IntervalMonotone( OP_LN, b, true ) );
+        case OP_LN:
+            if ( !IntervalClip( &a, 0, INFINITY ) )
+                return INTERVAL_ENTIRE;
+            return IntervalMonotone( OP_LN, a, true );
+
+        case OP_SIN:
+            return IntervalSin( a );
+        case OP_COS:
+            return IntervalSin( IntervalOperation( OP_ADD, a, { M_PI / 2, M_PI / 2 } ) );
+        case OP_TAN:
+            return IntervalTan( a, false );
+        case OP_CTAN:
+            return IntervalTan( a, true );
+
+        case OP_SH:
+        case OP_ARCTAN:
+        case OP_ARSINH:
+            return IntervalMonotone( op, a, true );
+        case OP_CH:
+            if ( IntervalContains( a, 0 ) )
+                return IntervalMake( 1, cosh( fmax( -a.lo, a.hi ) ) );
+            return IntervalMake( fmin( cosh( a.lo ), cosh( a.hi ) ), fmax( cosh( a.lo ), cosh( a.hi ) ) );
+
+        case OP_ARCSIN:
+        case OP_ARTANH:
+            if ( !IntervalClip( &a, -1, 1 ) )
+                return INTERVAL_ENTIRE;
+            return IntervalMonotone( op, a, true );
+        case OP_ARCCOS:
+            if ( !IntervalClip( &a, -1, 1 ) )
+                return INTERVAL_ENTIRE;
+            return IntervalMonotone( op, a, false );
+        case OP_ARCH:
+            if ( !IntervalClip( &a, 1, INFINITY ) )
+                return INTERVAL_ENTIRE;
+            return IntervalMonotone( op, a, true );
+        // atan(1 / x) jumps from -pi/2 to pi/2 at zero.
+        case OP_ARCCTAN:
+            if ( IntervalContains( a, 0 ) )
+                return IntervalMake( -M_PI / 2, M_PI / 2 );
+            return IntervalMonotone( op, a, false );
+
+        case OP_NOPE:
+        default:
+            return INTERVAL_ENTIRE;
+    }
+}
+
+Interval_t CompiledExprEvaluateInterval( const CompiledExpr_t *expr, const double *values, size_t slot,
+                                         Interval_t x ) {
+    my_assert( expr, "Null pointer on `expr`" );
+    my_assert( values, "Null pointer on `values`" );
+
+    Interval_t small_stack[INTERVAL_SMALL_STACK] = {};
+    Interval_t *stack = small_stack;
+    if ( expr->stack_size > INTERVAL_SMALL_STACK ) {
+        stack = (Interval_t *)calloc( expr->stack_size, sizeof( Interval_t ) );
+        assert( stack && "Memory allocation error" );
+    }
+
+    size_t top = 0;
+
+    for ( size_t idx = 0; idx < expr->size; idx++ ) {
+        const Instruction_t *instruction = &expr->code[idx];
+
+        switch ( instruction->type ) {
+            case NODE_NUMBER:
+                stack[top++] = IntervalPoint( instruction->number );
+                break;
+            case NODE_VARIABLE:
+                stack[top++] = ( instruction->slot == slot ) ? x : IntervalPoint( values[instruction->slot] );
+                break;
+            case NODE_OPERATION:
+                if ( operation_args[instruction->operation] == TWO_ARGS ) {
+                    top--;
+                    stack[top - 1] =
+                        IntervalOperation( (OperationType)instruction->operation, stack[top - 1], stack[top] );
+                } else {
+                    stack[top - 1] =
+                        IntervalOperation( (OperationType)instruction->operation, stack[top - 1], { 0, 0 } );
+                }
+                break;
+            case NODE_UNKNOWN:
+            default:
+                stack[top++] = INTERVAL_ENTIRE;
+                break;
+        }
+    }
+
+    Interval_t result = top ? stack[0] : Interval_t{ 0, 0 };
+
+    if ( stack != small_stack )
+        free( stack );
+
+    return result;
+}
@@ -1,11 +1,22 @@
 #include <assert.h>
+#include <ctype.h>
+#include <math.h>
 #include <string.h>
 
 #include "DebugUtils.h"
 #include "Differentiator.h"
+#include "ThreadPool.h"
 #include "UtilsRW.h"
 
-#define LATEX_PRINT( format, ... ) fprintf( latex_file, format, ##__VA_ARGS__ );
+// Same digits as printf("%g").
+const int LATEX_NUMBER_PRECISION = 6;
+
+// Derivatives of at least this many nodes are printed with repeated
+// subexpressions of at least LATEX_SHARED_MIN_SIZE nodes named u_1, u_2, ...
+const size_t LATEX_SHARED_THRESHOLD = 200;
+const size_t LATEX_SHARED_MIN_SIZE  = 4;
+
+#define LATEX_PRINT( format, ... ) BufferPrintf( latex_file, format, ##__VA_ARGS__ );
 
 #define OPERATIONS_LATEX( str, name, value, is_func, n_args, latex_fmt, ... ) latex_fmt,
 
@@ -13,25 +24,38 @@ static const char *latex_format[] = { INIT_OPERATIONS( OPERATIONS_LATEX ) };
 
 #undef OPERATIONS_LATEX
 
-static void LatexInsertChildren( const Node_t *node, FILE *latex_file, int parent_priority );
+static const char *const greek_letters[] = { "alpha", "beta",  "gamma", "delta", "epsilon", "zeta",    "eta",
+                                             "theta", "iota",  "kappa", "lambda", "mu",     "nu",      "xi",
+                                             "pi",    "rho",   "sigma", "tau",   "upsilon", "phi",     "chi",
+                                             "psi",   "omega", "Gamma", "Delta", "Theta",   "Lambda",  "Xi",
+                                             "Pi",    "Sigma", "Phi",   "Psi",   "Omega",   "Upsilon" };
 
-static void LatexHeader( FILE *latex_file );
+static void LatexNode( const Node_t *node, OutputBuffer_t *latex_file, int parent_priority,
+                       const SharedSubtrees_t *shared );
+static void LatexNodeValue( const Node_t *node, OutputBuffer_t *latex_file, int parent_priority,
+                            const SharedSubtrees_t *shared );
+static void LatexInsertChildren( const Node_t *node, OutputBuffer_t *latex_file, int parent_priority,
+                                 const SharedSubtrees_t *shared );
 
-Latex_t LatexCtor() {
+static void LatexHeader( OutputBuffer_t *latex_file );
+static void LatexSymbol( OutputBuffer_t *latex_file, SymbolId symbol );
+
+Latex_t LatexCtor( const char *output_dir ) {
     Latex_t latex = {};
-    latex.tex_path = strdup( "tex" );
+    latex.tex_path = MakePath( output_dir, "tex" );
     MakeDirectory( latex.tex_path );
     char buffer[MAX_LEN_PATH] = {};
     snprintf( buffer, MAX_LEN_PATH, "%s/main.tex", latex.tex_path );
     latex.tex_file = fopen( buffer, "w" );
     assert( latex.tex_file && "Error opening file" );
 
-    LatexHeader( latex.tex_file );
+    OutputBufferCtor( &latex.output, latex.tex_file );
+    LatexHeader( &latex.output );
 
     return latex;
 }
 
-static void LatexHeader( FILE *latex_file ) {
+static void LatexHeader( OutputBuffer_t *latex_file ) {
     LATEX_PRINT( "\\documentclass[14pt,a4paper]{article}\n" );
     LATEX_PRINT( "\\usepackage[utf8]{inputenc}\n" );
     LATEX_PRINT( "\\usepackage[T2A]{fontenc}\n" );
@@ -58,7 +82,7 @@ static void LatexHeader( FILE *latex_file ) {
 void LatexDtor( Latex_t *latex ) {
     my_assert( latex, "Null pointer on `latex`" );
 
-    FILE *latex_file = latex->tex_file;
+    OutputBuffer_t *latex_file = &latex->output;
 
     LATEX_PRINT( "\\subsection{\\textbf{Графики функции, касательной в точке, многочлена Тейлора}}" )
     LATEX_PRINT( "\\begin{figure}[ht]\n" );
@@ -68,20 +92,31 @@ void LatexDtor( Latex_t *latex ) {
     LATEX_PRINT( "\\label{fig:my_image}\n" );
     LATEX_PRINT( "\\end{figure}\n\n" );
 
-    fprintf( latex->tex_file, "\\end{document}\n" );
-    free( latex->tex_path );
+    LATEX_PRINT( "\\end{document}\n" );
 
+    bool written = OutputBufferDtor( &latex->output );
     int fclose_result = fclose( latex->tex_file );
-    if ( fclose_result ) {
+    latex->tex_file = NULL;
+    if ( fclose_result || !written ) {
         PRINT_ERROR( "Fail to close latex file\n" );
+        free( latex->tex_path );
         return;
     }
 
-    system( "pdflatex -synctex=1 -interaction=nonstopmode -output-directory=tex "
-            "tex/main.tex" );
+#define PDFLATEX_COMMAND "pdflatex -synctex=1 -interaction=nonstopmode -output-directory=%s %s/main.tex"
+    size_t cmd_length = sizeof( PDFLATEX_COMMAND ) + 2 * strlen( latex->tex_path );
+    char *cmd = (char *)calloc( cmd_length, sizeof( char ) );
+    assert( cmd && "Memory allocation error" );
+    snprintf( cmd, cmd_length, PDFLATEX_COMMAND, latex->tex_path, latex->tex_path );
+#undef PDFLATEX_COMMAND
+    system( cmd );
+    free( cmd );
+
+    free( latex->tex_path );
+    latex->tex_path = NULL;
 }
 
-void TreeDumpLatex( const Tree_t *tree, FILE *latex_file ) {
+void TreeDumpLatex( const Tree_t *tree, OutputBuffer_t *latex_file ) {
     my_assert( tree, "Null pointer on `tree`" );
     my_assert( latex_file, "Null pointer on `latex_file`" );
 
@@ -104,30 +139,93 @@ static int GetOperationPriority( OperationType op ) {
     }
 }
 
-void NodeToLatex( const Node_t *node, FILE *latex_file, int parent_priority ) {
+void NodeToLatex( const Node_t *node, OutputBuffer_t *latex_file, int parent_priority ) {
     my_assert( node, "Null pointer on `node`" );
 
+    LatexNodeValue( node, latex_file, parent_priority, NULL );
+}
+
+static void LatexNode( const Node_t *node, OutputBuffer_t *latex_file, int parent_priority,
+                       const SharedSubtrees_t *shared ) {
+    size_t name = shared ? SharedSubtreesName( shared, node ) : 0;
+    if ( name ) {
+        LATEX_PRINT( " u_{%lu} ", name );
+        return;
+    }
+
+    LatexNodeValue( node, latex_file, parent_priority, shared );
+}
+
+// `rho` is written as \rho, the part after `_` or the trailing digits become
+// a subscript (`k_b`, `T0`) and other names of several letters are \mathit.
+static void LatexSymbol( OutputBuffer_t *latex_file, SymbolId symbol ) {
+    const char *name = SymbolName( symbol );
+    size_t length = strlen( name );
+
+    size_t base = strcspn( name, "_" );
+    if ( base == length ) {
+        while ( base > 1 && isdigit( (unsigned char)name[base - 1] ) )
+            base--;
+    }
+
+    bool is_greek = false;
+    for ( size_t idx = 0; idx < sizeof( greek_letters ) / sizeof( greek_letters[0] ); idx++ ) {
+        if ( strlen( greek_letters[idx] ) == base && strncmp( greek_letters[idx], name, base ) == 0 )
+            is_greek = true;
+    }
+
+    if ( base == 1 ) {
+        BufferPutChar( latex_file, name[0] );
+    } else if ( is_greek ) {
+        LATEX_PRINT( "\\%.*s", (int)base, name );
+    } else {
+        LATEX_PRINT( "\\mathit{%.*s}", (int)base, name );
+    }
+
+    const char *subscript = name + base + ( name[base] == '_' );
+    if ( !*subscript )
+        return;
+
+    LATEX_PRINT( "_{" );
+    for ( ; *subscript; subscript++ ) {
+        if ( *subscript == '_' ) {
+            LATEX_PRINT( "\\_" );
+        } else {
+            BufferPutChar( latex_file, *subscript );
+        }
+    }
+    LATEX_PRINT( "}" );
+}
+
+static void LatexNodeValue( const Node_t *node, OutputBuffer_t *latex_file, int parent_priority,
+                            const SharedSubtrees_t *shared ) {
     switch ( node->value.type ) {
         case NODE_NUMBER: {
             double num = node->value.data.number;
             bool is_negative = ( CompareDoubleToDouble( num, 0 ) < 0 );
 
             if ( is_negative && parent_priority > 0 ) {
-                LATEX_PRINT( "(\\num{%g})", num );
+                LATEX_PRINT( "(\\num{" );
+                BufferPutDouble( latex_file, num, LATEX_NUMBER_PRECISION );
+                LATEX_PRINT( "})" );
             } else {
                 if ( CompareDoubleToDouble( num, 1e-8 ) == 0 ) {
                     LATEX_PRINT( "0" );
                 } else {
-                    LATEX_PRINT( "\\num{%g}", num );
+                    LATEX_PRINT( "\\num{" );
+                    BufferPutDouble( latex_file, num, LATEX_NUMBER_PRECISION );
+                    LATEX_PRINT( "}" );
                 }
             }
             break;
         }
         case NODE_VARIABLE:
-            LATEX_PRINT( " %c ", node->value.data.variable );
+            BufferPutChar( latex_file, ' ' );
+            LatexSymbol( latex_file, node->value.data.variable );
+            BufferPutChar( latex_file, ' ' );
             break;
         case NODE_OPERATION:
-            LatexInsertChildren( node, latex_file, parent_priority );
+            LatexInsertChildren( node, latex_file, parent_priority, shared );
             break;
         case NODE_UNKNOWN:
         default:
@@ -136,7 +234,8 @@ void NodeToLatex( const Node_t *node, FILE *latex_file, int parent_priority ) {
     }
 }
 
-static void LatexInsertChildren( const Node_t *node, FILE *latex_file, int parent_priority ) {
+static void LatexInsertChildren( const Node_t *node, OutputBuffer_t *latex_file, int parent_priority,
+                                 const SharedSubtrees_t *shared ) {
     OperationType op = (OperationType)node->value.data.operation;
     const char *format = latex_format[op];
     int curr_priority = GetOperationPriority( op );
@@ -150,13 +249,13 @@ static void LatexInsertChildren( const Node_t *node, FILE *latex_file, int paren
         if ( format[idx] == '%' && format[idx + 1] == 'e' ) {
             const Node_t *child = ( child_id == 0 ? node->left : node->right );
             if ( child )
-                NodeToLatex( child, latex_file, curr_priority );
+                LatexNode( child, latex_file, curr_priority, shared );
             else
                 LATEX_PRINT( "<?>" );
             child_id++;
             idx++;
         } else {
-            fputc( format[idx], latex_file );
+            BufferPutChar( latex_file, format[idx] );
         }
     }
 
@@ -164,31 +263,92 @@ static void LatexInsertChildren( const Node_t *node, FILE *latex_file, int paren
         LATEX_PRINT( ")" );
 }
 
-static void LatexFunction( Differentiator_t *diff, FILE *latex_file );
+static void LatexFunction( Differentiator_t *diff, OutputBuffer_t *latex_file );
+static void LatexDefinitions( const SharedSubtrees_t *shared, OutputBuffer_t *latex_file );
+static void LatexDerivative( Differentiator_t *diff, OutputBuffer_t *latex_file, SymbolId var, int order,
+                             const Tree_t *derivative );
+static void LatexDerivativeValue( Differentiator_t *diff, OutputBuffer_t *latex_file, SymbolId var, int order );
+static void LatexEvaluation( Differentiator_t *diff, OutputBuffer_t *latex_file, SymbolId name );
+static void LatexTaylorSeries( Differentiator_t *diff, OutputBuffer_t *latex_file, SymbolId var, double point,
+                               int order );
 
-void DifferentiatorAddOrigExpression( Differentiator_t *diff, int order ) {
+void DifferentiatorAddOrigExpression( Differentiator_t *diff, SymbolId var, int order ) {
     my_assert( diff, "Null pointer on `diff`" );
 
-    FILE *latex_file = diff->latex.tex_file;
+    OutputBuffer_t *latex_file = &diff->latex.output;
 
     LATEX_PRINT( "\\section{Исследование функции}\n" );
 
     LatexFunction( diff, latex_file );
 
     for ( int i = 1; i <= order; i++ ) {
-        LATEX_PRINT( "\\subsection{\\textbf{Производная порядка %d}}\n\n", i );
+        const Tree_t *derivative = NULL;
+        if ( i == 1 )
+            derivative = DifferentiateExpression( diff, var, 1 );
+        else if ( diff->diff_tree )
+            derivative = DifferentiateNextOrder( diff, var, i );
 
-        DifferentiateExpression( diff, 'x', i );
+        LatexDerivative( diff, latex_file, var, i, derivative );
         ON_DEBUG( DifferentiatiorDump( diff, DUMP_DIFFERENTIATED, "Differentiative (%d)", i ); );
+    }
+}
 
-        LATEX_PRINT( "\\textbf{Итог:}\n\n" );
+// `derivative` is NULL when it is over the budget.
+static void LatexDerivative( Differentiator_t *diff, OutputBuffer_t *latex_file, SymbolId var, int order,
+                             const Tree_t *derivative ) {
+    LATEX_PRINT( "\\subsection{\\textbf{Производная порядка %d}}\n\n", order );
 
+    if ( !derivative ) {
+        LatexDerivativeValue( diff, latex_file, var, order );
+        return;
+    }
+
+    LATEX_PRINT( "\\textbf{Итог:}\n\n" );
+
+    LATEX_PRINT( "\\begin{align*}\n" );
+    LATEX_PRINT( "\\begin{autobreak}\n" );
+    LATEX_PRINT( "\\MoveEqLeft\n" );
+
+    SharedSubtrees_t shared = {};
+    SharedSubtreesCtor( &shared, derivative->root, LATEX_SHARED_MIN_SIZE );
+    bool named = shared.n_nodes >= LATEX_SHARED_THRESHOLD && shared.n_definitions > 0;
+
+    LATEX_PRINT( "f^{(%d)}(x) = ", order );
+    LatexNode( derivative->root, latex_file, 0, named ? &shared : NULL );
+
+    LATEX_PRINT( "\n" );
+    LATEX_PRINT( "\\end{autobreak}\n" );
+    LATEX_PRINT( "\\end{align*}\n" );
+
+    if ( named )
+        LatexDefinitions( &shared, latex_file );
+
+    SharedSubtreesDtor( &shared );
+}
+
+// The symbolic derivative is over the budget, only its value at x_0 is given.
+static void LatexDerivativeValue( Differentiator_t *diff, OutputBuffer_t *latex_file, SymbolId var, int order ) {
+    double value = NAN;
+    if ( !TaylorModeDerivative( diff->expr_tree->root, &diff->var_table, var, diff->x_0, order, &value ) ) {
+        LATEX_PRINT( "Производную этого порядка найти не удалось.\n\n" );
+        return;
+    }
+
+    LATEX_PRINT( "Запись этой производной слишком велика, поэтому приводится только её значение, "
+                 "найденное разложением в ряд Тейлора:\n\n" );
+    LATEX_PRINT( "\\[ f^{(%d)}(\\num{%g}) = \\num{%g} \\]\n\n", order, diff->x_0, value );
+}
+
+static void LatexDefinitions( const SharedSubtrees_t *shared, OutputBuffer_t *latex_file ) {
+    LATEX_PRINT( "где\n\n" );
+
+    for ( size_t idx = 0; idx < shared->n_definitions; idx++ ) {
         LATEX_PRINT( "\\begin{align*}\n" );
         LATEX_PRINT( "\\begin{autobreak}\n" );
         LATEX_PRINT( "\\MoveEqLeft\n" );
 
-        LATEX_PRINT( "f^{(%d)}(x) = ", i );
-        NodeToLatex( diff->diff_tree->root, latex_file, 0 );
+        LATEX_PRINT( "u_{%lu} = ", idx + 1 );
+        LatexNodeValue( shared->definitions[idx], latex_file, 0, shared );
 
         LATEX_PRINT( "\n" );
         LATEX_PRINT( "\\end{autobreak}\n" );
@@ -196,7 +356,7 @@ void DifferentiatorAddOrigExpression( Differentiator_t *diff, int order ) {
     }
 }
 
-static void LatexFunction( Differentiator_t *diff, FILE *latex_file ) {
+static void LatexFunction( Differentiator_t *diff, OutputBuffer_t *latex_file ) {
     my_assert( diff, "Null pointer on `diff`" );
 
     LATEX_PRINT( "\\subsection{\\textbf{Функция}}\n" );
@@ -212,12 +372,16 @@ static void LatexFunction( Differentiator_t *diff, FILE *latex_file ) {
     LATEX_PRINT( "\\end{align*}\n" );
 }
 
-void DifferentiatorAddEvaluation( Differentiator_t *diff, char name ) {
+void DifferentiatorAddEvaluation( Differentiator_t *diff, SymbolId name ) {
     my_assert( diff, "Null pointer on diff" );
 
+    LatexEvaluation( diff, &diff->latex.output, name );
+}
+
+static void LatexEvaluation( Differentiator_t *diff, OutputBuffer_t *latex_file, SymbolId name ) {
     double point = 0;
 
-    VarTableSet( &( diff->var_table ), 'x', diff->x_0 );
+    VarTableSet( &( diff->var_table ), name, diff->x_0 );
 
     if ( !VarTableGet( &diff->var_table, name, &point ) ) {
         VarTableAskUser( &diff->var_table );
@@ -225,21 +389,25 @@ void DifferentiatorAddEvaluation( Differentiator_t *diff, char name ) {
 
     double val = EvaluateTree( diff->expr_tree, diff );
 
-    FILE *latex_file = diff->latex.tex_file;
     LATEX_PRINT( "\\subsection{Вычисление значения функции в точке}\n" );
-    LATEX_PRINT( "Для $%c = \\num{%g}$ получаем $f(%c) = \\num{%g}$\n\n", name, point, name, val );
+    LATEX_PRINT( "Для $" );
+    LatexSymbol( latex_file, name );
+    LATEX_PRINT( " = \\num{%g}$ получаем $f(", point );
+    LatexSymbol( latex_file, name );
+    LATEX_PRINT( ") = \\num{%g}$\n\n", val );
 }
 
 #define PRINT_O                                                                                              \
     LATEX_PRINT( " + o(" );                                                                                  \
-    if ( order > 1 ) {                                                                                       \
-        LATEX_PRINT( "(x-\\num{%g})^%d", point, order );                                                     \
-    } else {                                                                                                 \
-        LATEX_PRINT( "x-\\num{%g}", point );                                                                 \
-    }                                                                                                        \
+    if ( order > 1 )                                                                                         \
+        LATEX_PRINT( "(" );                                                                                  \
+    LatexSymbol( latex_file, var );                                                                          \
+    LATEX_PRINT( "-\\num{%g}", point );                                                                      \
+    if ( order > 1 )                                                                                         \
+        LATEX_PRINT( ")^%d", order );                                                                        \
     LATEX_PRINT( ")\n" );
 
-void DifferentiatorAddTaylorSeries( Differentiator_t *diff, char var, int order ) {
+void DifferentiatorAddTaylorSeries( Differentiator_t *diff, SymbolId var, int order ) {
     my_assert( diff, "Null pointer on `diff`" );
 
     double point = 0;
@@ -247,9 +415,14 @@ void DifferentiatorAddTaylorSeries( Differentiator_t *diff, char var, int order
         VarTableAskUser( &diff->var_table );
     }
 
-    diff->taylor_tree = DifferentiatorBuildTaylorTree( diff, var, point, order );
+    LatexTaylorSeries( diff, &diff->latex.output, var, point, order );
 
-    FILE *latex_file = diff->latex.tex_file;
+    ON_DEBUG( DifferentiatiorDump( diff, DUMP_TAYLOR, "After optimization" ); );
+}
+
+static void LatexTaylorSeries( Differentiator_t *diff, OutputBuffer_t *latex_file, SymbolId var, double point,
+                               int order ) {
+    diff->taylor_tree = DifferentiatorBuildTaylorTree( diff, var, point, order );
 
     OptimizeTree( diff->taylor_tree, diff, var );
 
@@ -259,18 +432,209 @@ void DifferentiatorAddTaylorSeries( Differentiator_t *diff, char var, int order
     LATEX_PRINT( "\\begin{autobreak}\n" );
     LATEX_PRINT( "\\MoveEqLeft\n" );
 
-    LATEX_PRINT( "T_{%d}(%c) = ", order, var );
-    TreeDumpLatex( diff->taylor_tree, diff->latex.tex_file );
+    LATEX_PRINT( "T_{%d}(", order );
+    LatexSymbol( latex_file, var );
+    LATEX_PRINT( ") = " );
+    TreeDumpLatex( diff->taylor_tree, latex_file );
     PRINT_O;
 
     LATEX_PRINT( "\\end{autobreak}\n" );
     LATEX_PRINT( "\\end{align*}\n" );
+}
 
-    ON_DEBUG( DifferentiatiorDump( diff, DUMP_TAYLOR, "After optimization" ); );
+void DifferentiatorAddTaylorOrderSearch( Differentiator_t *diff, SymbolId var, const TaylorOrderSearch_t *search ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( search, "Null pointer on `search`" );
+    my_assert( search->errors, "Null pointer on `search->errors`" );
+
+    OutputBuffer_t *latex_file = &diff->latex.output;
+
+    LATEX_PRINT( "\\subsection{Выбор порядка ряда Тейлора}\n" );
+    LATEX_PRINT( "Наибольшее отклонение $|f(" );
+    LatexSymbol( latex_file, var );
+    LATEX_PRINT( ") - T_n(" );
+    LatexSymbol( latex_file, var );
+    LATEX_PRINT( ")|$ на $[\\num{%g}; \\num{%g}]$ при допуске \\num{%g}:\n\n", search->from, search->to,
+                 search->tolerance );
+
+    LATEX_PRINT( "\\begin{tabular}{|c|c|}\n\\hline\n$n$ & отклонение \\\\\n\\hline\n" );
+    for ( int order = 0; order <= search->order; order++ ) {
+        LATEX_PRINT( "%d & \\num{%g} \\\\\n", order, search->errors[order] );
+    }
+    LATEX_PRINT( "\\hline\n\\end{tabular}\n\n" );
+
+    if ( search->converged ) {
+        LATEX_PRINT( "Допуск достигается при $n = %d$.\n\n", search->order );
+    } else {
+        LATEX_PRINT( "Допуск не достигнут до $n = %d$.\n\n", search->order );
+    }
+}
+
+// Indexed by CriticalPointType.
+static const char *const critical_point_names[] = { "минимум", "максимум", "перегиб" };
+
+void DifferentiatorAddCriticalPoints( Differentiator_t *diff, SymbolId var, double from, double to,
+                                      const CriticalPoints_t *points ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( points, "Null pointer on `points`" );
+
+    OutputBuffer_t *latex_file = &diff->latex.output;
+
+    LATEX_PRINT( "\\subsection{Экстремумы и точки перегиба}\n" );
+    if ( points->n_points == 0 ) {
+        LATEX_PRINT( "На $[\\num{%g}; \\num{%g}]$ нет ни экстремумов, ни точек перегиба.\n\n", from, to );
+        return;
+    }
+
+    LATEX_PRINT( "Корни $f'(" );
+    LatexSymbol( latex_file, var );
+    LATEX_PRINT( ")$ и $f''(" );
+    LatexSymbol( latex_file, var );
+    LATEX_PRINT( ")$ на $[\\num{%g}; \\num{%g}]$, в которых они меняют знак:\n\n", from, to );
+
+    LATEX_PRINT( "\\begin{tabular}{|c|c|c|}\n\\hline\n & $" );
+    LatexSymbol( latex_file, var );
+    LATEX_PRINT( "$ & $f(" );
+    LatexSymbol( latex_file, var );
+    LATEX_PRINT( ")$ \\\\\n\\hline\n" );
+    for ( size_t idx = 0; idx < points->n_points; idx++ ) {
+        const CriticalPoint_t *point = &points->points[idx];
+        LATEX_PRINT( "%s & \\num{%g} & \\num{%g} \\\\\n", critical_point_names[point->type], point->x, point->y );
+    }
+    LATEX_PRINT( "\\hline\n\\end{tabular}\n\n" );
 }
 
 #undef PRINT_O
 
+// ------------------------------- Parallel report -------------------------------
+
+// The derivatives are one sequential chain, so it is built once on the main
+// thread: it gives the trees of the derivative sections and the Taylor
+// coefficients. Only the formatting of every section runs in the pool, each by
+// a private worker into its own buffer. Workers share the read-only expression
+// tree and start from an empty variable table (derivatives) or a copy of the
+// table (Taylor), the same state the sequential report had at those points.
+struct LatexSection_t {
+    Differentiator_t *worker;
+
+    SymbolId var;
+    int      order;
+    bool     taylor;
+    double   point;
+};
+
+static Differentiator_t *LatexSectionWorker( const Differentiator_t *diff, bool copy_variables ) {
+    Differentiator_t *worker = DifferentiatorWorkerCtor();
+    worker->expr_tree = diff->expr_tree;
+    worker->cache = diff->cache;
+    worker->budget = diff->budget;
+    worker->pool = diff->pool;
+    worker->x_0 = diff->x_0;
+    OutputBufferCtor( &worker->latex.output, NULL );
+
+    for ( size_t idx = 0; copy_variables && idx < diff->var_table.number_of_variables; idx++ )
+        VarTableSet( &worker->var_table, diff->var_table.data[idx].name, diff->var_table.data[idx].value );
+
+    return worker;
+}
+
+static void LatexBuildSection( void *arg ) {
+    LatexSection_t *section = (LatexSection_t *)arg;
+    Differentiator_t *worker = section->worker;
+
+    if ( section->taylor )
+        LatexTaylorSeries( worker, &worker->latex.output, section->var, section->point, section->order );
+    else
+        LatexDerivative( worker, &worker->latex.output, section->var, section->order, worker->diff_tree );
+}
+
+static void LatexAppendSection( OutputBuffer_t *latex_file, const LatexSection_t *section ) {
+    const OutputBuffer_t *output = &section->worker->latex.output;
+    BufferPutBytes( latex_file, output->data, output->size );
+}
+
+void DifferentiatorAddReportSections( Differentiator_t *diff, SymbolId var, int n_orders, int taylor_order ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( diff->pool, "Null pointer on `diff->pool`" );
+
+    ThreadPool_t *pool = diff->pool;
+
+    size_t n_sections = (size_t)( n_orders > 0 ? n_orders : 0 ) + 1;
+    LatexSection_t *sections = (LatexSection_t *)calloc( n_sections, sizeof( LatexSection_t ) );
+    assert( sections && "Memory allocation error" );
+
+    // Questions to the user are asked here, never from a worker.
+    OutputBuffer_t evaluation = {};
+    OutputBufferCtor( &evaluation, NULL );
+    LatexEvaluation( diff, &evaluation, var );
+
+    LatexSection_t *taylor = &sections[n_sections - 1];
+    taylor->taylor = true;
+    taylor->var = var;
+    taylor->order = taylor_order;
+    if ( !VarTableGet( &diff->var_table, var, &taylor->point ) ) {
+        VarTableAskUser( &diff->var_table );
+    }
+
+    Tree_t **derivatives = (Tree_t **)calloc( n_sections, sizeof( Tree_t * ) );
+    assert( derivatives && "Memory allocation error" );
+    DifferentiatorTaylorChain( diff, var, taylor->point, taylor_order, derivatives, (int)n_sections - 1 );
+
+    for ( size_t idx = 0; idx + 1 < n_sections; idx++ ) {
+        sections[idx].worker = LatexSectionWorker( diff, false );
+        sections[idx].worker->diff_tree = derivatives[idx];
+        sections[idx].var = var;
+        sections[idx].order = (int)idx + 1;
+
+        ThreadPoolSubmit( pool, LatexBuildSection, &sections[idx] );
+    }
+    free( derivatives );
+
+    taylor->worker = LatexSectionWorker( diff, true );
+    TaylorPolynomial_t *found = &taylor->worker->taylor;
+    TaylorPolynomialCtor( found, diff->taylor.var, diff->taylor.point, diff->taylor.order );
+    memcpy( found->coefficients, diff->taylor.coefficients, ( (size_t)diff->taylor.order + 1 ) * sizeof( double ) );
+
+    ThreadPoolSubmit( pool, LatexBuildSection, taylor );
+    ThreadPoolWait( pool );
+
+    OutputBuffer_t *latex_file = &diff->latex.output;
+
+    LATEX_PRINT( "\\section{Исследование функции}\n" );
+    LatexFunction( diff, latex_file );
+
+    ON_DEBUG( Tree_t *own_diff_tree = diff->diff_tree; )
+    for ( size_t idx = 0; idx + 1 < n_sections; idx++ ) {
+        LatexAppendSection( latex_file, &sections[idx] );
+        ON_DEBUG( diff->diff_tree = sections[idx].worker->diff_tree; )
+        ON_DEBUG( DifferentiatiorDump( diff, DUMP_DIFFERENTIATED, "Differentiative (%d)", sections[idx].order ); )
+        ON_DEBUG( diff->diff_tree = own_diff_tree; )
+    }
+
+    BufferPutBytes( latex_file, evaluation.data, evaluation.size );
+    OutputBufferDtor( &evaluation );
+
+    LatexAppendSection( latex_file, taylor );
+
+    // The trees end up where the sequential report left them.
+    TreeDtor( &diff->taylor_tree, NULL );
+    TaylorPolynomialDtor( &diff->taylor );
+
+    diff->taylor_tree = taylor->worker->taylor_tree;
+    taylor->worker->taylor_tree = NULL;
+    diff->taylor = taylor->worker->taylor;
+    taylor->worker->taylor.coefficients = NULL;
+    ON_DEBUG( DifferentiatiorDump( diff, DUMP_TAYLOR, "After optimization" ); )
+
+    for ( size_t idx = 0; idx < n_sections; idx++ ) {
+        sections[idx].worker->expr_tree = NULL;
+        OutputBufferDtor( &sections[idx].worker->latex.output );
+        DifferentiatorDtor( &sections[idx].worker );
+    }
+
+    free( sections );
+}
+
 
 static const char *joke_lines[] = {
 #define X( str, op_enum, prio, is_func, nargs, latex, joke ) [op_enum] = joke,
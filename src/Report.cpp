@@ -0,0 +1,165 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "Metrics.h"
+#include "ThreadPool.h"
+#include "UtilsRW.h"
+
+// Full report for one expression file. Every output (LaTeX, plot, dump) goes
+// into `output_dir`, so independent reports can run in parallel threads.
+// The sections and the plot of one report run on `n_threads` threads (0 is one
+// per core, or DIFF_THREADS).
+// With a tolerance the Taylor order is the smallest one that stays within it
+// over the plot interval, instead of the extent from the file.
+// Extrema and inflection points over the plot interval are listed in the
+// LaTeX and marked on the plot.
+// Unbound variables are asked on stdin only in the interactive mode,
+// otherwise they are taken as zero.
+
+const char *STRESS_DIR = "stress";
+
+struct StressJob_t {
+    const char *expr_filename;
+    char        output_dir[64];
+    bool        ok;
+};
+
+bool DifferentiatorReport( const char *expr_filename, const char *output_dir, bool interactive,
+                           DerivativeCache_t *cache, size_t n_threads, const DerivativeBudget_t *budget,
+                           double taylor_tolerance ) {
+    my_assert( expr_filename, "Null pointer on `expr_filename`" );
+
+    Differentiator_t *diff = DifferentiatorCtor( expr_filename, output_dir );
+    if ( !diff )
+        return false;
+
+    diff->cache = cache;
+    if ( budget )
+        diff->budget = *budget;
+    diff->pool = ThreadPoolCtor( n_threads );
+
+    ON_DEBUG( DifferentiatiorDump( diff, DUMP_ORIGINAL, "After creation expr_tree" ); )
+
+    SymbolId x = SymbolIntern( "x" );
+    VarTableSet( &diff->var_table, x, diff->x_0 );
+    if ( interactive )
+        VarTableAskMissing( &diff->var_table, diff->expr_tree );
+    else
+        VarTableAddFromTree( &diff->var_table, diff->expr_tree );
+
+    TaylorOrderSearch_t search = {};
+    search.tolerance = taylor_tolerance;
+    search.from = diff->plot_x_min;
+    search.to = diff->plot_x_max;
+    bool searched = taylor_tolerance > 0 && TaylorSearchOrder( diff, x, diff->x_0, &search );
+    if ( searched ) {
+        for ( int order = 0; order <= search.order; order++ )
+            fprintf( stderr, "Taylor order %d: error %g\n", order, search.errors[order] );
+        diff->extent = search.order;
+    }
+
+    CriticalPoints_t critical = {};
+    bool critical_found = FindCriticalPoints( diff, x, diff->plot_x_min, diff->plot_x_max, 0, &critical );
+
+    METRIC_PHASE_BEGIN( PHASE_LATEX )
+    DifferentiatorAddReportSections( diff, x, 3, diff->extent );
+    if ( searched )
+        DifferentiatorAddTaylorOrderSearch( diff, x, &search );
+    if ( critical_found )
+        DifferentiatorAddCriticalPoints( diff, x, diff->plot_x_min, diff->plot_x_max, &critical );
+    METRIC_PHASE_END( PHASE_LATEX )
+    TaylorOrderSearchDtor( &search );
+
+    METRIC_PHASE_BEGIN( PHASE_PLOT )
+    char *plot_path = MakePath( diff->latex.tex_path, "plot.png" );
+    DifferentiatorPlotFunctionAndTaylor( diff, x, 250, plot_path, critical_found ? &critical : NULL );
+    free( plot_path );
+    METRIC_PHASE_END( PHASE_PLOT )
+    CriticalPointsDtor( &critical );
+
+    ThreadPoolDtor( &diff->pool );
+    DifferentiatorDtor( &diff );
+    NodeArenaRelease();
+
+    return true;
+}
+
+static void StressRunJob( void *arg ) {
+    StressJob_t *job = (StressJob_t *)arg;
+
+    // The jobs already keep every worker busy, one report is built on a single thread.
+    job->ok = DifferentiatorReport( job->expr_filename, job->output_dir, false, NULL, 1 );
+}
+
+static bool StressSameOutput( const StressJob_t *job, const char *reference, size_t reference_size ) {
+    char *tex_path = MakePath( job->output_dir, "tex/main.tex" );
+
+    size_t size = 0;
+    char *data = MapFile( tex_path, &size );
+    free( tex_path );
+
+    bool same = data && size == reference_size && memcmp( data, reference, size ) == 0;
+    UnmapFile( data, size );
+
+    return same;
+}
+
+bool DifferentiatorStress( const char *expr_filename, size_t n_jobs, size_t n_threads ) {
+    my_assert( expr_filename, "Null pointer on `expr_filename`" );
+
+    if ( n_jobs == 0 )
+        return true;
+
+    struct timespec start = {}, finish = {};
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    if ( MakeDirectory( STRESS_DIR ) != 0 )
+        return false;
+
+    StressJob_t *jobs = (StressJob_t *)calloc( n_jobs, sizeof( StressJob_t ) );
+    assert( jobs && "Memory allocation error" );
+
+    ThreadPool_t *pool = ThreadPoolCtor( n_threads );
+    size_t n_workers = ThreadPoolSize( pool );
+
+    for ( size_t idx = 0; idx < n_jobs; idx++ ) {
+        jobs[idx].expr_filename = expr_filename;
+        snprintf( jobs[idx].output_dir, sizeof( jobs[idx].output_dir ), "%s/job%03lu", STRESS_DIR, idx );
+
+        ThreadPoolSubmit( pool, StressRunJob, &jobs[idx] );
+    }
+
+    ThreadPoolWait( pool );
+    ThreadPoolDtor( &pool );
+    NodeArenaRelease();
+
+    char *reference_path = MakePath( jobs[0].output_dir, "tex/main.tex" );
+    size_t reference_size = 0;
+    char *reference = jobs[0].ok ? MapFile( reference_path, &reference_size ) : NULL;
+    free( reference_path );
+
+    size_t failed = 0;
+    size_t mismatched = 0;
+    for ( size_t idx = 0; idx < n_jobs; idx++ ) {
+        if ( !jobs[idx].ok )
+            failed++;
+        else if ( !reference || !StressSameOutput( &jobs[idx], reference, reference_size ) )
+            mismatched++;
+    }
+
+    UnmapFile( reference, reference_size );
+    free( jobs );
+
+    clock_gettime( CLOCK_MONOTONIC, &finish );
+    double elapsed = (double)( finish.tv_sec - start.tv_sec ) + (double)( finish.tv_nsec - start.tv_nsec ) * 1e-9;
+
+    fprintf( stderr, "Stress: %lu jobs, %lu workers, %lu failed, %lu mismatched, %.3f s\n", n_jobs, n_workers,
+             failed, mismatched, elapsed );
+
+    return failed == 0 && mismatched == 0;
+}
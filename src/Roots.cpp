@@ -0,0 +1,434 @@
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "OutputBuffer.h"
+#include "SymbolTable.h"
+#include "ThreadPool.h"
+
+// Roots of f over an interval. f is sampled by the batch evaluator and every
+// sign change between neighbouring samples is a bracket; the brackets are
+// refined in parallel by Halley iterations on compiled f, f' and f'' (Newton
+// when f'' is over the budget, bisection when f' is). A step that leaves the
+// bracket or does not halve the one before the last is replaced by bisection,
+// so every bracket converges, down to adjacent doubles.
+// A bracket around a pole converges as well, it is dropped unless some iterate
+// is below |f| at both samples it started from.
+// Roots of a derivative f^(k) are searched the same way, except that the
+// samples are the ends of cells left by interval splitting: a piece of the
+// interval where the interval bounds of f^(k) exclude zero is dropped whole,
+// only the rest is split down to cells and evaluated.
+// The derivatives are built as one chain, each order a single step from the one
+// before it; the first goes through DifferentiateExpression, so the derivative
+// cache is used when the Differentiator_t has one.
+
+const int ROOT_MAX_ITERATIONS = 256;
+const size_t ROOT_GRAIN = 4;
+const int ROOT_ORDERS = 3;
+
+// Pieces are split a little off the middle: expressions are often singular at
+// round numbers (1/x, ctg x), and a halved symmetric interval ends right there.
+const double ROOT_CELL_SPLIT = 0.49;
+
+// f^(k) and the orders after it used to refine its roots, taken from a
+// CompiledDerivatives_t, which owns them.
+struct RootFunctions_t {
+    CompiledExpr_t *expr[ROOT_ORDERS];
+    double *values[ROOT_ORDERS];
+    size_t slot[ROOT_ORDERS];
+    int n_orders;
+};
+
+struct RootBracket_t {
+    double a, b;
+    double fa, fb;
+
+    Root_t root;
+    bool found;
+};
+
+struct RootRange_t {
+    const RootFunctions_t *functions;
+    RootBracket_t *brackets;
+};
+
+// Ends of the cells where f may vanish, in increasing order.
+struct RootCells_t {
+    const RootFunctions_t *functions;
+    double min_width;
+
+    double *xs;
+    size_t n;
+    size_t capacity;
+};
+
+bool CompiledDerivativesCtor( CompiledDerivatives_t *derivatives, Differentiator_t *diff, SymbolId var,
+                              int first_order, int n_orders ) {
+    my_assert( derivatives, "Null pointer on `derivatives`" );
+    my_assert( diff, "Null pointer on `diff`" );
+
+    *derivatives = {};
+    derivatives->first_order = first_order;
+    if ( n_orders > COMPILED_DERIVATIVES_MAX )
+        n_orders = COMPILED_DERIVATIVES_MAX;
+
+    for ( int idx = 0; idx < n_orders; idx++ ) {
+        int order = first_order + idx;
+        const Tree_t *tree =
+            ( idx == 0 ) ? DifferentiateExpression( diff, var, order ) : DifferentiateNextOrder( diff, var, order );
+        if ( !tree )
+            break;
+
+        CompiledExpr_t *expr = CompileTree( tree );
+        derivatives->values[idx] = (double *)calloc( expr->n_variables + 1, sizeof( double ) );
+        assert( derivatives->values[idx] && "Memory allocation error" );
+
+        CompiledExprBind( expr, &diff->var_table, derivatives->values[idx] );
+        derivatives->slot[idx] = CompiledExprSlot( expr, var );
+        derivatives->expr[idx] = expr;
+        derivatives->n_orders++;
+    }
+    PRINT( "Compiled f^(%d) and %d orders after it", first_order, derivatives->n_orders - 1 );
+
+    return derivatives->n_orders > 0;
+}
+
+void CompiledDerivativesDtor( CompiledDerivatives_t *derivatives ) {
+    my_assert( derivatives, "Null pointer on `derivatives`" );
+
+    for ( int idx = 0; idx < derivatives->n_orders; idx++ ) {
+        CompiledExprDtor( &derivatives->expr[idx] );
+        free( derivatives->values[idx] );
+    }
+    *derivatives = {};
+}
+
+// False when the chain does not have f^(order).
+static bool RootFunctionsTake( RootFunctions_t *functions, const CompiledDerivatives_t *derivatives, int order ) {
+    int first = order - derivatives->first_order;
+    if ( first < 0 || first >= derivatives->n_orders )
+        return false;
+
+    *functions = {};
+    for ( int idx = first; idx < derivatives->n_orders && functions->n_orders < ROOT_ORDERS; idx++ ) {
+        functions->expr[functions->n_orders] = derivatives->expr[idx];
+        functions->values[functions->n_orders] = derivatives->values[idx];
+        functions->slot[functions->n_orders] = derivatives->slot[idx];
+        functions->n_orders++;
+    }
+    PRINT( "Roots of f^(%d) are refined with %d derivatives", order, functions->n_orders - 1 );
+
+    return true;
+}
+
+// f and as many derivatives as there are, `values` are the private copies of a task.
+static void RootEvaluate( const RootFunctions_t *functions, double *const *values, double x, double *f ) {
+    for ( int order = 0; order < functions->n_orders; order++ ) {
+        values[order][functions->slot[order]] = x;
+        f[order] = CompiledExprEvaluate( functions->expr[order], values[order] );
+    }
+}
+
+static void RootRefine( const RootFunctions_t *functions, double *const *values, RootBracket_t *bracket ) {
+    double a = bracket->a, b = bracket->b;
+    double fa = bracket->fa, fb = bracket->fb;
+
+    Root_t *root = &bracket->root;
+    root->x = a;
+    root->value = INFINITY;
+    root->iterations = 0;
+
+    // A sample that is a root, `fa` and `fb` are f at the samples around it.
+    if ( !( a < b ) ) {
+        root->value = 0;
+        root->crossing = ( fa < 0 && fb > 0 ) ? 1 : ( fa > 0 && fb < 0 ) ? -1 : 0;
+        bracket->found = true;
+        return;
+    }
+    root->crossing = ( fb > 0 ) ? 1 : -1;
+
+    double x = a - fa * ( b - a ) / ( fb - fa );
+    if ( !( a < x && x < b ) )
+        x = a + ( b - a ) / 2;
+
+    double step = b - a, step_before = step;
+    double f[ROOT_ORDERS] = {};
+
+    while ( root->iterations < ROOT_MAX_ITERATIONS ) {
+        RootEvaluate( functions, values, x, f );
+        root->iterations++;
+
+        if ( isfinite( f[0] ) && fabs( f[0] ) < fabs( root->value ) ) {
+            root->x = x;
+            root->value = f[0];
+        }
+        if ( fpclassify( f[0] ) == FP_ZERO )
+            break;
+
+        // f is not defined at x, so its side is unknown: the bracket stays and
+        // the next iterate is halfway back to `a`, where f was defined.
+        if ( isnan( f[0] ) ) {
+            x = a + ( x - a ) / 2;
+            continue;
+        }
+
+        if ( ( f[0] < 0 ) == ( fa < 0 ) ) {
+            a = x;
+            fa = f[0];
+        } else {
+            b = x;
+            fb = f[0];
+        }
+        if ( nextafter( a, b ) >= b )
+            break;
+
+        double next = NAN;
+        if ( functions->n_orders > 1 && fpclassify( f[1] ) != FP_ZERO ) {
+            double denominator = ( functions->n_orders > 2 ) ? 2 * f[1] * f[1] - f[0] * f[2] : 0;
+            double delta = ( fpclassify( denominator ) != FP_ZERO ) ? 2 * f[0] * f[1] / denominator : f[0] / f[1];
+            next = x - delta;
+        }
+
+        // Converged: the step is below the spacing of doubles around x.
+        if ( fabs( next - x ) <= DBL_EPSILON * fabs( x ) || fpclassify( next - x ) == FP_ZERO )
+            break;
+
+        double previous_step = step_before;
+        step_before = step;
+        if ( a < next && next < b && fabs( next - x ) <= previous_step / 2 ) {
+            step = fabs( next - x );
+        } else {
+            next = a + ( b - a ) / 2;
+            step = ( b - a ) / 2;
+        }
+
+        x = next;
+    }
+
+    bracket->found = fabs( root->value ) < fmin( fabs( bracket->fa ), fabs( bracket->fb ) );
+}
+
+static void RootRange( void *arg, size_t begin, size_t end ) {
+    const RootRange_t *range = (const RootRange_t *)arg;
+    const RootFunctions_t *functions = range->functions;
+
+    double *values[ROOT_ORDERS] = {};
+    for ( int order = 0; order < functions->n_orders; order++ ) {
+        size_t size = ( functions->expr[order]->n_variables + 1 ) * sizeof( double );
+        values[order] = (double *)malloc( size );
+        assert( values[order] && "Memory allocation error" );
+        memcpy( values[order], functions->values[order], size );
+    }
+
+    for ( size_t idx = begin; idx < end; idx++ )
+        RootRefine( functions, values, &range->brackets[idx] );
+
+    for ( int order = 0; order < functions->n_orders; order++ )
+        free( values[order] );
+}
+
+// Evaluates f at the samples `xs` and brackets the sign changes between
+// neighbours and the samples where f is exactly zero.
+static RootBracket_t *FindBrackets( const Differentiator_t *diff, const RootFunctions_t *functions,
+                                    const double *xs, size_t n_samples, size_t *n_brackets ) {
+    double *fs = (double *)calloc( n_samples + 1, sizeof( double ) );
+    assert( fs && "Memory allocation error" );
+
+    CompiledExprEvaluateBatch( functions->expr[0], functions->slot[0], xs, n_samples, functions->values[0], fs,
+                               diff->pool );
+
+    RootBracket_t *brackets = (RootBracket_t *)calloc( n_samples + 1, sizeof( RootBracket_t ) );
+    assert( brackets && "Memory allocation error" );
+
+    size_t count = 0;
+    for ( size_t idx = 0; idx < n_samples; idx++ ) {
+        if ( fpclassify( fs[idx] ) == FP_ZERO ) {
+            double before = ( idx > 0 ) ? fs[idx - 1] : NAN;
+            double after = ( idx + 1 < n_samples ) ? fs[idx + 1] : NAN;
+            brackets[count++] = { xs[idx], xs[idx], before, after, {}, false };
+        } else if ( idx + 1 < n_samples && isfinite( fs[idx] ) && isfinite( fs[idx + 1] ) &&
+                    fpclassify( fs[idx + 1] ) != FP_ZERO && ( fs[idx] < 0 ) != ( fs[idx + 1] < 0 ) ) {
+            brackets[count++] = { xs[idx], xs[idx + 1], fs[idx], fs[idx + 1], {}, false };
+        }
+    }
+
+    free( fs );
+
+    *n_brackets = count;
+    return brackets;
+}
+
+static void RootCellsPush( RootCells_t *cells, double x ) {
+    if ( cells->n >= cells->capacity ) {
+        cells->capacity = cells->capacity ? cells->capacity * 2 : 64;
+        cells->xs = (double *)realloc( cells->xs, cells->capacity * sizeof( double ) );
+        assert( cells->xs && "Memory allocation error" );
+    }
+
+    cells->xs[cells->n++] = x;
+}
+
+// Splits [a, b] until f is bounded away from zero or the piece is a cell.
+static void RootCellsSplit( RootCells_t *cells, double a, double b ) {
+    const RootFunctions_t *functions = cells->functions;
+
+    Interval_t bounds =
+        CompiledExprEvaluateInterval( functions->expr[0], functions->values[0], functions->slot[0], { a, b } );
+    if ( bounds.lo > 0 || bounds.hi < 0 )
+        return;
+
+    if ( b - a <= cells->min_width ) {
+        // Neighbouring cells share an end.
+        if ( cells->n == 0 || cells->xs[cells->n - 1] < a )
+            RootCellsPush( cells, a );
+        RootCellsPush( cells, b );
+        return;
+    }
+
+    double middle = a + ( b - a ) * ROOT_CELL_SPLIT;
+    RootCellsSplit( cells, a, middle );
+    RootCellsSplit( cells, middle, b );
+}
+
+// Refines the brackets in parallel and keeps the roots found.
+static void SolveBrackets( const Differentiator_t *diff, const RootFunctions_t *functions,
+                           RootBracket_t *brackets, size_t n_brackets, Roots_t *roots ) {
+    RootRange_t range = { functions, brackets };
+    ThreadPoolParallelFor( diff->pool, n_brackets, ROOT_GRAIN, RootRange, &range );
+
+    roots->roots = (Root_t *)calloc( n_brackets + 1, sizeof( Root_t ) );
+    assert( roots->roots && "Memory allocation error" );
+    roots->n_roots = 0;
+
+    for ( size_t idx = 0; idx < n_brackets; idx++ ) {
+        if ( brackets[idx].found )
+            roots->roots[roots->n_roots++] = brackets[idx].root;
+    }
+}
+
+bool FindRoots( Differentiator_t *diff, SymbolId var, double from, double to, size_t n_samples, Roots_t *roots ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( diff->expr_tree, "Null pointer on `diff->expr_tree`" );
+    my_assert( roots, "Null pointer on `roots`" );
+
+    if ( n_samples < 2 )
+        n_samples = ROOTS_DEFAULT_SAMPLES;
+    if ( !isfinite( from ) || !isfinite( to ) || !( from < to ) )
+        return false;
+
+    CompiledDerivatives_t derivatives = {};
+    CompiledDerivativesCtor( &derivatives, diff, var, 0, ROOT_ORDERS );
+
+    RootFunctions_t functions = {};
+    RootFunctionsTake( &functions, &derivatives, 0 );
+
+    double *xs = (double *)calloc( n_samples, sizeof( double ) );
+    assert( xs && "Memory allocation error" );
+
+    double step = ( to - from ) / (double)( n_samples - 1 );
+    for ( size_t idx = 0; idx < n_samples; idx++ )
+        xs[idx] = from + (double)idx * step;
+    xs[n_samples - 1] = to;
+
+    size_t n_brackets = 0;
+    RootBracket_t *brackets = FindBrackets( diff, &functions, xs, n_samples, &n_brackets );
+    SolveBrackets( diff, &functions, brackets, n_brackets, roots );
+
+    free( brackets );
+    free( xs );
+    CompiledDerivativesDtor( &derivatives );
+
+    return true;
+}
+
+// Cells are no wider than (to - from) / n_cells. False when the chain does not
+// have f^(order), which is over the budget then.
+bool FindDerivativeRoots( const Differentiator_t *diff, const CompiledDerivatives_t *derivatives, int order,
+                          double from, double to, size_t n_cells, Roots_t *roots ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( derivatives, "Null pointer on `derivatives`" );
+    my_assert( roots, "Null pointer on `roots`" );
+
+    if ( n_cells < 1 )
+        n_cells = ROOTS_DEFAULT_SAMPLES;
+    if ( !isfinite( from ) || !isfinite( to ) || !( from < to ) )
+        return false;
+
+    RootFunctions_t functions = {};
+    if ( !RootFunctionsTake( &functions, derivatives, order ) )
+        return false;
+
+    RootCells_t cells = {};
+    cells.functions = &functions;
+    cells.min_width = ( to - from ) / (double)n_cells;
+    RootCellsSplit( &cells, from, to );
+    PRINT( "f^(%d): %lu cell ends left of %lu", order, cells.n, n_cells + 1 );
+
+    size_t n_brackets = 0;
+    RootBracket_t *brackets = NULL;
+    if ( cells.n )
+        brackets = FindBrackets( diff, &functions, cells.xs, cells.n, &n_brackets );
+    SolveBrackets( diff, &functions, brackets, n_brackets, roots );
+
+    free( brackets );
+    free( cells.xs );
+
+    return true;
+}
+
+void RootsDtor( Roots_t *roots ) {
+    my_assert( roots, "Null pointer on `roots`" );
+
+    free( roots->roots );
+    roots->roots = NULL;
+    roots->n_roots = 0;
+}
+
+// One line per root: the root, f at it and the number of iterations.
+bool DifferentiatorRoots( const char *expr_filename, const char *output_filename, size_t n_samples,
+                          size_t n_threads, DerivativeCache_t *cache, const DerivativeBudget_t *budget ) {
+    my_assert( expr_filename, "Null pointer on `expr_filename`" );
+    my_assert( output_filename, "Null pointer on `output_filename`" );
+
+    SymbolId x = 0;
+    Differentiator_t *diff = DifferentiatorFileCtor( expr_filename, n_threads, cache, budget, &x );
+    if ( !diff )
+        return false;
+
+    Roots_t roots = {};
+    bool ok = FindRoots( diff, x, diff->plot_x_min, diff->plot_x_max, n_samples, &roots );
+
+    bool to_stdout = ( strcmp( output_filename, "-" ) == 0 );
+    FILE *output = !ok ? NULL : to_stdout ? stdout : fopen( output_filename, "w" );
+    if ( ok && !output ) {
+        PRINT_ERROR( "Error opening file `%s` \n", output_filename );
+        ok = false;
+    }
+
+    if ( ok ) {
+        fprintf( stderr, "Roots: %lu in [%g; %g]\n", roots.n_roots, diff->plot_x_min, diff->plot_x_max );
+
+        OutputBuffer_t buffer = {};
+        OutputBufferCtor( &buffer, output );
+        for ( size_t idx = 0; idx < roots.n_roots; idx++ ) {
+            BufferPutDouble( &buffer, roots.roots[idx].x );
+            BufferPutChar( &buffer, ' ' );
+            BufferPutDouble( &buffer, roots.roots[idx].value );
+            BufferPrintf( &buffer, " %d\n", roots.roots[idx].iterations );
+        }
+        ok = OutputBufferDtor( &buffer );
+
+        if ( !to_stdout )
+            ok = fclose( output ) == 0 && ok;
+    }
+
+    RootsDtor( &roots );
+    DifferentiatorFileDtor( &diff );
+
+    return ok;
+}
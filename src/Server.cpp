@@ -0,0 +1,1165 @@
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "ThreadPool.h"
+#include "Tree.h"
+
+// Server mode: one JSON request per line in, one JSON response per line out,
+// over stdin/stdout or a Unix domain socket.
+//
+//   {"id": 1, "op": "differentiate", "expr": "sin(x)*y", "var": "x", "order": 2}
+//   {"id": 2, "op": "evaluate", "expr": "x^2", "order": 1, "points": [0, 0.5], "vars": {"y": 2}}
+//   {"id": 3, "op": "taylor", "expr": "sin(x)", "point": 0.5, "order": 4}
+//   {"id": 4, "op": "gradient", "expr": "rho*k_b", "vars": {"rho": 1, "k_b": 2}}
+//   {"id": 5, "op": "hessian", "expr": "x^2*y", "vars": {"x": 1, "y": 2}}
+//   {"op": "stats"}, {"op": "shutdown"}
+//
+// Parsed trees, their derivatives and compiled programs are kept in an LRU
+// cache keyed by the canonical (serialized) form of the parsed expression.
+// A derivative over the node budget has no tree: "evaluate" and "taylor" then
+// answer with values from Taylor-mode evaluation, "differentiate" fails.
+// Every socket connection is served by a thread of its own, so an idle client
+// does not hold up the others; requests take turns on the cache lock and the
+// response is written after it is released. A client that goes away only ends
+// its own connection: SIGPIPE is ignored and a failed write closes it.
+
+const size_t MAX_ID_LEN = 64;
+const size_t MAX_OP_LEN = 32;
+const int    MAX_SERVER_ORDER = 32;
+
+const size_t CANONICAL_FORM_CAPACITY = 256;
+
+const useconds_t ACCEPT_BACKOFF_US = 100000;
+
+struct DerivativeChain_t {
+    SymbolId var;
+
+    Tree_t         **trees;
+    CompiledExpr_t **compiled;
+    int              n_orders;
+    int              capacity;
+};
+
+struct CacheEntry_t {
+    char    *key;
+    uint64_t hash;
+
+    Tree_t *tree;
+
+    DerivativeChain_t *chains;
+    size_t             n_chains;
+
+    DerivativeMatrix_t gradient;
+    DerivativeMatrix_t hessian;
+    bool               has_hessian;
+
+    CacheEntry_t *lru_prev;
+    CacheEntry_t *lru_next;
+    CacheEntry_t *bucket_next;
+};
+
+struct ExprCache_t {
+    CacheEntry_t **buckets;
+    size_t         n_buckets;
+
+    CacheEntry_t *lru_head;
+    CacheEntry_t *lru_tail;
+
+    size_t size;
+    size_t capacity;
+
+    size_t hits;
+    size_t misses;
+
+    Differentiator_t *diff;
+
+    pthread_mutex_t lock;
+};
+
+// Open connections, shut down when a client asks the server to stop.
+struct ServerClients_t {
+    ExprCache_t *cache;
+    int          server_fd;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  all_closed;
+    int            *fds;
+    size_t          n_fds;
+    size_t          capacity;
+    bool            stopping;
+};
+
+struct Client_t {
+    ServerClients_t *clients;
+    int              fd;
+};
+
+struct ServerRequest_t {
+    char id[MAX_ID_LEN];
+    char op[MAX_OP_LEN];
+
+    char    *expr;
+    SymbolId var;
+    int      order;
+
+    double point;
+    bool   has_point;
+
+    double *points;
+    size_t  n_points;
+
+    VarTable_t vars;
+};
+
+// ------------------------------------ Cache ------------------------------------
+
+static uint64_t HashString( const char *string, size_t length ) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for ( size_t idx = 0; idx < length; idx++ ) {
+        hash ^= (unsigned char)string[idx];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static void ExprCacheCtor( ExprCache_t *cache, size_t capacity ) {
+    cache->capacity = capacity ? capacity : 1;
+    cache->n_buckets = cache->capacity * 2;
+    cache->buckets = (CacheEntry_t **)calloc( cache->n_buckets, sizeof( CacheEntry_t * ) );
+    assert( cache->buckets && "Memory allocation error" );
+
+    cache->diff = DifferentiatorWorkerCtor();
+    cache->diff->pool = ThreadPoolCtor( 0 );
+    pthread_mutex_init( &cache->lock, NULL );
+}
+
+static void CacheEntryDtor( CacheEntry_t *entry ) {
+    for ( size_t chain = 0; chain < entry->n_chains; chain++ ) {
+        for ( int order = 0; order < entry->chains[chain].n_orders; order++ ) {
+            TreeDtor( &entry->chains[chain].trees[order], NULL );
+            CompiledExprDtor( &entry->chains[chain].compiled[order] );
+        }
+        free( entry->chains[chain].trees );
+        free( entry->chains[chain].compiled );
+    }
+
+    free( entry->chains );
+    if ( entry->has_hessian ) {
+        DerivativeMatrixDtor( &entry->gradient );
+        DerivativeMatrixDtor( &entry->hessian );
+    }
+    TreeDtor( &entry->tree, NULL );
+    free( entry->key );
+    free( entry );
+}
+
+static void ExprCacheDtor( ExprCache_t *cache ) {
+    CacheEntry_t *entry = cache->lru_head;
+    while ( entry ) {
+        CacheEntry_t *next = entry->lru_next;
+        CacheEntryDtor( entry );
+        entry = next;
+    }
+
+    free( cache->buckets );
+    ThreadPoolDtor( &cache->diff->pool );
+    DifferentiatorDtor( &cache->diff );
+    NodeArenaRelease();
+    pthread_mutex_destroy( &cache->lock );
+}
+
+static void LruUnlink( ExprCache_t *cache, CacheEntry_t *entry ) {
+    if ( entry->lru_prev )
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        cache->lru_head = entry->lru_next;
+
+    if ( entry->lru_next )
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        cache->lru_tail = entry->lru_prev;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void LruPushFront( ExprCache_t *cache, CacheEntry_t *entry ) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+
+    if ( cache->lru_head )
+        cache->lru_head->lru_prev = entry;
+    cache->lru_head = entry;
+
+    if ( !cache->lru_tail )
+        cache->lru_tail = entry;
+}
+
+static void ExprCacheEvict( ExprCache_t *cache ) {
+    CacheEntry_t *victim = cache->lru_tail;
+    if ( !victim )
+        return;
+
+    LruUnlink( cache, victim );
+
+    CacheEntry_t **link = &cache->buckets[victim->hash % cache->n_buckets];
+    while ( *link != victim )
+        link = &( *link )->bucket_next;
+    *link = victim->bucket_next;
+
+    CacheEntryDtor( victim );
+    cache->size--;
+}
+
+static char *CanonicalForm( const Tree_t *tree ) {
+    OutputBuffer_t key = {};
+    OutputBufferCtor( &key, NULL, CANONICAL_FORM_CAPACITY );
+
+    TreeWriteText( tree, &key );
+    BufferPutChar( &key, '\0' );
+
+    return key.data;
+}
+
+static CacheEntry_t *ExprCacheGet( ExprCache_t *cache, const char *expression ) {
+    if ( !DifferentiatorSetExpression( cache->diff, expression, strlen( expression ) ) )
+        return NULL;
+
+    char *key = CanonicalForm( cache->diff->expr_tree );
+    if ( !key )
+        return NULL;
+
+    uint64_t hash = HashString( key, strlen( key ) );
+    CacheEntry_t **bucket = &cache->buckets[hash % cache->n_buckets];
+
+    for ( CacheEntry_t *entry = *bucket; entry; entry = entry->bucket_next ) {
+        if ( entry->hash == hash && strcmp( entry->key, key ) == 0 ) {
+            free( key );
+            LruUnlink( cache, entry );
+            LruPushFront( cache, entry );
+            cache->hits++;
+            return entry;
+        }
+    }
+
+    cache->misses++;
+
+    if ( cache->size >= cache->capacity ) {
+        ExprCacheEvict( cache );
+        bucket = &cache->buckets[hash % cache->n_buckets];
+    }
+
+    CacheEntry_t *entry = (CacheEntry_t *)calloc( 1, sizeof( *entry ) );
+    assert( entry && "Memory allocation error" );
+
+    entry->key = key;
+    entry->hash = hash;
+    entry->tree = cache->diff->expr_tree;
+    cache->diff->expr_tree = NULL;
+
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    LruPushFront( cache, entry );
+    cache->size++;
+
+    return entry;
+}
+
+static DerivativeChain_t *GetChain( CacheEntry_t *entry, SymbolId var ) {
+    for ( size_t idx = 0; idx < entry->n_chains; idx++ ) {
+        if ( entry->chains[idx].var == var )
+            return &entry->chains[idx];
+    }
+
+    DerivativeChain_t *chains =
+        (DerivativeChain_t *)realloc( entry->chains, ( entry->n_chains + 1 ) * sizeof( DerivativeChain_t ) );
+    assert( chains && "Memory allocation error" );
+    entry->chains = chains;
+
+    DerivativeChain_t *chain = &entry->chains[entry->n_chains++];
+    memset( chain, 0, sizeof( *chain ) );
+    chain->var = var;
+
+    return chain;
+}
+
+static CompiledExpr_t *ExprCacheDerivative( ExprCache_t *cache, CacheEntry_t *entry, SymbolId var, int order,
+                                            const Tree_t **tree ) {
+    if ( order < 0 || order > MAX_SERVER_ORDER )
+        return NULL;
+
+    DerivativeChain_t *chain = GetChain( entry, var );
+
+    while ( chain->n_orders <= order ) {
+        if ( chain->n_orders >= chain->capacity ) {
+            chain->capacity = chain->capacity ? chain->capacity * 2 : 4;
+            chain->trees = (Tree_t **)realloc( chain->trees, (size_t)chain->capacity * sizeof( Tree_t * ) );
+            chain->compiled =
+                (CompiledExpr_t **)realloc( chain->compiled, (size_t)chain->capacity * sizeof( CompiledExpr_t * ) );
+            assert( chain->trees && chain->compiled && "Memory allocation error" );
+        }
+
+        Tree_t *next = NULL;
+        if ( chain->n_orders == 0 ) {
+            next = TreeCtor();
+            next->root = NodeCopy( entry->tree->root );
+        } else {
+            next = DifferentiateTree( cache->diff, chain->trees[chain->n_orders - 1], var );
+            if ( !next )
+                return NULL;
+        }
+
+        chain->trees[chain->n_orders] = next;
+        chain->compiled[chain->n_orders] = CompileTree( next );
+        chain->n_orders++;
+    }
+
+    if ( tree )
+        *tree = chain->trees[order];
+
+    return chain->compiled[order];
+}
+
+// ------------------------------------ JSON -------------------------------------
+
+static void JsonSkipSpaces( const char **position ) {
+    while ( isspace( (unsigned char)**position ) )
+        ( *position )++;
+}
+
+static bool JsonSkipString( const char **position ) {
+    if ( **position != '"' )
+        return false;
+
+    ( *position )++;
+    while ( **position && **position != '"' ) {
+        if ( **position == '\\' && ( *position )[1] )
+            ( *position )++;
+        ( *position )++;
+    }
+
+    if ( **position != '"' )
+        return false;
+
+    ( *position )++;
+    return true;
+}
+
+static char *JsonReadString( const char **position ) {
+    const char *start = *position + 1;
+    if ( !JsonSkipString( position ) )
+        return NULL;
+
+    size_t length = (size_t)( *position - start - 1 );
+    char *string = (char *)calloc( length + 1, sizeof( char ) );
+    assert( string && "Memory allocation error" );
+
+    size_t out = 0;
+    for ( size_t idx = 0; idx < length; idx++ ) {
+        char symbol = start[idx];
+        if ( symbol == '\\' && idx + 1 < length ) {
+            symbol = start[++idx];
+            switch ( symbol ) {
+                case 'n':
+                    symbol = '\n';
+                    break;
+                case 't':
+                    symbol = '\t';
+                    break;
+                case 'r':
+                    symbol = '\r';
+                    break;
+                default:
+                    break;
+            }
+        }
+        string[out++] = symbol;
+    }
+
+    return string;
+}
+
+static bool JsonSkipValue( const char **position ) {
+    JsonSkipSpaces( position );
+
+    if ( **position == '"' )
+        return JsonSkipString( position );
+
+    if ( **position == '[' || **position == '{' ) {
+        int depth = 0;
+        do {
+            if ( **position == '"' ) {
+                if ( !JsonSkipString( position ) )
+                    return false;
+                continue;
+            }
+            if ( **position == '[' || **position == '{' )
+                depth++;
+            else if ( **position == ']' || **position == '}' )
+                depth--;
+            else if ( !**position )
+                return false;
+            ( *position )++;
+        } while ( depth > 0 );
+
+        return true;
+    }
+
+    const char *start = *position;
+    while ( **position && **position != ',' && **position != '}' && **position != ']' &&
+            !isspace( (unsigned char)**position ) )
+        ( *position )++;
+
+    return *position != start;
+}
+
+static bool JsonReadNumber( const char **position, double *value ) {
+    JsonSkipSpaces( position );
+
+    if ( strncmp( *position, "null", 4 ) == 0 ) {
+        *position += 4;
+        *value = NAN;
+        return true;
+    }
+
+    size_t read_bytes = ReadDouble( *position, value );
+    *position += read_bytes;
+
+    return read_bytes != 0;
+}
+
+static bool JsonReadNumberArray( const char **position, double **array, size_t *size ) {
+    JsonSkipSpaces( position );
+    if ( **position != '[' )
+        return false;
+    ( *position )++;
+
+    size_t capacity = 0;
+    *size = 0;
+
+    JsonSkipSpaces( position );
+    if ( **position == ']' ) {
+        ( *position )++;
+        return true;
+    }
+
+    while ( true ) {
+        if ( *size >= capacity ) {
+            capacity = capacity ? capacity * 2 : 16;
+            double *new_array = (double *)realloc( *array, capacity * sizeof( double ) );
+            assert( new_array && "Memory allocation error" );
+            *array = new_array;
+        }
+
+        if ( !JsonReadNumber( position, &( *array )[*size] ) )
+            return false;
+        ( *size )++;
+
+        JsonSkipSpaces( position );
+        if ( **position == ']' ) {
+            ( *position )++;
+            return true;
+        }
+        if ( **position != ',' )
+            return false;
+        ( *position )++;
+    }
+}
+
+// Variable names are not escaped on output, so only identifiers are accepted.
+static bool JsonIsSymbol( const char *string ) {
+    size_t length = strlen( string );
+
+    return length && SymbolNameLength( string ) == length;
+}
+
+static bool JsonReadVariables( const char **position, VarTable_t *vars ) {
+    JsonSkipSpaces( position );
+    if ( **position != '{' )
+        return false;
+    ( *position )++;
+
+    JsonSkipSpaces( position );
+    if ( **position == '}' ) {
+        ( *position )++;
+        return true;
+    }
+
+    while ( true ) {
+        JsonSkipSpaces( position );
+        char *name = JsonReadString( position );
+        if ( !name )
+            return false;
+
+        JsonSkipSpaces( position );
+        double value = 0;
+        bool ok = ( **position == ':' );
+        if ( ok ) {
+            ( *position )++;
+            ok = JsonReadNumber( position, &value ) && JsonIsSymbol( name );
+        }
+
+        if ( ok )
+            VarTableSet( vars, SymbolIntern( name ), value );
+        free( name );
+        if ( !ok )
+            return false;
+
+        JsonSkipSpaces( position );
+        if ( **position == '}' ) {
+            ( *position )++;
+            return true;
+        }
+        if ( **position != ',' )
+            return false;
+        ( *position )++;
+    }
+}
+
+static bool ParseRequestField( const char **position, const char *key, ServerRequest_t *request ) {
+    JsonSkipSpaces( position );
+
+    if ( strcmp( key, "id" ) == 0 ) {
+        const char *start = *position;
+        if ( !JsonSkipValue( position ) )
+            return false;
+        size_t length = (size_t)( *position - start );
+        if ( length >= MAX_ID_LEN )
+            return false;
+        memcpy( request->id, start, length );
+        request->id[length] = '\0';
+        return true;
+    }
+
+    if ( strcmp( key, "op" ) == 0 || strcmp( key, "expr" ) == 0 || strcmp( key, "var" ) == 0 ) {
+        char *string = JsonReadString( position );
+        if ( !string )
+            return false;
+
+        bool ok = true;
+        if ( key[0] == 'o' ) {
+            ok = strlen( string ) < MAX_OP_LEN;
+            if ( ok )
+                strcpy( request->op, string );
+            free( string );
+        } else if ( key[0] == 'v' ) {
+            ok = JsonIsSymbol( string );
+            if ( ok )
+                request->var = SymbolIntern( string );
+            free( string );
+        } else {
+            free( request->expr );
+            request->expr = string;
+        }
+
+        return ok;
+    }
+
+    if ( strcmp( key, "order" ) == 0 ) {
+        double order = 0;
+        if ( !JsonReadNumber( position, &order ) )
+            return false;
+        request->order = (int)order;
+        return true;
+    }
+
+    if ( strcmp( key, "point" ) == 0 ) {
+        request->has_point = true;
+        return JsonReadNumber( position, &request->point );
+    }
+
+    if ( strcmp( key, "points" ) == 0 )
+        return JsonReadNumberArray( position, &request->points, &request->n_points );
+
+    if ( strcmp( key, "vars" ) == 0 )
+        return JsonReadVariables( position, &request->vars );
+
+    return JsonSkipValue( position );
+}
+
+static bool ParseRequest( const char *line, ServerRequest_t *request ) {
+    const char *position = line;
+
+    JsonSkipSpaces( &position );
+    if ( *position != '{' )
+        return false;
+    position++;
+
+    JsonSkipSpaces( &position );
+    if ( *position == '}' )
+        return true;
+
+    while ( true ) {
+        JsonSkipSpaces( &position );
+        char *key = JsonReadString( &position );
+        if ( !key )
+            return false;
+
+        JsonSkipSpaces( &position );
+        bool ok = ( *position == ':' );
+        if ( ok ) {
+            position++;
+            ok = ParseRequestField( &position, key, request );
+        }
+        free( key );
+        if ( !ok )
+            return false;
+
+        JsonSkipSpaces( &position );
+        if ( *position == '}' )
+            return true;
+        if ( *position != ',' )
+            return false;
+        position++;
+    }
+}
+
+static void ServerRequestDtor( ServerRequest_t *request ) {
+    free( request->expr );
+    free( request->points );
+    VarTableDtor( &request->vars );
+}
+
+// ---------------------------------- Responses ----------------------------------
+
+static double GetTimeMicroseconds() {
+    struct timespec ts = {};
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec * 1e-3;
+}
+
+static void JsonWriteNumber( OutputBuffer_t *output, double value ) {
+    if ( isfinite( value ) )
+        BufferPutDouble( output, value );
+    else
+        BufferPutString( output, "null" );
+}
+
+static void JsonWriteString( OutputBuffer_t *output, const char *string ) {
+    BufferPutChar( output, '"' );
+    for ( ; *string; string++ ) {
+        if ( *string == '"' || *string == '\\' )
+            BufferPutChar( output, '\\' );
+        if ( *string == '\n' )
+            BufferPutString( output, "\\n" );
+        else
+            BufferPutChar( output, *string );
+    }
+    BufferPutChar( output, '"' );
+}
+
+static void ResponseBegin( OutputBuffer_t *output, const ServerRequest_t *request, bool ok ) {
+    BufferPrintf( output, "{\"id\":%s,\"ok\":%s", request->id[0] ? request->id : "null", ok ? "true" : "false" );
+}
+
+static void ResponseError( OutputBuffer_t *output, const ServerRequest_t *request, const char *message ) {
+    ResponseBegin( output, request, false );
+    BufferPrintf( output, ",\"error\":" );
+    JsonWriteString( output, message );
+    BufferPrintf( output, "}\n" );
+}
+
+static double *AllocValues( const CompiledExpr_t *expr ) {
+    double *values = (double *)calloc( expr->n_variables + 1, sizeof( double ) );
+    assert( values && "Memory allocation error" );
+
+    return values;
+}
+
+static bool HandleDifferentiate( ExprCache_t *cache, CacheEntry_t *entry, ServerRequest_t *request, OutputBuffer_t *output ) {
+    const Tree_t *tree = NULL;
+    if ( !ExprCacheDerivative( cache, entry, request->var, request->order, &tree ) ) {
+        ResponseError( output, request, "differentiation failed" );
+        return false;
+    }
+
+    ResponseBegin( output, request, true );
+    BufferPrintf( output, ",\"result\":\"" );
+    TreeWriteText( tree, output );
+    BufferPrintf( output, "\"" );
+
+    return true;
+}
+
+static bool NumericDerivatives( const CacheEntry_t *entry, const ServerRequest_t *request, const double *points,
+                                size_t n_points, double *results ) {
+    for ( size_t idx = 0; idx < n_points; idx++ ) {
+        if ( !TaylorModeDerivative( entry->tree->root, &request->vars, request->var, points[idx], request->order,
+                                    &results[idx] ) )
+            return false;
+    }
+
+    return true;
+}
+
+static bool HandleEvaluate( ExprCache_t *cache, CacheEntry_t *entry, ServerRequest_t *request, OutputBuffer_t *output ) {
+    size_t n_points = request->n_points;
+    const double *points = request->points;
+    if ( !points ) {
+        points = &request->point;
+        n_points = 1;
+    }
+
+    double *results = (double *)calloc( n_points + 1, sizeof( double ) );
+    assert( results && "Memory allocation error" );
+
+    CompiledExpr_t *expr = ExprCacheDerivative( cache, entry, request->var, request->order, NULL );
+    if ( expr ) {
+        double *values = AllocValues( expr );
+        CompiledExprBind( expr, &request->vars, values );
+        CompiledExprEvaluateBatch( expr, CompiledExprSlot( expr, request->var ), points, n_points, values, results,
+                                   cache->diff->pool );
+        free( values );
+    } else if ( !NumericDerivatives( entry, request, points, n_points, results ) ) {
+        free( results );
+        ResponseError( output, request, "differentiation failed" );
+        return false;
+    }
+
+    ResponseBegin( output, request, true );
+    BufferPrintf( output, ",\"values\":[" );
+    for ( size_t idx = 0; idx < n_points; idx++ ) {
+        if ( idx )
+            BufferPutChar( output, ',' );
+        JsonWriteNumber( output, results[idx] );
+    }
+    BufferPrintf( output, "]" );
+
+    free( results );
+
+    return true;
+}
+
+static bool HandleTaylor( ExprCache_t *cache, CacheEntry_t *entry, ServerRequest_t *request, OutputBuffer_t *output ) {
+    VarTableSet( &request->vars, request->var, request->point );
+
+    double *coefficients = (double *)calloc( (size_t)request->order + 1, sizeof( double ) );
+    assert( coefficients && "Memory allocation error" );
+
+    double factorial = 1;
+    for ( int order = 0; order <= request->order; order++ ) {
+        CompiledExpr_t *expr = ExprCacheDerivative( cache, entry, request->var, order, NULL );
+        if ( !expr ) {
+            if ( TaylorModeCoefficients( entry->tree->root, &request->vars, request->var, request->point,
+                                         request->order, coefficients ) )
+                break;
+
+            free( coefficients );
+            ResponseError( output, request, "differentiation failed" );
+            return false;
+        }
+
+        if ( order > 1 )
+            factorial *= order;
+
+        double *values = AllocValues( expr );
+        CompiledExprBind( expr, &request->vars, values );
+        coefficients[order] = CompiledExprEvaluate( expr, values ) / factorial;
+        free( values );
+    }
+
+    ResponseBegin( output, request, true );
+    BufferPrintf( output, ",\"coefficients\":[" );
+    for ( int order = 0; order <= request->order; order++ ) {
+        if ( order )
+            BufferPutChar( output, ',' );
+        JsonWriteNumber( output, coefficients[order] );
+    }
+    BufferPrintf( output, "]" );
+
+    free( coefficients );
+
+    return true;
+}
+
+static bool HandleGradient( ExprCache_t *cache, CacheEntry_t *entry, ServerRequest_t *request, OutputBuffer_t *output ) {
+    CompiledExpr_t *function = ExprCacheDerivative( cache, entry, request->var, 0, NULL );
+    if ( !function ) {
+        ResponseError( output, request, "compilation failed" );
+        return false;
+    }
+
+    size_t n_vars = function->n_variables;
+    SymbolId *names = (SymbolId *)calloc( n_vars + 1, sizeof( SymbolId ) );
+    assert( names && "Memory allocation error" );
+    memcpy( names, function->variables, n_vars * sizeof( SymbolId ) );
+
+    double *gradient = (double *)calloc( n_vars + 1, sizeof( double ) );
+    assert( gradient && "Memory allocation error" );
+
+    for ( size_t idx = 0; idx < n_vars; idx++ ) {
+        CompiledExpr_t *expr = ExprCacheDerivative( cache, entry, names[idx], 1, NULL );
+        if ( !expr ) {
+            free( names );
+            free( gradient );
+            ResponseError( output, request, "differentiation failed" );
+            return false;
+        }
+
+        double *values = AllocValues( expr );
+        CompiledExprBind( expr, &request->vars, values );
+        gradient[idx] = CompiledExprEvaluate( expr, values );
+        free( values );
+    }
+
+    ResponseBegin( output, request, true );
+    BufferPrintf( output, ",\"gradient\":{" );
+    for ( size_t idx = 0; idx < n_vars; idx++ ) {
+        BufferPrintf( output, "%s\"%s\":", idx ? "," : "", SymbolName( names[idx] ) );
+        JsonWriteNumber( output, gradient[idx] );
+    }
+    BufferPrintf( output, "}" );
+
+    free( names );
+    free( gradient );
+
+    return true;
+}
+
+// The symbolic gradient and Hessian are built once per cache entry.
+static bool HandleHessian( ExprCache_t *cache, CacheEntry_t *entry, ServerRequest_t *request, OutputBuffer_t *output ) {
+    if ( !entry->has_hessian ) {
+        CompiledExpr_t *function = ExprCacheDerivative( cache, entry, request->var, 0, NULL );
+        const Tree_t *tree = entry->tree;
+
+        if ( !function ||
+             !DerivativeJacobian( cache->diff, &tree, 1, function->variables, function->n_variables,
+                                  &entry->gradient ) ) {
+            ResponseError( output, request, "differentiation failed" );
+            return false;
+        }
+
+        if ( !DerivativeHessian( cache->diff, &entry->gradient, &entry->hessian ) ) {
+            DerivativeMatrixDtor( &entry->gradient );
+            ResponseError( output, request, "differentiation failed" );
+            return false;
+        }
+
+        entry->has_hessian = true;
+    }
+
+    size_t n_vars = entry->hessian.n_cols;
+    double *gradient = (double *)calloc( n_vars + 1, sizeof( double ) );
+    double *hessian = (double *)calloc( n_vars * n_vars + 1, sizeof( double ) );
+    assert( gradient && hessian && "Memory allocation error" );
+
+    DerivativeMatrixEvaluate( &entry->gradient, &request->vars, gradient );
+    DerivativeMatrixEvaluate( &entry->hessian, &request->vars, hessian );
+
+    ResponseBegin( output, request, true );
+    BufferPrintf( output, ",\"variables\":[" );
+    for ( size_t idx = 0; idx < n_vars; idx++ ) {
+        BufferPrintf( output, "%s", idx ? "," : "" );
+        JsonWriteString( output, SymbolName( entry->hessian.variables[idx] ) );
+    }
+
+    BufferPrintf( output, "],\"gradient\":[" );
+    for ( size_t idx = 0; idx < n_vars; idx++ ) {
+        BufferPrintf( output, "%s", idx ? "," : "" );
+        JsonWriteNumber( output, gradient[idx] );
+    }
+
+    BufferPrintf( output, "],\"hessian\":[" );
+    for ( size_t row = 0; row < n_vars; row++ ) {
+        BufferPrintf( output, "%s[", row ? "," : "" );
+        for ( size_t col = 0; col < n_vars; col++ ) {
+            BufferPrintf( output, "%s", col ? "," : "" );
+            JsonWriteNumber( output, hessian[row * n_vars + col] );
+        }
+        BufferPrintf( output, "]" );
+    }
+    BufferPrintf( output, "],\"nonzeros\":%lu", DerivativeMatrixNonZeros( &entry->hessian ) );
+
+    free( gradient );
+    free( hessian );
+
+    return true;
+}
+
+static bool HandleRequest( ExprCache_t *cache, const char *line, OutputBuffer_t *output ) {
+    double start = GetTimeMicroseconds();
+
+    ServerRequest_t request = {};
+    request.var = SymbolIntern( "x" );
+
+    bool keep_running = true;
+
+    if ( !ParseRequest( line, &request ) ) {
+        ResponseError( output, &request, "malformed request" );
+    } else if ( strcmp( request.op, "shutdown" ) == 0 ) {
+        ResponseBegin( output, &request, true );
+        BufferPrintf( output, "}\n" );
+        keep_running = false;
+    } else if ( strcmp( request.op, "stats" ) == 0 ) {
+        ResponseBegin( output, &request, true );
+        BufferPrintf( output, ",\"cached\":%lu,\"capacity\":%lu,\"hits\":%lu,\"misses\":%lu}\n", cache->size,
+                 cache->capacity, cache->hits, cache->misses );
+    } else if ( !request.expr ) {
+        ResponseError( output, &request, "missing `expr`" );
+    } else if ( request.order < 0 || request.order > MAX_SERVER_ORDER ) {
+        ResponseError( output, &request, "`order` is out of range" );
+    } else {
+        CacheEntry_t *entry = ExprCacheGet( cache, request.expr );
+        bool answered = false;
+
+        if ( !entry )
+            ResponseError( output, &request, "syntax error in `expr`" );
+        else if ( strcmp( request.op, "differentiate" ) == 0 )
+            answered = HandleDifferentiate( cache, entry, &request, output );
+        else if ( strcmp( request.op, "evaluate" ) == 0 )
+            answered = HandleEvaluate( cache, entry, &request, output );
+        else if ( strcmp( request.op, "taylor" ) == 0 )
+            answered = HandleTaylor( cache, entry, &request, output );
+        else if ( strcmp( request.op, "gradient" ) == 0 )
+            answered = HandleGradient( cache, entry, &request, output );
+        else if ( strcmp( request.op, "hessian" ) == 0 )
+            answered = HandleHessian( cache, entry, &request, output );
+        else
+            ResponseError( output, &request, "unknown `op`" );
+
+        if ( answered )
+            BufferPrintf( output, ",\"us\":%.1f}\n", GetTimeMicroseconds() - start );
+    }
+
+    ServerRequestDtor( &request );
+
+    return keep_running;
+}
+
+// False when a request asked the server to stop. A failed write (EPIPE,
+// ECONNRESET) means the client is gone and only ends this stream.
+static bool ServeStream( ExprCache_t *cache, FILE *input, FILE *output_file ) {
+    OutputBuffer_t response = {};
+    OutputBufferCtor( &response, NULL );
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    bool keep_running = true;
+
+    while ( keep_running && getline( &line, &line_capacity, input ) != -1 ) {
+        const char *position = line;
+        JsonSkipSpaces( &position );
+        if ( !*position )
+            continue;
+
+        pthread_mutex_lock( &cache->lock );
+        keep_running = HandleRequest( cache, line, &response );
+        pthread_mutex_unlock( &cache->lock );
+
+        bool written = fwrite( response.data, 1, response.size, output_file ) == response.size;
+        written = ( fflush( output_file ) == 0 ) && written;
+        response.size = 0;
+
+        if ( !written ) {
+            PRINT( "Client is gone: %s", strerror( errno ) );
+            break;
+        }
+    }
+
+    free( line );
+    OutputBufferDtor( &response );
+
+    return keep_running;
+}
+
+// Wakes the accept loop and every connection blocked on a read.
+static void ServerStop( ServerClients_t *clients ) {
+    pthread_mutex_lock( &clients->lock );
+
+    clients->stopping = true;
+    shutdown( clients->server_fd, SHUT_RDWR );
+    for ( size_t idx = 0; idx < clients->n_fds; idx++ )
+        shutdown( clients->fds[idx], SHUT_RDWR );
+
+    pthread_mutex_unlock( &clients->lock );
+}
+
+static bool ServerAddClient( ServerClients_t *clients, int fd ) {
+    pthread_mutex_lock( &clients->lock );
+
+    bool added = !clients->stopping;
+    if ( added ) {
+        if ( clients->n_fds >= clients->capacity ) {
+            clients->capacity = clients->capacity ? clients->capacity * 2 : 16;
+            clients->fds = (int *)realloc( clients->fds, clients->capacity * sizeof( int ) );
+            assert( clients->fds && "Memory allocation error" );
+        }
+        clients->fds[clients->n_fds++] = fd;
+    }
+
+    pthread_mutex_unlock( &clients->lock );
+
+    return added;
+}
+
+// Called before the descriptor is closed, so ServerStop never shuts down a reused number.
+static void ServerRemoveClient( ServerClients_t *clients, int fd ) {
+    pthread_mutex_lock( &clients->lock );
+
+    for ( size_t idx = 0; idx < clients->n_fds; idx++ ) {
+        if ( clients->fds[idx] == fd ) {
+            clients->fds[idx] = clients->fds[--clients->n_fds];
+            break;
+        }
+    }
+    if ( clients->n_fds == 0 )
+        pthread_cond_broadcast( &clients->all_closed );
+
+    pthread_mutex_unlock( &clients->lock );
+}
+
+static void *ServeClient( void *arg ) {
+    Client_t *client = (Client_t *)arg;
+    ServerClients_t *clients = client->clients;
+
+    int output_fd = dup( client->fd );
+    FILE *input = fdopen( client->fd, "r" );
+    FILE *output = ( output_fd != -1 ) ? fdopen( output_fd, "w" ) : NULL;
+
+    if ( input && output && !ServeStream( clients->cache, input, output ) )
+        ServerStop( clients );
+
+    ServerRemoveClient( clients, client->fd );
+
+    if ( input )
+        fclose( input );
+    else
+        close( client->fd );
+
+    if ( output )
+        fclose( output );
+    else if ( output_fd != -1 )
+        close( output_fd );
+
+    free( client );
+
+    return NULL;
+}
+
+static bool ServeSocket( ExprCache_t *cache, const char *socket_path ) {
+    struct sockaddr_un address = {};
+    if ( strlen( socket_path ) >= sizeof( address.sun_path ) ) {
+        PRINT_ERROR( "Socket path `%s` is too long \n", socket_path );
+        return false;
+    }
+
+    int server_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( server_fd == -1 ) {
+        PRINT_ERROR( "Failed to create socket \n" );
+        return false;
+    }
+
+    address.sun_family = AF_UNIX;
+    strcpy( address.sun_path, socket_path );
+    unlink( socket_path );
+
+    if ( bind( server_fd, (struct sockaddr *)&address, sizeof( address ) ) == -1 || listen( server_fd, 16 ) == -1 ) {
+        PRINT_ERROR( "Failed to listen on `%s` \n", socket_path );
+        close( server_fd );
+        return false;
+    }
+
+    fprintf( stderr, "Listening on %s\n", socket_path );
+
+    // A client that closes its end before the response is written must not kill the server.
+    signal( SIGPIPE, SIG_IGN );
+
+    ServerClients_t clients = {};
+    clients.cache = cache;
+    clients.server_fd = server_fd;
+    pthread_mutex_init( &clients.lock, NULL );
+    pthread_cond_init( &clients.all_closed, NULL );
+
+    bool ok = true;
+    while ( true ) {
+        int client_fd = accept( server_fd, NULL, NULL );
+        if ( client_fd == -1 ) {
+            pthread_mutex_lock( &clients.lock );
+            bool stopping = clients.stopping;
+            pthread_mutex_unlock( &clients.lock );
+            if ( stopping )
+                break;
+
+            if ( errno == EINTR || errno == ECONNABORTED )
+                continue;
+
+            // Out of descriptors or memory: the next attempt may succeed, but not right away.
+            if ( errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM ) {
+                PRINT_ERROR( "Failed to accept a connection: %s, retrying \n", strerror( errno ) );
+                usleep( ACCEPT_BACKOFF_US );
+                continue;
+            }
+
+            PRINT_ERROR( "Failed to accept a connection: %s \n", strerror( errno ) );
+            ok = false;
+            break;
+        }
+
+        if ( !ServerAddClient( &clients, client_fd ) ) {
+            close( client_fd );
+            break;
+        }
+
+        Client_t *client = (Client_t *)calloc( 1, sizeof( Client_t ) );
+        assert( client && "Memory allocation error" );
+        *client = { &clients, client_fd };
+
+        pthread_t thread = {};
+        if ( pthread_create( &thread, NULL, ServeClient, client ) != 0 ) {
+            PRINT_ERROR( "Failed to start a thread for a connection \n" );
+            ServerRemoveClient( &clients, client_fd );
+            close( client_fd );
+            free( client );
+            continue;
+        }
+        pthread_detach( thread );
+    }
+
+    ServerStop( &clients );
+
+    pthread_mutex_lock( &clients.lock );
+    while ( clients.n_fds )
+        pthread_cond_wait( &clients.all_closed, &clients.lock );
+    pthread_mutex_unlock( &clients.lock );
+
+    free( clients.fds );
+    pthread_cond_destroy( &clients.all_closed );
+    pthread_mutex_destroy( &clients.lock );
+
+    close( server_fd );
+    unlink( socket_path );
+
+    return ok;
+}
+
+bool DifferentiatorServe( const char *socket_path, size_t cache_capacity ) {
+    ExprCache_t cache = {};
+    ExprCacheCtor( &cache, cache_capacity );
+
+    bool result = true;
+    if ( socket_path )
+        result = ServeSocket( &cache, socket_path );
+    else
+        ServeStream( &cache, stdin, stdout );
+
+    ExprCacheDtor( &cache );
+
+    return result;
+}
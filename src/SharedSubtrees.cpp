@@ -0,0 +1,333 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+
+// Repeated subtrees are found by hash-consing: bottom-up every node gets the id
+// of its class, two nodes share a class when their values and the classes of
+// their children are equal, so a lookup never walks a subtree.
+// A class gets a name when it is at least `min_size` nodes and still occurs
+// twice after the bigger named classes around it are replaced by their names.
+// Names are numbered so that a definition only refers to earlier ones.
+
+struct SubtreeClass_t {
+    const Node_t *node;
+    size_t        left;
+    size_t        right;
+
+    size_t size;
+    size_t count;
+    size_t uses;
+    size_t name;
+    bool   shared;
+};
+
+static uint64_t HashWord( uint64_t hash, uint64_t word ) {
+    hash ^= word + 0x9e3779b97f4a7c15ULL + ( hash << 6 ) + ( hash >> 2 );
+    return hash * 0xff51afd7ed558ccdULL;
+}
+
+static uint64_t HashValue( const NodeValue *value ) {
+    uint64_t payload = 0;
+    switch ( value->type ) {
+        case NODE_NUMBER:
+            memcpy( &payload, &value->data.number, sizeof( payload ) );
+            break;
+        case NODE_VARIABLE:
+            payload = (uint64_t)value->data.variable;
+            break;
+        case NODE_OPERATION:
+            payload = (uint64_t)value->data.operation;
+            break;
+        case NODE_UNKNOWN:
+        default:
+            break;
+    }
+
+    return HashWord( HashWord( 0, (uint64_t)value->type ), payload );
+}
+
+static bool ValuesEqual( const NodeValue *a, const NodeValue *b ) {
+    if ( a->type != b->type )
+        return false;
+
+    switch ( a->type ) {
+        case NODE_NUMBER:
+            return memcmp( &a->data.number, &b->data.number, sizeof( a->data.number ) ) == 0;
+        case NODE_VARIABLE:
+            return a->data.variable == b->data.variable;
+        case NODE_OPERATION:
+            return a->data.operation == b->data.operation;
+        case NODE_UNKNOWN:
+        default:
+            return true;
+    }
+}
+
+static size_t NodeSlot( const SharedSubtrees_t *shared, const Node_t *node ) {
+    size_t mask = shared->table_size - 1;
+    size_t slot = HashWord( 0, (uintptr_t)node ) & mask;
+
+    while ( shared->node_keys[slot] && shared->node_keys[slot] != node )
+        slot = ( slot + 1 ) & mask;
+
+    return slot;
+}
+
+static size_t NodeClass( const SharedSubtrees_t *shared, const Node_t *node ) {
+    size_t slot = NodeSlot( shared, node );
+
+    return shared->node_keys[slot] ? shared->node_classes[slot] : 0;
+}
+
+// Explicit stacks walk the trees: the parser accepts very deep ones.
+struct SubtreeFrame_t {
+    const Node_t *node;
+    int           state;
+    size_t        left;
+};
+
+struct SubtreeStack_t {
+    SubtreeFrame_t *frames;
+    size_t          top;
+    size_t          capacity;
+};
+
+static void SubtreeStackPush( SubtreeStack_t *stack, const Node_t *node ) {
+    if ( stack->top >= stack->capacity ) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 64;
+        stack->frames = (SubtreeFrame_t *)realloc( stack->frames, stack->capacity * sizeof( SubtreeFrame_t ) );
+        assert( stack->frames && "Memory allocation error" );
+    }
+
+    stack->frames[stack->top++] = { node, 0, 0 };
+}
+
+static size_t ClassifyValue( SharedSubtrees_t *shared, size_t *class_table, const Node_t *node, size_t left,
+                             size_t right ) {
+    uint64_t hash = HashWord( HashWord( HashValue( &node->value ), left ), right );
+    size_t mask = shared->table_size - 1;
+    size_t slot = hash & mask;
+
+    size_t id = 0;
+    for ( ; class_table[slot]; slot = ( slot + 1 ) & mask ) {
+        const SubtreeClass_t *candidate = &shared->classes[class_table[slot]];
+        if ( candidate->left == left && candidate->right == right &&
+             ValuesEqual( &candidate->node->value, &node->value ) ) {
+            id = class_table[slot];
+            break;
+        }
+    }
+
+    if ( id ) {
+        shared->classes[id].count++;
+    } else {
+        id = ++shared->n_classes;
+        class_table[slot] = id;
+
+        SubtreeClass_t *new_class = &shared->classes[id];
+        new_class->node = node;
+        new_class->left = left;
+        new_class->right = right;
+        new_class->size = 1 + shared->classes[left].size + shared->classes[right].size;
+        new_class->count = 1;
+    }
+
+    size_t node_slot = NodeSlot( shared, node );
+    shared->node_keys[node_slot] = node;
+    shared->node_classes[node_slot] = id;
+
+    return id;
+}
+
+// Post-order, so the classes of the children are known.
+static size_t ClassifyTree( SharedSubtrees_t *shared, size_t *class_table, SubtreeStack_t *stack,
+                            const Node_t *root ) {
+    size_t id = 0;
+    SubtreeStackPush( stack, root );
+
+    while ( stack->top ) {
+        SubtreeFrame_t *frame = &stack->frames[stack->top - 1];
+        const Node_t *node = frame->node;
+
+        if ( frame->state == 0 ) {
+            frame->state = 1;
+            id = 0;
+            if ( node->left ) {
+                SubtreeStackPush( stack, node->left );
+                continue;
+            }
+        }
+
+        if ( frame->state == 1 ) {
+            frame->state = 2;
+            frame->left = id;
+            id = 0;
+            if ( node->right ) {
+                SubtreeStackPush( stack, node->right );
+                continue;
+            }
+        }
+
+        id = ClassifyValue( shared, class_table, node, frame->left, id );
+        stack->top--;
+    }
+
+    return id;
+}
+
+// A class occurs once for every time a class around it is written out: once
+// when that one is named, as often as it occurs otherwise. Children are
+// numbered before their parents, so going down from the last class decides
+// every class after all the classes around it, and the result is final in both
+// directions.
+static void ChooseShared( SharedSubtrees_t *shared, size_t min_size ) {
+    for ( size_t id = shared->n_classes; id >= 1; id-- ) {
+        SubtreeClass_t *node_class = &shared->classes[id];
+        node_class->shared = node_class->uses >= 2 && node_class->size >= min_size;
+
+        size_t written = node_class->shared ? 1 : node_class->uses;
+        if ( node_class->left )
+            shared->classes[node_class->left].uses += written;
+        if ( node_class->right )
+            shared->classes[node_class->right].uses += written;
+    }
+}
+
+// Post-order, so a definition only refers to earlier ones; a named class is
+// not entered again.
+static void AssignNames( SharedSubtrees_t *shared, SubtreeStack_t *stack, const Node_t *root ) {
+    SubtreeStackPush( stack, root );
+
+    while ( stack->top ) {
+        SubtreeFrame_t *frame = &stack->frames[stack->top - 1];
+        const Node_t *node = frame->node;
+        SubtreeClass_t *node_class = &shared->classes[NodeClass( shared, node )];
+
+        if ( frame->state == 0 ) {
+            if ( node_class->shared && node_class->name ) {
+                stack->top--;
+                continue;
+            }
+
+            frame->state = 1;
+            if ( node->left ) {
+                SubtreeStackPush( stack, node->left );
+                continue;
+            }
+        }
+
+        if ( frame->state == 1 ) {
+            frame->state = 2;
+            if ( node->right ) {
+                SubtreeStackPush( stack, node->right );
+                continue;
+            }
+        }
+
+        if ( node_class->shared ) {
+            shared->definitions[shared->n_definitions++] = node;
+            node_class->name = shared->n_definitions;
+        }
+        stack->top--;
+    }
+}
+
+void SharedSubtreesCtor( SharedSubtrees_t *shared, const Node_t *root, size_t min_size ) {
+    SharedSubtreesCtorForest( shared, &root, 1, min_size );
+}
+
+// Several trees are classified together, so a subtree repeated across them is one class.
+void SharedSubtreesCtorForest( SharedSubtrees_t *shared, const Node_t *const *roots, size_t n_roots,
+                               size_t min_size ) {
+    my_assert( shared, "Null pointer on `shared`" );
+    my_assert( roots || n_roots == 0, "Null pointer on `roots`" );
+
+    memset( shared, 0, sizeof( *shared ) );
+    for ( size_t idx = 0; idx < n_roots; idx++ )
+        shared->n_nodes += NodeCount( roots[idx] );
+    if ( shared->n_nodes == 0 )
+        return;
+
+    shared->table_size = 16;
+    while ( shared->table_size < shared->n_nodes * 2 )
+        shared->table_size *= 2;
+
+    shared->classes = (SubtreeClass_t *)calloc( shared->n_nodes + 1, sizeof( SubtreeClass_t ) );
+    shared->node_keys = (const Node_t **)calloc( shared->table_size, sizeof( Node_t * ) );
+    shared->node_classes = (size_t *)calloc( shared->table_size, sizeof( size_t ) );
+    size_t *class_table = (size_t *)calloc( shared->table_size, sizeof( size_t ) );
+    assert( shared->classes && shared->node_keys && shared->node_classes && class_table &&
+            "Memory allocation error" );
+
+    SubtreeStack_t stack = {};
+    for ( size_t idx = 0; idx < n_roots; idx++ ) {
+        if ( roots[idx] )
+            shared->classes[ClassifyTree( shared, class_table, &stack, roots[idx] )].uses++;
+    }
+    free( class_table );
+
+    ChooseShared( shared, min_size );
+
+    shared->definitions = (const Node_t **)calloc( shared->n_classes + 1, sizeof( Node_t * ) );
+    assert( shared->definitions && "Memory allocation error" );
+
+    for ( size_t idx = 0; idx < n_roots; idx++ ) {
+        if ( roots[idx] )
+            AssignNames( shared, &stack, roots[idx] );
+    }
+    free( stack.frames );
+
+    PRINT( "Shared subtrees: %lu nodes, %lu classes, %lu named", shared->n_nodes, shared->n_classes,
+           shared->n_definitions );
+}
+
+void SharedSubtreesDtor( SharedSubtrees_t *shared ) {
+    my_assert( shared, "Null pointer on `shared`" );
+
+    free( shared->classes );
+    free( shared->node_keys );
+    free( shared->node_classes );
+    free( shared->definitions );
+
+    memset( shared, 0, sizeof( *shared ) );
+}
+
+size_t SharedSubtreesName( const SharedSubtrees_t *shared, const Node_t *node ) {
+    my_assert( shared, "Null pointer on `shared`" );
+
+    if ( !shared->n_definitions || !node )
+        return 0;
+
+    return shared->classes[NodeClass( shared, node )].name;
+}
+
+const Node_t *SharedSubtreesRepresentative( const SharedSubtrees_t *shared, const Node_t *node ) {
+    my_assert( shared, "Null pointer on `shared`" );
+
+    if ( !shared->n_classes || !node )
+        return node;
+
+    size_t id = NodeClass( shared, node );
+
+    return id ? shared->classes[id].node : node;
+}
+
+// Classes are numbered bottom-up from 1: the children of a class come before it.
+size_t SharedSubtreesClass( const SharedSubtrees_t *shared, const Node_t *node ) {
+    my_assert( shared, "Null pointer on `shared`" );
+
+    if ( !shared->n_classes || !node )
+        return 0;
+
+    return NodeClass( shared, node );
+}
+
+const Node_t *SharedSubtreesClassNode( const SharedSubtrees_t *shared, size_t id ) {
+    my_assert( shared, "Null pointer on `shared`" );
+
+    return ( id && id <= shared->n_classes ) ? shared->classes[id].node : NULL;
+}
@@ -0,0 +1,347 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "Metrics.h"
+#include "Tree.h"
+
+// Taylor-mode automatic differentiation: every subtree is evaluated as the
+// truncated series of f(point + t), s[k] = f^(k)(point) / k!, k = 0..order.
+// Products and quotients are Cauchy convolutions, elementary functions follow
+// the recurrences of f' = g'(u) u', so n nodes cost O(n k^2) and no derivative
+// is built. It is the fallback for derivatives over the node budget.
+// Series live on one stack: a node pushes its operands and scratch series and
+// pops them when it is done, so the stack is bounded by the tree depth.
+
+struct TaylorMode_t {
+    const VarTable_t *table;
+    SymbolId          var;
+    double            point;
+
+    size_t  n;
+    double *stack;
+    size_t  used;
+    size_t  capacity;
+};
+
+const size_t SERIES_PER_LEVEL = 2;
+const size_t SERIES_SCRATCH   = 2;
+
+static size_t NodeDepth( const Node_t *node ) {
+    if ( !node )
+        return 0;
+
+    size_t left = NodeDepth( node->left );
+    size_t right = NodeDepth( node->right );
+
+    return 1 + ( left > right ? left : right );
+}
+
+static double *SeriesPush( TaylorMode_t *mode ) {
+    assert( mode->used < mode->capacity && "Taylor-mode stack overflow" );
+
+    double *series = mode->stack + mode->used * mode->n;
+    mode->used++;
+    memset( series, 0, mode->n * sizeof( double ) );
+
+    return series;
+}
+
+static bool SeriesIsConstant( const double *a, size_t n ) {
+    for ( size_t k = 1; k < n; k++ ) {
+        if ( fpclassify( a[k] ) != FP_ZERO )
+            return false;
+    }
+
+    return true;
+}
+
+// Backwards, so `out` may be `a` or `b`.
+static void SeriesMul( const double *a, const double *b, double *out, size_t n ) {
+    for ( size_t k = n; k-- > 0; ) {
+        double sum = 0;
+        for ( size_t j = 0; j <= k; j++ )
+            sum += a[j] * b[k - j];
+        out[k] = sum;
+    }
+}
+
+// `out` may be `a`.
+static void SeriesDiv( const double *a, const double *b, double *out, size_t n ) {
+    for ( size_t k = 0; k < n; k++ ) {
+        double sum = a[k];
+        for ( size_t j = 1; j <= k; j++ )
+            sum -= b[j] * out[k - j];
+        out[k] = sum / b[0];
+    }
+}
+
+static void SeriesExp( const double *a, double *out, size_t n ) {
+    out[0] = exp( a[0] );
+    for ( size_t k = 1; k < n; k++ ) {
+        double sum = 0;
+        for ( size_t j = 1; j <= k; j++ )
+            sum += (double)j * a[j] * out[k - j];
+        out[k] = sum / (double)k;
+    }
+}
+
+static void SeriesLn( const double *a, double *out, size_t n ) {
+    out[0] = log( a[0] );
+    for ( size_t k = 1; k < n; k++ ) {
+        double sum = 0;
+        for ( size_t j = 1; j < k; j++ )
+            sum += (double)j * out[j] * a[k - j];
+        out[k] = ( a[k] - sum / (double)k ) / a[0];
+    }
+}
+
+// The recurrence divides by a[0]; a zero base with a small natural power is
+// multiplied out instead, `scratch` holds the running square.
+static void SeriesPowConst( const double *a, double p, double *out, double *scratch, size_t n ) {
+    if ( fpclassify( a[0] ) == FP_ZERO && p >= 0 && CompareDoubleToDouble( p, floor( p ) ) == 0 ) {
+        memset( out, 0, n * sizeof( double ) );
+        if ( p >= (double)n )
+            return;
+
+        out[0] = 1;
+        memcpy( scratch, a, n * sizeof( double ) );
+        for ( size_t power = (size_t)p; power; power >>= 1 ) {
+            if ( power & 1 )
+                SeriesMul( out, scratch, out, n );
+            SeriesMul( scratch, scratch, scratch, n );
+        }
+        return;
+    }
+
+    out[0] = pow( a[0], p );
+    for ( size_t k = 1; k < n; k++ ) {
+        double sum = 0;
+        for ( size_t j = 1; j <= k; j++ )
+            sum += ( p * (double)j - (double)( k - j ) ) * a[j] * out[k - j];
+        out[k] = sum / ( (double)k * a[0] );
+    }
+}
+
+// sign = -1 gives sin and cos, sign = 1 gives sinh and cosh.
+static void SeriesSinCos( const double *a, double sign, double *s, double *c, size_t n ) {
+    s[0] = sign < 0 ? sin( a[0] ) : sinh( a[0] );
+    c[0] = sign < 0 ? cos( a[0] ) : cosh( a[0] );
+    for ( size_t k = 1; k < n; k++ ) {
+        double sum_s = 0, sum_c = 0;
+        for ( size_t j = 1; j <= k; j++ ) {
+            sum_s += (double)j * a[j] * c[k - j];
+            sum_c += (double)j * a[j] * s[k - j];
+        }
+        s[k] = sum_s / (double)k;
+        c[k] = sign * sum_c / (double)k;
+    }
+}
+
+// out' = h * u', the inverse functions are integrals of their derivatives.
+static void SeriesIntegrate( const double *u, const double *h, double value, double *out, size_t n ) {
+    out[0] = value;
+    for ( size_t k = 1; k < n; k++ ) {
+        double sum = 0;
+        for ( size_t j = 1; j <= k; j++ )
+            sum += (double)j * u[j] * h[k - j];
+        out[k] = sum / (double)k;
+    }
+}
+
+// out = sign * u^2 + constant
+static void SeriesQuadratic( const double *u, double sign, double constant, double *out, size_t n ) {
+    SeriesMul( u, u, out, n );
+    for ( size_t k = 0; k < n; k++ )
+        out[k] *= sign;
+    out[0] += constant;
+}
+
+static bool TaylorOperation( TaylorMode_t *mode, OperationType op, const double *L, double *R, double *out ) {
+    size_t n = mode->n;
+
+    switch ( op ) {
+        case OP_ADD:
+            for ( size_t k = 0; k < n; k++ )
+                out[k] = L[k] + R[k];
+            return true;
+        case OP_SUB:
+            for ( size_t k = 0; k < n; k++ )
+                out[k] = L[k] - R[k];
+            return true;
+        case OP_MUL:
+            SeriesMul( L, R, out, n );
+            return true;
+        case OP_DIV:
+            SeriesDiv( L, R, out, n );
+            return true;
+
+        case OP_POW:
+            if ( SeriesIsConstant( R, n ) ) {
+                SeriesPowConst( L, R[0], out, SeriesPush( mode ), n );
+            } else {
+                double *exponent = SeriesPush( mode );
+                SeriesLn( L, exponent, n );
+                SeriesMul( exponent, R, exponent, n );
+                SeriesExp( exponent, out, n );
+            }
+            return true;
+
+        case OP_LOG: {
+            double *ln_base = SeriesPush( mode );
+            double *ln_argument = SeriesPush( mode );
+            SeriesLn( L, ln_argument, n );
+            SeriesLn( R, ln_base, n );
+            SeriesDiv( ln_argument, ln_base, out, n );
+            return true;
+        }
+        case OP_LN:
+            SeriesLn( L, out, n );
+            return true;
+
+        // The second operand of a function is empty, it is used as scratch.
+        case OP_SIN:
+            SeriesSinCos( L, -1, out, R, n );
+            return true;
+        case OP_COS:
+            SeriesSinCos( L, -1, R, out, n );
+            return true;
+        case OP_TAN:
+        case OP_CTAN: {
+            double *c = SeriesPush( mode );
+            SeriesSinCos( L, -1, R, c, n );
+            if ( op == OP_TAN )
+                SeriesDiv( R, c, out, n );
+            else
+                SeriesDiv( c, R, out, n );
+            return true;
+        }
+        case OP_SH:
+            SeriesSinCos( L, 1, out, R, n );
+            return true;
+        case OP_CH:
+            SeriesSinCos( L, 1, R, out, n );
+            return true;
+
+        case OP_ARCSIN:
+        case OP_ARCCOS:
+        case OP_ARCTAN:
+        case OP_ARCCTAN:
+        case OP_ARSINH:
+        case OP_ARCH:
+        case OP_ARTANH: {
+            double *w = SeriesPush( mode );
+            double *scratch = SeriesPush( mode );
+            double sign = ( op == OP_ARCSIN || op == OP_ARCCOS || op == OP_ARTANH ) ? -1 : 1;
+            double constant = ( op == OP_ARCH ) ? -1 : 1;
+            double power = ( op == OP_ARCTAN || op == OP_ARCCTAN || op == OP_ARTANH ) ? -1 : -0.5;
+
+            SeriesQuadratic( L, sign, constant, w, n );
+            SeriesPowConst( w, power, R, scratch, n );
+            if ( op == OP_ARCCOS || op == OP_ARCCTAN ) {
+                for ( size_t k = 0; k < n; k++ )
+                    R[k] = -R[k];
+            }
+            SeriesIntegrate( L, R, EvaluateOperation( op, L[0], 0 ), out, n );
+            return true;
+        }
+
+        case OP_NOPE:
+        default:
+            PRINT_ERROR( "Unknown operation in Taylor-mode evaluation\n" );
+            return false;
+    }
+}
+
+static bool TaylorNode( TaylorMode_t *mode, const Node_t *node, double *out ) {
+    memset( out, 0, mode->n * sizeof( double ) );
+
+    // A missing operand is zero, as in EvaluateTree.
+    if ( !node )
+        return true;
+
+    switch ( node->value.type ) {
+        case NODE_NUMBER:
+            out[0] = node->value.data.number;
+            return true;
+
+        case NODE_VARIABLE:
+            if ( node->value.data.variable == mode->var ) {
+                out[0] = mode->point;
+                if ( mode->n > 1 )
+                    out[1] = 1;
+            } else {
+                out[0] = NAN;
+                VarTableGet( mode->table, node->value.data.variable, &out[0] );
+            }
+            return true;
+
+        case NODE_OPERATION: {
+            size_t mark = mode->used;
+            double *L = SeriesPush( mode );
+            double *R = SeriesPush( mode );
+
+            bool ok = TaylorNode( mode, node->left, L ) && TaylorNode( mode, node->right, R ) &&
+                      TaylorOperation( mode, (OperationType)node->value.data.operation, L, R, out );
+
+            mode->used = mark;
+            return ok;
+        }
+
+        case NODE_UNKNOWN:
+        default:
+            PRINT_ERROR( "Error: invalid node in Taylor-mode evaluation\n" );
+            return false;
+    }
+}
+
+bool TaylorModeCoefficients( const Node_t *root, const VarTable_t *table, SymbolId var, double point, int order,
+                             double *coefficients ) {
+    my_assert( coefficients, "Null pointer on `coefficients`" );
+
+    if ( !root || order < 0 )
+        return false;
+
+    TaylorMode_t mode = {};
+    mode.table = table;
+    mode.var = var;
+    mode.point = point;
+    mode.n = (size_t)order + 1;
+    mode.capacity = SERIES_PER_LEVEL * NodeDepth( root ) + SERIES_SCRATCH;
+    mode.stack = (double *)calloc( mode.capacity * mode.n, sizeof( double ) );
+    assert( mode.stack && "Memory allocation error" );
+
+    METRIC_PHASE_BEGIN( PHASE_EVALUATE )
+    bool ok = TaylorNode( &mode, root, coefficients );
+    METRIC_PHASE_END( PHASE_EVALUATE )
+    METRIC_INC( METRIC_TAYLOR_MODE_EVALUATIONS )
+
+    free( mode.stack );
+
+    return ok;
+}
+
+bool TaylorModeDerivative( const Node_t *root, const VarTable_t *table, SymbolId var, double point, int order,
+                           double *value ) {
+    my_assert( value, "Null pointer on `value`" );
+
+    double *coefficients = (double *)calloc( (size_t)( order < 0 ? 0 : order ) + 1, sizeof( double ) );
+    assert( coefficients && "Memory allocation error" );
+
+    bool ok = TaylorModeCoefficients( root, table, var, point, order, coefficients );
+
+    *value = NAN;
+    if ( ok ) {
+        double factorial = 1;
+        for ( int k = 2; k <= order; k++ )
+            factorial *= k;
+        *value = coefficients[order] * factorial;
+    }
+
+    free( coefficients );
+
+    return ok;
+}
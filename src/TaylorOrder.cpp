@@ -0,0 +1,150 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "Tree.h"
+
+// The smallest Taylor order within a tolerance. Orders are added one at a
+// time: the next derivative is one step from the previous one, and the partial
+// sums at the samples are updated with one more term, so order k costs one
+// differentiation and O(samples). The remainder is measured at evenly spaced
+// samples of the interval, where the function is finite.
+// Coefficients follow DifferentiatorTaylorChain (the variable takes its value
+// from the table), so the Taylor section of the report reuses them.
+
+struct OrderSamples_t {
+    double *f;
+    double *t;
+    double *power;
+    double *sum;
+    size_t  n;
+};
+
+static void OrderSamplesCtor( OrderSamples_t *samples, Differentiator_t *diff, SymbolId var, double point,
+                              double from, double to ) {
+    size_t n = TAYLOR_SEARCH_SAMPLES;
+
+    samples->n = n;
+    samples->f = (double *)calloc( 4 * n, sizeof( double ) );
+    assert( samples->f && "Memory allocation error" );
+    samples->t = samples->f + n;
+    samples->power = samples->f + 2 * n;
+    samples->sum = samples->f + 3 * n;
+
+    // `t` holds the sample points until the function is evaluated at them.
+    double step = ( to - from ) / (double)( n - 1 );
+    for ( size_t idx = 0; idx < n; idx++ )
+        samples->t[idx] = from + (double)idx * step;
+
+    CompiledExpr_t *expr = CompileTree( diff->expr_tree );
+
+    double *values = (double *)calloc( expr->n_variables + 1, sizeof( double ) );
+    assert( values && "Memory allocation error" );
+
+    CompiledExprBind( expr, &diff->var_table, values );
+    CompiledExprEvaluateBatch( expr, CompiledExprSlot( expr, var ), samples->t, n, values, samples->f, diff->pool );
+
+    free( values );
+    CompiledExprDtor( &expr );
+
+    for ( size_t idx = 0; idx < n; idx++ ) {
+        samples->t[idx] -= point;
+        samples->power[idx] = 1;
+    }
+}
+
+// Adds c (x - point)^order and returns the largest error left.
+static double OrderSamplesAdd( OrderSamples_t *samples, int order, double coefficient ) {
+    double error = 0;
+
+    for ( size_t idx = 0; idx < samples->n; idx++ ) {
+        if ( order > 0 )
+            samples->power[idx] *= samples->t[idx];
+        samples->sum[idx] += coefficient * samples->power[idx];
+
+        if ( !isfinite( samples->f[idx] ) )
+            continue;
+
+        double deviation = fabs( samples->f[idx] - samples->sum[idx] );
+        if ( !( deviation <= error ) )
+            error = isnan( deviation ) ? INFINITY : deviation;
+    }
+
+    return error;
+}
+
+bool TaylorSearchOrder( Differentiator_t *diff, SymbolId var, double point, TaylorOrderSearch_t *search ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( diff->expr_tree, "Null pointer on `diff->expr_tree`" );
+    my_assert( search, "Null pointer on `search`" );
+
+    if ( search->max_order <= 0 )
+        search->max_order = TAYLOR_SEARCH_MAX_ORDER;
+    if ( !( search->tolerance > 0 ) || !isfinite( search->from ) || !isfinite( search->to ) ||
+         !( search->from < search->to ) )
+        return false;
+
+    int max_order = search->max_order;
+    search->errors = (double *)calloc( (size_t)max_order + 1, sizeof( double ) );
+    double *coefficients = (double *)calloc( (size_t)max_order + 1, sizeof( double ) );
+    assert( search->errors && coefficients && "Memory allocation error" );
+
+    OrderSamples_t samples = {};
+    OrderSamplesCtor( &samples, diff, var, point, search->from, search->to );
+
+    bool taylor_mode = false;
+    double factorial = 1;
+
+    search->converged = false;
+    search->order = max_order;
+
+    for ( int order = 0; order <= max_order; order++ ) {
+        if ( !taylor_mode ) {
+            bool differentiated = ( order == 0 ) ? DifferentiateExpression( diff, var, 0 ) != NULL
+                                                 : DifferentiateStep( diff, var, order );
+            if ( differentiated ) {
+                if ( order > 0 ) {
+                    OptimizeTree( diff->diff_tree, diff, var );
+                    factorial *= order;
+                }
+                coefficients[order] = EvaluateTree( diff->diff_tree, diff ) / factorial;
+            } else {
+                // Over the budget the rest of the coefficients come from one Taylor-mode pass.
+                taylor_mode = true;
+                if ( !TaylorModeCoefficients( diff->expr_tree->root, &diff->var_table, var, point, max_order,
+                                              coefficients ) ) {
+                    for ( int idx = order; idx <= max_order; idx++ )
+                        coefficients[idx] = NAN;
+                }
+            }
+        }
+
+        search->errors[order] = OrderSamplesAdd( &samples, order, coefficients[order] );
+        PRINT( "Taylor order %d: error %g", order, search->errors[order] );
+
+        if ( search->errors[order] <= search->tolerance ) {
+            search->order = order;
+            search->converged = true;
+            break;
+        }
+    }
+
+    TaylorPolynomialDtor( &diff->taylor );
+    TaylorPolynomialCtor( &diff->taylor, var, point, search->order );
+    memcpy( diff->taylor.coefficients, coefficients, ( (size_t)search->order + 1 ) * sizeof( double ) );
+
+    free( samples.f );
+    free( coefficients );
+
+    return true;
+}
+
+void TaylorOrderSearchDtor( TaylorOrderSearch_t *search ) {
+    my_assert( search, "Null pointer on `search`" );
+
+    free( search->errors );
+    search->errors = NULL;
+}
@@ -0,0 +1,118 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "ThreadPool.h"
+#include "Tree.h"
+
+// A Taylor polynomial kept as its coefficients. It is evaluated in Horner form,
+// one multiply-add per order and no pow(); batches run Horner over a block of
+// points at once, so the inner loop is independent across points and
+// vectorizes. The tree of the same form is built for compiled evaluation.
+
+const size_t HORNER_BLOCK = 8;
+const size_t HORNER_GRAIN = 1024;
+
+void TaylorPolynomialCtor( TaylorPolynomial_t *taylor, SymbolId var, double point, int order ) {
+    my_assert( taylor, "Null pointer on `taylor`" );
+    assert( order >= 0 && "Negative Taylor order" );
+
+    taylor->var = var;
+    taylor->point = point;
+    taylor->order = order;
+    taylor->coefficients = (double *)calloc( (size_t)order + 1, sizeof( double ) );
+    assert( taylor->coefficients && "Memory allocation error" );
+}
+
+void TaylorPolynomialDtor( TaylorPolynomial_t *taylor ) {
+    my_assert( taylor, "Null pointer on `taylor`" );
+
+    free( taylor->coefficients );
+    taylor->coefficients = NULL;
+    taylor->order = 0;
+}
+
+double TaylorPolynomialEvaluate( const TaylorPolynomial_t *taylor, double x ) {
+    my_assert( taylor, "Null pointer on `taylor`" );
+    my_assert( taylor->coefficients, "Null pointer on `taylor->coefficients`" );
+
+    const double *c = taylor->coefficients;
+    double t = x - taylor->point;
+
+    double result = c[taylor->order];
+    for ( int k = taylor->order - 1; k >= 0; k-- )
+        result = result * t + c[k];
+
+    return result;
+}
+
+struct HornerBatch_t {
+    const TaylorPolynomial_t *taylor;
+    const double *xs;
+    double *results;
+};
+
+static void HornerRange( void *arg, size_t begin, size_t end ) {
+    const HornerBatch_t *batch = (const HornerBatch_t *)arg;
+    const double *c = batch->taylor->coefficients;
+    double point = batch->taylor->point;
+    int order = batch->taylor->order;
+
+    double t[HORNER_BLOCK] = {};
+    double y[HORNER_BLOCK] = {};
+
+    for ( size_t start = begin; start < end; start += HORNER_BLOCK ) {
+        size_t n = ( end - start < HORNER_BLOCK ) ? end - start : HORNER_BLOCK;
+
+        for ( size_t j = 0; j < n; j++ ) {
+            t[j] = batch->xs[start + j] - point;
+            y[j] = c[order];
+        }
+
+        for ( int k = order - 1; k >= 0; k-- ) {
+            for ( size_t j = 0; j < HORNER_BLOCK; j++ )
+                y[j] = y[j] * t[j] + c[k];
+        }
+
+        memcpy( batch->results + start, y, n * sizeof( double ) );
+    }
+}
+
+void TaylorPolynomialEvaluateBatch( const TaylorPolynomial_t *taylor, const double *xs, size_t n_points,
+                                    double *results, ThreadPool_t *pool ) {
+    my_assert( taylor, "Null pointer on `taylor`" );
+    my_assert( taylor->coefficients, "Null pointer on `taylor->coefficients`" );
+    my_assert( xs, "Null pointer on `xs`" );
+    my_assert( results, "Null pointer on `results`" );
+
+    HornerBatch_t batch = { taylor, xs, results };
+    ThreadPoolParallelFor( pool, n_points, HORNER_GRAIN, HornerRange, &batch );
+}
+
+static Node_t *HornerArgument( const TaylorPolynomial_t *taylor ) {
+    Node_t *var = NodeCreate( MakeVariable( taylor->var ), NULL );
+    if ( fpclassify( taylor->point ) == FP_ZERO )
+        return var;
+
+    return MakeNode( OP_SUB, var, NodeCreate( MakeNumber( taylor->point ), NULL ) );
+}
+
+// c0 + t (c1 + t (c2 + ... + t c_n))
+Tree_t *TaylorPolynomialHornerTree( const TaylorPolynomial_t *taylor ) {
+    my_assert( taylor, "Null pointer on `taylor`" );
+    my_assert( taylor->coefficients, "Null pointer on `taylor->coefficients`" );
+
+    Node_t *result = NodeCreate( MakeNumber( taylor->coefficients[taylor->order] ), NULL );
+    for ( int k = taylor->order - 1; k >= 0; k-- ) {
+        Node_t *scaled = MakeNode( OP_MUL, HornerArgument( taylor ), result );
+        result = MakeNode( OP_ADD, NodeCreate( MakeNumber( taylor->coefficients[k] ), NULL ), scaled );
+    }
+
+    Tree_t *tree = TreeCtor();
+    tree->root = result;
+
+    return tree;
+}
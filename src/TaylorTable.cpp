@@ -0,0 +1,226 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
+#include "Differentiator.h"
+#include "OutputBuffer.h"
+#include "ThreadPool.h"
+
+// Taylor expansions at many points: the k-th derivative is built once, compiled
+// and evaluated at every point by the batch evaluator on the pool, then scaled
+// by 1/k!. From the first order over the node budget on, the remaining
+// coefficients come from Taylor-mode evaluation, one point per task.
+
+const size_t TAYLOR_MODE_GRAIN = 16;
+
+struct TaylorModeRange_t {
+    const Differentiator_t *diff;
+    TaylorTable_t *table;
+    int first_order;
+};
+
+static void TaylorModeRange( void *arg, size_t begin, size_t end ) {
+    const TaylorModeRange_t *range = (const TaylorModeRange_t *)arg;
+    TaylorTable_t *table = range->table;
+    size_t n_coefficients = (size_t)table->order + 1;
+
+    double *coefficients = (double *)calloc( n_coefficients, sizeof( double ) );
+    assert( coefficients && "Memory allocation error" );
+
+    for ( size_t idx = begin; idx < end; idx++ ) {
+        double *row = table->coefficients + idx * n_coefficients;
+        if ( !TaylorModeCoefficients( range->diff->expr_tree->root, &range->diff->var_table, table->var,
+                                      table->points[idx], table->order, coefficients ) ) {
+            for ( size_t k = 0; k < n_coefficients; k++ )
+                coefficients[k] = NAN;
+        }
+
+        for ( size_t k = (size_t)range->first_order; k < n_coefficients; k++ )
+            row[k] = coefficients[k];
+    }
+
+    free( coefficients );
+}
+
+// Coefficient `order` of every point from `diff->diff_tree`.
+static void DerivativeColumn( Differentiator_t *diff, TaylorTable_t *table, int order, double factorial,
+                              double *column ) {
+    CompiledExpr_t *expr = CompileTree( diff->diff_tree );
+
+    double *values = (double *)calloc( expr->n_variables + 1, sizeof( double ) );
+    assert( values && "Memory allocation error" );
+
+    CompiledExprBind( expr, &diff->var_table, values );
+    CompiledExprEvaluateBatch( expr, CompiledExprSlot( expr, table->var ), table->points, table->n_points, values,
+                               column, diff->pool );
+
+    size_t n_coefficients = (size_t)table->order + 1;
+    for ( size_t idx = 0; idx < table->n_points; idx++ )
+        table->coefficients[idx * n_coefficients + (size_t)order] = column[idx] / factorial;
+
+    free( values );
+    CompiledExprDtor( &expr );
+}
+
+bool TaylorTableBuild( Differentiator_t *diff, SymbolId var, const double *points, size_t n_points, int order,
+                       TaylorTable_t *table ) {
+    my_assert( diff, "Null pointer on `diff`" );
+    my_assert( diff->expr_tree, "Null pointer on `diff->expr_tree`" );
+    my_assert( points || n_points == 0, "Null pointer on `points`" );
+    my_assert( table, "Null pointer on `table`" );
+
+    if ( order < 0 || order > UINT16_MAX )
+        return false;
+
+    size_t n_coefficients = (size_t)order + 1;
+
+    table->var = var;
+    table->order = order;
+    table->n_points = n_points;
+    table->points = (double *)calloc( n_points + 1, sizeof( double ) );
+    table->coefficients = (double *)calloc( n_points * n_coefficients + 1, sizeof( double ) );
+    assert( table->points && table->coefficients && "Memory allocation error" );
+
+    if ( n_points )
+        memcpy( table->points, points, n_points * sizeof( double ) );
+
+    double *column = (double *)calloc( n_points + 1, sizeof( double ) );
+    assert( column && "Memory allocation error" );
+
+    int cur_order = 0;
+    double factorial = 1;
+    for ( ; cur_order <= order; cur_order++ ) {
+        if ( cur_order == 0 ) {
+            if ( !DifferentiateExpression( diff, var, 0 ) )
+                break;
+        } else {
+            if ( !DifferentiateStep( diff, var, cur_order ) )
+                break;
+            OptimizeTree( diff->diff_tree, diff, var );
+            factorial *= cur_order;
+        }
+
+        DerivativeColumn( diff, table, cur_order, factorial, column );
+    }
+
+    free( column );
+
+    if ( cur_order <= order ) {
+        PRINT( "Orders from %d on come from Taylor-mode evaluation", cur_order );
+
+        TaylorModeRange_t range = { diff, table, cur_order };
+        ThreadPoolParallelFor( diff->pool, n_points, TAYLOR_MODE_GRAIN, TaylorModeRange, &range );
+    }
+
+    return true;
+}
+
+void TaylorTableDtor( TaylorTable_t *table ) {
+    my_assert( table, "Null pointer on `table`" );
+
+    free( table->points );
+    free( table->coefficients );
+    table->points = NULL;
+    table->coefficients = NULL;
+    table->n_points = 0;
+}
+
+static bool TaylorTableWriteBinary( const TaylorTable_t *table, FILE *file ) {
+    TaylorTableHeader_t header = {};
+    header.magic = TAYLOR_TABLE_MAGIC;
+    header.version = TAYLOR_TABLE_VERSION;
+    header.order = (uint16_t)table->order;
+    header.n_points = table->n_points;
+
+    if ( fwrite( &header, sizeof( header ), 1, file ) != 1 )
+        return false;
+
+    size_t n_coefficients = (size_t)table->order + 1;
+    for ( size_t idx = 0; idx < table->n_points; idx++ ) {
+        if ( fwrite( &table->points[idx], sizeof( double ), 1, file ) != 1 ||
+             fwrite( table->coefficients + idx * n_coefficients, sizeof( double ), n_coefficients, file ) !=
+                 n_coefficients )
+            return false;
+    }
+
+    return true;
+}
+
+static bool TaylorTableWriteCsv( const TaylorTable_t *table, FILE *file ) {
+    OutputBuffer_t output = {};
+    OutputBufferCtor( &output, file );
+
+    BufferPutString( &output, "point" );
+    for ( int k = 0; k <= table->order; k++ )
+        BufferPrintf( &output, ",c%d", k );
+    BufferPutChar( &output, '\n' );
+
+    size_t n_coefficients = (size_t)table->order + 1;
+    for ( size_t idx = 0; idx < table->n_points; idx++ ) {
+        BufferPutDouble( &output, table->points[idx] );
+        for ( size_t k = 0; k < n_coefficients; k++ ) {
+            BufferPutChar( &output, ',' );
+            BufferPutDouble( &output, table->coefficients[idx * n_coefficients + k] );
+        }
+        BufferPutChar( &output, '\n' );
+    }
+
+    return OutputBufferDtor( &output );
+}
+
+// Binary for a .bin name, CSV otherwise; `-` is CSV on stdout.
+bool TaylorTableWrite( const TaylorTable_t *table, const char *filename ) {
+    my_assert( table, "Null pointer on `table`" );
+    my_assert( filename, "Null pointer on `filename`" );
+
+    if ( strcmp( filename, "-" ) == 0 )
+        return TaylorTableWriteCsv( table, stdout );
+
+    size_t length = strlen( filename );
+    bool binary = length >= 4 && strcmp( filename + length - 4, ".bin" ) == 0;
+
+    FILE *file = fopen( filename, binary ? "wb" : "w" );
+    if ( !file ) {
+        PRINT_ERROR( "Error opening file `%s` \n", filename );
+        return false;
+    }
+
+    bool ok = binary ? TaylorTableWriteBinary( table, file ) : TaylorTableWriteCsv( table, file );
+
+    return fclose( file ) == 0 && ok;
+}
+
+// `n_points` expansion points spread evenly over [from, to]; variables other
+// than x evaluate to zero.
+bool DifferentiatorTaylorTable( const char *expr_filename, const char *output_filename, double from, double to,
+                                size_t n_points, int order, size_t n_threads, const DerivativeBudget_t *budget ) {
+    my_assert( expr_filename, "Null pointer on `expr_filename`" );
+    my_assert( output_filename, "Null pointer on `output_filename`" );
+
+    SymbolId x = 0;
+    Differentiator_t *diff = DifferentiatorFileCtor( expr_filename, n_threads, NULL, budget, &x );
+    if ( !diff )
+        return false;
+
+    double *points = (double *)calloc( n_points + 1, sizeof( double ) );
+    assert( points && "Memory allocation error" );
+
+    double step = ( n_points > 1 ) ? ( to - from ) / (double)( n_points - 1 ) : 0;
+    for ( size_t idx = 0; idx < n_points; idx++ )
+        points[idx] = from + (double)idx * step;
+
+    TaylorTable_t table = {};
+    bool ok = TaylorTableBuild( diff, x, points, n_points, order, &table );
+    if ( ok )
+        ok = TaylorTableWrite( &table, output_filename );
+
+    TaylorTableDtor( &table );
+    free( points );
+
+    DifferentiatorFileDtor( &diff );
+
+    return ok;
+}
@@ -6,41 +6,44 @@
 
 #include "DebugUtils.h"
 #include "Differentiator.h"
+#include "Metrics.h"
 #include "Tree.h"
 
 
-static bool ContainsVariable( Node_t *node, char independent_var );
+static bool ContainsVariable( Node_t *node, SymbolId independent_var );
 static bool EvaluateConstant( Node_t *node, VarTable_t *var_table, double *result );
 static bool IsNumber( Node_t *node, double value );
 static bool NodesEqual( Node_t *a, Node_t *b );
 static void ReplaceNode( Node_t **node_ptr, Node_t *new_node );
 
-static void OptimizeConstantsNode( Node_t **node_ptr, VarTable_t *var_table, char independent_var );
-static void TryEvaluateAndReplaceIfConstant( Node_t **node_ptr, VarTable_t *var_table, char independent_var );
+static void OptimizeConstantsNode( Node_t **node_ptr, VarTable_t *var_table, SymbolId independent_var );
+static void TryEvaluateAndReplaceIfConstant( Node_t **node_ptr, VarTable_t *var_table, SymbolId independent_var );
 
 // Упрощение переменных
-static bool SimplifyVariablesNode( Node_t **node_ptr, char independent_var );
-static bool ApplySimplificationRule( Node_t **node_ptr, char independent_var );
+static bool SimplifyVariablesNode( Node_t **node_ptr, SymbolId independent_var );
+static bool ApplySimplificationRule( Node_t **node_ptr, SymbolId independent_var );
 
 // Правила упрощения по операциям
-static bool TrySimplifySub( Node_t **node_ptr, char independent_var );
-static bool TrySimplifyPow( Node_t **node_ptr, char independent_var );
-static bool TrySimplifyMul( Node_t **node_ptr, char independent_var );
-static bool TrySimplifyAdd( Node_t **node_ptr, char independent_var );
-static bool TrySimplifyDiv( Node_t **node_ptr, char independent_var );
+static bool TrySimplifySub( Node_t **node_ptr, SymbolId independent_var );
+static bool TrySimplifyPow( Node_t **node_ptr, SymbolId independent_var );
+static bool TrySimplifyMul( Node_t **node_ptr, SymbolId independent_var );
+static bool TrySimplifyAdd( Node_t **node_ptr, SymbolId independent_var );
+static bool TrySimplifyDiv( Node_t **node_ptr, SymbolId independent_var );
 
 // Утилиты замены
 static void ReplaceWithZero( Node_t **node_ptr );
 static void ReplaceWithOne( Node_t **node_ptr );
 static void ReplaceWithCopy( Node_t **node_ptr, Node_t *original );
 
-bool OptimizeTree( Tree_t *tree, Differentiator_t *diff, char independent_var ) {
+bool OptimizeTree( Tree_t *tree, Differentiator_t *diff, SymbolId independent_var ) {
     my_assert( tree, "Null pointer on `tree`" );
     my_assert( diff, "Null pointer on `diff`" );
 
     if ( !tree->root )
         return true;
 
+    METRIC_PHASE_BEGIN( PHASE_SIMPLIFY )
+
     const int max_passes = 100;
     int passes = 0;
     bool changed = true;
@@ -54,10 +57,13 @@ bool OptimizeTree( Tree_t *tree, Differentiator_t *diff, char independent_var )
         passes++;
     }
 
+    METRIC_ADD( METRIC_OPTIMIZE_PASSES, (uint64_t)passes )
+    METRIC_PHASE_END( PHASE_SIMPLIFY )
+
     return true;
 }
 
-static void OptimizeConstantsNode( Node_t **node_ptr, VarTable_t *var_table, char independent_var ) {
+static void OptimizeConstantsNode( Node_t **node_ptr, VarTable_t *var_table, SymbolId independent_var ) {
     if ( !node_ptr || !*node_ptr )
         return;
 
@@ -72,7 +78,7 @@ static void OptimizeConstantsNode( Node_t **node_ptr, VarTable_t *var_table, cha
 }
 
 static void TryEvaluateAndReplaceIfConstant( Node_t **node_ptr, VarTable_t *var_table,
-                                             char independent_var ) {
+                                             SymbolId independent_var ) {
     Node_t *node = *node_ptr;
 
     bool left_const = !node->left || !ContainsVariable( node->left, independent_var );
@@ -83,11 +89,12 @@ static void TryEvaluateAndReplaceIfConstant( Node_t **node_ptr, VarTable_t *var_
         if ( EvaluateConstant( node, var_table, &result ) ) {
             Node_t *new_node = NodeCreate( MakeNumber( result ), node->parent );
             ReplaceNode( node_ptr, new_node );
+            METRIC_INC( METRIC_CONSTANTS_FOLDED )
         }
     }
 }
 
-static bool SimplifyVariablesNode( Node_t **node_ptr, char independent_var ) {
+static bool SimplifyVariablesNode( Node_t **node_ptr, SymbolId independent_var ) {
     if ( !node_ptr || !*node_ptr )
         return false;
 
@@ -104,27 +111,36 @@ static bool SimplifyVariablesNode( Node_t **node_ptr, char independent_var ) {
     return changed;
 }
 
-static bool ApplySimplificationRule( Node_t **node_ptr, char independent_var ) {
+static bool CountRewrite( bool applied, MetricCounter counter ) {
+    if ( applied ) {
+        METRIC_INC( counter )
+    }
+    (void)counter;
+
+    return applied;
+}
+
+static bool ApplySimplificationRule( Node_t **node_ptr, SymbolId independent_var ) {
     Node_t *node = *node_ptr;
     OperationType op = (OperationType)node->value.data.operation;
 
     switch ( op ) {
         case OP_SUB:
-            return TrySimplifySub( node_ptr, independent_var );
+            return CountRewrite( TrySimplifySub( node_ptr, independent_var ), METRIC_REWRITES_SUB );
         case OP_POW:
-            return TrySimplifyPow( node_ptr, independent_var );
+            return CountRewrite( TrySimplifyPow( node_ptr, independent_var ), METRIC_REWRITES_POW );
         case OP_MUL:
-            return TrySimplifyMul( node_ptr, independent_var );
+            return CountRewrite( TrySimplifyMul( node_ptr, independent_var ), METRIC_REWRITES_MUL );
         case OP_ADD:
-            return TrySimplifyAdd( node_ptr, independent_var );
+            return CountRewrite( TrySimplifyAdd( node_ptr, independent_var ), METRIC_REWRITES_ADD );
         case OP_DIV:
-            return TrySimplifyDiv( node_ptr, independent_var );
+            return CountRewrite( TrySimplifyDiv( node_ptr, independent_var ), METRIC_REWRITES_DIV );
         default:
             return false;
     }
 }
 
-static bool TrySimplifySub( Node_t **node_ptr, char independent_var ) {
+static bool TrySimplifySub( Node_t **node_ptr, SymbolId independent_var ) {
     Node_t *node = *node_ptr;
 
     if ( node->left && node->right && NodesEqual( node->left, node->right ) ) {
@@ -140,7 +156,7 @@ static bool TrySimplifySub( Node_t **node_ptr, char independent_var ) {
     return false;
 }
 
-static bool TrySimplifyPow( Node_t **node_ptr, char independent_var ) {
+static bool TrySimplifyPow( Node_t **node_ptr, SymbolId independent_var ) {
     Node_t *node = *node_ptr;
 
     if ( node->right && IsNumber( node->right, 0.0 ) ) {
@@ -163,7 +179,7 @@ static bool TrySimplifyPow( Node_t **node_ptr, char independent_var ) {
     return false;
 }
 
-static bool TrySimplifyMul( Node_t **node_ptr, char independent_var ) {
+static bool TrySimplifyMul( Node_t **node_ptr, SymbolId independent_var ) {
     Node_t *node = *node_ptr;
 
     if ( ( node->left && IsNumber( node->left, 0.0 ) ) || ( node->right && IsNumber( node->right, 0.0 ) ) ) {
@@ -184,7 +200,7 @@ static bool TrySimplifyMul( Node_t **node_ptr, char independent_var ) {
     return false;
 }
 
-static bool TrySimplifyAdd( Node_t **node_ptr, char independent_var ) {
+static bool TrySimplifyAdd( Node_t **node_ptr, SymbolId independent_var ) {
     Node_t *node = *node_ptr;
 
     if ( node->right && IsNumber( node->right, 0.0 ) && node->left ) {
@@ -200,7 +216,7 @@ static bool TrySimplifyAdd( Node_t **node_ptr, char independent_var ) {
     return false;
 }
 
-static bool TrySimplifyDiv( Node_t **node_ptr, char independent_var ) {
+static bool TrySimplifyDiv( Node_t **node_ptr, SymbolId independent_var ) {
     Node_t *node = *node_ptr;
 
     if ( node->right && IsNumber( node->right, 1.0 ) && node->left ) {
@@ -230,7 +246,7 @@ static void ReplaceWithCopy( Node_t **node_ptr, Node_t *original ) {
     ReplaceNode( node_ptr, NodeCopy( original ) );
 }
 
-static bool ContainsVariable( Node_t *node, char independent_var ) {
+static bool ContainsVariable( Node_t *node, SymbolId independent_var ) {
     if ( !node )
         return false;
     if ( node->value.type == NODE_VARIABLE )
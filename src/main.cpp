@@ -1,22 +1,350 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DebugUtils.h"
 #include "Differentiator.h"
+#include "Metrics.h"
+
+struct CacheOptions_t {
+    const char *directory;
+    size_t      max_megabytes;
+};
+
+static bool ParseCacheOption( const char *option, const char *value, CacheOptions_t *options ) {
+    if ( strcmp( option, "--cache-dir" ) == 0 ) {
+        options->directory = value;
+        return true;
+    }
+
+    if ( strcmp( option, "--cache-size" ) == 0 ) {
+        options->max_megabytes = (size_t)atol( value );
+        return true;
+    }
+
+    return false;
+}
+
+static bool ParseBudgetOption( const char *option, const char *value, DerivativeBudget_t *budget ) {
+    if ( strcmp( option, "--max-nodes" ) == 0 ) {
+        budget->max_nodes = (size_t)atol( value );
+        return true;
+    }
+
+    if ( strcmp( option, "--max-memory" ) == 0 ) {
+        budget->max_bytes = (size_t)atol( value ) << 20;
+        return true;
+    }
+
+    return false;
+}
+
+struct MetricsOptions_t {
+    const char *report_path;
+    const char *trace_path;
+};
+
+static bool ParseMetricsOption( const char *option, const char *value, MetricsOptions_t *options ) {
+    if ( strcmp( option, "--metrics" ) == 0 ) {
+        options->report_path = value;
+        return true;
+    }
+
+    if ( strcmp( option, "--trace" ) == 0 ) {
+        options->trace_path = value;
+        return true;
+    }
+
+    return false;
+}
+
+static bool WriteMetrics( const MetricsOptions_t *options ) {
+    if ( !options->report_path && !options->trace_path )
+        return true;
+
+    return MetricsWrite( options->report_path, options->trace_path );
+}
+
+static bool OpenCache( const CacheOptions_t *options, DerivativeCache_t *cache ) {
+    if ( !options->directory )
+        return true;
+
+    size_t max_bytes = options->max_megabytes ? options->max_megabytes << 20 : DERIVATIVE_CACHE_DEFAULT_SIZE;
+
+    return DerivativeCacheCtor( cache, options->directory, max_bytes );
+}
+
+static void PrintUsage( const char *program ) {
+    fprintf( stderr,
+             "Usage: %s [expr_file] [--threads N] [--cache-dir DIR] [--cache-size MB] [--metrics FILE] [--trace FILE]\n"
+             "          [--max-nodes N] [--max-memory MB] [--tolerance EPS]\n"
+             "       %s --batch <input|-> <output|-> [--order N] [--threads N] [--cache-dir DIR] [--cache-size MB]\n"
+             "          [--metrics FILE] [--trace FILE] [--max-nodes N] [--max-memory MB]\n"
+             "       %s --taylor-table <expr_file> <output|-> --from A --to B [--points N] [--order N] [--threads N]\n"
+             "          [--max-nodes N] [--max-memory MB]\n"
+             "       %s --chebyshev <expr_file> <output.c|-> [--degree N] [--derivative N] [--tolerance EPS]\n"
+             "          [--max-pieces N] [--remez] [--name NAME] [--threads N] [--max-nodes N] [--max-memory MB]\n"
+             "       %s --roots <expr_file> <output|-> [--samples N] [--threads N] [--cache-dir DIR] [--cache-size MB]\n"
+             "          [--max-nodes N] [--max-memory MB]\n"
+             "       %s --server [socket_path] [--cache N]\n"
+             "       %s --stress <expr_file> [--jobs N] [--threads N] [--metrics FILE] [--trace FILE]\n"
+             "Metrics are written as JSON (CSV for a .csv name), the trace in the Chrome trace-event format;\n"
+             "both need a build with -D_METRICS.\n"
+             "A derivative over the node or memory budget is given by its values from Taylor-mode evaluation.\n"
+             "Without --threads (or with 0) every core is used, unless DIFF_THREADS sets the number.\n"
+             "With --tolerance the Taylor order is the smallest one within EPS over the plot interval.\n"
+             "A Taylor table has one row of coefficients per point, binary for a .bin name, CSV otherwise.\n"
+             "A Chebyshev approximation over the plot interval is written as C code.\n"
+             "Roots over the plot interval are written one per line: the root, f at it and the iterations.\n",
+             program, program, program, program, program, program, program );
+}
+
+int main( int argc, char **argv ) {
+    if ( argc >= 2 && strcmp( argv[1], "--batch" ) == 0 ) {
+        if ( argc < 4 ) {
+            PrintUsage( argv[0] );
+            return 1;
+        }
+
+        int order = 1;
+        size_t n_threads = 0;
+        CacheOptions_t cache_options = {};
+        MetricsOptions_t metrics_options = {};
+        DerivativeBudget_t budget = {};
+
+        for ( int idx = 4; idx < argc; idx += 2 ) {
+            if ( idx + 1 >= argc ) {
+                PrintUsage( argv[0] );
+                return 1;
+            } else if ( strcmp( argv[idx], "--order" ) == 0 ) {
+                order = atoi( argv[idx + 1] );
+            } else if ( strcmp( argv[idx], "--threads" ) == 0 ) {
+                n_threads = (size_t)atol( argv[idx + 1] );
+            } else if ( !ParseCacheOption( argv[idx], argv[idx + 1], &cache_options ) &&
+                        !ParseMetricsOption( argv[idx], argv[idx + 1], &metrics_options ) &&
+                        !ParseBudgetOption( argv[idx], argv[idx + 1], &budget ) ) {
+                PrintUsage( argv[0] );
+                return 1;
+            }
+        }
+
+        DerivativeCache_t cache = {};
+        if ( !OpenCache( &cache_options, &cache ) )
+            return 1;
+
+        bool ok = DifferentiatorBatch( argv[2], argv[3], SymbolIntern( "x" ), order, n_threads,
+                                       cache_options.directory ? &cache : NULL, &budget );
+
+        if ( cache_options.directory )
+            DerivativeCacheDtor( &cache );
+
+        ok = WriteMetrics( &metrics_options ) && ok;
+
+        return ok ? 0 : 1;
+    }
+
+    if ( argc >= 2 && strcmp( argv[1], "--taylor-table" ) == 0 ) {
+        if ( argc < 4 ) {
+            PrintUsage( argv[0] );
+            return 1;
+        }
+
+        double from = NAN, to = NAN;
+        size_t n_points = 1000;
+        int order = 4;
+        size_t n_threads = 0;
+        DerivativeBudget_t budget = {};
+
+        for ( int idx = 4; idx < argc; idx += 2 ) {
+            if ( idx + 1 >= argc ) {
+                PrintUsage( argv[0] );
+                return 1;
+            } else if ( strcmp( argv[idx], "--from" ) == 0 ) {
+                from = atof( argv[idx + 1] );
+            } else if ( strcmp( argv[idx], "--to" ) == 0 ) {
+                to = atof( argv[idx + 1] );
+            } else if ( strcmp( argv[idx], "--points" ) == 0 ) {
+                n_points = (size_t)atol( argv[idx + 1] );
+            } else if ( strcmp( argv[idx], "--order" ) == 0 ) {
+                order = atoi( argv[idx + 1] );
+            } else if ( strcmp( argv[idx], "--threads" ) == 0 ) {
+                n_threads = (size_t)atol( argv[idx + 1] );
+            } else if ( !ParseBudgetOption( argv[idx], argv[idx + 1], &budget ) ) {
+                PrintUsage( argv[0] );
+                return 1;
+            }
+        }
+
+        if ( !isfinite( from ) || !isfinite( to ) ) {
+            PrintUsage( argv[0] );
+            return 1;
+        }
+
+        return DifferentiatorTaylorTable( argv[2], argv[3], from, to, n_points, order, n_threads, &budget ) ? 0 : 1;
+    }
+
+    if ( argc >= 2 && strcmp( argv[1], "--chebyshev" ) == 0 ) {
+        if ( argc < 4 ) {
+            PrintUsage( argv[0] );
+            return 1;
+        }
+
+        ChebyshevOptions_t options = {};
+        const char *name = "approximation";
+        size_t n_threads = 0;
+        DerivativeBudget_t budget = {};
+
+        for ( int idx = 4; idx < argc; idx++ ) {
+            if ( strcmp( argv[idx], "--remez" ) == 0 ) {
+                options.remez = true;
+            } else if ( idx + 1 >= argc ) {
+                PrintUsage( argv[0] );
+                return 1;
+            } else if ( strcmp( argv[idx], "--degree" ) == 0 ) {
+                options.degree = atoi( argv[++idx] );
+            } else if ( strcmp( argv[idx], "--derivative" ) == 0 ) {
+                options.derivative = atoi( argv[++idx] );
+            } else if ( strcmp( argv[idx], "--tolerance" ) == 0 ) {
+                options.tolerance = atof( argv[++idx] );
+            } else if ( strcmp( argv[idx], "--max-pieces" ) == 0 ) {
+                options.max_pieces = (size_t)atol( argv[++idx] );
+            } else if ( strcmp( argv[idx], "--name" ) == 0 ) {
+                name = argv[++idx];
+            } else if ( strcmp( argv[idx], "--threads" ) == 0 ) {
+                n_threads = (size_t)atol( argv[++idx] );
+            } else if ( ParseBudgetOption( argv[idx], argv[idx + 1], &budget ) ) {
+                idx++;
+            } else {
+                PrintUsage( argv[0] );
+                return 1;
+            }
+        }
+
+        return DifferentiatorChebyshev( argv[2], argv[3], name, &options, n_threads, &budget ) ? 0 : 1;
+    }
+
+    if ( argc >= 2 && strcmp( argv[1], "--roots" ) == 0 ) {
+        if ( argc < 4 ) {
+            PrintUsage( argv[0] );
+            return 1;
+        }
+
+        size_t n_samples = ROOTS_DEFAULT_SAMPLES;
+        size_t n_threads = 0;
+        CacheOptions_t cache_options = {};
+        DerivativeBudget_t budget = {};
+
+        for ( int idx = 4; idx < argc; idx += 2 ) {
+            if ( idx + 1 >= argc ) {
+                PrintUsage( argv[0] );
+                return 1;
+            } else if ( strcmp( argv[idx], "--samples" ) == 0 ) {
+                n_samples = (size_t)atol( argv[idx + 1] );
+            } else if ( strcmp( argv[idx], "--threads" ) == 0 ) {
+                n_threads = (size_t)atol( argv[idx + 1] );
+            } else if ( !ParseCacheOption( argv[idx], argv[idx + 1], &cache_options ) &&
+                        !ParseBudgetOption( argv[idx], argv[idx + 1], &budget ) ) {
+                PrintUsage( argv[0] );
+                return 1;
+            }
+        }
+
+        DerivativeCache_t cache = {};
+        if ( !OpenCache( &cache_options, &cache ) )
+            return 1;
+
+        bool ok = DifferentiatorRoots( argv[2], argv[3], n_samples, n_threads,
+                                       cache_options.directory ? &cache : NULL, &budget );
+
+        if ( cache_options.directory )
+            DerivativeCacheDtor( &cache );
+
+        return ok ? 0 : 1;
+    }
+
+    if ( argc >= 2 && strcmp( argv[1], "--server" ) == 0 ) {
+        const char *socket_path = NULL;
+        size_t cache_capacity = 256;
+
+        for ( int idx = 2; idx < argc; idx++ ) {
+            if ( strcmp( argv[idx], "--cache" ) == 0 && idx + 1 < argc ) {
+                cache_capacity = (size_t)atol( argv[++idx] );
+            } else if ( argv[idx][0] != '-' && !socket_path ) {
+                socket_path = argv[idx];
+            } else {
+                PrintUsage( argv[0] );
+                return 1;
+            }
+        }
+
+        return DifferentiatorServe( socket_path, cache_capacity ) ? 0 : 1;
+    }
+
+    if ( argc >= 2 && strcmp( argv[1], "--stress" ) == 0 ) {
+        if ( argc < 3 ) {
+            PrintUsage( argv[0] );
+            return 1;
+        }
+
+        size_t n_jobs = 64;
+        size_t n_threads = 0;
+        MetricsOptions_t metrics_options = {};
+
+        for ( int idx = 3; idx < argc; idx += 2 ) {
+            if ( idx + 1 >= argc ) {
+                PrintUsage( argv[0] );
+                return 1;
+            } else if ( strcmp( argv[idx], "--jobs" ) == 0 ) {
+                n_jobs = (size_t)atol( argv[idx + 1] );
+            } else if ( strcmp( argv[idx], "--threads" ) == 0 ) {
+                n_threads = (size_t)atol( argv[idx + 1] );
+            } else if ( !ParseMetricsOption( argv[idx], argv[idx + 1], &metrics_options ) ) {
+                PrintUsage( argv[0] );
+                return 1;
+            }
+        }
+
+        bool ok = DifferentiatorStress( argv[2], n_jobs, n_threads );
+        ok = WriteMetrics( &metrics_options ) && ok;
 
-int main() {
-    const char *filename = "expr.txt";
+        return ok ? 0 : 1;
+    }
 
-    Differentiator_t *diff = DifferentiatorCtor( filename );
+    const char *expr_filename = "expr.txt";
+    CacheOptions_t cache_options = {};
+    MetricsOptions_t metrics_options = {};
+    DerivativeBudget_t budget = {};
+    size_t n_threads = 0;
+    double tolerance = 0;
 
-    DifferentiatiorDump( diff, DUMP_ORIGINAL, "After creation expr_tree" );
+    int idx = 1;
+    if ( argc >= 2 && argv[1][0] != '-' )
+        expr_filename = argv[idx++];
 
-    DifferentiatorAddOrigExpression( diff, 3 );
-    DifferentiatiorDump( diff, DUMP_DIFFERENTIATED, "After optimization" );
+    for ( ; idx < argc; idx += 2 ) {
+        if ( idx + 1 < argc && strcmp( argv[idx], "--threads" ) == 0 ) {
+            n_threads = (size_t)atol( argv[idx + 1] );
+        } else if ( idx + 1 < argc && strcmp( argv[idx], "--tolerance" ) == 0 ) {
+            tolerance = atof( argv[idx + 1] );
+        } else if ( idx + 1 >= argc || ( !ParseCacheOption( argv[idx], argv[idx + 1], &cache_options ) &&
+                                         !ParseMetricsOption( argv[idx], argv[idx + 1], &metrics_options ) &&
+                                         !ParseBudgetOption( argv[idx], argv[idx + 1], &budget ) ) ) {
+            PrintUsage( argv[0] );
+            return 1;
+        }
+    }
 
-    DifferentiatorAddEvaluation( diff, 'x' );
+    DerivativeCache_t cache = {};
+    if ( !OpenCache( &cache_options, &cache ) )
+        return 1;
 
-    DifferentiatorAddTaylorSeries( diff, 'x', diff->extent );
+    bool ok = DifferentiatorReport( expr_filename, NULL, true, cache_options.directory ? &cache : NULL,
+                                    n_threads, &budget, tolerance );
 
-    DifferentiatorPlotFunctionAndTaylor( diff, 'x', 250, "tex/plot.png" );
+    if ( cache_options.directory )
+        DerivativeCacheDtor( &cache );
 
-    DifferentiatorDtor( &diff );
+    ok = WriteMetrics( &metrics_options ) && ok;
 
-    return 0;
+    return ok ? 0 : 1;
 }